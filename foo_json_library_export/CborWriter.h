@@ -0,0 +1,243 @@
+#pragma once
+
+#include "RapidJsonWrapper.h"
+
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace jsonexport {
+
+//------------------------------------------------------------------------------
+
+/// rapidjson handler which writes CBOR rather than JSON, so that anything written through a rapidjson writer,
+/// such as Document::Accept() or the streaming export, can be written as CBOR unchanged.
+/// Maps and arrays are written with indefinite lengths, so unlike MessagePack, everything is written straight to the stream.
+/// As a sequence writer, the top-level array isn't written, so its elements form a CBOR sequence (RFC 8742).
+template<typename OutputStream, bool is_sequence = false>
+class cbor_writer
+{
+public:
+	typedef char Ch;
+
+	explicit cbor_writer(OutputStream& os)
+		: m_os(os)
+		, m_depth(0)
+		, m_in_sequence(false)
+	{
+	}
+
+	cbor_writer& Null()
+	{
+		put(0xF6);
+		return end_value();
+	}
+
+	cbor_writer& Bool(bool b)
+	{
+		put(b ? 0xF5 : 0xF4);
+		return end_value();
+	}
+
+	cbor_writer& Int(int i)
+	{
+		return Int64(i);
+	}
+
+	cbor_writer& Uint(unsigned u)
+	{
+		return Uint64(u);
+	}
+
+	cbor_writer& Int64(int64_t i)
+	{
+		if(i >= 0)
+		{
+			return Uint64(static_cast<uint64_t>(i));
+		}
+
+		// Negative integers are stored as -1 - n.
+		put_header(major_negative_integer, static_cast<uint64_t>(-(i + 1)));
+		return end_value();
+	}
+
+	cbor_writer& Uint64(uint64_t u)
+	{
+		put_header(major_unsigned_integer, u);
+		return end_value();
+	}
+
+	cbor_writer& Double(double d)
+	{
+		// Values which survive the trip to single precision, like replaygain's, are written in half the space.
+		if(std::fabs(d) <= FLT_MAX && static_cast<double>(static_cast<float>(d)) == d)
+		{
+			const float f = static_cast<float>(d);
+			uint32_t bits = 0;
+			memcpy(&bits, &f, sizeof(bits));
+
+			put(0xFA);
+			put_big_endian(bits, 4);
+		}
+		else
+		{
+			uint64_t bits = 0;
+			memcpy(&bits, &d, sizeof(bits));
+
+			put(0xFB);
+			put_big_endian(bits, 8);
+		}
+
+		return end_value();
+	}
+
+	cbor_writer& String(const Ch* str, rapidjson::SizeType length, bool copy = false)
+	{
+		(void)copy;
+
+		put_header(major_text_string, length);
+		rapidjson::PutBuffer(m_os, str, length);
+		return end_value();
+	}
+
+	cbor_writer& String(const Ch* str)
+	{
+		return String(str, static_cast<rapidjson::SizeType>(strlen(str)));
+	}
+
+	cbor_writer& StartObject()
+	{
+		put(indefinite_map);
+		++m_depth;
+		return *this;
+	}
+
+	cbor_writer& EndObject(rapidjson::SizeType memberCount = 0)
+	{
+		(void)memberCount;
+
+		RAPIDJSON_ASSERT(m_depth > 0);
+		--m_depth;
+		put(indefinite_break);
+		return end_value();
+	}
+
+	cbor_writer& StartArray()
+	{
+		if(is_sequence && m_depth == 0 && !m_in_sequence)
+		{
+			m_in_sequence = true;
+			return *this;
+		}
+
+		put(indefinite_array);
+		++m_depth;
+		return *this;
+	}
+
+	cbor_writer& EndArray(rapidjson::SizeType elementCount = 0)
+	{
+		(void)elementCount;
+
+		if(is_sequence && m_depth == 0)
+		{
+			RAPIDJSON_ASSERT(m_in_sequence);
+			m_in_sequence = false;
+			return *this;
+		}
+
+		RAPIDJSON_ASSERT(m_depth > 0);
+		--m_depth;
+		put(indefinite_break);
+		return end_value();
+	}
+
+	/// Writes a value already encoded as CBOR, e.g. by another cbor_writer.
+	cbor_writer& RawValue(const Ch* data, size_t length, rapidjson::Type type)
+	{
+		(void)type;
+
+		rapidjson::PutBuffer(m_os, data, length);
+		return end_value();
+	}
+
+private:
+	// Non-copyable.
+	cbor_writer(const cbor_writer&);
+	cbor_writer& operator=(const cbor_writer&);
+
+	enum major_type
+	{
+		major_unsigned_integer = 0,
+		major_negative_integer = 1,
+		major_text_string = 3
+	};
+
+	static const unsigned char indefinite_array = 0x9F;
+	static const unsigned char indefinite_map = 0xBF;
+	static const unsigned char indefinite_break = 0xFF;
+
+	void put(unsigned char c)
+	{
+		m_os.Put(static_cast<Ch>(c));
+	}
+
+	void put_big_endian(uint64_t value, size_t size)
+	{
+		for(size_t i = size; i > 0; --i)
+		{
+			put(static_cast<unsigned char>(value >> ((i - 1) * 8)));
+		}
+	}
+
+	/// The major type and its argument, which is held in the initial byte if it's small, or follows it if not.
+	void put_header(major_type type, uint64_t argument)
+	{
+		const unsigned char initial = static_cast<unsigned char>(type << 5);
+
+		if(argument < 24)
+		{
+			put(static_cast<unsigned char>(initial | argument));
+		}
+		else if(argument <= UINT8_MAX)
+		{
+			put(initial | 24);
+			put_big_endian(argument, 1);
+		}
+		else if(argument <= UINT16_MAX)
+		{
+			put(initial | 25);
+			put_big_endian(argument, 2);
+		}
+		else if(argument <= UINT32_MAX)
+		{
+			put(initial | 26);
+			put_big_endian(argument, 4);
+		}
+		else
+		{
+			put(initial | 27);
+			put_big_endian(argument, 8);
+		}
+	}
+
+	cbor_writer& end_value()
+	{
+		// Like rapidjson's writers, flush once the top-level value's complete; not after each element of a sequence.
+		if(m_depth == 0 && !m_in_sequence)
+		{
+			m_os.Flush();
+		}
+
+		return *this;
+	}
+
+	OutputStream& m_os;
+	size_t m_depth;			///< Maps and arrays which haven't been ended yet.
+	bool m_in_sequence;		///< Whether the top-level array of a sequence writer has been started.
+};
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
@@ -0,0 +1,125 @@
+#include "ChangeJournal.h"
+
+#include <algorithm>
+
+namespace jsonexport {
+
+//------------------------------------------------------------------------------
+
+track_change::track_change()
+	: path()
+	, subsong_index(0)
+	, removed(false)
+	, generation(0)
+	, sequence(0)
+{
+}
+
+//------------------------------------------------------------------------------
+
+change_journal::change_journal(uint64_t generation)
+	: m_mutex()
+	, m_changes()
+	, m_first_generation(generation)
+	, m_generation(generation)
+	, m_next_sequence(0)
+{
+}
+
+//------------------------------------------------------------------------------
+
+void change_journal::record_change(const char* path, unsigned subsong_index, bool removed)
+{
+	// Paths can't contain nulls, so the subsong index can't be mistaken for part of the path.
+	std::string key(path);
+	key.push_back('\0');
+	key.append(reinterpret_cast<const char*>(&subsong_index), sizeof(subsong_index));
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	track_change& change = m_changes[key];
+
+	if(change.path.empty())
+	{
+		change.path = path;
+		change.subsong_index = subsong_index;
+	}
+
+	change.removed = removed;
+	change.generation = m_generation;
+	change.sequence = m_next_sequence++;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t change_journal::get_generation() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	return m_generation;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t change_journal::end_generation()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	return m_generation++;
+}
+
+//------------------------------------------------------------------------------
+
+bool change_journal::is_recorded_since(uint64_t generation) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	return generation + 1 >= m_first_generation && generation <= m_generation;
+}
+
+//------------------------------------------------------------------------------
+
+void change_journal::get_changes_since(uint64_t generation, std::vector<track_change>& changes) const
+{
+	changes.clear();
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		for(std::unordered_map<std::string, track_change>::const_iterator i = m_changes.begin(); i != m_changes.end(); ++i)
+		{
+			if(i->second.generation > generation)
+			{
+				changes.push_back(i->second);
+			}
+		}
+	}
+
+	std::sort(changes.begin(), changes.end(), [](const track_change& a, const track_change& b){ return a.sequence < b.sequence; });
+}
+
+//------------------------------------------------------------------------------
+
+void change_journal::forget_changes_until(uint64_t generation)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for(std::unordered_map<std::string, track_change>::iterator i = m_changes.begin(); i != m_changes.end(); )
+	{
+		if(i->second.generation <= generation)
+		{
+			i = m_changes.erase(i);
+		}
+		else
+		{
+			++i;
+		}
+	}
+
+	// Changes since the given generation are still all here, but not those since any before it.
+	m_first_generation = std::max(m_first_generation, generation + 1);
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
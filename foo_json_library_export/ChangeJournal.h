@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace jsonexport {
+
+//------------------------------------------------------------------------------
+
+/// A track's latest change, as recorded in a change_journal.
+struct track_change
+{
+	track_change();
+
+	std::string path;
+	unsigned subsong_index;
+	bool removed;				///< Whether the track is no longer in the library; otherwise it was added or modified.
+	uint64_t generation;		///< The generation the change was made in.
+	uint64_t sequence;			///< Orders changes, across generations.
+};
+
+//------------------------------------------------------------------------------
+
+/// Records which tracks have been added to, modified in or removed from the library, so that an export can write
+/// only the tracks that changed since an earlier export. Time is divided into generations, each ended by an export;
+/// only each track's latest change is kept, so the journal grows with the number of tracks changed, not the number of changes.
+/// Changes no export needs any more are dropped by forget_changes_until(); until then, the journal keeps growing.
+/// All functions may be called from any thread.
+class change_journal
+{
+public:
+	/// Starts recording changes in the given generation.
+	explicit change_journal(uint64_t generation);
+
+	void record_change(const char* path, unsigned subsong_index, bool removed);
+
+	/// The generation changes are currently being recorded in.
+	uint64_t get_generation() const;
+
+	/// Ends the current generation, which an export is about to capture the state of the library for, and returns it.
+	/// Changes from then on are recorded in the next generation.
+	uint64_t end_generation();
+
+	/// Whether every change made after the given generation has been recorded.
+	bool is_recorded_since(uint64_t generation) const;
+
+	/// Gets the latest change to each track changed after the given generation, in the order the changes were made.
+	/// Changes made since the current generation ended are included too, as exports read the tracks' current state.
+	void get_changes_since(uint64_t generation, std::vector<track_change>& changes) const;
+
+	/// Forgets the changes made in the given generation and before it, once no export will be made relative to an earlier one,
+	/// e.g. once the given generation has been exported. is_recorded_since() is false for earlier generations from then on.
+	void forget_changes_until(uint64_t generation);
+
+private:
+	// Non-copyable.
+	change_journal(const change_journal&);
+	change_journal& operator=(const change_journal&);
+
+	mutable std::mutex m_mutex;
+
+	std::unordered_map<std::string, track_change> m_changes;	///< Latest change to each track, keyed by path and subsong.
+	uint64_t m_first_generation;
+	uint64_t m_generation;
+	uint64_t m_next_sequence;
+};
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
@@ -4,17 +4,53 @@ namespace libraryexport {
 
 //------------------------------------------------------------------------------
 
-DatabaseScopeLock::DatabaseScopeLock()
+DatabaseScopeLock::DatabaseScopeLock(jsonexport::export_metrics* metrics)
 	: db()
+	, m_locked(false)
+	, m_holdTimer()
+	, m_holdTimes()
+	, m_metrics(metrics)
 {
-	db->database_lock();
+	acquire();
 }
 
 //------------------------------------------------------------------------------
 
 DatabaseScopeLock::~DatabaseScopeLock()
 {
-	db->database_unlock();
+	release();
+}
+
+//------------------------------------------------------------------------------
+
+void DatabaseScopeLock::acquire()
+{
+	if(!m_locked)
+	{
+		const jsonexport::stage_timer waitTimer(m_metrics, jsonexport::stage_lock_wait, 1);
+		db->database_lock();
+		m_locked = true;
+		m_holdTimer.start();
+	}
+}
+
+//------------------------------------------------------------------------------
+
+void DatabaseScopeLock::release()
+{
+	if(m_locked)
+	{
+		m_holdTimes.record(m_holdTimer.query());
+		db->database_unlock();
+		m_locked = false;
+	}
+}
+
+//------------------------------------------------------------------------------
+
+const jsonexport::hold_time_histogram& DatabaseScopeLock::getHoldTimes() const
+{
+	return m_holdTimes;
 }
 
 //------------------------------------------------------------------------------
@@ -1,21 +1,38 @@
 #pragma once
 
 #include "FoobarSDKWrapper.h"
+#include "ExportMetrics.h"
+#include "HoldTimeHistogram.h"
+#include "TrackSnapshot.h"
 
 namespace libraryexport {
 
-class DatabaseScopeLock
+// Locks the database for the scope, or for parts of it, and records how long it was held each time.
+// If there are metrics, the time spent waiting for the lock is added to them too.
+class DatabaseScopeLock : public jsonexport::source_lock
 {
 public:
-	DatabaseScopeLock();
+	explicit DatabaseScopeLock(jsonexport::export_metrics* metrics = nullptr);
 	~DatabaseScopeLock();
 
+	// Locks the database again after release(); does nothing if it's already locked.
+	virtual void acquire() override;
+
+	// Unlocks the database before the end of the scope; does nothing if it's already been released.
+	virtual void release() override;
+
+	const jsonexport::hold_time_histogram& getHoldTimes() const;
+
 private:
 	// Non-copyable.
 	DatabaseScopeLock(const DatabaseScopeLock&);
 	DatabaseScopeLock& operator=(const DatabaseScopeLock&);
 
 	static_api_ptr_t<metadb> db;
+	bool m_locked;
+	pfc::hires_timer m_holdTimer;
+	jsonexport::hold_time_histogram m_holdTimes;
+	jsonexport::export_metrics* const m_metrics;
 };
 
 } // namespace libraryexport
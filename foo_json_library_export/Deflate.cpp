@@ -0,0 +1,720 @@
+#include "Deflate.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <utility>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace jsonexport {
+
+namespace
+{
+
+// Matches are found by hashing the next four bytes, so shorter matches than deflate allows aren't looked for.
+static const size_t min_match_length = 4;
+static const size_t max_match_length = 258;
+static const unsigned hash_bits = 15;
+
+// How many earlier positions with the same hash to try; more finds longer matches, but more slowly.
+static const unsigned max_chain_length = 16;
+
+// A match this long is good enough to stop looking for a longer one.
+static const size_t nice_match_length = 64;
+
+// Symbols per block; blocks get their own Huffman codes, so they shouldn't be so long that the data changes character.
+static const size_t max_block_symbols = 32768;
+
+static const uint32_t match_flag = 0x80000000;
+
+static const unsigned literal_length_code_count = 286;
+static const unsigned distance_code_count = 30;
+static const unsigned code_length_code_count = 19;
+static const unsigned max_code_length = 15;
+static const unsigned max_code_length_code_length = 7;
+
+static const unsigned end_of_block = 256;
+
+static const unsigned length_base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const unsigned length_extra_bits[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const unsigned distance_base[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const unsigned distance_extra_bits[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+// The order code length code lengths are written in.
+static const unsigned code_length_order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+// Lookup tables, built during static initialization as local statics aren't thread-safe in all our compilers.
+struct lookup_tables
+{
+	lookup_tables()
+	{
+		for(unsigned code = 0; code < 29; ++code)
+		{
+			const unsigned last = code == 27 ? 257 : length_base[code] + (1 << length_extra_bits[code]) - 1;
+
+			for(unsigned length = length_base[code]; length <= last && length <= max_match_length; ++length)
+			{
+				length_codes[length] = static_cast<unsigned char>(code);
+			}
+		}
+
+		for(unsigned code = 0; code < distance_code_count; ++code)
+		{
+			const unsigned last = distance_base[code] + (1 << distance_extra_bits[code]) - 1;
+
+			for(unsigned distance = distance_base[code]; distance <= last; ++distance)
+			{
+				if(distance <= 512)
+				{
+					short_distance_codes[distance] = static_cast<unsigned char>(code);
+				}
+				else
+				{
+					long_distance_codes[(distance - 1) >> 8] = static_cast<unsigned char>(code);
+				}
+			}
+		}
+
+		for(uint32_t i = 0; i < 256; ++i)
+		{
+			uint32_t crc = i;
+
+			for(int bit = 0; bit < 8; ++bit)
+			{
+				crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+			}
+
+			crc32[0][i] = crc;
+		}
+
+		for(uint32_t i = 0; i < 256; ++i)
+		{
+			for(int table = 1; table < 8; ++table)
+			{
+				crc32[table][i] = (crc32[table - 1][i] >> 8) ^ crc32[0][crc32[table - 1][i] & 0xFF];
+			}
+		}
+	}
+
+	unsigned distance_code(unsigned distance) const
+	{
+		return distance <= 512 ? short_distance_codes[distance] : long_distance_codes[(distance - 1) >> 8];
+	}
+
+	unsigned char length_codes[max_match_length + 1];
+	unsigned char short_distance_codes[513];
+	unsigned char long_distance_codes[128];
+
+	uint32_t crc32[8][256];		///< Slicing-by-8 tables.
+};
+
+const lookup_tables tables;
+
+//------------------------------------------------------------------------------
+
+unsigned count_trailing_zeros(uint64_t value)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+
+	if(static_cast<uint32_t>(value) != 0)
+	{
+		_BitScanForward(&index, static_cast<uint32_t>(value));
+		return index;
+	}
+
+	_BitScanForward(&index, static_cast<uint32_t>(value >> 32));
+	return index + 32;
+#else
+	return static_cast<unsigned>(__builtin_ctzll(value));
+#endif
+}
+
+// Length of the common prefix of a and b, up to max_length. Assumes a little-endian machine.
+size_t match_length(const unsigned char* a, const unsigned char* b, size_t max_length)
+{
+	size_t length = 0;
+
+	while(length + 8 <= max_length)
+	{
+		uint64_t x;
+		uint64_t y;
+		memcpy(&x, a + length, sizeof(x));
+		memcpy(&y, b + length, sizeof(y));
+
+		if(x != y)
+		{
+			return length + count_trailing_zeros(x ^ y) / 8;
+		}
+
+		length += 8;
+	}
+
+	while(length < max_length && a[length] == b[length])
+	{
+		++length;
+	}
+
+	return length;
+}
+
+unsigned hash(const unsigned char* p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return (value * 2654435761u) >> (32 - hash_bits);
+}
+
+//------------------------------------------------------------------------------
+
+// Computes Huffman code lengths for the given symbol frequencies, limited to max_length bits.
+void build_code_lengths(const uint32_t* frequencies, unsigned count, unsigned max_length, unsigned char* lengths)
+{
+	unsigned symbols[literal_length_code_count];
+	uint32_t weights[literal_length_code_count];
+	unsigned leaf_count = 0;
+
+	for(unsigned symbol = 0; symbol < count; ++symbol)
+	{
+		lengths[symbol] = 0;
+
+		if(frequencies[symbol] != 0)
+		{
+			symbols[leaf_count] = symbol;
+			weights[leaf_count] = frequencies[symbol];
+			++leaf_count;
+		}
+	}
+
+	// Decoders expect a complete code, so make sure there are at least two symbols.
+	for(unsigned symbol = 0; leaf_count < 2 && symbol < count; ++symbol)
+	{
+		if(frequencies[symbol] == 0)
+		{
+			symbols[leaf_count] = symbol;
+			weights[leaf_count] = 1;
+			++leaf_count;
+		}
+	}
+
+	// Build the tree; leaves are nodes [0, leaf_count), and each internal node is numbered after its children.
+	typedef std::pair<uint64_t, unsigned> weighted_node;
+	std::priority_queue<weighted_node, std::vector<weighted_node>, std::greater<weighted_node>> queue;
+	unsigned parents[2 * literal_length_code_count];
+	unsigned node_count = leaf_count;
+
+	for(unsigned leaf = 0; leaf < leaf_count; ++leaf)
+	{
+		queue.push(weighted_node(weights[leaf], leaf));
+	}
+
+	while(queue.size() > 1)
+	{
+		const weighted_node a = queue.top();
+		queue.pop();
+		const weighted_node b = queue.top();
+		queue.pop();
+
+		parents[a.second] = node_count;
+		parents[b.second] = node_count;
+		queue.push(weighted_node(a.first + b.first, node_count));
+		++node_count;
+	}
+
+	unsigned depths[2 * literal_length_code_count];
+	unsigned depth_counts[2 * literal_length_code_count] = {};
+	unsigned max_depth = 0;
+
+	depths[node_count - 1] = 0;
+
+	for(unsigned node = node_count - 1; node-- > 0;)
+	{
+		depths[node] = depths[parents[node]] + 1;
+	}
+
+	for(unsigned leaf = 0; leaf < leaf_count; ++leaf)
+	{
+		++depth_counts[depths[leaf]];
+		max_depth = std::max(max_depth, depths[leaf]);
+	}
+
+	// Limit the code lengths by moving leaves up the tree, keeping it complete (JPEG, Annex K.3).
+	for(unsigned depth = max_depth; depth > max_length; --depth)
+	{
+		while(depth_counts[depth] > 0)
+		{
+			unsigned shallower = depth - 2;
+
+			while(depth_counts[shallower] == 0)
+			{
+				--shallower;
+			}
+
+			depth_counts[depth] -= 2;
+			depth_counts[depth - 1] += 1;
+			depth_counts[shallower + 1] += 2;
+			depth_counts[shallower] -= 1;
+		}
+	}
+
+	// Give the shortest codes to the most frequent symbols.
+	unsigned order[literal_length_code_count];
+
+	for(unsigned leaf = 0; leaf < leaf_count; ++leaf)
+	{
+		order[leaf] = leaf;
+	}
+
+	std::stable_sort(order, order + leaf_count, [&weights](unsigned a, unsigned b){ return weights[a] > weights[b]; });
+
+	unsigned next = 0;
+
+	for(unsigned length = 1; length <= max_length; ++length)
+	{
+		for(unsigned i = 0; i < depth_counts[length]; ++i)
+		{
+			lengths[symbols[order[next++]]] = static_cast<unsigned char>(length);
+		}
+	}
+}
+
+// Computes canonical Huffman codes from code lengths, bit-reversed as deflate writes codes from their top bit first.
+void build_codes(const unsigned char* lengths, unsigned count, uint16_t* codes)
+{
+	unsigned length_counts[max_code_length + 1] = {};
+
+	for(unsigned symbol = 0; symbol < count; ++symbol)
+	{
+		++length_counts[lengths[symbol]];
+	}
+
+	length_counts[0] = 0;
+
+	unsigned next_codes[max_code_length + 1] = {};
+	unsigned code = 0;
+
+	for(unsigned length = 1; length <= max_code_length; ++length)
+	{
+		code = (code + length_counts[length - 1]) << 1;
+		next_codes[length] = code;
+	}
+
+	for(unsigned symbol = 0; symbol < count; ++symbol)
+	{
+		const unsigned length = lengths[symbol];
+
+		if(length != 0)
+		{
+			unsigned value = next_codes[length]++;
+			unsigned reversed = 0;
+
+			for(unsigned bit = 0; bit < length; ++bit)
+			{
+				reversed = (reversed << 1) | (value & 1);
+				value >>= 1;
+			}
+
+			codes[symbol] = static_cast<uint16_t>(reversed);
+		}
+	}
+}
+
+} // anonymous namespace
+
+//------------------------------------------------------------------------------
+
+// Writes bits to a byte vector, least significant bit first.
+struct deflate_compressor::bit_writer
+{
+	explicit bit_writer(std::vector<unsigned char>& out)
+		: out(out)
+		, bits(0)
+		, bit_count(0)
+	{
+	}
+
+	void put(uint32_t value, unsigned count)
+	{
+		bits |= static_cast<uint64_t>(value) << bit_count;
+		bit_count += count;
+
+		if(bit_count >= 32)
+		{
+			const size_t size = out.size();
+			out.resize(size + 4);
+			out[size + 0] = static_cast<unsigned char>(bits);
+			out[size + 1] = static_cast<unsigned char>(bits >> 8);
+			out[size + 2] = static_cast<unsigned char>(bits >> 16);
+			out[size + 3] = static_cast<unsigned char>(bits >> 24);
+			bits >>= 32;
+			bit_count -= 32;
+		}
+	}
+
+	void align_to_byte()
+	{
+		while(bit_count > 0)
+		{
+			out.push_back(static_cast<unsigned char>(bits));
+			bits >>= 8;
+			bit_count = bit_count > 8 ? bit_count - 8 : 0;
+		}
+
+		bits = 0;
+	}
+
+	std::vector<unsigned char>& out;
+	uint64_t bits;
+	unsigned bit_count;
+
+private:
+	// Non-copyable.
+	bit_writer(const bit_writer&);
+	bit_writer& operator=(const bit_writer&);
+};
+
+//------------------------------------------------------------------------------
+
+// Defined for when it's bound to a reference, e.g. by std::min(); the value is in the class.
+const size_t deflate_compressor::window_size;
+
+//------------------------------------------------------------------------------
+
+deflate_compressor::deflate_compressor()
+	: m_head(1 << hash_bits)
+	, m_previous(window_size)
+	, m_symbols()
+{
+	m_symbols.reserve(max_block_symbols);
+}
+
+//------------------------------------------------------------------------------
+
+void deflate_compressor::compress_chunk(const unsigned char* data, size_t dictionary_size, size_t size, std::vector<unsigned char>& out)
+{
+	bit_writer writer(out);
+
+	std::fill(m_head.begin(), m_head.end(), -1);
+	m_symbols.clear();
+
+	// Only the last window's worth of history can be referred to.
+	const size_t history_start = dictionary_size > window_size ? dictionary_size - window_size : 0;
+	const size_t window_mask = window_size - 1;
+
+	for(size_t position = history_start; position + min_match_length <= dictionary_size && position + min_match_length <= size; ++position)
+	{
+		const unsigned h = hash(data + position);
+		m_previous[position & window_mask] = m_head[h];
+		m_head[h] = static_cast<int>(position);
+	}
+
+	size_t position = dictionary_size;
+
+	while(position < size)
+	{
+		size_t best_length = 0;
+		size_t best_distance = 0;
+
+		if(position + min_match_length <= size)
+		{
+			const unsigned h = hash(data + position);
+			int candidate = m_head[h];
+			m_previous[position & window_mask] = candidate;
+			m_head[h] = static_cast<int>(position);
+
+			const size_t max_length = std::min(max_match_length, size - position);
+			const int oldest = static_cast<int>(position) - static_cast<int>(window_size);
+
+			for(unsigned chain = 0; candidate >= 0 && candidate >= oldest && chain < max_chain_length; ++chain)
+			{
+				// Cheap check that this could beat the best match so far before comparing the whole thing.
+				if(data[candidate + best_length] == data[position + best_length])
+				{
+					const size_t length = match_length(data + candidate, data + position, max_length);
+
+					if(length > best_length)
+					{
+						best_length = length;
+						best_distance = position - candidate;
+
+						if(length >= nice_match_length || length == max_length)
+						{
+							break;
+						}
+					}
+				}
+
+				candidate = m_previous[candidate & window_mask];
+			}
+		}
+
+		if(best_length >= min_match_length)
+		{
+			m_symbols.push_back(match_flag | static_cast<uint32_t>(best_length << 16) | static_cast<uint32_t>(best_distance));
+
+			// Make the positions inside the match available for later matches.
+			const size_t match_end = position + best_length;
+
+			for(++position; position < match_end; ++position)
+			{
+				if(position + min_match_length <= size)
+				{
+					const unsigned h = hash(data + position);
+					m_previous[position & window_mask] = m_head[h];
+					m_head[h] = static_cast<int>(position);
+				}
+			}
+		}
+		else
+		{
+			m_symbols.push_back(data[position]);
+			++position;
+		}
+
+		if(m_symbols.size() >= max_block_symbols)
+		{
+			write_block(writer);
+		}
+	}
+
+	if(!m_symbols.empty())
+	{
+		write_block(writer);
+	}
+
+	// Finish with an empty stored block, which brings the output to a byte boundary.
+	writer.put(0, 3);
+	writer.align_to_byte();
+	out.push_back(0x00);
+	out.push_back(0x00);
+	out.push_back(0xFF);
+	out.push_back(0xFF);
+}
+
+//------------------------------------------------------------------------------
+
+void deflate_compressor::finish_stream(std::vector<unsigned char>& out)
+{
+	// A final block with fixed codes, holding only the end-of-block code (seven zero bits).
+	out.push_back(0x03);
+	out.push_back(0x00);
+}
+
+//------------------------------------------------------------------------------
+
+void deflate_compressor::write_block(bit_writer& writer)
+{
+	uint32_t literal_frequencies[literal_length_code_count] = {};
+	uint32_t distance_frequencies[distance_code_count] = {};
+
+	for(size_t i = 0; i < m_symbols.size(); ++i)
+	{
+		const uint32_t symbol = m_symbols[i];
+
+		if(symbol & match_flag)
+		{
+			++literal_frequencies[257 + tables.length_codes[(symbol >> 16) & 0x1FF]];
+			++distance_frequencies[tables.distance_code(symbol & 0xFFFF)];
+		}
+		else
+		{
+			++literal_frequencies[symbol];
+		}
+	}
+
+	literal_frequencies[end_of_block] = 1;
+
+	unsigned char literal_lengths[literal_length_code_count];
+	unsigned char distance_lengths[distance_code_count];
+	uint16_t literal_codes[literal_length_code_count];
+	uint16_t distance_codes[distance_code_count];
+
+	build_code_lengths(literal_frequencies, literal_length_code_count, max_code_length, literal_lengths);
+	build_code_lengths(distance_frequencies, distance_code_count, max_code_length, distance_lengths);
+	build_codes(literal_lengths, literal_length_code_count, literal_codes);
+	build_codes(distance_lengths, distance_code_count, distance_codes);
+
+	unsigned literal_count = literal_length_code_count;
+	unsigned distance_count = distance_code_count;
+
+	while(literal_count > 257 && literal_lengths[literal_count - 1] == 0)
+	{
+		--literal_count;
+	}
+
+	while(distance_count > 1 && distance_lengths[distance_count - 1] == 0)
+	{
+		--distance_count;
+	}
+
+	// Run-length encode the code lengths, using code length codes 16 (repeat previous), 17 and 18 (repeat zero).
+	unsigned char all_lengths[literal_length_code_count + distance_code_count];
+	memcpy(all_lengths, literal_lengths, literal_count);
+	memcpy(all_lengths + literal_count, distance_lengths, distance_count);
+	const unsigned all_count = literal_count + distance_count;
+
+	std::vector<std::pair<unsigned, unsigned>> runs;	// Code length code and its extra bits.
+	runs.reserve(all_count);
+
+	for(unsigned i = 0; i < all_count;)
+	{
+		const unsigned length = all_lengths[i];
+		unsigned run = 1;
+
+		while(i + run < all_count && all_lengths[i + run] == length)
+		{
+			++run;
+		}
+
+		i += run;
+
+		if(length == 0)
+		{
+			while(run >= 11)
+			{
+				const unsigned count = std::min(run, 138u);
+				runs.push_back(std::make_pair(18u, count - 11));
+				run -= count;
+			}
+
+			if(run >= 3)
+			{
+				runs.push_back(std::make_pair(17u, run - 3));
+				run = 0;
+			}
+		}
+		else
+		{
+			runs.push_back(std::make_pair(length, 0u));
+			--run;
+
+			while(run >= 3)
+			{
+				const unsigned count = std::min(run, 6u);
+				runs.push_back(std::make_pair(16u, count - 3));
+				run -= count;
+			}
+		}
+
+		for(; run > 0; --run)
+		{
+			runs.push_back(std::make_pair(length, 0u));
+		}
+	}
+
+	uint32_t code_length_frequencies[code_length_code_count] = {};
+
+	for(size_t i = 0; i < runs.size(); ++i)
+	{
+		++code_length_frequencies[runs[i].first];
+	}
+
+	unsigned char code_length_lengths[code_length_code_count];
+	uint16_t code_length_codes[code_length_code_count];
+	build_code_lengths(code_length_frequencies, code_length_code_count, max_code_length_code_length, code_length_lengths);
+	build_codes(code_length_lengths, code_length_code_count, code_length_codes);
+
+	unsigned code_length_count = code_length_code_count;
+
+	while(code_length_count > 4 && code_length_lengths[code_length_order[code_length_count - 1]] == 0)
+	{
+		--code_length_count;
+	}
+
+	// Block header: not final, dynamic Huffman codes.
+	writer.put(0, 1);
+	writer.put(2, 2);
+	writer.put(literal_count - 257, 5);
+	writer.put(distance_count - 1, 5);
+	writer.put(code_length_count - 4, 4);
+
+	for(unsigned i = 0; i < code_length_count; ++i)
+	{
+		writer.put(code_length_lengths[code_length_order[i]], 3);
+	}
+
+	for(size_t i = 0; i < runs.size(); ++i)
+	{
+		const unsigned code = runs[i].first;
+		writer.put(code_length_codes[code], code_length_lengths[code]);
+
+		if(code == 16)
+		{
+			writer.put(runs[i].second, 2);
+		}
+		else if(code == 17)
+		{
+			writer.put(runs[i].second, 3);
+		}
+		else if(code == 18)
+		{
+			writer.put(runs[i].second, 7);
+		}
+	}
+
+	// The data itself.
+	for(size_t i = 0; i < m_symbols.size(); ++i)
+	{
+		const uint32_t symbol = m_symbols[i];
+
+		if(symbol & match_flag)
+		{
+			const unsigned length = (symbol >> 16) & 0x1FF;
+			const unsigned distance = symbol & 0xFFFF;
+			const unsigned length_code = tables.length_codes[length];
+			const unsigned distance_code = tables.distance_code(distance);
+
+			writer.put(literal_codes[257 + length_code], literal_lengths[257 + length_code]);
+			writer.put(length - length_base[length_code], length_extra_bits[length_code]);
+			writer.put(distance_codes[distance_code], distance_lengths[distance_code]);
+			writer.put(distance - distance_base[distance_code], distance_extra_bits[distance_code]);
+		}
+		else
+		{
+			writer.put(literal_codes[symbol], literal_lengths[symbol]);
+		}
+	}
+
+	writer.put(literal_codes[end_of_block], literal_lengths[end_of_block]);
+
+	m_symbols.clear();
+}
+
+//------------------------------------------------------------------------------
+
+uint32_t crc32_update(uint32_t crc, const unsigned char* data, size_t size)
+{
+	crc = ~crc;
+
+	while(size >= 8)
+	{
+		uint32_t a;
+		uint32_t b;
+		memcpy(&a, data, sizeof(a));
+		memcpy(&b, data + 4, sizeof(b));
+		a ^= crc;
+
+		crc = tables.crc32[7][a & 0xFF] ^ tables.crc32[6][(a >> 8) & 0xFF] ^ tables.crc32[5][(a >> 16) & 0xFF] ^ tables.crc32[4][a >> 24]
+			^ tables.crc32[3][b & 0xFF] ^ tables.crc32[2][(b >> 8) & 0xFF] ^ tables.crc32[1][(b >> 16) & 0xFF] ^ tables.crc32[0][b >> 24];
+
+		data += 8;
+		size -= 8;
+	}
+
+	while(size > 0)
+	{
+		crc = tables.crc32[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+		++data;
+		--size;
+	}
+
+	return ~crc;
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A small deflate (RFC 1951) compressor, so the export can write gzip files without depending on zlib.
+namespace jsonexport {
+
+//------------------------------------------------------------------------------
+
+/// Compresses independent chunks of a deflate stream, so that chunks can be compressed in parallel
+/// and their output concatenated in order.
+class deflate_compressor
+{
+public:
+	/// The furthest back a match can refer, and so the most history worth passing to compress_chunk().
+	static const size_t window_size = 32768;
+
+	deflate_compressor();
+
+	/// Compresses data[dictionary_size, size), which follows data[0, dictionary_size) in the stream.
+	/// Appends non-final blocks to out, ending on a byte boundary so the next chunk's output can follow directly.
+	void compress_chunk(const unsigned char* data, size_t dictionary_size, size_t size, std::vector<unsigned char>& out);
+
+	/// Appends the empty final block which ends a deflate stream.
+	static void finish_stream(std::vector<unsigned char>& out);
+
+private:
+	// Non-copyable.
+	deflate_compressor(const deflate_compressor&);
+	deflate_compressor& operator=(const deflate_compressor&);
+
+	struct bit_writer;
+
+	void write_block(bit_writer& writer);
+
+	std::vector<int> m_head;				///< Most recent position with each hash.
+	std::vector<int> m_previous;			///< Previous position with the same hash, indexed by position modulo the window.
+	std::vector<uint32_t> m_symbols;		///< Literals and matches waiting to be written as a block.
+};
+
+//------------------------------------------------------------------------------
+
+/// Updates a CRC-32 (as used by gzip) with more data; start with a crc of 0.
+uint32_t crc32_update(uint32_t crc, const unsigned char* data, size_t size);
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
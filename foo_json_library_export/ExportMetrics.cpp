@@ -0,0 +1,430 @@
+#include "ExportMetrics.h"
+
+#include "ProcessMemory.h"
+#include "ToString.h"
+
+#include <algorithm>
+
+namespace jsonexport {
+
+namespace
+{
+
+typedef std::chrono::steady_clock stage_clock;
+
+double seconds_since(const stage_clock::time_point& start)
+{
+	return std::chrono::duration<double>(stage_clock::now() - start).count();
+}
+
+std::string megabytes(uint64_t bytes)
+{
+	return to_string(bytes / (1024.0 * 1024.0), 4) + " MB";
+}
+
+// Times reading and formatting, adding them up locally until it's destroyed.
+class metered_reader : public track_reader
+{
+public:
+	metered_reader(std::unique_ptr<track_reader> reader, export_metrics& metrics)
+		: m_reader(std::move(reader))
+		, m_metrics(metrics)
+		, m_read_seconds(0.0)
+		, m_read_count(0)
+		, m_format_seconds(0.0)
+		, m_format_count(0)
+	{
+	}
+
+	virtual ~metered_reader()
+	{
+		if(m_read_count > 0)
+		{
+			m_metrics.add_stage_time(stage_info_fetch, m_read_seconds, m_read_count);
+		}
+
+		if(m_format_count > 0)
+		{
+			m_metrics.add_stage_time(stage_titleformat, m_format_seconds, m_format_count);
+		}
+	}
+
+	virtual bool read(size_t index) override
+	{
+		const stage_clock::time_point start = stage_clock::now();
+		const bool success = m_reader->read(index);
+		m_read_seconds += seconds_since(start);
+		++m_read_count;
+		return success;
+	}
+
+	virtual void format_fields(std::vector<field_value>& values) const override
+	{
+		const stage_clock::time_point start = stage_clock::now();
+		m_reader->format_fields(values);
+		m_format_seconds += seconds_since(start);
+		++m_format_count;
+	}
+
+	virtual const char* get_path() const override								{ return m_reader->get_path(); }
+	virtual unsigned get_subsong_index() const override						{ return m_reader->get_subsong_index(); }
+	virtual double get_length() const override									{ return m_reader->get_length(); }
+	virtual replaygain get_replaygain() const override							{ return m_reader->get_replaygain(); }
+
+	virtual size_t info_get_count() const override								{ return m_reader->info_get_count(); }
+	virtual const char* info_enum_name(size_t index) const override				{ return m_reader->info_enum_name(index); }
+	virtual const char* info_enum_value(size_t index) const override			{ return m_reader->info_enum_value(index); }
+
+	virtual size_t meta_get_count() const override								{ return m_reader->meta_get_count(); }
+	virtual const char* meta_enum_name(size_t index) const override				{ return m_reader->meta_enum_name(index); }
+	virtual size_t meta_enum_value_count(size_t index) const override			{ return m_reader->meta_enum_value_count(index); }
+	virtual const char* meta_enum_value(size_t index, size_t value_index) const override	{ return m_reader->meta_enum_value(index, value_index); }
+
+private:
+	// Non-copyable.
+	metered_reader(const metered_reader&);
+	metered_reader& operator=(const metered_reader&);
+
+	const std::unique_ptr<track_reader> m_reader;
+	export_metrics& m_metrics;
+
+	double m_read_seconds;
+	uint64_t m_read_count;
+	mutable double m_format_seconds;
+	mutable uint64_t m_format_count;
+};
+
+} // anonymous namespace
+
+//------------------------------------------------------------------------------
+
+const char* get_stage_name(export_stage stage)
+{
+	static const char* const names[stage_count] = {
+		"enumeration",
+		"lock_wait",
+		"info_fetch",
+		"titleformat",
+		"build",
+		"serialization",
+		"compression",
+		"output_wait",
+		"write"
+	};
+
+	return stage < stage_count ? names[stage] : "unknown";
+}
+
+//------------------------------------------------------------------------------
+
+export_metrics::export_metrics()
+	: m_mutex()
+	, m_start(stage_clock::now())
+	, m_resident_size_at_start(get_resident_size())
+	, m_track_count(0)
+	, m_bytes_written(0)
+	, m_allocation_count(0)
+	, m_allocated_bytes(0)
+	, m_chunk_count(0)
+	, m_peak_allocated_size(0)
+	, m_has_allocations(false)
+	, m_settings()
+{
+	for(size_t i = 0; i < stage_count; ++i)
+	{
+		m_stages[i].seconds = 0.0;
+		m_stages[i].count = 0;
+	}
+
+	reset_peak_resident_size();
+}
+
+//------------------------------------------------------------------------------
+
+void export_metrics::add_stage_time(export_stage stage, double seconds, uint64_t count)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_stages[stage].seconds += seconds;
+	m_stages[stage].count += count;
+}
+
+//------------------------------------------------------------------------------
+
+double export_metrics::get_stage_seconds(export_stage stage) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_stages[stage].seconds;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t export_metrics::get_stage_count(export_stage stage) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_stages[stage].count;
+}
+
+//------------------------------------------------------------------------------
+
+void export_metrics::set_track_count(size_t track_count)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_track_count = track_count;
+}
+
+//------------------------------------------------------------------------------
+
+size_t export_metrics::get_track_count() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_track_count;
+}
+
+//------------------------------------------------------------------------------
+
+void export_metrics::add_bytes_written(uint64_t bytes)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_bytes_written += bytes;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t export_metrics::get_bytes_written() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_bytes_written;
+}
+
+//------------------------------------------------------------------------------
+
+void export_metrics::add_allocations(uint64_t count, uint64_t bytes, uint64_t chunk_count, uint64_t peak_size)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_allocation_count += count;
+	m_allocated_bytes += bytes;
+	m_chunk_count += chunk_count;
+	m_peak_allocated_size = std::max(m_peak_allocated_size, peak_size);
+	m_has_allocations = true;
+}
+
+//------------------------------------------------------------------------------
+
+bool export_metrics::has_allocations() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_has_allocations;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t export_metrics::get_allocation_count() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_allocation_count;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t export_metrics::get_allocated_bytes() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_allocated_bytes;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t export_metrics::get_chunk_count() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_chunk_count;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t export_metrics::get_peak_allocated_size() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_peak_allocated_size;
+}
+
+//------------------------------------------------------------------------------
+
+void export_metrics::set_setting(const std::string& name, uint64_t value)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for(size_t i = 0; i < m_settings.size(); ++i)
+	{
+		if(m_settings[i].first == name)
+		{
+			m_settings[i].second = value;
+			return;
+		}
+	}
+
+	m_settings.push_back(std::make_pair(name, value));
+}
+
+//------------------------------------------------------------------------------
+
+std::vector<std::pair<std::string, uint64_t>> export_metrics::get_settings() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_settings;
+}
+
+//------------------------------------------------------------------------------
+
+double export_metrics::get_elapsed_seconds() const
+{
+	return seconds_since(m_start);
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t export_metrics::get_resident_size_at_start() const
+{
+	return m_resident_size_at_start;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t export_metrics::get_peak_resident_size() const
+{
+	return jsonexport::get_peak_resident_size();
+}
+
+//------------------------------------------------------------------------------
+
+std::string export_metrics::summarize() const
+{
+	std::string stages;
+
+	for(size_t i = 0; i < stage_count; ++i)
+	{
+		const export_stage stage = static_cast<export_stage>(i);
+		const double seconds = get_stage_seconds(stage);
+
+		if(seconds > 0.0)
+		{
+			stages += (stages.empty() ? "" : ", ") + std::string(get_stage_name(stage)) + " " + to_string(seconds, 3) + " s";
+		}
+	}
+
+	std::string summary = "Export took " + to_string(get_elapsed_seconds(), 4) + " s for " + to_string(get_track_count()) + " tracks";
+	summary += stages.empty() ? "." : "; time in each stage, added up over threads: " + stages + ".";
+
+	summary += "\nWrote " + megabytes(get_bytes_written());
+
+	if(has_allocations())
+	{
+		summary += "; allocated " + megabytes(get_allocated_bytes()) + " in " + to_string(get_allocation_count()) + " allocations";
+
+		const uint64_t chunk_count = get_chunk_count();
+
+		if(chunk_count > 0)
+		{
+			summary += " from " + to_string(chunk_count) + " chunks, holding at most " + megabytes(get_peak_allocated_size());
+		}
+	}
+	else
+	{
+		summary += "; allocations weren't measured, as neither a document nor a snapshot was built";
+	}
+
+	const uint64_t peak = get_peak_resident_size();
+
+	if(peak > 0)
+	{
+		summary += "; peak memory use " + megabytes(peak) + ", from " + megabytes(get_resident_size_at_start()) + " at the start";
+	}
+
+	return summary + ".";
+}
+
+//------------------------------------------------------------------------------
+
+stage_timer::stage_timer(export_metrics* metrics, export_stage stage, uint64_t count)
+	: m_metrics(metrics)
+	, m_stage(stage)
+	, m_count(count)
+	, m_start()
+{
+	if(m_metrics)
+	{
+		m_start = stage_clock::now();
+	}
+}
+
+//------------------------------------------------------------------------------
+
+stage_timer::~stage_timer()
+{
+	stop();
+}
+
+//------------------------------------------------------------------------------
+
+void stage_timer::set_count(uint64_t count)
+{
+	m_count = count;
+}
+
+//------------------------------------------------------------------------------
+
+void stage_timer::stop()
+{
+	if(m_metrics)
+	{
+		m_metrics->add_stage_time(m_stage, seconds_since(m_start), m_count);
+		m_metrics = nullptr;
+	}
+}
+
+//------------------------------------------------------------------------------
+
+metered_source::metered_source(track_source& source, export_metrics& metrics)
+	: m_source(source)
+	, m_metrics(metrics)
+{
+}
+
+//------------------------------------------------------------------------------
+
+size_t metered_source::get_track_count() const
+{
+	return m_source.get_track_count();
+}
+
+//------------------------------------------------------------------------------
+
+const std::vector<formatted_field>& metered_source::get_formatted_fields() const
+{
+	return m_source.get_formatted_fields();
+}
+
+//------------------------------------------------------------------------------
+
+std::unique_ptr<track_reader> metered_source::create_reader()
+{
+	return std::unique_ptr<track_reader>(new metered_reader(m_source.create_reader(), m_metrics));
+}
+
+//------------------------------------------------------------------------------
+
+const char* metered_source::get_track_path(size_t index) const
+{
+	return m_source.get_track_path(index);
+}
+
+//------------------------------------------------------------------------------
+
+unsigned metered_source::get_track_subsong_index(size_t index) const
+{
+	return m_source.get_track_subsong_index(index);
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
@@ -0,0 +1,168 @@
+#pragma once
+
+#include "LibraryExport.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace jsonexport {
+
+//------------------------------------------------------------------------------
+
+/// The stages of an export which are timed. Each thread's time in a stage is added up, so a stage done on several threads
+/// can take longer than the export did. Stages nest: tracks read while being serialized count towards both.
+enum export_stage
+{
+	stage_enumeration,		///< Listing the tracks to export; counts tracks.
+	stage_lock_wait,		///< Waiting for the lock on the source, e.g. the database lock; counts times it was acquired.
+	stage_info_fetch,		///< Reading tracks' info, in track_reader::read(); counts tracks.
+	stage_titleformat,		///< Formatting tracks' fields, in track_reader::format_fields(); counts tracks.
+	stage_build,			///< Building the library in memory: a snapshot, document, columns or table of directories; counts tracks.
+	stage_serialization,	///< Serializing tracks into the output's buffers, or the document into the output; counts tracks.
+	stage_compression,		///< Compressing the output, on the compressing threads; counts files.
+	stage_output_wait,		///< Waiting for a free output buffer, as writing or compression is behind; counts files.
+	stage_write,			///< Writing the output to the file, on the I/O thread; counts files.
+	stage_count
+};
+
+/// The stage's name in the metrics file, e.g. "lock_wait".
+const char* get_stage_name(export_stage stage);
+
+//------------------------------------------------------------------------------
+
+/// What an export spent its time and memory on, for tuning the lock and thread settings on a particular machine.
+/// Passed to the export in export_options::metrics, and to whatever prepares the source (e.g. a track_snapshot's capture)
+/// by its caller. All functions may be called from any thread.
+class export_metrics
+{
+public:
+	/// The export's time and peak memory are measured from here.
+	export_metrics();
+
+	void add_stage_time(export_stage stage, double seconds, uint64_t count);
+	double get_stage_seconds(export_stage stage) const;
+	uint64_t get_stage_count(export_stage stage) const;
+
+	void set_track_count(size_t track_count);
+	size_t get_track_count() const;
+
+	/// Bytes written to output files, after any compression.
+	void add_bytes_written(uint64_t bytes);
+	uint64_t get_bytes_written() const;
+
+	/// Allocations made for the export's in-memory structures, i.e. the document or a snapshot of the tracks, and the bytes
+	/// they asked for; then the chunks of memory those were allocated from, and the most bytes of chunks held at once.
+	/// The peak is the largest of any structure's, as they're not all held at once.
+	void add_allocations(uint64_t count, uint64_t bytes, uint64_t chunk_count, uint64_t peak_size);
+
+	/// Whether any allocations were added. If not, they weren't measured rather than there being none:
+	/// streaming the tracks, building columns or a string table and caching them allocate as they go, uncounted.
+	bool has_allocations() const;
+	uint64_t get_allocation_count() const;
+	uint64_t get_allocated_bytes() const;
+	uint64_t get_chunk_count() const;
+	uint64_t get_peak_allocated_size() const;
+
+	/// A setting the export was made with, such as its thread count, for comparing the metrics of different settings.
+	/// Booleans are recorded as 0 or 1. Setting one twice replaces its value.
+	void set_setting(const std::string& name, uint64_t value);
+	std::vector<std::pair<std::string, uint64_t>> get_settings() const;
+
+	/// Seconds since the metrics were created.
+	double get_elapsed_seconds() const;
+
+	/// The process's resident memory when the metrics were created, and at most since; 0 where the platform doesn't say.
+	/// Where the peak can't be reset, it's the peak since the process started.
+	uint64_t get_resident_size_at_start() const;
+	uint64_t get_peak_resident_size() const;
+
+	/// A few lines for the console: the time of each stage which took any, and what was written and allocated.
+	std::string summarize() const;
+
+private:
+	// Non-copyable.
+	export_metrics(const export_metrics&);
+	export_metrics& operator=(const export_metrics&);
+
+	struct stage_total
+	{
+		double seconds;
+		uint64_t count;
+	};
+
+	mutable std::mutex m_mutex;
+
+	const std::chrono::steady_clock::time_point m_start;
+	const uint64_t m_resident_size_at_start;
+
+	stage_total m_stages[stage_count];
+	size_t m_track_count;
+	uint64_t m_bytes_written;
+	uint64_t m_allocation_count;
+	uint64_t m_allocated_bytes;
+	uint64_t m_chunk_count;
+	uint64_t m_peak_allocated_size;
+	bool m_has_allocations;
+	std::vector<std::pair<std::string, uint64_t>> m_settings;
+};
+
+//------------------------------------------------------------------------------
+
+/// Times a scope as a stage, if there are metrics to add it to; otherwise does nothing, not even reading the clock.
+class stage_timer
+{
+public:
+	stage_timer(export_metrics* metrics, export_stage stage, uint64_t count);
+	~stage_timer();
+
+	/// For when what the stage handled isn't known until it's done.
+	void set_count(uint64_t count);
+
+	/// Ends the stage before the end of the scope; does nothing if it's already been ended.
+	void stop();
+
+private:
+	// Non-copyable.
+	stage_timer(const stage_timer&);
+	stage_timer& operator=(const stage_timer&);
+
+	export_metrics* m_metrics;		///< Null once stopped.
+	const export_stage m_stage;
+	uint64_t m_count;
+	std::chrono::steady_clock::time_point m_start;
+};
+
+//------------------------------------------------------------------------------
+
+/// Passes another source's tracks through, timing its readers' read() as stage_info_fetch and format_fields() as
+/// stage_titleformat. Each reader adds its times to the metrics when it's destroyed, so they don't contend for them per track.
+/// Wrap whichever source reads from the library itself, rather than e.g. a snapshot of it, to time the library's reading.
+class metered_source : public track_source
+{
+public:
+	metered_source(track_source& source, export_metrics& metrics);
+
+	virtual size_t get_track_count() const override;
+	virtual const std::vector<formatted_field>& get_formatted_fields() const override;
+	virtual std::unique_ptr<track_reader> create_reader() override;
+	virtual const char* get_track_path(size_t index) const override;
+	virtual unsigned get_track_subsong_index(size_t index) const override;
+
+private:
+	// Non-copyable.
+	metered_source(const metered_source&);
+	metered_source& operator=(const metered_source&);
+
+	track_source& m_source;
+	export_metrics& m_metrics;
+};
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
@@ -0,0 +1,202 @@
+#include "FragmentCache.h"
+
+#include <cstring>
+
+namespace jsonexport {
+
+//------------------------------------------------------------------------------
+
+fragment_cache::fragment_cache()
+	: m_mutex()
+	, m_fragments()
+	, m_format()
+	, m_size(0)
+	, m_recently_invalidated()
+	, m_invalidation_count(0)
+	, m_exports_in_progress(0)
+{
+}
+
+//------------------------------------------------------------------------------
+
+void fragment_cache::set_format(const std::string& format)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if(format != m_format)
+	{
+		m_fragments.clear();
+		m_size = 0;
+		m_format = format;
+	}
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t fragment_cache::begin_export()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	++m_exports_in_progress;
+	return m_invalidation_count;
+}
+
+//------------------------------------------------------------------------------
+
+void fragment_cache::end_export()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if(--m_exports_in_progress == 0)
+	{
+		m_recently_invalidated.clear();
+	}
+}
+
+//------------------------------------------------------------------------------
+
+bool fragment_cache::find(const char* path, unsigned subsong_index, std::string& json) const
+{
+	std::string key;
+	make_key(path, subsong_index, key);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	const std::unordered_map<std::string, std::string>::const_iterator found = m_fragments.find(key);
+
+	if(found == m_fragments.end())
+	{
+		return false;
+	}
+
+	json = found->second;
+	return true;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t fragment_cache::store(const char* path, unsigned subsong_index, uint64_t export_token, const char* json, size_t size)
+{
+	std::string key;
+	make_key(path, subsong_index, key);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	const std::unordered_map<std::string, uint64_t>::const_iterator invalidated = m_recently_invalidated.find(key);
+
+	if(invalidated != m_recently_invalidated.end() && invalidated->second > export_token)
+	{
+		return m_size;
+	}
+
+	std::string& fragment = m_fragments[key];
+
+	if(fragment.empty())
+	{
+		m_size += key.size();
+	}
+
+	m_size = m_size - fragment.size() + size;
+	fragment.assign(json, size);
+	return m_size;
+}
+
+//------------------------------------------------------------------------------
+
+void fragment_cache::invalidate(const char* path, unsigned subsong_index)
+{
+	std::string key;
+	make_key(path, subsong_index, key);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	const std::unordered_map<std::string, std::string>::iterator found = m_fragments.find(key);
+
+	if(found != m_fragments.end())
+	{
+		m_size -= found->first.size() + found->second.size();
+		m_fragments.erase(found);
+	}
+
+	// An export may have read the track before it changed, and not yet stored it.
+	if(m_exports_in_progress > 0)
+	{
+		m_recently_invalidated[key] = ++m_invalidation_count;
+	}
+}
+
+//------------------------------------------------------------------------------
+
+void fragment_cache::clear()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_fragments.clear();
+	m_size = 0;
+}
+
+//------------------------------------------------------------------------------
+
+size_t fragment_cache::get_track_count() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	return m_fragments.size();
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t fragment_cache::get_size() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	return m_size;
+}
+
+//------------------------------------------------------------------------------
+
+void fragment_cache::make_key(const char* path, unsigned subsong_index, std::string& key)
+{
+	// Paths can't contain nulls, so the subsong index can't be mistaken for part of the path.
+	const size_t path_length = strlen(path);
+	key.resize(path_length + 1 + sizeof(subsong_index));
+	memcpy(&key[0], path, path_length);
+	key[path_length] = '\0';
+	memcpy(&key[path_length + 1], &subsong_index, sizeof(subsong_index));
+}
+
+//------------------------------------------------------------------------------
+
+cache_export_scope::cache_export_scope(fragment_cache* cache)
+	: m_cache(cache)
+	, m_token(cache ? cache->begin_export() : 0)
+{
+}
+
+//------------------------------------------------------------------------------
+
+cache_export_scope::~cache_export_scope()
+{
+	if(m_cache)
+	{
+		m_cache->end_export();
+	}
+}
+
+//------------------------------------------------------------------------------
+
+fragment_cache* cache_export_scope::get_cache() const
+{
+	return m_cache;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t cache_export_scope::get_token() const
+{
+	return m_token;
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
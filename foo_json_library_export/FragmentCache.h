@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace jsonexport {
+
+//------------------------------------------------------------------------------
+
+/// The serialized JSON of each track from previous exports, so that tracks which haven't changed since
+/// needn't be read or serialized again. Whoever owns the cache must invalidate tracks when they change.
+/// All functions may be called from any thread.
+class fragment_cache
+{
+public:
+	fragment_cache();
+
+	/// Forgets every fragment unless they were serialized in the given format,
+	/// which identifies everything besides the track itself that affects its JSON.
+	void set_format(const std::string& format);
+
+	/// Called at the start of an export which uses the cache; returns a token to pass to store().
+	uint64_t begin_export();
+
+	/// Called at the end of every export begun with begin_export(), whether it succeeded or not.
+	void end_export();
+
+	/// Copies the track's fragment into json, returning false if there isn't one.
+	bool find(const char* path, unsigned subsong_index, std::string& json) const;
+
+	/// Stores a track's fragment, unless the track was invalidated since the export_token was handed out,
+	/// in which case the fragment may have been serialized from the track's old info. Returns get_size() afterwards.
+	uint64_t store(const char* path, unsigned subsong_index, uint64_t export_token, const char* json, size_t size);
+
+	/// Forgets a track's fragment, because the track has changed or been removed from the library.
+	void invalidate(const char* path, unsigned subsong_index);
+
+	void clear();
+
+	size_t get_track_count() const;
+
+	/// Bytes used by keys and fragments, not counting the overheads of the containers holding them.
+	uint64_t get_size() const;
+
+private:
+	// Non-copyable.
+	fragment_cache(const fragment_cache&);
+	fragment_cache& operator=(const fragment_cache&);
+
+	static void make_key(const char* path, unsigned subsong_index, std::string& key);
+
+	mutable std::mutex m_mutex;
+
+	std::unordered_map<std::string, std::string> m_fragments;
+	std::string m_format;
+	uint64_t m_size;
+
+	/// Tracks invalidated while exports were in progress, with when; forgotten once no exports are in progress.
+	std::unordered_map<std::string, uint64_t> m_recently_invalidated;
+	uint64_t m_invalidation_count;
+	size_t m_exports_in_progress;
+};
+
+//------------------------------------------------------------------------------
+
+/// Brackets an export's use of a cache, so that the cache can tell which tracks changed while they were being serialized.
+/// Must begin before the first track is read: a track which changes after being read, but before the scope begins, would be
+/// stored from its old info. So when the tracks are read ahead of the export, e.g. into a track_snapshot, begin one before
+/// that and pass it in export_options::cache_scope.
+class cache_export_scope
+{
+public:
+	/// Does nothing if cache is null.
+	explicit cache_export_scope(fragment_cache* cache);
+	~cache_export_scope();
+
+	fragment_cache* get_cache() const;
+
+	/// The token to pass to fragment_cache::store().
+	uint64_t get_token() const;
+
+private:
+	// Non-copyable.
+	cache_export_scope(const cache_export_scope&);
+	cache_export_scope& operator=(const cache_export_scope&);
+
+	fragment_cache* const m_cache;
+	const uint64_t m_token;
+};
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
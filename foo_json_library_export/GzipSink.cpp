@@ -0,0 +1,352 @@
+#include "GzipSink.h"
+
+#include "LibraryExport.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace jsonexport {
+
+namespace
+{
+
+typedef std::chrono::steady_clock stage_clock;
+
+double seconds_since(const stage_clock::time_point& start)
+{
+	return std::chrono::duration<double>(stage_clock::now() - start).count();
+}
+
+// How much output is compressed at once. Larger chunks lose less to their block headers and restarted history;
+// smaller ones let compression start sooner and use less memory per thread.
+static const size_t gzip_chunk_size = 1024 * 1024;
+
+void write_bytes(sink_write_stream& stream, const unsigned char* data, size_t size)
+{
+	stream.PutBuffer(reinterpret_cast<const char*>(data), size);
+}
+
+void write_uint32_le(sink_write_stream& stream, uint32_t value)
+{
+	const unsigned char bytes[4] = {
+		static_cast<unsigned char>(value),
+		static_cast<unsigned char>(value >> 8),
+		static_cast<unsigned char>(value >> 16),
+		static_cast<unsigned char>(value >> 24)
+	};
+
+	write_bytes(stream, bytes, sizeof(bytes));
+}
+
+} // anonymous namespace
+
+//------------------------------------------------------------------------------
+
+gzip_sink::gzip_sink(output_sink& destination, size_t thread_count)
+	: m_destination(destination)
+	, m_stream(destination)
+	, m_chunks()
+	, m_free_chunks()
+	, m_pending_chunks()
+	, m_completed_chunks()
+	, m_current_chunk(0)
+	, m_next_sequence(0)
+	, m_next_write_sequence(0)
+	, m_history()
+	, m_mutex()
+	, m_chunk_freed()
+	, m_chunk_committed()
+	, m_writing(false)
+	, m_stopping(false)
+	, m_error()
+	, m_crc(0)
+	, m_input_size(0)
+	, m_output_size(0)
+	, m_compression_seconds(0.0)
+	, m_producer_wait_seconds(0.0)
+	, m_threads()
+{
+	// Magic, deflate, no flags, no modification time, no extra flags, unknown OS.
+	static const unsigned char header[10] = { 0x1F, 0x8B, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF };
+	write_bytes(m_stream, header, sizeof(header));
+	m_output_size = sizeof(header);
+
+	thread_count = thread_count < 1 ? 1 : thread_count;
+
+	// Enough chunks for each thread to be compressing one while another waits, plus the one being filled.
+	const size_t chunk_count = thread_count * 2 + 1;
+
+	m_chunks.resize(chunk_count);
+
+	for(size_t i = 0; i < chunk_count; ++i)
+	{
+		m_chunks[i].input.resize(deflate_compressor::window_size + gzip_chunk_size);
+		m_chunks[i].output.reserve(gzip_chunk_size / 2);
+		m_free_chunks.push_back(i);
+	}
+
+	m_history.reserve(deflate_compressor::window_size);
+
+	for(size_t i = 0; i < thread_count; ++i)
+	{
+		m_threads.push_back(std::thread([this](){ compress_pending_chunks(); }));
+	}
+}
+
+//------------------------------------------------------------------------------
+
+gzip_sink::~gzip_sink()
+{
+	stop();
+}
+
+//------------------------------------------------------------------------------
+
+char* gzip_sink::acquire_buffer(size_t& capacity)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	if(m_free_chunks.empty() && !m_error)
+	{
+		const stage_clock::time_point wait_start = stage_clock::now();
+		m_chunk_freed.wait(lock, [this](){ return !m_free_chunks.empty() || m_error; });
+		m_producer_wait_seconds += seconds_since(wait_start);
+	}
+
+	if(m_error)
+	{
+		std::rethrow_exception(m_error);
+	}
+
+	m_current_chunk = m_free_chunks.back();
+	m_free_chunks.pop_back();
+
+	chunk& current = m_chunks[m_current_chunk];
+
+	if(!m_history.empty())
+	{
+		memcpy(current.input.data(), m_history.data(), m_history.size());
+	}
+
+	current.dictionary_size = m_history.size();
+
+	capacity = gzip_chunk_size;
+	return reinterpret_cast<char*>(current.input.data() + current.dictionary_size);
+}
+
+//------------------------------------------------------------------------------
+
+void gzip_sink::commit_buffer(size_t size)
+{
+	chunk& current = m_chunks[m_current_chunk];
+	current.size = current.dictionary_size + size;
+
+	// Keep the end of this chunk as the next one's history.
+	const size_t history_size = std::min(current.size, deflate_compressor::window_size);
+	m_history.assign(current.input.begin() + (current.size - history_size), current.input.begin() + current.size);
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if(size == 0)
+		{
+			m_free_chunks.push_back(m_current_chunk);
+			return;
+		}
+
+		m_input_size += size;
+		m_pending_chunks[m_next_sequence++] = m_current_chunk;
+	}
+
+	m_chunk_committed.notify_one();
+}
+
+//------------------------------------------------------------------------------
+
+void gzip_sink::finish()
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_chunk_freed.wait(lock, [this](){ return m_next_write_sequence == m_next_sequence || m_error; });
+	}
+
+	stop();
+
+	if(m_error)
+	{
+		std::rethrow_exception(m_error);
+	}
+
+	std::vector<unsigned char> final_block;
+	deflate_compressor::finish_stream(final_block);
+	write_bytes(m_stream, final_block.data(), final_block.size());
+
+	// The trailer: CRC-32 and size modulo 2^32 of the uncompressed data.
+	write_uint32_le(m_stream, m_crc);
+	write_uint32_le(m_stream, static_cast<uint32_t>(m_input_size));
+	m_output_size += final_block.size() + 8;
+
+	m_stream.Flush();
+	m_destination.finish();
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t gzip_sink::get_input_size() const
+{
+	return m_input_size;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t gzip_sink::get_output_size() const
+{
+	return m_output_size;
+}
+
+//------------------------------------------------------------------------------
+
+double gzip_sink::get_compression_seconds() const
+{
+	return m_compression_seconds;
+}
+
+//------------------------------------------------------------------------------
+
+double gzip_sink::get_producer_wait_seconds() const
+{
+	return m_producer_wait_seconds;
+}
+
+//------------------------------------------------------------------------------
+
+void gzip_sink::compress_pending_chunks()
+{
+	deflate_compressor compressor;
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while(true)
+	{
+		m_chunk_committed.wait(lock, [this](){ return !m_pending_chunks.empty() || m_stopping; });
+
+		if(m_pending_chunks.empty())
+		{
+			// Stopping, and everything committed has been compressed.
+			return;
+		}
+
+		const std::map<uint64_t, size_t>::iterator next = m_pending_chunks.begin();
+		const uint64_t sequence = next->first;
+		const size_t chunk_index = next->second;
+		m_pending_chunks.erase(next);
+
+		if(!m_error)
+		{
+			lock.unlock();
+
+			chunk& current = m_chunks[chunk_index];
+			bool success = true;
+
+			const stage_clock::time_point compression_start = stage_clock::now();
+
+			try
+			{
+				current.output.clear();
+				compressor.compress_chunk(current.input.data(), current.dictionary_size, current.size, current.output);
+			}
+			catch(...)
+			{
+				success = false;
+				lock.lock();
+				m_error = m_error ? m_error : std::current_exception();
+				lock.unlock();
+			}
+
+			const double compression_seconds = seconds_since(compression_start);
+
+			lock.lock();
+
+			m_compression_seconds += compression_seconds;
+
+			if(success)
+			{
+				m_completed_chunks[sequence] = chunk_index;
+				write_completed_chunks(lock);
+				continue;
+			}
+		}
+
+		m_free_chunks.push_back(chunk_index);
+		m_chunk_freed.notify_all();
+	}
+}
+
+//------------------------------------------------------------------------------
+
+void gzip_sink::write_completed_chunks(std::unique_lock<std::mutex>& lock)
+{
+	// Chunks must be written in order, by one thread at a time; whoever's already writing will pick this one up.
+	if(m_writing)
+	{
+		return;
+	}
+
+	m_writing = true;
+
+	while(!m_error && !m_completed_chunks.empty() && m_completed_chunks.begin()->first == m_next_write_sequence)
+	{
+		const size_t chunk_index = m_completed_chunks.begin()->second;
+		m_completed_chunks.erase(m_completed_chunks.begin());
+
+		// Don't hold the lock while writing, so other threads can keep compressing.
+		lock.unlock();
+
+		const chunk& current = m_chunks[chunk_index];
+
+		try
+		{
+			m_crc = crc32_update(m_crc, current.input.data() + current.dictionary_size, current.size - current.dictionary_size);
+			write_bytes(m_stream, current.output.data(), current.output.size());
+			m_output_size += current.output.size();
+		}
+		catch(...)
+		{
+			lock.lock();
+			m_error = m_error ? m_error : std::current_exception();
+			lock.unlock();
+		}
+
+		lock.lock();
+
+		++m_next_write_sequence;
+		m_free_chunks.push_back(chunk_index);
+		m_chunk_freed.notify_all();
+	}
+
+	m_writing = false;
+}
+
+//------------------------------------------------------------------------------
+
+void gzip_sink::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+
+	m_chunk_committed.notify_all();
+
+	for(size_t i = 0; i < m_threads.size(); ++i)
+	{
+		if(m_threads[i].joinable())
+		{
+			m_threads[i].join();
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "Deflate.h"
+#include "OutputSink.h"
+#include "SinkWriteStream.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace jsonexport {
+
+//------------------------------------------------------------------------------
+
+/// Compresses the output as gzip on its way to another sink.
+/// The output is split into chunks which are compressed on worker threads while the exporting thread carries on;
+/// each chunk is given the end of the previous one as history, so the compression ratio barely suffers for it.
+class gzip_sink : public output_sink
+{
+public:
+	/// Writes the gzip header to destination, which must outlive this sink.
+	gzip_sink(output_sink& destination, size_t thread_count);
+	virtual ~gzip_sink();
+
+	virtual char* acquire_buffer(size_t& capacity) override;
+	virtual void commit_buffer(size_t size) override;
+	virtual void finish() override;
+
+	/// Bytes passed in, i.e. the size of the uncompressed output.
+	uint64_t get_input_size() const;
+
+	/// Bytes passed on to the destination.
+	uint64_t get_output_size() const;
+
+	/// Total time spent compressing, summed across threads.
+	double get_compression_seconds() const;
+
+	/// Total time the exporting thread spent waiting for compression to catch up.
+	double get_producer_wait_seconds() const;
+
+private:
+	// Non-copyable.
+	gzip_sink(const gzip_sink&);
+	gzip_sink& operator=(const gzip_sink&);
+
+	struct chunk
+	{
+		std::vector<unsigned char> input;			///< History from the previous chunk, then the data to compress.
+		size_t dictionary_size;
+		size_t size;
+		std::vector<unsigned char> output;
+	};
+
+	void compress_pending_chunks();
+	void write_completed_chunks(std::unique_lock<std::mutex>& lock);
+	void stop();
+
+	output_sink& m_destination;
+	sink_write_stream m_stream;
+
+	std::vector<chunk> m_chunks;
+	std::vector<size_t> m_free_chunks;
+	std::map<uint64_t, size_t> m_pending_chunks;	///< Chunks waiting to be compressed, by sequence number.
+	std::map<uint64_t, size_t> m_completed_chunks;	///< Chunks waiting to be written, by sequence number.
+	size_t m_current_chunk;
+	uint64_t m_next_sequence;
+	uint64_t m_next_write_sequence;
+
+	std::vector<unsigned char> m_history;			///< The end of the output so far, the next chunk's dictionary.
+
+	std::mutex m_mutex;
+	std::condition_variable m_chunk_freed;
+	std::condition_variable m_chunk_committed;
+	bool m_writing;
+	bool m_stopping;
+	std::exception_ptr m_error;
+
+	uint32_t m_crc;
+	uint64_t m_input_size;
+	uint64_t m_output_size;
+	double m_compression_seconds;
+	double m_producer_wait_seconds;
+
+	std::vector<std::thread> m_threads;
+};
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
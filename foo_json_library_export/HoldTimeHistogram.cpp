@@ -0,0 +1,119 @@
+#include "HoldTimeHistogram.h"
+
+#include "ToString.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace jsonexport {
+
+//------------------------------------------------------------------------------
+
+hold_time_histogram::hold_time_histogram()
+	: m_samples()
+	, m_total_seconds(0.0)
+{
+}
+
+//------------------------------------------------------------------------------
+
+void hold_time_histogram::record(double seconds)
+{
+	m_samples.push_back(seconds);
+	m_total_seconds += seconds;
+}
+
+//------------------------------------------------------------------------------
+
+size_t hold_time_histogram::get_count() const
+{
+	return m_samples.size();
+}
+
+//------------------------------------------------------------------------------
+
+double hold_time_histogram::get_total_seconds() const
+{
+	return m_total_seconds;
+}
+
+//------------------------------------------------------------------------------
+
+double hold_time_histogram::get_max_seconds() const
+{
+	return m_samples.empty() ? 0.0 : *std::max_element(m_samples.begin(), m_samples.end());
+}
+
+//------------------------------------------------------------------------------
+
+double hold_time_histogram::get_percentile_seconds(double fraction) const
+{
+	if(m_samples.empty())
+	{
+		return 0.0;
+	}
+
+	// Nearest rank: the smallest sample which at least the given fraction of samples are no greater than.
+	const double rank = std::ceil(std::min(std::max(fraction, 0.0), 1.0) * m_samples.size());
+	const size_t index = rank < 1.0 ? 0 : static_cast<size_t>(rank) - 1;
+
+	std::vector<double> sorted(m_samples);
+	std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+	return sorted[index];
+}
+
+//------------------------------------------------------------------------------
+
+std::string hold_time_histogram::describe() const
+{
+	std::string description = to_string(m_samples.size()) + (m_samples.size() == 1 ? " hold" : " holds");
+
+	if(m_samples.empty())
+	{
+		return description;
+	}
+
+	description += "; max " + to_string(get_max_seconds() * 1000.0, 3) + " ms"
+		", p50 " + to_string(get_percentile_seconds(0.5) * 1000.0, 3) + " ms"
+		", p99 " + to_string(get_percentile_seconds(0.99) * 1000.0, 3) + " ms;";
+
+	// Buckets doubling from 1 ms; the last one takes everything longer.
+	static const size_t bucket_count = 12;
+	size_t buckets[bucket_count] = {};
+
+	for(size_t i = 0; i < m_samples.size(); ++i)
+	{
+		size_t bucket = 0;
+
+		for(double limit = 0.001; bucket + 1 < bucket_count && m_samples[i] >= limit; limit *= 2.0)
+		{
+			++bucket;
+		}
+
+		++buckets[bucket];
+	}
+
+	const char* separator = " ";
+
+	for(size_t bucket = 0; bucket < bucket_count; ++bucket)
+	{
+		if(buckets[bucket] == 0)
+		{
+			continue;
+		}
+
+		const size_t lower = bucket == 0 ? 0 : static_cast<size_t>(1) << (bucket - 1);
+		const size_t upper = static_cast<size_t>(1) << bucket;
+
+		description += separator;
+		description += bucket == 0 ? "<1 ms" : bucket + 1 == bucket_count ? ">=" + to_string(lower) + " ms" : to_string(lower) + "-" + to_string(upper) + " ms";
+		description += ": " + to_string(buckets[bucket]);
+		separator = ", ";
+	}
+
+	return description;
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace jsonexport {
+
+//------------------------------------------------------------------------------
+
+/// Records how long a lock was held each time it was taken, to show whether the export holds up anyone waiting for it.
+class hold_time_histogram
+{
+public:
+	hold_time_histogram();
+
+	void record(double seconds);
+
+	size_t get_count() const;
+	double get_total_seconds() const;
+	double get_max_seconds() const;
+
+	/// The hold time which the given fraction (0 to 1) of holds were no longer than, or 0 if nothing's been recorded.
+	double get_percentile_seconds(double fraction) const;
+
+	/// Summarises the holds for the log, e.g. "3 holds; max 4.1 ms, p50 2.2 ms, p99 4.1 ms; <1 ms: 1, 2-4 ms: 1, 4-8 ms: 1".
+	std::string describe() const;
+
+private:
+	std::vector<double> m_samples;
+	double m_total_seconds;
+};
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
@@ -0,0 +1,149 @@
+#include "LibraryChanges.h"
+
+#include "FoobarSDKWrapper.h"
+
+#include <memory>
+
+namespace libraryexport {
+
+namespace
+{
+
+// Generations carry on from one session to the next, so a journal is never mistaken for one from an earlier session.
+// Starts at 1, so that generation 0 can mean nothing has been exported yet.
+// {0E3C6A51-29F4-4F8B-A6D1-7B5C2E9F8D34}
+static const GUID config_journal_generation_guid = { 0x0e3c6a51, 0x29f4, 0x4f8b, { 0xa6, 0xd1, 0x7b, 0x5c, 0x2e, 0x9f, 0x8d, 0x34 } };
+cfg_int_t<t_uint64> config_journal_generation(config_journal_generation_guid, 1);
+
+// {5A7D2C18-E4B9-4C63-8F01-3D9E6B4A7C25}
+static const GUID config_last_exported_generation_guid = { 0x5a7d2c18, 0xe4b9, 0x4c63, { 0x8f, 0x01, 0x3d, 0x9e, 0x6b, 0x4a, 0x7c, 0x25 } };
+cfg_int_t<t_uint64> config_last_exported_generation(config_last_exported_generation_guid, 0);
+
+jsonexport::fragment_cache exportCache;
+std::unique_ptr<jsonexport::change_journal> changeJournal;
+
+void invalidateTracks(metadb_handle_list_cref tracks)
+{
+	for(t_size i = 0; i < tracks.get_count(); ++i)
+	{
+		const metadb_handle_ptr& track = tracks.get_item_ref(i);
+		exportCache.invalidate(track->get_path(), track->get_subsong_index());
+	}
+}
+
+void recordChanges(metadb_handle_list_cref tracks, bool removed)
+{
+	for(t_size i = 0; i < tracks.get_count(); ++i)
+	{
+		const metadb_handle_ptr& track = tracks.get_item_ref(i);
+		changeJournal->record_change(track->get_path(), track->get_subsong_index(), removed);
+	}
+}
+
+// Forgets the cached JSON of any track that's changed, so the next export serializes it afresh, and journals changes to the library.
+// Library changes cover tracks being added, removed and having their tags edited; metadb changes also cover playback statistics
+// changing, as the statistics components refresh the tracks they've updated.
+class LibraryChangeListener : public library_callback_dynamic_impl_base, public metadb_io_callback_dynamic_impl_base
+{
+public:
+	virtual void on_items_added(metadb_handle_list_cref tracks) override
+	{
+		invalidateTracks(tracks);
+		recordChanges(tracks, false);
+	}
+
+	virtual void on_items_removed(metadb_handle_list_cref tracks) override
+	{
+		invalidateTracks(tracks);
+		recordChanges(tracks, true);
+	}
+
+	virtual void on_items_modified(metadb_handle_list_cref tracks) override
+	{
+		invalidateTracks(tracks);
+		recordChanges(tracks, false);
+	}
+
+	virtual void on_changed_sorted(metadb_handle_list_cref tracks, bool) override
+	{
+		invalidateTracks(tracks);
+
+		for(t_size i = 0; i < tracks.get_count(); ++i)
+		{
+			const metadb_handle_ptr& track = tracks.get_item_ref(i);
+
+			if(m_library->is_item_in_library(track))
+			{
+				changeJournal->record_change(track->get_path(), track->get_subsong_index(), false);
+			}
+		}
+	}
+
+private:
+	static_api_ptr_t<library_manager> m_library;
+};
+
+// The callbacks can only be registered once the services they're registered with are up and running.
+class LibraryChangesInitQuit : public initquit
+{
+public:
+	virtual void on_init() override
+	{
+		// Changes made while foobar2000 wasn't running weren't recorded, so skip a generation:
+		// the last one exported in the previous session can't have changes exported relative to it.
+		changeJournal.reset(new jsonexport::change_journal(config_journal_generation + 1));
+		m_listener.reset(new LibraryChangeListener());
+	}
+
+	virtual void on_quit() override
+	{
+		m_listener.reset();
+		config_journal_generation = changeJournal->get_generation();
+		exportCache.clear();
+	}
+
+private:
+	std::unique_ptr<LibraryChangeListener> m_listener;
+};
+
+initquit_factory_t<LibraryChangesInitQuit> libraryChangesInitQuit;
+
+} // anonymous namespace
+
+//------------------------------------------------------------------------------
+
+jsonexport::fragment_cache& getExportCache()
+{
+	return exportCache;
+}
+
+//------------------------------------------------------------------------------
+
+jsonexport::change_journal& getChangeJournal()
+{
+	return *changeJournal;
+}
+
+//------------------------------------------------------------------------------
+
+t_uint64 getLastExportedGeneration()
+{
+	return config_last_exported_generation;
+}
+
+//------------------------------------------------------------------------------
+
+void setLastExportedGeneration(t_uint64 generation)
+{
+	config_last_exported_generation = generation;
+
+	// The next export is of the changes since this one, so nothing from before it is needed any more.
+	changeJournal->forget_changes_until(generation);
+
+	// Save the journal's generation too, so it's not reused if foobar2000 doesn't get to shut down cleanly.
+	config_journal_generation = changeJournal->get_generation();
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace libraryexport
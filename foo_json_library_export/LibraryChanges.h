@@ -0,0 +1,21 @@
+#pragma once
+
+#include "ChangeJournal.h"
+#include "FoobarSDKWrapper.h"
+#include "FragmentCache.h"
+
+namespace libraryexport {
+
+// The serialized JSON of tracks from earlier exports this session, for the next export to reuse.
+// Tracks are invalidated as the library and their info change, from the time the component is initialised.
+extern jsonexport::fragment_cache& getExportCache();
+
+// Changes to the library since the component was initialised, for exporting only what's changed since an earlier export.
+extern jsonexport::change_journal& getChangeJournal();
+
+// The generation of the last export, full or of changes, or 0 if nothing has been exported yet. Main thread only.
+// Setting it forgets the journal's changes up to it, as later exports are only ever of the changes since the last one.
+extern t_uint64 getLastExportedGeneration();
+extern void setLastExportedGeneration(t_uint64 generation);
+
+} // namespace libraryexport
@@ -1,9 +1,2787 @@
 #include "LibraryExport.h"
 
+#include "CborWriter.h"
+#include "ChangeJournal.h"
+#include "ExportMetrics.h"
+#include "FragmentCache.h"
+#include "GzipSink.h"
+#include "LineWriter.h"
+#include "MsgPackWriter.h"
+#include "OutputSink.h"
+#include "PathTable.h"
+#include "RapidJsonWrapper.h"
+#include "SinkWriteStream.h"
+#include "StringDictionary.h"
+#include "StringInternTable.h"
+#include "ToString.h"
+#include "TrackingAllocator.h"
+#include "WorkerThreads.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cfloat>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
 namespace jsonexport {
 
-void export_library_as_json_file(const std::string& file_path)
+namespace
+{
+
+// The document's allocator: a pool of chunks from a tracking_allocator, which also counts what's allocated from the pool.
+// rapidjson calls the allocator through its type, so these hide the pool's own Malloc() and Realloc() rather than overriding them.
+class json_allocator : public rapidjson::MemoryPoolAllocator<tracking_allocator>
+{
+public:
+	/// As for the pool: without a chunk_allocator, the pool makes its own. rapidjson needs to be able to make one of these without arguments.
+	explicit json_allocator(size_t chunk_size = 64 * 1024, tracking_allocator* chunk_allocator = nullptr)
+		: rapidjson::MemoryPoolAllocator<tracking_allocator>(chunk_size, chunk_allocator)
+		, m_count(0)
+		, m_bytes(0)
+	{
+	}
+
+	void* Malloc(size_t size)
+	{
+		++m_count;
+		m_bytes += size;
+		return rapidjson::MemoryPoolAllocator<tracking_allocator>::Malloc(size);
+	}
+
+	void* Realloc(void* original, size_t original_size, size_t size)
+	{
+		++m_count;
+		m_bytes += size;
+		return rapidjson::MemoryPoolAllocator<tracking_allocator>::Realloc(original, original_size, size);
+	}
+
+	/// Allocations made from the pool, and the bytes they asked for.
+	uint64_t get_count() const
+	{
+		return m_count;
+	}
+
+	uint64_t get_bytes() const
+	{
+		return m_bytes;
+	}
+
+private:
+	// Non-copyable.
+	json_allocator(const json_allocator&);
+	json_allocator& operator=(const json_allocator&);
+
+	uint64_t m_count;
+	uint64_t m_bytes;
+};
+
+typedef rapidjson::GenericValue<rapidjson::UTF8<>, json_allocator> json_value;
+typedef rapidjson::GenericDocument<rapidjson::UTF8<>, json_allocator> json_document;
+
+// Strips whitespace, including the carriage returns of Windows line endings, from both ends.
+std::string trim(const std::string& text)
+{
+	static const char whitespace[] = " \t\r\n";
+	const size_t begin = text.find_first_not_of(whitespace);
+
+	if(begin == std::string::npos)
+	{
+		return std::string();
+	}
+
+	return text.substr(begin, text.find_last_not_of(whitespace) - begin + 1);
+}
+
+// Parses a decimal integer which fits in 64 bits, with an optional minus sign.
+bool parse_integer(const field_value& value, int64_t& integer)
+{
+	const char* begin = value.data;
+	const char* const end = value.data + value.length;
+	const bool negative = begin != end && *begin == '-';
+
+	if(negative)
+	{
+		++begin;
+	}
+
+	// Accumulate negatively, as the most negative value has no positive counterpart.
+	static const int64_t min_value = INT64_MIN;
+	int64_t result = 0;
+
+	if(begin == end)
+	{
+		return false;
+	}
+
+	for(const char* c = begin; c != end; ++c)
+	{
+		if(*c < '0' || *c > '9')
+		{
+			return false;
+		}
+
+		const int digit = *c - '0';
+
+		if(result < (min_value + digit) / 10)
+		{
+			return false;
+		}
+
+		result = result * 10 - digit;
+	}
+
+	if(!negative && result == min_value)
+	{
+		return false;
+	}
+
+	integer = negative ? result : -result;
+	return true;
+}
+
+// Parses a finite decimal number, e.g. "-1.5e3".
+bool parse_float(const field_value& value, double& number)
+{
+	// strtod() needs a null-terminated string, and anything longer than this isn't a sensible number.
+	char buffer[64];
+
+	if(value.length == 0 || value.length >= sizeof(buffer))
+	{
+		return false;
+	}
+
+	for(size_t i = 0; i < value.length; ++i)
+	{
+		const char c = value.data[i];
+
+		// Rules out hexadecimal, infinity, NaN and surrounding whitespace, which strtod() would otherwise accept.
+		if(!((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E'))
+		{
+			return false;
+		}
+
+		buffer[i] = c;
+	}
+
+	buffer[value.length] = '\0';
+
+	char* end = nullptr;
+	const double result = strtod(buffer, &end);
+
+	if(end != buffer + value.length || !(result >= -DBL_MAX && result <= DBL_MAX))
+	{
+		return false;
+	}
+
+	number = result;
+	return true;
+}
+
+// Whether the value is the given word, ignoring ASCII case.
+bool is_word(const field_value& value, const char* word)
+{
+	const size_t length = strlen(word);
+	return value.length == length && std::equal(value.data, value.data + length, word, [](char a, char b){ return tolower(static_cast<unsigned char>(a)) == b; });
+}
+
+bool parse_boolean(const field_value& value, bool& boolean)
+{
+	if(is_word(value, "1") || is_word(value, "true") || is_word(value, "yes"))
+	{
+		boolean = true;
+		return true;
+	}
+
+	if(is_word(value, "0") || is_word(value, "false") || is_word(value, "no"))
+	{
+		boolean = false;
+		return true;
+	}
+
+	return false;
+}
+
+// A formatted field's value, converted to the field's type if it parses as one.
+struct typed_value
+{
+	field_type type;
+	int64_t integer;
+	double number;
+	bool boolean;
+};
+
+typed_value parse_field_value(const formatted_field& field, const field_value& value)
+{
+	typed_value typed;
+	typed.type = field_string;
+	typed.integer = 0;
+	typed.number = 0.0;
+	typed.boolean = false;
+
+	const bool parsed =
+		(field.type == field_integer && parse_integer(value, typed.integer)) ||
+		(field.type == field_float && parse_float(value, typed.number)) ||
+		(field.type == field_boolean && parse_boolean(value, typed.boolean));
+
+	if(parsed)
+	{
+		typed.type = field.type;
+	}
+
+	return typed;
+}
+
+// Sets json_value to the string, referring to the table's copy rather than copying it into the document where possible.
+void set_interned_value(json_value& json_value, const char* key, const char* string, size_t length, string_intern_table& strings, json_allocator& allocator)
+{
+	const char* const interned = strings.intern_value(key, string, length);
+
+	if(interned)
+	{
+		json_value.SetString(interned, static_cast<rapidjson::SizeType>(length));
+	}
+	else
+	{
+		json_value.SetString(string, static_cast<rapidjson::SizeType>(length), allocator);
+	}
+}
+
+// string_key must exist until after the JSON object is destroyed, as a copy will not be taken.
+void add_field_value_to_json_object_if_not_empty(const char* string_key, const formatted_field& field, const field_value& string_value, json_value& json_object, string_intern_table& strings, json_allocator& allocator)
+{
+	if(string_value.length == 0)
+	{
+		return;
+	}
+
+	const typed_value typed = parse_field_value(field, string_value);
+	json_value json_value;
+
+	switch(typed.type)
+	{
+	case field_integer:
+		json_value.SetInt64(typed.integer);
+		break;
+
+	case field_float:
+		json_value.SetDouble(typed.number);
+		break;
+
+	case field_boolean:
+		json_value.SetBool(typed.boolean);
+		break;
+
+	default:
+		set_interned_value(json_value, string_key, string_value.data, string_value.length, strings, allocator);
+		break;
+	}
+
+	json_object.AddMember(string_key, json_value, allocator);
+}
+
+// Writes just the value of a field, converted to its type.
+template<typename Writer>
+void write_field_value(const formatted_field& field, const field_value& string_value, Writer& writer)
+{
+	const typed_value typed = parse_field_value(field, string_value);
+
+	switch(typed.type)
+	{
+	case field_integer:
+		writer.Int64(typed.integer);
+		break;
+
+	case field_float:
+		writer.Double(typed.number);
+		break;
+
+	case field_boolean:
+		writer.Bool(typed.boolean);
+		break;
+
+	default:
+		writer.String(string_value.data, static_cast<rapidjson::SizeType>(string_value.length));
+		break;
+	}
+}
+
+// Replaces the values of a dictionary's properties with their indices in it, as tracks are serialized into buffer.
+// Where each index was written is remembered, so that it can be corrected if the dictionary is reordered afterwards.
+struct dictionary_encoding
+{
+	dictionary_encoding(string_dictionary& dictionary, const rapidjson::StringBuffer& buffer)
+		: dictionary(dictionary)
+		, buffer(buffer)
+		, indices()
+	{
+	}
+
+	string_dictionary& dictionary;
+	const rapidjson::StringBuffer& buffer;
+	std::vector<std::pair<size_t, size_t>> indices;	///< The end of each index in buffer, and the index written there.
+
+private:
+	// Non-copyable.
+	dictionary_encoding(const dictionary_encoding&);
+	dictionary_encoding& operator=(const dictionary_encoding&);
+};
+
+// The bytes encoding holds: the tracks serialized so far, the dictionary's values, and where the tracks refer to them.
+uint64_t get_dictionary_encoding_size(const dictionary_encoding& encoding)
+{
+	return encoding.buffer.GetSize() + encoding.dictionary.get_value_size() + encoding.indices.size() * sizeof(encoding.indices[0]);
+}
+
+// Writes a string value, or its index in the dictionary if it's the value of one of the dictionary's properties.
+template<typename Writer>
+void write_string_value(Writer& writer, const char* value, size_t length, bool is_encoded, dictionary_encoding* encoding)
+{
+	if(!is_encoded)
+	{
+		writer.String(value, static_cast<rapidjson::SizeType>(length));
+		return;
+	}
+
+	const size_t index = encoding->dictionary.add(value, length);
+	writer.Uint64(index);
+	encoding->indices.push_back(std::make_pair(encoding->buffer.GetSize(), index));
+}
+
+// Streaming counterpart of add_field_value_to_json_object_if_not_empty(); writes the key and value straight to the writer.
+// Values which are strings are written as their index in the dictionary instead if is_encoded is set.
+template<typename Writer>
+void write_field_value_if_not_empty(const char* string_key, const formatted_field& field, const field_value& string_value, Writer& writer, bool is_encoded, dictionary_encoding* encoding)
+{
+	if(string_value.length == 0)
+	{
+		return;
+	}
+
+	writer.String(string_key);
+
+	if(is_encoded && parse_field_value(field, string_value).type == field_string)
+	{
+		write_string_value(writer, string_value.data, string_value.length, true, encoding);
+	}
+	else
+	{
+		write_field_value(field, string_value, writer);
+	}
+}
+
+// The end of the run of fields saved in the same object as fields[begin].
+size_t end_of_field_object(const std::vector<formatted_field>& fields, size_t begin)
+{
+	size_t end = begin + 1;
+
+	while(end < fields.size() && fields[end].object == fields[begin].object)
+	{
+		++end;
+	}
+
+	return end;
+}
+
+bool is_any_value_present(const std::vector<field_value>& values, size_t begin, size_t end)
+{
+	for(size_t i = begin; i < end; ++i)
+	{
+		if(values[i].length > 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Formats every formatted field for the current track into values, which is reused between tracks to save allocations.
+// Returns true if any of them produced a value.
+bool format_fields(const track_reader& track, std::vector<field_value>& values)
+{
+	track.format_fields(values);
+
+	for(size_t i = 0; i < values.size(); ++i)
+	{
+		if(values[i].length > 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Replaygain values are floats; widened to double as they are, they'd be written with digits they were never precise to.
+double replaygain_json_value(float value)
+{
+	return rapidjson::internal::ShortestDouble(value);
+}
+
+// Builds a single track object in memory, for adding to a document.
+// Keys and repeated values refer to their copies in strings, which must outlive the document.
+// If paths is given, the track's path is written as [the index of its directory in paths, its file name].
+void build_track_json_value(json_value& trackValue, const track_reader& track, const std::vector<formatted_field>& fields, std::vector<field_value>& field_values, const path_table* paths, string_intern_table& strings, json_allocator& allocator)
+{
+	trackValue.SetObject();
+
+	// Track properties.
+
+	// No need to copy string (by passing rapidjson allocator)
+	// as track_reader guarantees the path is valid until the source is destroyed,
+	// which will be after we've saved the file.
+	// In general though, most strings below will need to be copied as the API doesn't guarantee they'll stick around;
+	// keys and values which repeat from track to track are copied once into the intern table, and the rest into the document.
+	if(paths)
+	{
+		const char* file_name = nullptr;
+		const size_t directory = paths->find(track.get_path(), file_name);
+
+		json_value pathValue;
+		pathValue.SetArray();
+		pathValue.Reserve(2, allocator);
+
+		json_value directoryValue(static_cast<uint64_t>(directory));
+		pathValue.PushBack(directoryValue, allocator);
+
+		json_value fileNameValue(file_name);
+		pathValue.PushBack(fileNameValue, allocator);
+
+		trackValue.AddMember("path", pathValue, allocator);
+	}
+	else
+	{
+		json_value pathValue(track.get_path());
+		trackValue.AddMember("path", pathValue, allocator);
+	}
+
+	json_value subsongIndexValue(track.get_subsong_index());
+	trackValue.AddMember("subsong_index", subsongIndexValue, allocator);
+
+	// Let's not bother saving out timestamp and file size;
+	// these are properties of the files themselves which require no special parsing or decoding.
+
+	// This is the only thing the file_info struct has that isn't calculated from other fields.
+	// e.g. "number of samples" which the foobar interface shows in a track's properties,
+	// is actually calculated from length and bitrate.
+	json_value lengthValue(track.get_length());
+	trackValue.AddMember("length", lengthValue, allocator);
+
+	// Replaygain data.
+	const replaygain replay_gain_info = track.get_replaygain();
+
+	if(replay_gain_info.is_any_present())
+	{
+		json_value replayGainContainerValue;
+		replayGainContainerValue.SetObject();
+
+		if(replay_gain_info.is_album_gain_present)
+		{
+			json_value replayGainValue(replaygain_json_value(replay_gain_info.album_gain));
+			replayGainContainerValue.AddMember("album_gain", replayGainValue, allocator);
+		}
+
+		if(replay_gain_info.is_album_peak_present)
+		{
+			json_value replayGainValue(replaygain_json_value(replay_gain_info.album_peak));
+			replayGainContainerValue.AddMember("album_peak", replayGainValue, allocator);
+		}
+
+		if(replay_gain_info.is_track_gain_present)
+		{
+			json_value replayGainValue(replaygain_json_value(replay_gain_info.track_gain));
+			replayGainContainerValue.AddMember("track_gain", replayGainValue, allocator);
+		}
+
+		if(replay_gain_info.is_track_peak_present)
+		{
+			json_value replayGainValue(replaygain_json_value(replay_gain_info.track_peak));
+			replayGainContainerValue.AddMember("track_peak", replayGainValue, allocator);
+		}
+
+		trackValue.AddMember("replaygain", replayGainContainerValue, allocator);
+	}
+
+	// 'info', which is technical details about the file.
+	if(track.info_get_count() > 0)
+	{
+		json_value infoValue;
+		infoValue.SetObject();
+
+		for(size_t i = 0; i < track.info_get_count(); ++i)
+		{
+			const char* const name = strings.intern(track.info_enum_name(i));
+			const char* const value = track.info_enum_value(i);
+
+			json_value individualInfoValue;
+			set_interned_value(individualInfoValue, name, value, strlen(value), strings, allocator);
+			infoValue.AddMember(name, individualInfoValue, allocator);
+		}
+
+		trackValue.AddMember("info", infoValue, allocator);
+	}
+
+	// 'meta', which are metadata about the track, normally called its 'tags'.
+	// Note that unlike 'info', all meta fields can be multi-valued, so we save them out as arrays.
+	// todo: add option to save single-valued fields as values directly rather than one-element arrays.
+	if(track.meta_get_count() > 0)
+	{
+		json_value metaValue;
+		metaValue.SetObject();
+
+		for(size_t i = 0; i < track.meta_get_count(); ++i)
+		{
+			const char* const name = strings.intern(track.meta_enum_name(i));
+
+			json_value individualMetaValue;
+			individualMetaValue.SetArray();
+			individualMetaValue.Reserve(static_cast<rapidjson::SizeType>(track.meta_enum_value_count(i)), allocator);
+
+			for(size_t j = 0; j < track.meta_enum_value_count(i); ++j)
+			{
+				const char* const value = track.meta_enum_value(i, j);
+
+				json_value individualValue;
+				set_interned_value(individualValue, name, value, strlen(value), strings, allocator);
+				individualMetaValue.PushBack(individualValue, allocator);
+			}
+
+			metaValue.AddMember(name, individualMetaValue, allocator);
+		}
+
+		trackValue.AddMember("meta", metaValue, allocator);
+	}
+
+	// Playback statistics, and any other formatted fields, in the objects they're saved in.
+	// I don't know if there's an API for the playback statistics component, or if that's even possible,
+	// so we do the expensive and inextensible thing and query for its fields using titleformatting.
+	// Scripts have already been compiled by the source; we just need to format the track with them and add their values
+	// if present.
+	if(format_fields(track, field_values))
+	{
+		for(size_t begin = 0, end = 0; begin < fields.size(); begin = end)
+		{
+			end = end_of_field_object(fields, begin);
+
+			if(!is_any_value_present(field_values, begin, end))
+			{
+				continue;
+			}
+
+			json_value object_value;
+			object_value.SetObject();
+
+			for(size_t i = begin; i < end; ++i)
+			{
+				add_field_value_to_json_object_if_not_empty(fields[i].key.c_str(), fields[i], field_values[i], object_value, strings, allocator);
+			}
+
+			trackValue.AddMember(fields[begin].object.c_str(), object_value, allocator);
+		}
+	}
+}
+
+// Writes a single track object straight to the writer, without building any intermediate DOM.
+// Must produce exactly the same output as build_track_json_value() followed by Accept(), unless encoding is given,
+// in which case the values of the dictionary's properties are written as indices into it.
+template<typename Writer>
+void write_track_json(Writer& writer, const track_reader& track, const std::vector<formatted_field>& fields, std::vector<field_value>& field_values, const path_table* paths, dictionary_encoding* encoding = nullptr)
+{
+	writer.StartObject();
+
+	// Track properties.
+	writer.String("path");
+
+	if(paths)
+	{
+		const char* file_name = nullptr;
+		const size_t directory = paths->find(track.get_path(), file_name);
+
+		writer.StartArray();
+		writer.Uint64(directory);
+		writer.String(file_name);
+		writer.EndArray();
+	}
+	else
+	{
+		writer.String(track.get_path());
+	}
+
+	writer.String("subsong_index");
+	writer.Uint(track.get_subsong_index());
+
+	writer.String("length");
+	writer.Double(track.get_length());
+
+	// Replaygain data.
+	const replaygain replay_gain_info = track.get_replaygain();
+
+	if(replay_gain_info.is_any_present())
+	{
+		writer.String("replaygain");
+		writer.StartObject();
+
+		if(replay_gain_info.is_album_gain_present)
+		{
+			writer.String("album_gain");
+			writer.Double(replaygain_json_value(replay_gain_info.album_gain));
+		}
+
+		if(replay_gain_info.is_album_peak_present)
+		{
+			writer.String("album_peak");
+			writer.Double(replaygain_json_value(replay_gain_info.album_peak));
+		}
+
+		if(replay_gain_info.is_track_gain_present)
+		{
+			writer.String("track_gain");
+			writer.Double(replaygain_json_value(replay_gain_info.track_gain));
+		}
+
+		if(replay_gain_info.is_track_peak_present)
+		{
+			writer.String("track_peak");
+			writer.Double(replaygain_json_value(replay_gain_info.track_peak));
+		}
+
+		writer.EndObject();
+	}
+
+	// 'info', which is technical details about the file.
+	if(track.info_get_count() > 0)
+	{
+		writer.String("info");
+		writer.StartObject();
+
+		for(size_t i = 0; i < track.info_get_count(); ++i)
+		{
+			const char* const name = track.info_enum_name(i);
+			const char* const value = track.info_enum_value(i);
+
+			writer.String(name);
+			write_string_value(writer, value, strlen(value), encoding && encoding->dictionary.is_encoded("info", name), encoding);
+		}
+
+		writer.EndObject();
+	}
+
+	// 'meta', which are metadata about the track, normally called its 'tags'.
+	if(track.meta_get_count() > 0)
+	{
+		writer.String("meta");
+		writer.StartObject();
+
+		for(size_t i = 0; i < track.meta_get_count(); ++i)
+		{
+			const char* const name = track.meta_enum_name(i);
+			const bool is_encoded = encoding && encoding->dictionary.is_encoded("meta", name);
+
+			writer.String(name);
+			writer.StartArray();
+
+			for(size_t j = 0; j < track.meta_enum_value_count(i); ++j)
+			{
+				const char* const value = track.meta_enum_value(i, j);
+				write_string_value(writer, value, strlen(value), is_encoded, encoding);
+			}
+
+			writer.EndArray();
+		}
+
+		writer.EndObject();
+	}
+
+	// Playback statistics, and any other formatted fields, in the objects they're saved in.
+	if(format_fields(track, field_values))
+	{
+		for(size_t begin = 0, end = 0; begin < fields.size(); begin = end)
+		{
+			end = end_of_field_object(fields, begin);
+
+			if(!is_any_value_present(field_values, begin, end))
+			{
+				continue;
+			}
+
+			writer.String(fields[begin].object.c_str());
+			writer.StartObject();
+
+			for(size_t i = begin; i < end; ++i)
+			{
+				const bool is_encoded = encoding && encoding->dictionary.is_encoded(fields[i].object.c_str(), fields[i].key.c_str());
+				write_field_value_if_not_empty(fields[i].key.c_str(), fields[i], field_values[i], writer, is_encoded, encoding);
+			}
+
+			writer.EndObject();
+		}
+	}
+
+	writer.EndObject();
+}
+
+// Makes the given track current, or throws if its info can't be read.
+void read_track_or_exception(track_reader& reader, size_t track_index)
+{
+	if(!reader.read(track_index))
+	{
+		throw export_error(std::string("Failed to get info on track: ") + reader.get_path());
+	}
+}
+
+// Writes each track straight to the writer as it's visited, so memory use doesn't depend on library size.
+template<typename Writer>
+void stream_library(Writer& writer, track_source& source, const path_table* paths, export_metrics* metrics, export_status& status)
+{
+	status.log("Streaming JSON to output file.");
+
+	const std::vector<formatted_field>& fields = source.get_formatted_fields();
+	std::vector<field_value> field_values;
+	const std::unique_ptr<track_reader> reader = source.create_reader();
+	const size_t track_count = source.get_track_count();
+	const stage_timer timer(metrics, stage_serialization, track_count);
+
+	// JSON will be formatted as such:
+	// [{"path":"path/to/1", "title":"abc"},{"path":"path/to/2", "title":"def"}]
+	writer.StartArray();
+
+	for(size_t track_index = 0; track_index < track_count; ++track_index)
+	{
+		// Check if the user has chosen to abort; will throw an exception if this is the case.
+		status.check_abort();
+
+		// Update the progress bar.
+		status.set_progress(track_index, track_count);
+
+		read_track_or_exception(*reader, track_index);
+
+		write_track_json(writer, *reader, fields, field_values, paths);
+	}
+
+	writer.EndArray();
+}
+
+// Maps the writer used for the file to the same kind of writer over an in-memory buffer,
+// so that tracks serialized by worker threads come out exactly as the file's writer would have written them.
+// is_json says whether tracks written as array elements are preceded by separators, which must be stripped off.
+template<typename Writer>
+struct fragment_writer;
+
+template<typename Stream, typename SourceEncoding, typename TargetEncoding, typename Allocator>
+struct fragment_writer<rapidjson::Writer<Stream, SourceEncoding, TargetEncoding, Allocator> >
+{
+	typedef rapidjson::Writer<rapidjson::StringBuffer, SourceEncoding, TargetEncoding, Allocator> type;
+	static const bool is_json = true;
+};
+
+template<typename Stream, typename SourceEncoding, typename TargetEncoding, typename Allocator>
+struct fragment_writer<rapidjson::PrettyWriter<Stream, SourceEncoding, TargetEncoding, Allocator> >
 {
+	typedef rapidjson::PrettyWriter<rapidjson::StringBuffer, SourceEncoding, TargetEncoding, Allocator> type;
+	static const bool is_json = true;
+};
+
+template<typename Stream>
+struct fragment_writer<line_writer<Stream> >
+{
+	typedef rapidjson::Writer<rapidjson::StringBuffer> type;
+	static const bool is_json = true;
+};
+
+// Binary tracks are written as a sequence, so that each is written to the buffer as soon as it's complete.
+template<typename Stream, bool is_sequence>
+struct fragment_writer<msgpack_writer<Stream, is_sequence> >
+{
+	typedef msgpack_writer<rapidjson::StringBuffer, true> type;
+	static const bool is_json = false;
+};
+
+template<typename Stream, bool is_sequence>
+struct fragment_writer<cbor_writer<Stream, is_sequence> >
+{
+	typedef cbor_writer<rapidjson::StringBuffer, true> type;
+	static const bool is_json = false;
+};
+
+// A contiguous range of tracks serialized by one worker thread.
+struct serialized_range
+{
+	serialized_range()
+		: first_track(0)
+		, track_count(0)
+		, buffer()
+		, fragments()
+		, cached_track_count(0)
+		, cached_fragment()
+		, error()
+	{
+	}
+
+	size_t first_track;
+	size_t track_count;
+
+	rapidjson::StringBuffer buffer;
+	std::vector<std::pair<size_t, size_t>> fragments;	///< Begin and end offsets of each track's object in buffer.
+	size_t cached_track_count;							///< How many of the tracks were copied from the cache.
+	std::string cached_fragment;						///< Somewhere to copy cached tracks to, reused between tracks.
+	std::exception_ptr error;							///< Set if the worker failed, to be rethrown on the exporting thread.
+
+private:
+	// Non-copyable.
+	serialized_range(const serialized_range&);
+	serialized_range& operator=(const serialized_range&);
+};
+
+// Serializes each track in the range into the range's buffer, or copies it from the cache if there is one and it has the track.
+// The cache mustn't grow past memory_ceiling. Exceptions are caught and stored in the range, as they can't propagate out of a worker thread.
+template<typename Writer>
+void serialize_range(serialized_range& range, const track_source& source, track_reader& reader, const std::vector<formatted_field>& fields, std::vector<field_value>& field_values, const path_table* paths, fragment_cache* cache, uint64_t cache_token, uint64_t memory_ceiling, export_metrics* metrics, const std::atomic<bool>& cancelled)
+{
+	try
+	{
+		const stage_timer timer(metrics, stage_serialization, range.track_count);
+
+		range.buffer.Clear();
+		range.fragments.clear();
+		range.cached_track_count = 0;
+
+		typename fragment_writer<Writer>::type writer(range.buffer);
+
+		// Write the tracks as elements of an array, as in the file, so they get the same separators and indentation.
+		// The separators are stripped off; the file's writer adds its own when splicing the tracks in.
+		// With a table of directories, JSON's array is in the top-level object, as it is in the file, so it's indented the same.
+		// Binary tracks aren't indented, and must be at the top level to be written as a sequence.
+		if(paths && fragment_writer<Writer>::is_json)
+		{
+			writer.StartObject();
+			writer.String("tracks");
+		}
+
+		writer.StartArray();
+
+		for(size_t i = 0; i < range.track_count && !cancelled; ++i)
+		{
+			const size_t track_index = range.first_track + i;
+			const size_t separator_begin = range.buffer.GetSize();
+
+			// Tracks in the cache haven't changed since they were last serialized, so needn't even be read.
+			const char* const path = cache ? source.get_track_path(track_index) : nullptr;
+			const unsigned subsong_index = cache ? source.get_track_subsong_index(track_index) : 0;
+			const bool is_cached = cache && cache->find(path, subsong_index, range.cached_fragment);
+
+			if(is_cached)
+			{
+				writer.RawValue(range.cached_fragment.data(), range.cached_fragment.size(), rapidjson::kObjectType);
+				++range.cached_track_count;
+			}
+			else
+			{
+				read_track_or_exception(reader, track_index);
+				write_track_json(writer, reader, fields, field_values, paths);
+			}
+
+			const size_t end = range.buffer.GetSize();
+			const char* const json = range.buffer.GetString();
+			const char* const object_begin = fragment_writer<Writer>::is_json
+				? static_cast<const char*>(memchr(json + separator_begin, '{', end - separator_begin))
+				: json + separator_begin;
+
+			range.fragments.push_back(std::make_pair(static_cast<size_t>(object_begin - json), end));
+
+			if(cache && !is_cached)
+			{
+				const uint64_t cache_size = cache->store(path, subsong_index, cache_token, object_begin, json + end - object_begin);
+				check_memory_ceiling(cache_size, memory_ceiling, "The cache holds a copy of every track's JSON; exporting without it needs far less.");
+			}
+		}
+	}
+	catch(...)
+	{
+		range.error = std::current_exception();
+	}
+}
+
+// The serialized tracks of a library, one at a time, in order.
+class fragment_sequence
+{
+public:
+	virtual ~fragment_sequence() {}
+
+	// Gets the next track's fragment, which stays valid until the next call; returns false once every track has been handed out.
+	virtual bool next(const char*& fragment, size_t& size) = 0;
+
+	// How many of the tracks handed out so far were copied from the cache.
+	virtual size_t get_cached_track_count() const = 0;
+};
+
+// Splits the library into contiguous ranges, which worker threads serialize into their own buffers;
+// the tracks are then handed out in order, so they come out identical to stream_library()'s.
+// Tracks are serialized in rounds, with the workers serializing the next round while the last is handed out.
+template<typename Writer>
+class parallel_fragment_sequence : public fragment_sequence
+{
+public:
+	/// If cache_scope is set, it was begun before the tracks were read from the library, and its token is used rather than this export's own.
+	/// Throws export_error from next() if the cache grows past memory_ceiling.
+	parallel_fragment_sequence(track_source& source, size_t thread_count, const path_table* paths, fragment_cache* cache, const cache_export_scope* cache_scope, uint64_t memory_ceiling, export_metrics* metrics)
+		: m_source(source)
+		, m_fields(source.get_formatted_fields())
+		, m_track_count(source.get_track_count())
+		, m_paths(paths)
+		, m_cache(cache)
+		, m_cache_scope(cache)
+		, m_cache_token(cache_scope ? cache_scope->get_token() : m_cache_scope.get_token())
+		, m_memory_ceiling(memory_ceiling)
+		, m_metrics(metrics)
+		, m_readers()
+		, m_field_values(thread_count)
+		, m_current(1)
+		, m_is_serializing(false)
+		, m_next_track_to_serialize(0)
+		, m_range(0)
+		, m_fragment(0)
+		, m_json(nullptr)
+		, m_cached_track_count(0)
+		, m_workers()
+	{
+		for(size_t i = 0; i < thread_count; ++i)
+		{
+			m_readers.push_back(m_source.create_reader());
+			m_rounds[0].push_back(std::unique_ptr<serialized_range>(new serialized_range()));
+			m_rounds[1].push_back(std::unique_ptr<serialized_range>(new serialized_range()));
+		}
+
+		// Nothing's been handed out from the current round, which is empty, so the first call to next() waits for this one.
+		start_round(m_rounds[0]);
+	}
+
+	virtual bool next(const char*& fragment, size_t& size) override
+	{
+		while(true)
+		{
+			const std::vector<std::unique_ptr<serialized_range>>& round = m_rounds[m_current];
+
+			for(; m_range < round.size(); ++m_range, m_fragment = 0)
+			{
+				const serialized_range& range = *round[m_range];
+
+				if(m_fragment < range.fragments.size())
+				{
+					if(m_fragment == 0)
+					{
+						m_json = range.buffer.GetString();
+					}
+
+					const std::pair<size_t, size_t>& range_fragment = range.fragments[m_fragment++];
+					fragment = m_json + range_fragment.first;
+					size = range_fragment.second - range_fragment.first;
+					return true;
+				}
+			}
+
+			if(!m_is_serializing)
+			{
+				return false;
+			}
+
+			// Everything in the current round has been handed out, so its buffers can be reused for the round after the next.
+			m_workers.join();
+			m_is_serializing = false;
+			m_current = 1 - m_current;
+			m_range = 0;
+			m_fragment = 0;
+
+			const std::vector<std::unique_ptr<serialized_range>>& next_round = m_rounds[m_current];
+
+			for(size_t i = 0; i < next_round.size(); ++i)
+			{
+				if(next_round[i]->error)
+				{
+					std::rethrow_exception(next_round[i]->error);
+				}
+
+				m_cached_track_count += next_round[i]->cached_track_count;
+			}
+
+			if(m_next_track_to_serialize < m_track_count)
+			{
+				start_round(m_rounds[1 - m_current]);
+			}
+		}
+	}
+
+	virtual size_t get_cached_track_count() const override
+	{
+		return m_cached_track_count;
+	}
+
+private:
+	// Non-copyable.
+	parallel_fragment_sequence(const parallel_fragment_sequence&);
+	parallel_fragment_sequence& operator=(const parallel_fragment_sequence&);
+
+	// Divides up the next round of tracks between the workers and starts them off.
+	void start_round(std::vector<std::unique_ptr<serialized_range>>& round)
+	{
+		// Enough tracks per worker per round that the threads aren't mostly waiting on each other,
+		// but few enough that the buffers stay small.
+		static const size_t max_tracks_per_range = 1024;
+
+		const size_t thread_count = round.size();
+		const size_t remaining = m_track_count - m_next_track_to_serialize;
+		const size_t tracks_per_range = std::min(max_tracks_per_range, (remaining + thread_count - 1) / thread_count);
+
+		for(size_t i = 0; i < thread_count; ++i)
+		{
+			serialized_range& range = *round[i];
+			range.first_track = m_next_track_to_serialize;
+			range.track_count = std::min(tracks_per_range, m_track_count - m_next_track_to_serialize);
+			range.error = nullptr;
+			m_next_track_to_serialize += range.track_count;
+
+			track_reader& reader = *m_readers[i];
+			std::vector<field_value>& values = m_field_values[i];
+
+			m_workers.start([this, &range, &reader, &values]()
+			{
+				serialize_range<Writer>(range, m_source, reader, m_fields, values, m_paths, m_cache, m_cache_token, m_memory_ceiling, m_metrics, m_workers.cancelled());
+			});
+		}
+
+		m_is_serializing = true;
+	}
+
+	track_source& m_source;
+	const std::vector<formatted_field>& m_fields;
+	const size_t m_track_count;
+	const path_table* const m_paths;
+	fragment_cache* const m_cache;
+	const cache_export_scope m_cache_scope;
+	const uint64_t m_cache_token;
+	const uint64_t m_memory_ceiling;
+	export_metrics* const m_metrics;
+
+	std::vector<std::unique_ptr<track_reader>> m_readers;			///< One for each worker.
+	std::vector<std::vector<field_value>> m_field_values;			///< One for each worker.
+	std::vector<std::unique_ptr<serialized_range>> m_rounds[2];		///< One being handed out while the other's serialized.
+	size_t m_current;												///< The round being handed out.
+	bool m_is_serializing;											///< Whether the other round is being serialized.
+	size_t m_next_track_to_serialize;
+
+	size_t m_range;				///< Position of the next fragment in the current round.
+	size_t m_fragment;
+	const char* m_json;			///< The buffer of the range being handed out.
+	size_t m_cached_track_count;
+
+	// Last, so the workers are stopped before anything they use is destroyed.
+	worker_threads m_workers;
+};
+
+void log_cache_use(const fragment_cache& cache, size_t cached_track_count, size_t track_count, export_status& status)
+{
+	const std::string message = "Copied " + to_string(cached_track_count) + " of " + to_string(track_count) + " tracks from the cache; "
+		"it now holds " + to_string(cache.get_track_count()) + " tracks in " + to_string(cache.get_size() / (1024 * 1024)) + " MB.";
+	status.log(message.c_str());
 }
 
+// Writes the library from a parallel_fragment_sequence, so the output is identical to stream_library()'s.
+template<typename Writer>
+void stream_library_in_parallel(Writer& writer, track_source& source, size_t thread_count, const path_table* paths, fragment_cache* cache, const cache_export_scope* cache_scope, uint64_t memory_ceiling, export_metrics* metrics, export_status& status)
+{
+	status.log(thread_count > 1 ? "Streaming JSON to output file using multiple threads." : "Streaming JSON to output file.");
+
+	const size_t track_count = source.get_track_count();
+	parallel_fragment_sequence<Writer> fragments(source, thread_count, paths, cache, cache_scope, memory_ceiling, metrics);
+
+	// JSON will be formatted as such:
+	// [{"path":"path/to/1", "title":"abc"},{"path":"path/to/2", "title":"def"}]
+	writer.StartArray();
+
+	const char* fragment = nullptr;
+	size_t size = 0;
+
+	for(size_t track_index = 0; fragments.next(fragment, size); ++track_index)
+	{
+		// Check if the user has chosen to abort; will throw an exception if this is the case.
+		status.check_abort();
+
+		// Update the progress bar.
+		status.set_progress(track_index, track_count);
+
+		writer.RawValue(fragment, size, rapidjson::kObjectType);
+	}
+
+	writer.EndArray();
+
+	if(cache)
+	{
+		log_cache_use(*cache, fragments.get_cached_track_count(), track_count, status);
+	}
 }
+
+// Builds the whole library as a document in memory, then writes it out in one go.
+template<typename Writer>
+void build_and_write_document(Writer& writer, track_source& source, const path_table* paths, const export_options& options, export_status& status)
+{
+	status.log("Creating in-memory JSON.");
+
+	const std::vector<formatted_field>& fields = source.get_formatted_fields();
+	std::vector<field_value> field_values;
+	const std::unique_ptr<track_reader> reader = source.create_reader();
+	const size_t track_count = source.get_track_count();
+
+	// JSON will be formatted as such:
+	// [{"path":"path/to/1", "title":"abc"},{"path":"path/to/2", "title":"def"}]
+	// Declared before the document, as the document refers to its strings.
+	string_intern_table strings;
+
+	// The pool's chunks are as big as rapidjson makes them by default. Running out of memory, or into the ceiling,
+	// throws from inside rapidjson; nothing built so far is used after that, so it's only left to be freed.
+	static const size_t chunk_size = 64 * 1024;
+	tracking_allocator chunk_allocator(options.memory_ceiling);
+	json_allocator allocator(chunk_size, &chunk_allocator);
+
+	json_document document(&allocator);
+	document.SetArray();
+
+	{
+		const stage_timer timer(options.metrics, stage_build, track_count);
+
+		document.Reserve(static_cast<rapidjson::SizeType>(track_count), allocator);
+
+		for(size_t track_index = 0; track_index < track_count; ++track_index)
+		{
+			// Check if the user has chosen to abort; will throw an exception if this is the case.
+			status.check_abort();
+
+			// Update the progress bar.
+			status.set_progress(track_index, track_count);
+
+			read_track_or_exception(*reader, track_index);
+
+			json_value trackValue;
+			build_track_json_value(trackValue, *reader, fields, field_values, paths, strings, allocator);
+
+			// Finally, add the whole track object to the document.
+			document.PushBack(trackValue, allocator);
+		}
+	}
+
+	if(options.metrics)
+	{
+		options.metrics->add_allocations(allocator.get_count(), allocator.get_bytes(), chunk_allocator.get_allocation_count(), chunk_allocator.get_peak_size());
+	}
+
+	const std::string message = "The document takes " + to_string(allocator.Size() / 1048576.0, 3) + " MB in "
+		+ to_string(chunk_allocator.get_block_count()) + " chunks taking " + to_string(chunk_allocator.get_size() / 1048576.0, 3) + " MB, referring to "
+		+ to_string(strings.get_distinct_count()) + " interned keys and values taking " + to_string(strings.get_stored_size() / 1048576.0, 3) + " MB; "
+		"interning saved " + to_string(strings.get_saved_size() / 1048576.0, 3) + " MB of copies, reusing strings " + to_string(strings.get_reuse_count()) + " times.";
+	status.log(message.c_str());
+
+	status.log("JSON built up in memory; saving to output file.");
+
+	const stage_timer timer(options.metrics, stage_serialization, track_count);
+	document.Accept(writer);
+}
+
+// One property's values in the columnar layout, for the tracks which have it, serialized as they're read.
+struct column
+{
+	explicit column(const std::string& name)
+		: name(name)
+		, buffer()
+		, writer(buffer)
+		, tracks()
+		, value_ends()
+	{
+		// The values are written as elements of an array, so the writer separates them; the separators are skipped when copying them out.
+		writer.StartArray();
+	}
+
+	/// Call before writing a track's value with writer.
+	void begin_value(size_t track_index)
+	{
+		tracks.push_back(track_index);
+	}
+
+	void end_value()
+	{
+		value_ends.push_back(buffer.GetSize());
+	}
+
+	const char* get_value(size_t index, size_t& length) const
+	{
+		// Skip the '[' before the first value and the ',' before the rest.
+		const size_t begin = (index == 0 ? 0 : value_ends[index - 1]) + 1;
+		length = value_ends[index] - begin;
+		return buffer.GetString() + begin;
+	}
+
+	/// The bytes the column holds: its values, and the tracks they belong to and where they end.
+	uint64_t get_size() const
+	{
+		return name.size() + buffer.GetSize() + (tracks.size() + value_ends.size()) * sizeof(size_t);
+	}
+
+	std::string name;
+	rapidjson::StringBuffer buffer;
+	rapidjson::Writer<rapidjson::StringBuffer> writer;
+	std::vector<size_t> tracks;			///< Indices of the tracks with values, in order.
+	std::vector<size_t> value_ends;		///< The end of each value in buffer.
+
+private:
+	// Non-copyable.
+	column(const column&);
+	column& operator=(const column&);
+};
+
+// The columns of the columnar layout, in the order their properties were first seen.
+class column_set
+{
+public:
+	column_set()
+		: m_columns()
+		, m_indices()
+		, m_name()
+	{
+	}
+
+	/// The column for the property with the given prefix and name, e.g. "meta." and "ARTIST", which is created if it's new.
+	column& get(const char* prefix, const char* name)
+	{
+		// Reuses the same string for every lookup, so finding existing columns doesn't allocate.
+		m_name.assign(prefix);
+		m_name.append(name);
+
+		const std::unordered_map<std::string, size_t>::const_iterator found = m_indices.find(m_name);
+
+		if(found != m_indices.end())
+		{
+			return *m_columns[found->second];
+		}
+
+		m_indices[m_name] = m_columns.size();
+		m_columns.push_back(std::unique_ptr<column>(new column(m_name)));
+		return *m_columns.back();
+	}
+
+	size_t size() const
+	{
+		return m_columns.size();
+	}
+
+	/// The bytes the columns hold, between them.
+	uint64_t get_size() const
+	{
+		uint64_t size = 0;
+
+		for(size_t i = 0; i < m_columns.size(); ++i)
+		{
+			size += m_columns[i]->get_size();
+		}
+
+		return size;
+	}
+
+	const column& operator[](size_t index) const
+	{
+		return *m_columns[index];
+	}
+
+private:
+	// Non-copyable.
+	column_set(const column_set&);
+	column_set& operator=(const column_set&);
+
+	std::vector<std::unique_ptr<column>> m_columns;
+	std::unordered_map<std::string, size_t> m_indices;
+	std::string m_name;
+};
+
+// Adds a track's value for each of its properties to their columns.
+// field_prefixes holds the prefix of each field's column name, i.e. the name of its object and a dot.
+void add_track_to_columns(column_set& columns, size_t track_index, const track_reader& track, const std::vector<formatted_field>& fields, const std::vector<std::string>& field_prefixes, std::vector<field_value>& field_values)
+{
+	column& path = columns.get("", "path");
+	path.begin_value(track_index);
+	path.writer.String(track.get_path());
+	path.end_value();
+
+	column& subsong_index = columns.get("", "subsong_index");
+	subsong_index.begin_value(track_index);
+	subsong_index.writer.Uint(track.get_subsong_index());
+	subsong_index.end_value();
+
+	column& length = columns.get("", "length");
+	length.begin_value(track_index);
+	length.writer.Double(track.get_length());
+	length.end_value();
+
+	const replaygain replay_gain_info = track.get_replaygain();
+
+	const struct
+	{
+		const char* name;
+		bool is_present;
+		float value;
+	} replay_gain_values[] = {
+		{ "album_gain", replay_gain_info.is_album_gain_present, replay_gain_info.album_gain },
+		{ "album_peak", replay_gain_info.is_album_peak_present, replay_gain_info.album_peak },
+		{ "track_gain", replay_gain_info.is_track_gain_present, replay_gain_info.track_gain },
+		{ "track_peak", replay_gain_info.is_track_peak_present, replay_gain_info.track_peak }
+	};
+
+	for(size_t i = 0; i < sizeof(replay_gain_values) / sizeof(replay_gain_values[0]); ++i)
+	{
+		if(replay_gain_values[i].is_present)
+		{
+			column& replay_gain = columns.get("replaygain.", replay_gain_values[i].name);
+			replay_gain.begin_value(track_index);
+			replay_gain.writer.Double(replaygain_json_value(replay_gain_values[i].value));
+			replay_gain.end_value();
+		}
+	}
+
+	for(size_t i = 0; i < track.info_get_count(); ++i)
+	{
+		column& info = columns.get("info.", track.info_enum_name(i));
+		info.begin_value(track_index);
+		info.writer.String(track.info_enum_value(i));
+		info.end_value();
+	}
+
+	for(size_t i = 0; i < track.meta_get_count(); ++i)
+	{
+		column& meta = columns.get("meta.", track.meta_enum_name(i));
+		meta.begin_value(track_index);
+		meta.writer.StartArray();
+
+		for(size_t j = 0; j < track.meta_enum_value_count(i); ++j)
+		{
+			meta.writer.String(track.meta_enum_value(i, j));
+		}
+
+		meta.writer.EndArray();
+		meta.end_value();
+	}
+
+	if(format_fields(track, field_values))
+	{
+		for(size_t i = 0; i < fields.size(); ++i)
+		{
+			if(field_values[i].length == 0)
+			{
+				continue;
+			}
+
+			column& field = columns.get(field_prefixes[i].c_str(), fields[i].key.c_str());
+			field.begin_value(track_index);
+			write_field_value(fields[i], field_values[i], field.writer);
+			field.end_value();
+		}
+	}
+}
+
+// The type of a serialized value, from its first character.
+rapidjson::Type raw_value_type(const char* json)
+{
+	switch(json[0])
+	{
+	case '"':
+		return rapidjson::kStringType;
+
+	case '[':
+		return rapidjson::kArrayType;
+
+	case 't':
+		return rapidjson::kTrueType;
+
+	case 'f':
+		return rapidjson::kFalseType;
+
+	default:
+		return rapidjson::kNumberType;
+	}
+}
+
+// Whether a column's better written as the tracks with values and their values, than with nulls for the tracks without.
+bool is_sparse_column(const column& values, size_t track_count)
+{
+	return values.tracks.size() * 2 < track_count;
+}
+
+// Writes a column's values, as an array with a value for every track if most tracks have one, or sparsely if not.
+template<typename Writer>
+void write_column(Writer& writer, const column& values, size_t track_count)
+{
+	const bool is_sparse = is_sparse_column(values, track_count);
+
+	if(is_sparse)
+	{
+		writer.StartObject();
+
+		writer.String("tracks");
+		writer.StartArray();
+
+		for(size_t i = 0; i < values.tracks.size(); ++i)
+		{
+			writer.Uint64(values.tracks[i]);
+		}
+
+		writer.EndArray();
+
+		writer.String("values");
+	}
+
+	writer.StartArray();
+
+	size_t next_value = 0;
+
+	for(size_t track_index = 0; track_index < track_count && next_value < values.tracks.size(); ++track_index)
+	{
+		if(values.tracks[next_value] != track_index)
+		{
+			if(!is_sparse)
+			{
+				writer.Null();
+			}
+
+			continue;
+		}
+
+		size_t length = 0;
+		const char* const json = values.get_value(next_value++, length);
+		writer.RawValue(json, length, raw_value_type(json));
+	}
+
+	// Tracks after the last with a value.
+	for(size_t track_index = values.tracks.empty() ? 0 : values.tracks.back() + 1; !is_sparse && track_index < track_count; ++track_index)
+	{
+		writer.Null();
+	}
+
+	writer.EndArray();
+
+	if(is_sparse)
+	{
+		writer.EndObject();
+	}
+}
+
+// Gathers each property's values into its own column in one pass over the tracks, then writes the columns one after another.
+template<typename Writer>
+void write_library_columns(Writer& writer, track_source& source, const export_options& options, export_status& status)
+{
+	// Summing the columns' sizes takes a pass over them, so the memory ceiling is checked every so many tracks rather than every one.
+	static const size_t ceiling_check_interval = 64;
+
+	status.log("Gathering JSON columns in memory.");
+
+	const std::vector<formatted_field>& fields = source.get_formatted_fields();
+	std::vector<field_value> field_values;
+	const std::unique_ptr<track_reader> reader = source.create_reader();
+	const size_t track_count = source.get_track_count();
+
+	std::vector<std::string> field_prefixes;
+
+	for(size_t i = 0; i < fields.size(); ++i)
+	{
+		field_prefixes.push_back(fields[i].object + ".");
+	}
+
+	column_set columns;
+
+	{
+		const stage_timer timer(options.metrics, stage_build, track_count);
+
+		for(size_t track_index = 0; track_index < track_count; ++track_index)
+		{
+			// Check if the user has chosen to abort; will throw an exception if this is the case.
+			status.check_abort();
+
+			// Update the progress bar.
+			status.set_progress(track_index, track_count);
+
+			read_track_or_exception(*reader, track_index);
+
+			add_track_to_columns(columns, track_index, *reader, fields, field_prefixes, field_values);
+
+			if(options.memory_ceiling > 0 && track_index % ceiling_check_interval == ceiling_check_interval - 1)
+			{
+				check_memory_ceiling(columns.get_size(), options.memory_ceiling);
+			}
+		}
+	}
+
+	const uint64_t size = columns.get_size();
+	check_memory_ceiling(size, options.memory_ceiling);
+
+	size_t sparse_count = 0;
+
+	for(size_t i = 0; i < columns.size(); ++i)
+	{
+		sparse_count += is_sparse_column(columns[i], track_count) ? 1 : 0;
+	}
+
+	const std::string message = "Gathered " + to_string(columns.size()) + " columns (" + to_string(sparse_count) + " sparse) taking "
+		+ to_string(size / 1048576.0, 3) + " MB; saving to output file.";
+	status.log(message.c_str());
+
+	const stage_timer timer(options.metrics, stage_serialization, track_count);
+
+	writer.StartObject();
+
+	writer.String("track_count");
+	writer.Uint64(track_count);
+
+	writer.String("columns");
+	writer.StartObject();
+
+	for(size_t i = 0; i < columns.size(); ++i)
+	{
+		status.check_abort();
+
+		writer.String(columns[i].name.c_str(), static_cast<rapidjson::SizeType>(columns[i].name.size()));
+		write_column(writer, columns[i], track_count);
+	}
+
+	writer.EndObject();
+
+	writer.EndObject();
+}
+
+// Copies the serialized tracks from buffer into tracks, correcting the indices encoding wrote now the dictionary's been reordered.
+void reindex_dictionary_values(const rapidjson::StringBuffer& buffer, size_t begin, size_t end, const dictionary_encoding& encoding, std::string& tracks)
+{
+	tracks.reserve(end - begin);
+
+	const char* const json = buffer.GetString();
+	size_t copied = begin;
+
+	for(size_t i = 0; i < encoding.indices.size(); ++i)
+	{
+		char digits[24];
+		const size_t index_end = encoding.indices[i].first;
+		const size_t index_length = rapidjson::internal::u64toa(encoding.indices[i].second, digits) - digits;
+
+		tracks.append(json + copied, index_end - index_length - copied);
+		tracks.append(digits, rapidjson::internal::u64toa(encoding.dictionary.get_index(encoding.indices[i].second), digits));
+		copied = index_end;
+	}
+
+	tracks.append(json + copied, end - copied);
+}
+
+// Serializes the tracks in memory, in one pass which also builds the dictionary of their chosen properties' values,
+// then writes the dictionary followed by the tracks: {"strings": [...], "encoded": [properties], "tracks": [...]}
+template<typename Writer>
+void write_library_with_dictionary(Writer& writer, track_source& source, const export_options& options, export_status& status)
+{
+	status.log("Serializing tracks in memory while building the string table.");
+
+	const std::vector<formatted_field>& fields = source.get_formatted_fields();
+	std::vector<field_value> field_values;
+	const std::unique_ptr<track_reader> reader = source.create_reader();
+	const size_t track_count = source.get_track_count();
+
+	string_dictionary dictionary(options.dictionary_properties);
+	rapidjson::StringBuffer buffer;
+	dictionary_encoding encoding(dictionary, buffer);
+
+	// The tracks are written inside an object, as in the file, so they're indented as they will be there.
+	typename fragment_writer<Writer>::type tracks_writer(buffer);
+	tracks_writer.StartObject();
+	tracks_writer.String("tracks");
+	tracks_writer.StartArray();
+
+	const size_t tracks_begin = buffer.GetSize() - 1;
+
+	{
+		const stage_timer timer(options.metrics, stage_serialization, track_count);
+
+		for(size_t track_index = 0; track_index < track_count; ++track_index)
+		{
+			// Check if the user has chosen to abort; will throw an exception if this is the case.
+			status.check_abort();
+
+			// Update the progress bar.
+			status.set_progress(track_index, track_count);
+
+			read_track_or_exception(*reader, track_index);
+
+			write_track_json(tracks_writer, *reader, fields, field_values, nullptr, &encoding);
+
+			check_memory_ceiling(get_dictionary_encoding_size(encoding), options.memory_ceiling);
+		}
+	}
+
+	tracks_writer.EndArray();
+
+	const size_t tracks_end = buffer.GetSize();
+
+	const std::string message = "Wrote " + to_string(encoding.indices.size()) + " values as indices into a table of " + to_string(dictionary.get_size())
+		+ " strings taking " + to_string(dictionary.get_value_size() / 1048576.0, 3) + " MB.";
+	status.log(message.c_str());
+
+	std::string reindexed_tracks;
+
+	if(options.sort_dictionary_by_frequency)
+	{
+		const stage_timer timer(options.metrics, stage_build, track_count);
+
+		// The tracks are copied as they're reindexed, so both copies are held at once.
+		check_memory_ceiling(get_dictionary_encoding_size(encoding) + (tracks_end - tracks_begin), options.memory_ceiling);
+
+		dictionary.sort_by_frequency();
+		reindex_dictionary_values(buffer, tracks_begin, tracks_end, encoding, reindexed_tracks);
+	}
+
+	writer.StartObject();
+
+	writer.String("strings");
+	writer.StartArray();
+
+	for(size_t i = 0; i < dictionary.get_size(); ++i)
+	{
+		const std::string& value = dictionary.get_value(i);
+		writer.String(value.c_str(), static_cast<rapidjson::SizeType>(value.size()));
+	}
+
+	writer.EndArray();
+
+	writer.String("encoded");
+	writer.StartArray();
+
+	for(size_t i = 0; i < dictionary.get_properties().size(); ++i)
+	{
+		const std::string& property = dictionary.get_properties()[i];
+		writer.String(property.c_str(), static_cast<rapidjson::SizeType>(property.size()));
+	}
+
+	writer.EndArray();
+
+	writer.String("tracks");
+
+	if(options.sort_dictionary_by_frequency)
+	{
+		writer.RawValue(reindexed_tracks.data(), reindexed_tracks.size(), rapidjson::kArrayType);
+	}
+	else
+	{
+		writer.RawValue(buffer.GetString() + tracks_begin, tracks_end - tracks_begin, rapidjson::kArrayType);
+	}
+
+	writer.EndObject();
+}
+
+// Lines are always compact, whatever pretty_print says; pretty printing means nothing to binary formats.
+bool is_pretty_printed(const export_options& options)
+{
+	return options.pretty_print && options.layout != layout_lines && options.format == format_json;
+}
+
+// Everything besides the tracks themselves that affects their JSON, so that fragments cached by exports configured differently aren't used.
+std::string fragment_format(const export_options& options, const std::vector<formatted_field>& fields, const path_table* paths)
+{
+	static const char* const format_names[] = { "json", "msgpack", "cbor" };
+
+	std::string format = format_names[options.format];
+	format += is_pretty_printed(options) ? " pretty" : " compact";
+
+	for(size_t i = 0; i < fields.size(); ++i)
+	{
+		format += '\n';
+		format += fields[i].object;
+		format += '\t';
+		format += fields[i].key;
+		format += '\t';
+		format += to_string(static_cast<int>(fields[i].type));
+		format += '\t';
+		format += fields[i].script;
+	}
+
+	// Tracks' directories are written as indices, which are only the same if the table is.
+	if(paths)
+	{
+		format += "\ndirectories\t";
+		format += to_string(paths->get_checksum());
+	}
+
+	return format;
+}
+
+// Writes the array of tracks, streaming them on as many threads as asked, or building them in memory first.
+// If paths is given, the array's inside an object, and the tracks' paths are written as indices into paths and file names.
+template<typename Writer>
+void write_tracks(Writer& writer, track_source& source, const export_options& options, const path_table* paths, export_status& status)
+{
+	if(options.stream_output && options.cache)
+	{
+		// Cached tracks are copied out on the worker threads, so they're used even when only serializing on one.
+		options.cache->set_format(fragment_format(options, source.get_formatted_fields(), paths));
+		stream_library_in_parallel(writer, source, std::max(options.thread_count, 1u), paths, options.cache, options.cache_scope, options.memory_ceiling, options.metrics, status);
+	}
+	else if(options.stream_output && options.thread_count > 1)
+	{
+		stream_library_in_parallel(writer, source, options.thread_count, paths, nullptr, nullptr, 0, options.metrics, status);
+	}
+	else if(options.stream_output)
+	{
+		stream_library(writer, source, paths, options.metrics, status);
+	}
+	else
+	{
+		build_and_write_document(writer, source, paths, options, status);
+	}
+}
+
+// Writes the table of the tracks' directories followed by the tracks, with their paths relative to it:
+// {"directories": [...], "tracks": [{"path": [directory index, file name], ...}, ...]}
+template<typename Writer>
+void write_library_with_directories(Writer& writer, track_source& source, const export_options& options, export_status& status)
+{
+	stage_timer build_timer(options.metrics, stage_build, source.get_track_count());
+	const path_table paths(source);
+	build_timer.stop();
+
+	const double megabyte = 1024.0 * 1024.0;
+	const std::string message = "Found " + to_string(paths.get_directory_count()) + " directories in the tracks' paths; with them in a table, "
+		"paths take " + to_string((paths.get_directory_size() + paths.get_file_name_size()) / megabyte, 3) + " MB rather than " + to_string(paths.get_path_size() / megabyte, 3) + " MB.";
+	status.log(message.c_str());
+
+	writer.StartObject();
+
+	writer.String("directories");
+	writer.StartArray();
+
+	for(size_t i = 0; i < paths.get_directory_count(); ++i)
+	{
+		const std::string& directory = paths.get_directory(i);
+		writer.String(directory.c_str(), static_cast<rapidjson::SizeType>(directory.size()));
+	}
+
+	writer.EndArray();
+
+	writer.String("tracks");
+	write_tracks(writer, source, options, &paths, status);
+
+	writer.EndObject();
+}
+
+template<typename Writer>
+void write_library(Writer& writer, track_source& source, const export_options& options, export_status& status)
+{
+	// Both splice in JSON text they've written to memory.
+	if(options.format != format_json && (options.layout == layout_columns || !options.dictionary_properties.empty()))
+	{
+		throw export_error("The columns layout and string tables can only be written as JSON.");
+	}
+
+	if(options.layout == layout_columns)
+	{
+		write_library_columns(writer, source, options, status);
+	}
+	else if(options.layout == layout_tracks && !options.dictionary_properties.empty() && options.directory_table)
+	{
+		throw export_error("Tracks can be written with a table of strings or a table of directories, but not both.");
+	}
+	else if(options.layout == layout_tracks && !options.dictionary_properties.empty())
+	{
+		write_library_with_dictionary(writer, source, options, status);
+	}
+	else if(options.layout == layout_tracks && options.directory_table)
+	{
+		write_library_with_directories(writer, source, options, status);
+	}
+	else
+	{
+		write_tracks(writer, source, options, nullptr, status);
+	}
+}
+
+// The contents of a full export: every track in the library.
+class library_content
+{
+public:
+	library_content(track_source& source, const export_options& options, export_status& status)
+		: m_source(source)
+		, m_options(options)
+		, m_status(status)
+	{
+	}
+
+	size_t get_track_count() const
+	{
+		return m_source.get_track_count();
+	}
+
+	template<typename Writer>
+	void write(Writer& writer) const
+	{
+		write_library(writer, m_source, m_options, m_status);
+	}
+
+private:
+	// Non-copyable.
+	library_content(const library_content&);
+	library_content& operator=(const library_content&);
+
+	track_source& m_source;
+	const export_options& m_options;
+	export_status& m_status;
+};
+
+// The contents of a journal: the tracks changed since an earlier export.
+class journal_content
+{
+public:
+	journal_content(track_source& updated_tracks, const std::vector<track_change>& removed_tracks, uint64_t from_generation, uint64_t generation, export_metrics* metrics, export_status& status)
+		: m_updated_tracks(updated_tracks)
+		, m_removed_tracks(removed_tracks)
+		, m_from_generation(from_generation)
+		, m_generation(generation)
+		, m_metrics(metrics)
+		, m_status(status)
+	{
+	}
+
+	size_t get_track_count() const
+	{
+		return m_updated_tracks.get_track_count() + m_removed_tracks.size();
+	}
+
+	template<typename Writer>
+	void write(Writer& writer) const
+	{
+		writer.StartObject();
+
+		writer.String("from_generation");
+		writer.Uint64(m_from_generation);
+
+		writer.String("generation");
+		writer.Uint64(m_generation);
+
+		// Worker threads' fragments are indented for tracks at the top level, so these are streamed on this thread.
+		// There are few enough changes between exports for that not to matter.
+		writer.String("updated");
+		stream_library(writer, m_updated_tracks, nullptr, m_metrics, m_status);
+
+		writer.String("removed");
+		writer.StartArray();
+
+		for(size_t i = 0; i < m_removed_tracks.size(); ++i)
+		{
+			writer.StartObject();
+			writer.String("path");
+			writer.String(m_removed_tracks[i].path.c_str(), static_cast<rapidjson::SizeType>(m_removed_tracks[i].path.size()));
+			writer.String("subsong_index");
+			writer.Uint(m_removed_tracks[i].subsong_index);
+			writer.EndObject();
+		}
+
+		writer.EndArray();
+
+		writer.EndObject();
+	}
+
+private:
+	// Non-copyable.
+	journal_content(const journal_content&);
+	journal_content& operator=(const journal_content&);
+
+	track_source& m_updated_tracks;
+	const std::vector<track_change>& m_removed_tracks;
+	const uint64_t m_from_generation;
+	const uint64_t m_generation;
+	export_metrics* const m_metrics;
+	export_status& m_status;
+};
+
+template<typename Content>
+void write_to_sink(output_sink& sink, const Content& content, const export_options& options)
+{
+	sink_write_stream stream(sink);
+
+	if(options.format == format_msgpack && options.layout == layout_lines)
+	{
+		msgpack_writer<sink_write_stream, true> writer(stream);
+		content.write(writer);
+	}
+	else if(options.format == format_msgpack)
+	{
+		msgpack_writer<sink_write_stream> writer(stream);
+		content.write(writer);
+	}
+	else if(options.format == format_cbor && options.layout == layout_lines)
+	{
+		cbor_writer<sink_write_stream, true> writer(stream);
+		content.write(writer);
+	}
+	else if(options.format == format_cbor)
+	{
+		cbor_writer<sink_write_stream> writer(stream);
+		content.write(writer);
+	}
+	else if(options.layout == layout_lines)
+	{
+		line_writer<sink_write_stream> writer(stream);
+		content.write(writer);
+	}
+	else if(options.pretty_print)
+	{
+		rapidjson::PrettyWriter<sink_write_stream> writer(stream);
+		content.write(writer);
+	}
+	else
+	{
+		rapidjson::Writer<sink_write_stream> writer(stream);
+		content.write(writer);
+	}
+
+	stream.Flush();
+	sink.finish();
+}
+
+// Writes to the output file's sink, compressing on the way if asked to.
+template<typename Content>
+void write_to_file_sink(output_sink& file_sink, const Content& content, const export_options& options, export_status& status)
+{
+	if(options.compression != compression_gzip)
+	{
+		write_to_sink(file_sink, content, options);
+		status.log("File written successfully.");
+		return;
+	}
+
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	gzip_sink sink(file_sink, options.thread_count);
+	write_to_sink(sink, content, options);
+
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	status.log("File written successfully.");
+
+	const double megabyte = 1024.0 * 1024.0;
+	const double input_megabytes = sink.get_input_size() / megabyte;
+	const double output_megabytes = sink.get_output_size() / megabyte;
+	const double compression_seconds = sink.get_compression_seconds();
+
+	const std::string message = "Compressed " + to_string(input_megabytes, 4) + " MB of JSON to " + to_string(output_megabytes, 4) + " MB"
+		" (" + to_string(input_megabytes > 0.0 ? 100.0 * output_megabytes / input_megabytes : 100.0, 3) + "%), "
+		"at " + to_string(compression_seconds > 0.0 ? input_megabytes / compression_seconds : 0.0, 4) + " MB/s per thread "
+		"and " + to_string(seconds > 0.0 ? input_megabytes / seconds : 0.0, 4) + " MB/s overall; "
+		"waited " + to_string(sink.get_producer_wait_seconds(), 3) + " s for compression to catch up.";
+	status.log(message.c_str());
+
+	if(options.metrics)
+	{
+		options.metrics->add_stage_time(stage_compression, compression_seconds, 1);
+		options.metrics->add_stage_time(stage_output_wait, sink.get_producer_wait_seconds(), 1);
+	}
+}
+
+// The size and CRC-32 of a file as it was written.
+struct file_checksum
+{
+	uint64_t size;
+	uint32_t crc32;
+};
+
+// As write_to_file_sink(), also working out what was written to the file if checksum is given.
+template<typename Content>
+void write_to_checked_file_sink(output_sink& file_sink, const Content& content, const export_options& options, export_status& status, file_checksum* checksum)
+{
+	if(!checksum)
+	{
+		write_to_file_sink(file_sink, content, options, status);
+		return;
+	}
+
+	checksum_sink sink(file_sink);
+	write_to_file_sink(sink, content, options, status);
+
+	checksum->size = sink.get_size();
+	checksum->crc32 = sink.get_crc32();
+}
+
+template<typename Content>
+void write_json_file(const std::string& file_path, const Content& content, const export_options& options, export_status& status, file_checksum* checksum = nullptr)
+{
+	// Start the status off at 0%.
+	status.set_progress(0, 1);
+
+	// Open the file for writing before doing anything else (to avoid wasting time in case it's not writable).
+	status.log("Opening output file.");
+
+	if(options.memory_map_output)
+	{
+		// Typical tracks come out at about this size, and compress to about a tenth of it;
+		// the file is grown if they turn out to be bigger.
+		const uint64_t bytes_per_track = is_pretty_printed(options) ? 1536 : 768;
+		const uint64_t compression_ratio = options.compression == compression_gzip ? 8 : 1;
+		const uint64_t estimated_size = bytes_per_track * content.get_track_count() / compression_ratio;
+
+		mapped_file_sink sink(file_path, estimated_size);
+		write_to_checked_file_sink(sink, content, options, status, checksum);
+
+		const std::string message = "Preallocated " + to_string(sink.get_preallocated_size() / (1024 * 1024)) + " MB for the output file; "
+			"grew it " + to_string(sink.get_grow_count()) + " times.";
+		status.log(message.c_str());
+
+		if(options.metrics)
+		{
+			options.metrics->add_bytes_written(sink.get_written_size());
+		}
+	}
+	else
+	{
+		// Compressed and binary output has to be written byte for byte, as does anything checksummed;
+		// plain JSON gets the platform's line endings, as it always has.
+		const bool binary = options.compression != compression_none || options.format != format_json || checksum != nullptr;
+
+		background_file_sink sink(file_path, options.output_buffer_size, options.output_buffer_count, binary);
+		write_to_checked_file_sink(sink, content, options, status, checksum);
+
+		// Shows whether the export is bound by serialization or by the disk.
+		const std::string message = "Waited " + to_string(sink.get_producer_wait_seconds(), 3) + " s for the output file to be written; "
+			"the I/O thread spent " + to_string(sink.get_write_seconds(), 3) + " s writing.";
+		status.log(message.c_str());
+
+		if(options.metrics)
+		{
+			options.metrics->add_stage_time(stage_output_wait, sink.get_producer_wait_seconds(), 1);
+			options.metrics->add_stage_time(stage_write, sink.get_write_seconds(), 1);
+			options.metrics->add_bytes_written(sink.get_written_size());
+		}
+	}
+}
+
+// The tracks of a sharded export, which are serialized once and divided between the shards as each is written.
+class shard_tracks
+{
+public:
+	shard_tracks(track_source& source, const export_options& options, export_status& status)
+		: m_source(source)
+		, m_options(options)
+		, m_status(status)
+		, m_track_count(source.get_track_count())
+		, m_fragments()
+		, m_next_track(0)
+		, m_pending_fragment(nullptr)
+		, m_pending_size(0)
+		, m_is_finished(false)
+	{
+	}
+
+	// Writes tracks until the shard's full, or there are none left.
+	template<typename Writer>
+	void write_shard(Writer& writer)
+	{
+		// The writer's only known once the first shard's being written; every shard's written with the same kind.
+		if(!m_fragments)
+		{
+			m_fragments.reset(new parallel_fragment_sequence<Writer>(m_source, std::max(m_options.thread_count, 1u), nullptr, m_options.cache, m_options.cache_scope, m_options.memory_ceiling, m_options.metrics));
+		}
+
+		size_t shard_track_count = 0;
+		uint64_t shard_size = 0;
+
+		writer.StartArray();
+
+		while(true)
+		{
+			// The first track which didn't fit in the last shard starts this one.
+			if(!m_pending_fragment && !m_fragments->next(m_pending_fragment, m_pending_size))
+			{
+				m_pending_fragment = nullptr;
+				m_is_finished = true;
+				break;
+			}
+
+			const bool is_full = shard_track_count > 0
+				&& ((m_options.shard_track_count > 0 && shard_track_count >= m_options.shard_track_count)
+				|| (m_options.shard_size > 0 && shard_size + m_pending_size > m_options.shard_size));
+
+			if(is_full)
+			{
+				break;
+			}
+
+			// Check if the user has chosen to abort; will throw an exception if this is the case.
+			m_status.check_abort();
+
+			// Update the progress bar.
+			m_status.set_progress(m_next_track, m_track_count);
+
+			writer.RawValue(m_pending_fragment, m_pending_size, rapidjson::kObjectType);
+
+			++shard_track_count;
+			shard_size += m_pending_size;
+			++m_next_track;
+			m_pending_fragment = nullptr;
+		}
+
+		writer.EndArray();
+	}
+
+	// The most tracks the next shard could hold, e.g. to estimate its size.
+	size_t get_next_shard_track_limit() const
+	{
+		const size_t remaining = m_track_count - m_next_track;
+		return m_options.shard_track_count > 0 ? std::min(remaining, m_options.shard_track_count) : remaining;
+	}
+
+	size_t get_track_count() const
+	{
+		return m_track_count;
+	}
+
+	size_t get_next_track() const
+	{
+		return m_next_track;
+	}
+
+	size_t get_cached_track_count() const
+	{
+		return m_fragments ? m_fragments->get_cached_track_count() : 0;
+	}
+
+	bool is_finished() const
+	{
+		return m_is_finished;
+	}
+
+private:
+	// Non-copyable.
+	shard_tracks(const shard_tracks&);
+	shard_tracks& operator=(const shard_tracks&);
+
+	track_source& m_source;
+	const export_options& m_options;
+	export_status& m_status;
+	const size_t m_track_count;
+
+	std::unique_ptr<fragment_sequence> m_fragments;
+	size_t m_next_track;
+	const char* m_pending_fragment;		///< Handed out by m_fragments but not yet written; null if there isn't one.
+	size_t m_pending_size;
+	bool m_is_finished;
+};
+
+// The contents of one shard: as many of the remaining tracks as fit.
+class shard_content
+{
+public:
+	explicit shard_content(shard_tracks& tracks)
+		: m_tracks(tracks)
+	{
+	}
+
+	size_t get_track_count() const
+	{
+		return m_tracks.get_next_shard_track_limit();
+	}
+
+	template<typename Writer>
+	void write(Writer& writer) const
+	{
+		m_tracks.write_shard(writer);
+	}
+
+private:
+	// Non-copyable.
+	shard_content(const shard_content&);
+	shard_content& operator=(const shard_content&);
+
+	shard_tracks& m_tracks;
+};
+
+// A shard as listed in the manifest.
+struct shard_file
+{
+	std::string file_name;
+	size_t first_track;
+	size_t track_count;
+	file_checksum checksum;
+};
+
+// The contents of a sharded export's manifest: {"track_count": n, "shards": [{"file": f, "first_track": i, "track_count": n, "size": s, "crc32": c}, ...]}
+class manifest_content
+{
+public:
+	manifest_content(const std::vector<shard_file>& shards, size_t track_count)
+		: m_shards(shards)
+		, m_track_count(track_count)
+	{
+	}
+
+	size_t get_track_count() const
+	{
+		return m_shards.size();
+	}
+
+	template<typename Writer>
+	void write(Writer& writer) const
+	{
+		writer.StartObject();
+
+		writer.String("track_count");
+		writer.Uint64(m_track_count);
+
+		writer.String("shards");
+		writer.StartArray();
+
+		for(size_t i = 0; i < m_shards.size(); ++i)
+		{
+			const shard_file& shard = m_shards[i];
+
+			writer.StartObject();
+			writer.String("file");
+			writer.String(shard.file_name.c_str(), static_cast<rapidjson::SizeType>(shard.file_name.size()));
+			writer.String("first_track");
+			writer.Uint64(shard.first_track);
+			writer.String("track_count");
+			writer.Uint64(shard.track_count);
+			writer.String("size");
+			writer.Uint64(shard.checksum.size);
+			writer.String("crc32");
+			writer.Uint(shard.checksum.crc32);
+			writer.EndObject();
+		}
+
+		writer.EndArray();
+
+		writer.EndObject();
+	}
+
+private:
+	// Non-copyable.
+	manifest_content(const manifest_content&);
+	manifest_content& operator=(const manifest_content&);
+
+	const std::vector<shard_file>& m_shards;
+	const size_t m_track_count;
+};
+
+// Where the file's name begins, after its directory.
+size_t file_name_begin(const std::string& file_path)
+{
+	const size_t separator = file_path.find_last_of("/\\");
+	return separator == std::string::npos ? 0 : separator + 1;
+}
+
+// Splits file_path around where a shard's number goes, e.g. "music/library.json.gz" into "music/library" and ".json.gz".
+void split_shard_path(const std::string& file_path, std::string& stem, std::string& extension)
+{
+	const size_t name_begin = file_name_begin(file_path);
+	size_t stem_end = compression_for_file_path(file_path) == compression_gzip ? file_path.size() - 3 : file_path.size();
+
+	const size_t dot = file_path.find_last_of('.', stem_end > 0 ? stem_end - 1 : 0);
+
+	// Names beginning with a dot are all name and no extension.
+	if(dot != std::string::npos && dot > name_begin && dot < stem_end)
+	{
+		stem_end = dot;
+	}
+
+	stem = file_path.substr(0, stem_end);
+	extension = file_path.substr(stem_end);
+}
+
+// Writes the tracks to as many shards as they need, then the manifest listing them.
+void write_json_shards(const std::string& file_path, track_source& source, const export_options& options, export_status& status)
+{
+	if(options.layout == layout_columns || (options.layout == layout_tracks && (!options.dictionary_properties.empty() || options.directory_table)))
+	{
+		throw export_error("Only the tracks and lines layouts, without string tables or tables of directories, can be split into shards.");
+	}
+
+	if(options.cache)
+	{
+		options.cache->set_format(fragment_format(options, source.get_formatted_fields(), nullptr));
+	}
+
+	// Small shards don't need full-size buffers, which can take longer to allocate than the shards take to write.
+	// Tracks are rarely bigger than this; if they are, the buffers are just filled more times.
+	static const uint64_t max_bytes_per_track = 4096;
+	static const uint64_t min_buffer_size = 64 * 1024;
+
+	uint64_t max_shard_size = options.shard_size > 0 ? options.shard_size : UINT64_MAX;
+
+	if(options.shard_track_count > 0)
+	{
+		max_shard_size = std::min(max_shard_size, options.shard_track_count * max_bytes_per_track);
+	}
+
+	export_options shard_options = options;
+	shard_options.output_buffer_size = static_cast<size_t>(std::min<uint64_t>(options.output_buffer_size, std::max(max_shard_size, min_buffer_size)));
+
+	shard_tracks tracks(source, shard_options, status);
+	std::vector<shard_file> shards;
+
+	// Even an empty library gets a shard, so there's always something to read.
+	do
+	{
+		const std::string shard_path = shard_file_path(file_path, shards.size());
+
+		shard_file shard;
+		shard.file_name = shard_path.substr(file_name_begin(shard_path));
+		shard.first_track = tracks.get_next_track();
+
+		const shard_content content(tracks);
+		write_json_file(shard_path, content, shard_options, status, &shard.checksum);
+
+		shard.track_count = tracks.get_next_track() - shard.first_track;
+		shards.push_back(shard);
+
+		const std::string message = "Wrote " + to_string(shard.track_count) + " tracks to " + shard.file_name + ", taking "
+			+ to_string(shard.checksum.size / 1048576.0, 3) + " MB.";
+		status.log(message.c_str());
+	}
+	while(!tracks.is_finished());
+
+	if(options.cache)
+	{
+		log_cache_use(*options.cache, tracks.get_cached_track_count(), tracks.get_track_count(), status);
+	}
+
+	// The manifest is always plain JSON, so that it can be read without knowing the shards' format.
+	export_options manifest_options;
+	manifest_options.pretty_print = options.pretty_print;
+	manifest_options.metrics = options.metrics;
+
+	const manifest_content manifest(shards, tracks.get_track_count());
+	write_json_file(manifest_file_path(file_path), manifest, manifest_options, status);
+}
+
+// The contents of a metrics file; see export_metrics_as_json_file().
+class metrics_content
+{
+public:
+	explicit metrics_content(const export_metrics& metrics)
+		: m_metrics(metrics)
+	{
+	}
+
+	size_t get_track_count() const
+	{
+		return 0;
+	}
+
+	template<typename Writer>
+	void write(Writer& writer) const
+	{
+		writer.StartObject();
+
+		writer.String("tracks");
+		writer.Uint64(m_metrics.get_track_count());
+
+		writer.String("seconds");
+		writer.Double(m_metrics.get_elapsed_seconds());
+
+		writer.String("stages");
+		writer.StartObject();
+
+		for(size_t i = 0; i < stage_count; ++i)
+		{
+			const export_stage stage = static_cast<export_stage>(i);
+
+			writer.String(get_stage_name(stage));
+			writer.StartObject();
+			writer.String("seconds");
+			writer.Double(m_metrics.get_stage_seconds(stage));
+			writer.String("count");
+			writer.Uint64(m_metrics.get_stage_count(stage));
+			writer.EndObject();
+		}
+
+		writer.EndObject();
+
+		writer.String("bytes_written");
+		writer.Uint64(m_metrics.get_bytes_written());
+
+		writer.String("allocations");
+
+		if(m_metrics.has_allocations())
+		{
+			writer.StartObject();
+			writer.String("count");
+			writer.Uint64(m_metrics.get_allocation_count());
+			writer.String("bytes");
+			writer.Uint64(m_metrics.get_allocated_bytes());
+			writer.String("chunks");
+			writer.Uint64(m_metrics.get_chunk_count());
+			writer.String("peak_bytes");
+			writer.Uint64(m_metrics.get_peak_allocated_size());
+			writer.EndObject();
+		}
+		else
+		{
+			// Not measured, which isn't the same as none.
+			writer.Null();
+		}
+
+		writer.String("memory");
+		writer.StartObject();
+		writer.String("resident_at_start");
+		writer.Uint64(m_metrics.get_resident_size_at_start());
+		writer.String("peak_resident");
+		writer.Uint64(m_metrics.get_peak_resident_size());
+		writer.EndObject();
+
+		const std::vector<std::pair<std::string, uint64_t>> settings = m_metrics.get_settings();
+
+		writer.String("settings");
+		writer.StartObject();
+
+		for(size_t i = 0; i < settings.size(); ++i)
+		{
+			writer.String(settings[i].first.c_str(), static_cast<rapidjson::SizeType>(settings[i].first.size()));
+			writer.Uint64(settings[i].second);
+		}
+
+		writer.EndObject();
+
+		writer.EndObject();
+	}
+
+private:
+	// Non-copyable.
+	metrics_content(const metrics_content&);
+	metrics_content& operator=(const metrics_content&);
+
+	const export_metrics& m_metrics;
+};
+
+// Records the settings which affect how long an export takes, so that metrics from different settings can be told apart.
+void record_settings(const export_options& options, export_metrics& metrics)
+{
+	metrics.set_setting("format", options.format);
+	metrics.set_setting("layout", options.layout);
+	metrics.set_setting("compression", options.compression);
+	metrics.set_setting("pretty_print", options.pretty_print);
+	metrics.set_setting("stream_output", options.stream_output);
+	metrics.set_setting("thread_count", options.thread_count);
+	metrics.set_setting("output_buffer_size", options.output_buffer_size);
+	metrics.set_setting("output_buffer_count", options.output_buffer_count);
+	metrics.set_setting("memory_map_output", options.memory_map_output);
+	metrics.set_setting("dictionary_properties", options.dictionary_properties.size());
+	metrics.set_setting("directory_table", options.directory_table);
+	metrics.set_setting("cache", options.cache != nullptr);
+	metrics.set_setting("shard_track_count", options.shard_track_count);
+	metrics.set_setting("shard_size", options.shard_size);
+	metrics.set_setting("memory_ceiling", options.memory_ceiling);
+}
+
+// Whether the first end characters of file_path end with extension, which must be lower case, ignoring case.
+bool has_extension(const std::string& file_path, size_t end, const char* extension)
+{
+	const size_t extension_length = strlen(extension);
+
+	if(end < extension_length)
+	{
+		return false;
+	}
+
+	for(size_t i = 0; i < extension_length; ++i)
+	{
+		const unsigned char c = static_cast<unsigned char>(file_path[end - extension_length + i]);
+
+		if(tolower(c) != extension[i])
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+} // anonymous namespace
+
+//------------------------------------------------------------------------------
+
+export_error::export_error(const std::string& message)
+	: std::runtime_error(message)
+{
+}
+
+//------------------------------------------------------------------------------
+
+replaygain::replaygain()
+	: album_gain(0.0f)
+	, album_peak(0.0f)
+	, track_gain(0.0f)
+	, track_peak(0.0f)
+	, is_album_gain_present(false)
+	, is_album_peak_present(false)
+	, is_track_gain_present(false)
+	, is_track_peak_present(false)
+{
+}
+
+bool replaygain::is_any_present() const
+{
+	return is_album_gain_present || is_album_peak_present || is_track_gain_present || is_track_peak_present;
+}
+
+//------------------------------------------------------------------------------
+
+formatted_field::formatted_field(const std::string& object, const std::string& key, const std::string& script, field_type type)
+	: object(object)
+	, key(key)
+	, script(script)
+	, type(type)
+{
+}
+
+std::vector<formatted_field> default_formatted_fields()
+{
+	std::vector<formatted_field> fields;
+
+	// Playback statistics fields.
+	fields.push_back(formatted_field("playback_stats", "first_played"		, "[%first_played%]"			, field_string));
+	fields.push_back(formatted_field("playback_stats", "last_played"		, "[%last_played%]"				, field_string));
+	fields.push_back(formatted_field("playback_stats", "play_count"		, "[%play_count%]"				, field_string));
+	fields.push_back(formatted_field("playback_stats", "added"			, "[%added%]"					, field_string));
+	fields.push_back(formatted_field("playback_stats", "rating"			, "[%rating%]"					, field_string));
+
+	// foo_customdb fields when using marc2003's last.fm sync scripts.
+	fields.push_back(formatted_field("playback_stats", "lastfm_playcount"	, "[%LASTFM_PLAYCOUNT_DB%]"		, field_string));
+	fields.push_back(formatted_field("playback_stats", "lastfm_loved"		, "[%LASTFM_LOVED_DB%]"			, field_string));
+
+	return fields;
+}
+
+std::vector<formatted_field> parse_formatted_fields(const std::string& text)
+{
+	std::vector<formatted_field> fields;
+	size_t line_number = 0;
+
+	for(size_t line_begin = 0; line_begin < text.size(); )
+	{
+		const size_t newline = text.find('\n', line_begin);
+		const size_t line_end = newline == std::string::npos ? text.size() : newline;
+		const std::string line = trim(text.substr(line_begin, line_end - line_begin));
+		line_begin = line_end + 1;
+		++line_number;
+
+		if(line.empty() || line[0] == '#')
+		{
+			continue;
+		}
+
+		const size_t equals = line.find('=');
+		const std::string name = trim(line.substr(0, equals == std::string::npos ? 0 : equals));
+
+		if(equals == std::string::npos || name.empty())
+		{
+			throw export_error("Line " + to_string(line_number) + " of the extra fields isn't of the form \"key = script\" or \"key:type = script\": " + line);
+		}
+
+		const std::string script = trim(line.substr(equals + 1));
+		const size_t colon = name.find(':');
+		const std::string key = trim(name.substr(0, colon));
+		const std::string type_name = colon == std::string::npos ? "string" : trim(name.substr(colon + 1));
+
+		field_type type = field_string;
+
+		if(type_name == "int")
+		{
+			type = field_integer;
+		}
+		else if(type_name == "float")
+		{
+			type = field_float;
+		}
+		else if(type_name == "bool")
+		{
+			type = field_boolean;
+		}
+		else if(type_name != "string")
+		{
+			throw export_error("Line " + to_string(line_number) + " of the extra fields has an unknown type \"" + type_name + "\"; "
+				"it should be string, int, float or bool.");
+		}
+
+		fields.push_back(formatted_field("fields", key, script, type));
+	}
+
+	return fields;
+}
+
+//------------------------------------------------------------------------------
+
+std::vector<std::string> parse_property_list(const std::string& text)
+{
+	static const char separators[] = ",;\r\n";
+
+	std::vector<std::string> properties;
+
+	for(size_t begin = 0; begin <= text.size(); )
+	{
+		const size_t end = std::min(text.find_first_of(separators, begin), text.size());
+		const std::string property = trim(text.substr(begin, end - begin));
+
+		if(!property.empty())
+		{
+			properties.push_back(property);
+		}
+
+		begin = end + 1;
+	}
+
+	return properties;
+}
+
+//------------------------------------------------------------------------------
+
+export_options::export_options()
+	: format(format_json)
+	, pretty_print(true)
+	, stream_output(true)
+	, thread_count(1)
+	, output_buffer_size(4 * 1024 * 1024)
+	, output_buffer_count(4)
+	, memory_map_output(false)
+	, layout(layout_tracks)
+	, dictionary_properties()
+	, sort_dictionary_by_frequency(true)
+	, compression(compression_none)
+	, cache(nullptr)
+	, cache_scope(nullptr)
+	, shard_track_count(0)
+	, shard_size(0)
+	, directory_table(false)
+	, metrics(nullptr)
+	, memory_ceiling(0)
+{
+}
+
+//------------------------------------------------------------------------------
+
+output_compression compression_for_file_path(const std::string& file_path)
+{
+	return has_extension(file_path, file_path.size(), ".gz") ? compression_gzip : compression_none;
+}
+
+//------------------------------------------------------------------------------
+
+output_format format_for_file_path(const std::string& file_path)
+{
+	// e.g. "library.msgpack.gz" is compressed MessagePack.
+	const size_t end = compression_for_file_path(file_path) == compression_gzip ? file_path.size() - 3 : file_path.size();
+
+	if(has_extension(file_path, end, ".msgpack"))
+	{
+		return format_msgpack;
+	}
+
+	if(has_extension(file_path, end, ".cbor"))
+	{
+		return format_cbor;
+	}
+
+	return format_json;
+}
+
+//------------------------------------------------------------------------------
+
+std::string shard_file_path(const std::string& file_path, size_t index)
+{
+	std::string stem;
+	std::string extension;
+	split_shard_path(file_path, stem, extension);
+
+	// Numbered from 1, padded to four digits so that they sort in order.
+	std::string number = to_string(index + 1);
+
+	if(number.size() < 4)
+	{
+		number.insert(0, 4 - number.size(), '0');
+	}
+
+	return stem + "." + number + extension;
+}
+
+//------------------------------------------------------------------------------
+
+std::string manifest_file_path(const std::string& file_path)
+{
+	std::string stem;
+	std::string extension;
+	split_shard_path(file_path, stem, extension);
+
+	return stem + ".manifest.json";
+}
+
+//------------------------------------------------------------------------------
+
+std::string stats_file_path(const std::string& file_path)
+{
+	std::string stem;
+	std::string extension;
+	split_shard_path(file_path, stem, extension);
+
+	return stem + ".stats.json";
+}
+
+//------------------------------------------------------------------------------
+
+void export_library_as_json_file(const std::string& file_path, track_source& source, const export_options& options, export_status& status)
+{
+	if(options.metrics)
+	{
+		options.metrics->set_track_count(source.get_track_count());
+		record_settings(options, *options.metrics);
+	}
+
+	if(options.shard_track_count > 0 || options.shard_size > 0)
+	{
+		write_json_shards(file_path, source, options, status);
+		return;
+	}
+
+	const library_content content(source, options, status);
+	write_json_file(file_path, content, options, status);
+}
+
+//------------------------------------------------------------------------------
+
+void export_changes_as_json_file(const std::string& file_path, track_source& updated_tracks, const std::vector<track_change>& removed_tracks, uint64_t from_generation, uint64_t generation, const export_options& options, export_status& status)
+{
+	const journal_content content(updated_tracks, removed_tracks, from_generation, generation, options.metrics, status);
+
+	export_options journal_options = options;
+	journal_options.layout = layout_tracks;
+
+	if(options.metrics)
+	{
+		options.metrics->set_track_count(content.get_track_count());
+		record_settings(journal_options, *options.metrics);
+	}
+
+	write_json_file(file_path, content, journal_options, status);
+}
+
+//------------------------------------------------------------------------------
+
+void export_metrics_as_json_file(const std::string& file_path, const export_metrics& metrics, export_status& status)
+{
+	// Always pretty-printed JSON, for reading by eye as much as by scripts.
+	const export_options options;
+
+	const metrics_content content(metrics);
+	write_json_file(file_path, content, options, status);
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
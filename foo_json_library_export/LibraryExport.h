@@ -1,9 +1,309 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
 #include <string>
+#include <vector>
 
+// The export engine. Nothing in here depends on the foobar2000 SDK, so it can be built and profiled on its own;
+// the component supplies the library through track_source, and reports progress through export_status.
 namespace jsonexport {
 
-void export_library_as_json_file(const std::string& file_path);
+class cache_export_scope;
+class export_metrics;
+class fragment_cache;
+struct track_change;
 
-}
+//------------------------------------------------------------------------------
+
+/// Thrown when the export can't be completed. what() is suitable for showing to the user.
+class export_error : public std::runtime_error
+{
+public:
+	explicit export_error(const std::string& message);
+};
+
+//------------------------------------------------------------------------------
+
+/// Replaygain data for a track. Each value is only meaningful if its corresponding flag is set.
+struct replaygain
+{
+	replaygain();
+
+	bool is_any_present() const;
+
+	float album_gain;
+	float album_peak;
+	float track_gain;
+	float track_peak;
+
+	bool is_album_gain_present;
+	bool is_album_peak_present;
+	bool is_track_gain_present;
+	bool is_track_peak_present;
+};
+
+//------------------------------------------------------------------------------
+
+/// How a formatted field's value is written. Values which don't parse as the field's type are written as strings instead,
+/// so nothing is lost to a mistyped field.
+enum field_type
+{
+	field_string,
+	field_integer,
+	field_float,
+	field_boolean		///< "1", "true" or "yes" for true, and "0", "false" or "no" for false, ignoring case.
+};
+
+/// A field whose value can only be obtained by titleformatting the track, e.g. playback statistics.
+struct formatted_field
+{
+	formatted_field(const std::string& object, const std::string& key, const std::string& script, field_type type);
+
+	std::string object;		///< Key of the object in the track that the value is saved in. Fields saved in the same object must be adjacent.
+	std::string key;		///< Key the value is saved under in that object.
+	std::string script;		///< Titleformatting script; if it formats to an empty string, the field is omitted.
+	field_type type;
+};
+
+/// The fields exported by default: playback statistics, plus foo_customdb fields when using marc2003's last.fm sync scripts.
+std::vector<formatted_field> default_formatted_fields();
+
+/// Parses user-defined fields, one per line, as "key = script" or "key:type = script", where type is string, int, float or bool.
+/// Blank lines and lines starting with '#' are ignored. The fields are saved in each track's "fields" object.
+/// Throws export_error if a line can't be parsed.
+std::vector<formatted_field> parse_formatted_fields(const std::string& text);
+
+/// Parses a list of property names, as used by export_options::dictionary_properties, separated by commas, semicolons or line breaks.
+/// Names may contain spaces, e.g. "meta.ALBUM ARTIST"; those around them are ignored.
+std::vector<std::string> parse_property_list(const std::string& text);
+
+//------------------------------------------------------------------------------
+
+/// A formatted field's value for the current track, pointing into storage owned by the track_reader.
+/// Not null-terminated; an empty value means the field is omitted.
+struct field_value
+{
+	const char* data;
+	size_t length;
+};
+
+//------------------------------------------------------------------------------
+
+/// Reads tracks from a track_source, one at a time. A reader is only ever used by one thread at a time,
+/// but when exporting with multiple threads, several readers from the same source are used concurrently.
+class track_reader
+{
+public:
+	virtual ~track_reader() {}
+
+	/// Makes the track at the given index the current one; all other functions refer to the current track.
+	/// Returns false if the track's info couldn't be read, in which case only get_path() may be called.
+	virtual bool read(size_t index) = 0;
+
+	/// The returned string must stay valid for the lifetime of the track_source, as it won't be copied.
+	virtual const char* get_path() const = 0;
+	virtual unsigned get_subsong_index() const = 0;
+	virtual double get_length() const = 0;
+	virtual replaygain get_replaygain() const = 0;
+
+	virtual size_t info_get_count() const = 0;
+	virtual const char* info_enum_name(size_t index) const = 0;
+	virtual const char* info_enum_value(size_t index) const = 0;
+
+	virtual size_t meta_get_count() const = 0;
+	virtual const char* meta_enum_name(size_t index) const = 0;
+	virtual size_t meta_enum_value_count(size_t index) const = 0;
+	virtual const char* meta_enum_value(size_t index, size_t value_index) const = 0;
+
+	/// Formats the track with all of the source's formatted fields at once, so that sources can share the work between them.
+	/// Resizes values to the number of fields. They stay valid until the next call to read() or format_fields().
+	virtual void format_fields(std::vector<field_value>& values) const = 0;
+};
+
+//------------------------------------------------------------------------------
+
+/// The library being exported.
+class track_source
+{
+public:
+	virtual ~track_source() {}
+
+	virtual size_t get_track_count() const = 0;
+	virtual const std::vector<formatted_field>& get_formatted_fields() const = 0;
+	virtual std::unique_ptr<track_reader> create_reader() = 0;
+
+	/// Identify a track without reading its info, so it can be looked up in a fragment_cache.
+	/// May be called from several threads at once. The returned string must stay valid for the lifetime of the source.
+	virtual const char* get_track_path(size_t index) const = 0;
+	virtual unsigned get_track_subsong_index(size_t index) const = 0;
+};
+
+//------------------------------------------------------------------------------
+
+/// Receives progress and diagnostics from the export.
+class export_status
+{
+public:
+	virtual ~export_status() {}
+
+	virtual void set_progress(size_t done, size_t total) = 0;
+
+	/// Called regularly; throws if the export should stop.
+	virtual void check_abort() = 0;
+
+	virtual void log(const char* message) = 0;
+};
+
+//------------------------------------------------------------------------------
+
+enum output_compression
+{
+	compression_none,
+	compression_gzip
+};
+
+/// The compression implied by a file's extension: gzip for ".gz", none otherwise.
+output_compression compression_for_file_path(const std::string& file_path);
+
+//------------------------------------------------------------------------------
+
+enum output_format
+{
+	format_json,
+
+	/// The same values as the JSON, encoded as MessagePack. Each container is assembled in memory until it ends,
+	/// as MessagePack gives containers' sizes up front, so the top-level value is held in memory in its entirety,
+	/// unless it's the lines layout, which writes each track as a separate MessagePack value one after another.
+	format_msgpack,
+
+	/// The same values as the JSON, encoded as CBOR, with indefinite-length maps and arrays so they can be streamed.
+	/// With the lines layout, each track is written as a separate CBOR value, making a CBOR sequence (RFC 8742).
+	format_cbor
+};
+
+/// The format implied by a file's extension, ignoring any ".gz": MessagePack for ".msgpack", CBOR for ".cbor", JSON otherwise.
+output_format format_for_file_path(const std::string& file_path);
+
+//------------------------------------------------------------------------------
+
+enum output_layout
+{
+	/// An array with an object for each track: [{"path": p, "meta": {...}, ...}, ...]
+	layout_tracks,
+
+	/// An array for each property, holding its value for every track, so that keys aren't repeated and readers can load
+	/// only the properties they need: {"track_count": n, "columns": {"path": [...], "meta.ARTIST": [...], ...}}
+	/// Properties are named by their place in the track objects, e.g. "length", "info.codec" or "playback_stats.play_count".
+	/// Columns of properties most tracks have hold null for tracks without them; columns of the rest are sparse,
+	/// {"tracks": [indices of the tracks which have the property], "values": [their values]}.
+	layout_columns,
+
+	/// Newline-delimited JSON: each track's object on a line of its own, without the array around them, so the file can be
+	/// split at any line break and the pieces read in parallel, appended to, or read as it's written. Never pretty-printed.
+	layout_lines
+};
+
+//------------------------------------------------------------------------------
+
+struct export_options
+{
+	export_options();
+
+	output_format format;
+	bool pretty_print;		///< Only applies to JSON.
+	bool stream_output;		///< Write each track as it's read, rather than building the whole document in memory first.
+	unsigned thread_count;	///< Number of threads serializing tracks when streaming; 1 serializes them on the calling thread.
+
+	size_t output_buffer_size;		///< Size of each buffer handed to the I/O thread.
+	size_t output_buffer_count;		///< Number of buffers; while one is being filled, the rest can be waiting to be written.
+
+	/// Write through a memory mapping of the output file instead of the buffers above.
+	/// Lines end in '\n' even on Windows, as the file is written exactly as serialized.
+	bool memory_map_output;
+
+	/// How the tracks are laid out. Only the tracks and lines layouts can be written as MessagePack or CBOR. Columns are gathered in memory in one pass over the tracks, on the calling thread,
+	/// so stream_output, thread_count and cache don't apply to them. Journals always use the tracks layout.
+	output_layout layout;
+
+	/// Properties, named as in layout_columns (e.g. "meta.GENRE" or "info.codec"), whose string values are written as indices
+	/// into a table of strings written before the tracks: {"strings": [...], "encoded": [these properties], "tracks": [...]}
+	/// Only applies to the tracks layout, not lines, and only to JSON. The tracks are serialized in memory, on the calling thread, while the table is built,
+	/// so stream_output, thread_count and cache don't apply either.
+	std::vector<std::string> dictionary_properties;
+
+	/// Order the table by how often each string is used, so the commonest get the shortest indices; otherwise by first use.
+	bool sort_dictionary_by_frequency;
+
+	/// Compress the output on its way to the file, using thread_count threads alongside the exporting one.
+	output_compression compression;
+
+	/// If set, tracks are copied from this cache where possible rather than being read and serialized,
+	/// and tracks which had to be serialized are added to it. Only used when streaming.
+	fragment_cache* cache;
+
+	/// If the tracks were read before the export, e.g. into a track_snapshot, a scope for cache begun before the first of them was read,
+	/// so that tracks which changed since aren't stored in the cache from what was read. Otherwise the export begins its own.
+	const cache_export_scope* cache_scope;
+
+	/// Split the tracks between several files, each valid on its own: "library.json" becomes "library.0001.json", "library.0002.json", ...
+	/// and "library.manifest.json", which lists each shard's file name, tracks, size and CRC-32, so the shards can be read in parallel.
+	/// A shard ends once it holds shard_track_count tracks, or before the track which would take the size of its tracks past shard_size bytes,
+	/// before any compression; it always holds at least one track. 0 means no limit; 0 for both writes a single file as usual.
+	/// Only the tracks themselves are counted, so a shard's file is a little bigger than shard_size, by the brackets, separators and
+	/// indentation around them, which depend on the format.
+	/// Only applies to the tracks and lines layouts. Tracks are always streamed, on thread_count threads, using the cache if there is one.
+	size_t shard_track_count;
+	uint64_t shard_size;
+
+	/// Write each directory in the tracks' paths once, in a table before the tracks, and each track's path as the index of its directory
+	/// and its file name: {"directories": [...], "tracks": [{"path": [directory index, file name], ...}, ...]}
+	/// A track's path is its directory followed by its file name. Only applies to the tracks layout, without a string table or shards.
+	bool directory_table;
+
+	/// If set, the time spent in each stage of the export, the bytes written and the memory allocated are added to these,
+	/// along with the settings above. Stages before the export, such as reading the library into a snapshot, are up to the caller.
+	export_metrics* metrics;
+
+	/// The most bytes the export may hold in memory: the document when it's built in memory (stream_output off), counting the
+	/// chunks it's allocated in rather than what's in them, or the columns, or the serialized tracks and string table, which
+	/// those layouts gather before writing them, counting what's in them, or the cache's keys and fragments. Each is limited
+	/// on its own, and a track_snapshot takes its own ceiling, which callers should set to this. The export throws export_error
+	/// rather than going over, e.g. so that a library too big for a 32-bit process fails the export instead of the process.
+	/// 0 means no limit, though running out of memory still throws.
+	uint64_t memory_ceiling;
+};
+
+//------------------------------------------------------------------------------
+
+/// Where a sharded export to file_path writes the shard with the given index, counting from 0, e.g. "library.0001.json" for "library.json".
+std::string shard_file_path(const std::string& file_path, size_t index);
+
+/// Where a sharded export to file_path writes the manifest listing its shards, e.g. "library.manifest.json" for "library.json".
+std::string manifest_file_path(const std::string& file_path);
+
+/// Where the metrics of an export to file_path are written, e.g. "library.stats.json" for "library.json" or "library.json.gz".
+std::string stats_file_path(const std::string& file_path);
+
+//------------------------------------------------------------------------------
+
+/// Exports every track in the source to a JSON file (or MessagePack or CBOR, as options.format says),
+/// or to several, as options.shard_track_count and shard_size say; throws export_error on failure.
+void export_library_as_json_file(const std::string& file_path, track_source& source, const export_options& options, export_status& status);
+
+/// Exports the changes made to the library since an earlier export, as recorded by a change_journal, to a JSON file:
+/// {"from_generation": n, "generation": m, "updated": [tracks added or modified], "removed": [{"path": p, "subsong_index": i}]}
+/// Applying it to the export of from_generation brings that up to date. Throws export_error on failure.
+void export_changes_as_json_file(const std::string& file_path, track_source& updated_tracks, const std::vector<track_change>& removed_tracks, uint64_t from_generation, uint64_t generation, const export_options& options, export_status& status);
+
+/// Writes an export's metrics to a JSON file, for comparing exports made with different settings:
+/// {"tracks": n, "seconds": s, "stages": {"enumeration": {"seconds": s, "count": n}, ...}, "bytes_written": b,
+///  "allocations": {"count": n, "bytes": b, "chunks": n, "peak_bytes": b}, "memory": {"resident_at_start": b, "peak_resident": b}, "settings": {"thread_count": n, ...}}
+/// "allocations" is null if they weren't measured, i.e. neither a document nor a snapshot was built. Throws export_error on failure.
+void export_metrics_as_json_file(const std::string& file_path, const export_metrics& metrics, export_status& status);
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
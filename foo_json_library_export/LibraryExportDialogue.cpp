@@ -3,51 +3,159 @@
 #include "FoobarSDKWrapper.h"
 #include "ATLHelpersWrapper.h"
 #include "DatabaseScopeLock.h"
+#include "ExportMetrics.h"
+#include "FragmentCache.h"
+#include "LibraryChanges.h"
 #include "LibraryExport.h"
-#include "RapidJsonWrapper.h"
+#include "MetadbTrackSource.h"
 #include "resource.h"
 #include "ToString.h"
+#include "TrackSnapshot.h"
 
-#include <memory>
 #include <regex>
+#include <vector>
 
 namespace
 {
 
-pfc::string8 title_format(const metadb_handle_ptr& track, const file_info& fileInfo, const titleformat_object::ptr& script)
+// Forwards progress and diagnostics from the export engine to foobar2000.
+class ThreadedProcessExportStatus : public jsonexport::export_status
 {
-	pfc::string8 formatted;
-	track->format_title_from_external_info_nonlocking(fileInfo, nullptr, formatted, script, nullptr);
-	return formatted;
-}
+public:
+	ThreadedProcessExportStatus(threaded_process_status& status, abort_callback& abort)
+		: m_status(status)
+		, m_abort(abort)
+	{
+	}
 
-// string_key must exist until after the JSON object is destroyed, as a copy will not be taken.
-void add_string_value_to_json_object_if_not_empty(const char* string_key, const pfc::string8& string_value, rapidjson::Value& json_object, rapidjson::MemoryPoolAllocator<rapidjson::CrtAllocator>& allocator)
-{
-	if(!string_value.is_empty())
+	virtual void set_progress(size_t done, size_t total) override
 	{
-		rapidjson::Value json_value(string_value.get_ptr(), allocator);
-		json_object.AddMember(string_key, json_value, allocator);
+		m_status.set_progress(done, total);
 	}
-}
 
-FILE* fopen_or_exception(const char* fileName, const char* mode)
-{
-	if(!fileName || !mode)
+	virtual void check_abort() override
 	{
-		throw std::invalid_argument("Invalid argument passed to fopen");
+		// Will throw an exception if the user has chosen to abort.
+		m_abort.check();
 	}
 
-#pragma warning (push)
-#pragma warning (disable: 4996)
-	return fopen(fileName, mode);
-#pragma warning (pop)
-}
+	virtual void log(const char* message) override
+	{
+		console::print(message);
+	}
+
+private:
+	// Non-copyable.
+	ThreadedProcessExportStatus(const ThreadedProcessExportStatus&);
+	ThreadedProcessExportStatus& operator=(const ThreadedProcessExportStatus&);
+
+	threaded_process_status& m_status;
+	abort_callback& m_abort;
+};
 
 // {744A7590-0DE7-4429-B31E-9B30FDBE2545}
 static const GUID config_export_path_guid = { 0x744a7590, 0xde7, 0x4429, { 0xb3, 0x1e, 0x9b, 0x30, 0xfd, 0xbe, 0x25, 0x45 } };
 cfg_string config_export_path(config_export_path_guid, "");
 
+// Fields to export besides the playback statistics, one "key = script" or "key:type = script" per line.
+// {B72E4D91-3A6F-4C08-9E15-D8C3F07A6B24}
+static const GUID config_extra_fields_guid = { 0xb72e4d91, 0x3a6f, 0x4c08, { 0x9e, 0x15, 0xd8, 0xc3, 0xf0, 0x7a, 0x6b, 0x24 } };
+cfg_string config_extra_fields(config_extra_fields_guid, "");
+
+// {9504C3E2-B2B5-48F9-B255-14A35B8ED952}
+static const GUID advconfig_branch_guid = { 0x9504c3e2, 0xb2b5, 0x48f9, { 0xb2, 0x55, 0x14, 0xa3, 0x5b, 0x8e, 0xd9, 0x52 } };
+advconfig_branch_factory advconfig_export_branch("JSON library export", advconfig_branch_guid, advconfig_branch::guid_branch_tools, 0);
+
+// {52C72468-AC5C-46C6-A920-79F044FABEF5}
+static const GUID advconfig_stream_output_guid = { 0x52c72468, 0xac5c, 0x46c6, { 0xa9, 0x20, 0x79, 0xf0, 0x44, 0xfa, 0xbe, 0xf5 } };
+advconfig_checkbox_factory advconfig_stream_output("Stream JSON straight to the file instead of building it in memory first", advconfig_stream_output_guid, advconfig_branch_guid, 0, true);
+
+// {54924700-8323-4092-9744-62C218B99C5E}
+static const GUID advconfig_thread_count_guid = { 0x54924700, 0x8323, 0x4092, { 0x97, 0x44, 0x62, 0xc2, 0x18, 0xb9, 0x9c, 0x5e } };
+advconfig_integer_factory advconfig_thread_count("Number of threads to serialize tracks with when streaming (0 = automatic)", advconfig_thread_count_guid, advconfig_branch_guid, 1, 0, 0, 64);
+
+// {194300E3-0C4D-45D4-8931-3B0E886F996C}
+static const GUID advconfig_memory_map_output_guid = { 0x194300e3, 0xc4d, 0x45d4, { 0x89, 0x31, 0x3b, 0x0e, 0x88, 0x6f, 0x99, 0x6c } };
+advconfig_checkbox_factory advconfig_memory_map_output("Write the output file through a memory mapping", advconfig_memory_map_output_guid, advconfig_branch_guid, 2, false);
+
+// Off by default, as the cache holds on to a copy of the exported JSON, which for large libraries is hundreds of megabytes.
+// {C8E1E4B3-7A3C-4B0C-9F4E-5D2A61B7C9A1}
+static const GUID advconfig_cache_tracks_guid = { 0xc8e1e4b3, 0x7a3c, 0x4b0c, { 0x9f, 0x4e, 0x5d, 0x2a, 0x61, 0xb7, 0xc9, 0xa1 } };
+advconfig_checkbox_factory advconfig_cache_tracks("Keep exported tracks in memory, so later exports only serialize tracks that have changed", advconfig_cache_tracks_guid, advconfig_branch_guid, 3, false);
+
+// {6B2F9E47-0C1D-4A85-B3E6-92D7F58A1C03}
+static const GUID advconfig_export_changes_guid = { 0x6b2f9e47, 0x0c1d, 0x4a85, { 0xb3, 0xe6, 0x92, 0xd7, 0xf5, 0x8a, 0x1c, 0x03 } };
+advconfig_checkbox_factory advconfig_export_changes("Only export the tracks added, modified or removed since the last export, as a journal", advconfig_export_changes_guid, advconfig_branch_guid, 4, false);
+
+// Costs a copy of the library's info in memory for the duration of the export, but keeps foobar2000 responsive meanwhile.
+// {3D8A6C15-E24F-4B97-8A0D-7F1C5B39E6D2}
+static const GUID advconfig_snapshot_tracks_guid = { 0x3d8a6c15, 0xe24f, 0x4b97, { 0x8a, 0x0d, 0x7f, 0x1c, 0x5b, 0x39, 0xe6, 0xd2 } };
+advconfig_checkbox_factory advconfig_snapshot_tracks("Copy track info before serializing it, so the database is only locked briefly", advconfig_snapshot_tracks_guid, advconfig_branch_guid, 5, true);
+
+// While copying track info, the database is unlocked between batches so that foobar2000 can get on with other things.
+// {A4E0B7C2-5F36-4D1E-9C8B-2E7A6F04D315}
+static const GUID advconfig_lock_batch_tracks_guid = { 0xa4e0b7c2, 0x5f36, 0x4d1e, { 0x9c, 0x8b, 0x2e, 0x7a, 0x6f, 0x04, 0xd3, 0x15 } };
+advconfig_integer_factory advconfig_lock_batch_tracks("Most tracks to copy per database lock (0 = no limit)", advconfig_lock_batch_tracks_guid, advconfig_branch_guid, 6, 0, 0, 1000000);
+
+// {5C19F2A8-8B43-4E6D-A0F7-D36E8B1C4A92}
+static const GUID advconfig_lock_batch_milliseconds_guid = { 0x5c19f2a8, 0x8b43, 0x4e6d, { 0xa0, 0xf7, 0xd3, 0x6e, 0x8b, 0x1c, 0x4a, 0x92 } };
+advconfig_integer_factory advconfig_lock_batch_milliseconds("Most milliseconds to hold the database lock for at a time while copying tracks (0 = no limit)", advconfig_lock_batch_milliseconds_guid, advconfig_branch_guid, 7, 20, 0, 10000);
+
+// {E83B5D10-6A2C-4F97-B1D4-0C9E7F2A8B36}
+static const GUID advconfig_benchmark_formatting_guid = { 0xe83b5d10, 0x6a2c, 0x4f97, { 0xb1, 0xd4, 0x0c, 0x9e, 0x7f, 0x2a, 0x8b, 0x36 } };
+advconfig_checkbox_factory advconfig_benchmark_formatting("Log how long titleformatting playback statistics takes per track", advconfig_benchmark_formatting_guid, advconfig_branch_guid, 8, false);
+
+// How the tracks are laid out; only one of these can be chosen.
+// {C5E1A8D4-7B2F-4693-9A0C-E4D63F81B257}
+static const GUID advconfig_layout_branch_guid = { 0xc5e1a8d4, 0x7b2f, 0x4693, { 0x9a, 0x0c, 0xe4, 0xd6, 0x3f, 0x81, 0xb2, 0x57 } };
+advconfig_branch_factory advconfig_layout_branch("Layout", advconfig_layout_branch_guid, advconfig_branch_guid, 9);
+
+// {6E3B0F27-9D84-4C1A-B5E2-07A9C4D8F163}
+static const GUID advconfig_tracks_layout_guid = { 0x6e3b0f27, 0x9d84, 0x4c1a, { 0xb5, 0xe2, 0x07, 0xa9, 0xc4, 0xd8, 0xf1, 0x63 } };
+advconfig_radio_factory advconfig_tracks_layout("An array with an object for each track", advconfig_tracks_layout_guid, advconfig_layout_branch_guid, 0, true);
+
+// Columns are smaller, and let readers load only the properties they need, but aren't what existing readers expect.
+// {1F6B9D43-C2A7-4E58-B3D0-6A8E2F15C974}
+static const GUID advconfig_columnar_layout_guid = { 0x1f6b9d43, 0xc2a7, 0x4e58, { 0xb3, 0xd0, 0x6a, 0x8e, 0x2f, 0x15, 0xc9, 0x74 } };
+advconfig_radio_factory advconfig_columnar_layout("An array for each property (columns)", advconfig_columnar_layout_guid, advconfig_layout_branch_guid, 1, false);
+
+// Lines can be split between readers at any line break, and appended to.
+// {A07D4C92-3E5B-4F18-8C6D-B2F1E9A40D35}
+static const GUID advconfig_lines_layout_guid = { 0xa07d4c92, 0x3e5b, 0x4f18, { 0x8c, 0x6d, 0xb2, 0xf1, 0xe9, 0xa4, 0x0d, 0x35 } };
+advconfig_radio_factory advconfig_lines_layout("A line for each track (newline-delimited JSON)", advconfig_lines_layout_guid, advconfig_layout_branch_guid, 2, false);
+
+// Read on the export thread, so needs the thread-safe kind of string entry.
+// {94C0E2B7-1D5A-4F83-A6E9-3B7D8C20F514}
+static const GUID advconfig_dictionary_properties_guid = { 0x94c0e2b7, 0x1d5a, 0x4f83, { 0xa6, 0xe9, 0x3b, 0x7d, 0x8c, 0x20, 0xf5, 0x14 } };
+advconfig_string_factory_MT advconfig_dictionary_properties("Properties to write as indices into a table of strings, e.g. meta.GENRE; info.codec", advconfig_dictionary_properties_guid, advconfig_branch_guid, 10, "");
+
+// {2D8F5A61-B93E-4C07-8E4A-F1C6D0B73A92}
+static const GUID advconfig_sort_dictionary_guid = { 0x2d8f5a61, 0xb93e, 0x4c07, { 0x8e, 0x4a, 0xf1, 0xc6, 0xd0, 0xb7, 0x3a, 0x92 } };
+advconfig_checkbox_factory advconfig_sort_dictionary("Order the table of strings so the most used strings get the shortest indices", advconfig_sort_dictionary_guid, advconfig_branch_guid, 11, true);
+
+// {2399EF36-961C-456D-AEB0-E0299CE1ED94}
+static const GUID advconfig_shard_tracks_guid = { 0x2399ef36, 0x961c, 0x456d, { 0xae, 0xb0, 0xe0, 0x29, 0x9c, 0xe1, 0xed, 0x94 } };
+advconfig_integer_factory advconfig_shard_tracks("Split the output into files of at most this many tracks, listed in a manifest (0 = no limit)", advconfig_shard_tracks_guid, advconfig_branch_guid, 12, 0, 0, 100000000);
+
+// {E2FC1239-2573-42DD-A8FB-27A8ABA18E93}
+static const GUID advconfig_shard_megabytes_guid = { 0xe2fc1239, 0x2573, 0x42dd, { 0xa8, 0xfb, 0x27, 0xa8, 0xab, 0xa1, 0x8e, 0x93 } };
+advconfig_integer_factory advconfig_shard_megabytes("Split the output into files of about this many MB: at most this many of tracks, before compression, plus a little framing; listed in a manifest (0 = no limit)", advconfig_shard_megabytes_guid, advconfig_branch_guid, 13, 0, 0, 1000000);
+
+// {1ED89FC2-7C6D-4647-A345-F735E97DAC06}
+static const GUID advconfig_directory_table_guid = { 0x1ed89fc2, 0x7c6d, 0x4647, { 0xa3, 0x45, 0xf7, 0x35, 0xe9, 0x7d, 0xac, 0x06 } };
+advconfig_checkbox_factory advconfig_directory_table("Write each directory once, in a table, and tracks' paths as their directory's index and file name", advconfig_directory_table_guid, advconfig_branch_guid, 14, false);
+
+// For tuning the thread and lock settings above: shows where the time goes on this machine and library.
+// {8F3D6A29-C174-4E5B-9A02-B6E1D7C84F50}
+static const GUID advconfig_export_metrics_guid = { 0x8f3d6a29, 0xc174, 0x4e5b, { 0x9a, 0x02, 0xb6, 0xe1, 0xd7, 0xc8, 0x4f, 0x50 } };
+advconfig_checkbox_factory advconfig_export_metrics("Time each stage of the export, and write the times to a .stats.json file beside it", advconfig_export_metrics_guid, advconfig_branch_guid, 15, false);
+
+// foobar2000 is often a 32-bit process, which a large library's document can run out of address space in;
+// better to fail the export than to take foobar2000 down with it.
+// {4B7E2C91-D05A-4F36-8E1B-A93C6F2D7508}
+static const GUID advconfig_memory_ceiling_guid = { 0x4b7e2c91, 0xd05a, 0x4f36, { 0x8e, 0x1b, 0xa9, 0x3c, 0x6f, 0x2d, 0x75, 0x08 } };
+advconfig_integer_factory advconfig_memory_ceiling("Most MB of memory to build the JSON in, copy track info into or cache tracks in, before giving up (0 = no limit)", advconfig_memory_ceiling_guid, advconfig_branch_guid, 16, 0, 0, 1000000);
+
 } // anonymous namespace
 
 namespace libraryexport
@@ -56,10 +164,16 @@ namespace libraryexport
 class library_export_process : public threaded_process_callback
 {
 public:
-	explicit library_export_process(const pfc::string8& filePath, const pfc::list_t<metadb_handle_ptr>& library)
+	// generation is the one ended when the library was listed, which the export captures.
+	library_export_process(const pfc::string8& filePath, const pfc::list_t<metadb_handle_ptr>& library, t_uint64 generation, double enumerationSeconds, const std::vector<jsonexport::formatted_field>& fields)
 	    : m_filePath(filePath)
 		, m_failureMessage()
 		, m_library(library)
+		, m_enumerationSeconds(enumerationSeconds)
+		, m_fields(fields)
+		, m_fromGeneration(getLastExportedGeneration())
+		, m_generation(generation)
+		, m_exportedGeneration(0)
 	{
 	}
 
@@ -71,243 +185,156 @@ public:
 	{
 		try
 		{
-			// Start the status off at 0%.
-			p_status.set_progress(0, 1);
-
-			// Open the file for writing before doing anything else (to avoid wasting time in case it's not writable).
-			console::print("Opening output file.");
-			std::shared_ptr<FILE> file = std::shared_ptr<FILE>(fopen_or_exception(m_filePath.get_ptr(), "w"), [](FILE* file){ if(file) fclose(file); });
-
-			if(!file)
+			ThreadedProcessExportStatus status(p_status, p_abort);
+
+			jsonexport::export_options options;
+			options.stream_output = advconfig_stream_output.get();
+			options.memory_map_output = advconfig_memory_map_output.get();
+			options.compression = jsonexport::compression_for_file_path(m_filePath.get_ptr());
+			options.format = jsonexport::format_for_file_path(m_filePath.get_ptr());
+			options.thread_count = static_cast<unsigned>(advconfig_thread_count.get());
+			options.layout = advconfig_columnar_layout.get() ? jsonexport::layout_columns
+				: advconfig_lines_layout.get() ? jsonexport::layout_lines
+				: jsonexport::layout_tracks;
+
+			pfc::string8 dictionaryProperties;
+			advconfig_dictionary_properties.get(dictionaryProperties);
+			options.dictionary_properties = jsonexport::parse_property_list(dictionaryProperties.get_ptr());
+			options.sort_dictionary_by_frequency = advconfig_sort_dictionary.get();
+			options.shard_track_count = static_cast<size_t>(advconfig_shard_tracks.get());
+			options.shard_size = advconfig_shard_megabytes.get() * 1024 * 1024;
+			options.directory_table = advconfig_directory_table.get();
+			options.memory_ceiling = advconfig_memory_ceiling.get() * 1024 * 1024;
+
+			if(options.thread_count == 0)
 			{
-				m_failureMessage = "Failed to open file for writing; aborting";
-				console::print(m_failureMessage);
-				return;
+				// Same heuristic as the SDK's own multithreaded sorting: don't bother with threads for small libraries.
+				options.thread_count = static_cast<unsigned>(pfc::getOptimalWorkerThreadCountEx(m_library.get_count() / 1024));
 			}
 
-			// Compile titleformatting scripts ahead of time.
-			console::print("Compiling titleformatting scripts ahead of time.");
-
-			static_api_ptr_t<titleformat_compiler> compiler;
-
-			// Playback statistics fields.
-			titleformat_object::ptr first_played_script;
-			compiler->compile_force(first_played_script, "[%first_played%]");
-			titleformat_object::ptr last_played_script;
-			compiler->compile_force(last_played_script, "[%last_played%]");
-			titleformat_object::ptr play_count_script;
-			compiler->compile_force(play_count_script, "[%play_count%]");
-			titleformat_object::ptr added_script;
-			compiler->compile_force(added_script, "[%added%]");
-			titleformat_object::ptr rating_script;
-			compiler->compile_force(rating_script, "[%rating%]");
-
-			// foo_customdb fields when using marc2003's last.fm sync scripts.
-			titleformat_object::ptr lastfm_playcount_script;
-			compiler->compile_force(lastfm_playcount_script, "[%LASTFM_PLAYCOUNT_DB%]");
-			titleformat_object::ptr lastfm_loved_script;
-			compiler->compile_force(lastfm_loved_script, "[%LASTFM_LOVED_DB%]");
-
-			// todo: allow user to specify list of extra titleformatting snippets they wish to be saved.
-
-			console::print("Creating in-memory JSON.");
-
-			// JSON will be formatted as such:
-			// [{"path":"path/to/1", "title":"abc"},{"path":"path/to/2", "title":"def"}]
-			rapidjson::Document document;
-			document.SetArray();
-
-			auto& allocator = document.GetAllocator();
-
-			// Lock the database for the duration of this scope.
-			DatabaseScopeLock databaseLock;
-
-			document.Reserve(m_library.get_count(), allocator);
-
-			for(t_size track_index = 0; track_index < m_library.get_count(); ++track_index)
+			if(advconfig_cache_tracks.get())
 			{
-				// Check if the user has chosen to abort; will throw an exception if this is the case.
-				p_abort.check();
+				options.cache = &getExportCache();
+			}
+			else
+			{
+				// Don't hold on to tracks from when the cache was enabled.
+				getExportCache().clear();
+			}
 
-				// Update the progress bar.
-				p_status.set_progress(track_index, m_library.get_count());
+			// todo: add UI option for pretty print.
 
-				const metadb_handle_ptr& track = m_library.get_item(track_index);
+			pfc::hires_timer exportTimer;
+			exportTimer.start();
 
-				const file_info* fileInfo = nullptr;
-				const bool success = track->get_info_locked(fileInfo);
+			// The library was listed on the main thread before this started, so that's added rather than timed here.
+			std::unique_ptr<jsonexport::export_metrics> metrics;
 
-				if(!success || !fileInfo)
-				{
-					uPrintf(m_failureMessage, "Failed to get info on track: %s", track->get_path());
-					console::print(m_failureMessage);
-					return;
-				}
+			if(advconfig_export_metrics.get())
+			{
+				metrics.reset(new jsonexport::export_metrics());
+				metrics->add_stage_time(jsonexport::stage_enumeration, m_enumerationSeconds, m_library.get_count());
+				metrics->set_setting("snapshot", advconfig_snapshot_tracks.get());
+				metrics->set_setting("lock_batch_tracks", advconfig_lock_batch_tracks.get());
+				metrics->set_setting("lock_batch_milliseconds", advconfig_lock_batch_milliseconds.get());
+				options.metrics = metrics.get();
+			}
 
-				// Create a JSON object for the track.
-				rapidjson::Value trackValue;
-				trackValue.SetObject();
+			// Begun before any track is read, so that a track edited after it's copied into the snapshot, but before it's serialized,
+			// isn't cached from its old info.
+			const jsonexport::cache_export_scope cacheScope(options.cache);
+			options.cache_scope = &cacheScope;
 
-				// Track properties.
+			// Lock the database until the tracks have been read, or in batches while they're copied into the snapshot.
+			// Worker threads read track info under this thread's lock, as the SDK's multithreaded sorting does.
+			DatabaseScopeLock databaseLock(metrics.get());
 
-				// No need to copy string (by passing rapidjson allocator)
-				// as foobar guarantees string is valid until metadb handle is released,
-				// which will be after we've saved the file.
-				// In general though, most strings below will need to be copied as the API doesn't guarantee they'll stick around.
-				rapidjson::Value pathValue(track->get_path());
-				trackValue.AddMember("path", pathValue, allocator);
+			const bool exportingChanges = advconfig_export_changes.get();
+			pfc::list_t<metadb_handle_ptr> updatedTracks;
+			std::vector<jsonexport::track_change> removedTracks;
 
-				rapidjson::Value subsongIndexValue(track->get_subsong_index());
-				trackValue.AddMember("subsong_index", subsongIndexValue, allocator);
+			if(exportingChanges)
+			{
+				jsonexport::stage_timer changesTimer(metrics.get(), jsonexport::stage_enumeration, 0);
+				getChanges(updatedTracks, removedTracks);
+				changesTimer.set_count(updatedTracks.get_count() + removedTracks.size());
+			}
 
-				// Let's not bother saving out timestamp and file size;
-				// these are properties of the files themselves which require no special parsing or decoding.
+			console::print("Compiling titleformatting scripts ahead of time.");
+			MetadbTrackSource metadbSource(exportingChanges ? updatedTracks : m_library, m_fields);
 
-				// This is the only thing the file_info struct has that isn't calculated from other fields.
-				// e.g. "number of samples" which the foobar interface shows in a track's properties,
-				// is actually calculated from length and bitrate.
-				rapidjson::Value lengthValue(fileInfo->get_length());
-				trackValue.AddMember("length", lengthValue, allocator);
+			if(advconfig_benchmark_formatting.get())
+			{
+				double fusedSeconds = 0.0;
+				double separateSeconds = 0.0;
+				metadbSource.benchmarkFormatting(1000, fusedSeconds, separateSeconds);
 
-				// Replaygain data.
-				const auto& replay_gain_info = fileInfo->get_replaygain();
-				const bool is_album_gain_present = replay_gain_info.is_album_gain_present();
-				const bool is_album_peak_present = replay_gain_info.is_album_peak_present();
-				const bool is_track_gain_present = replay_gain_info.is_track_gain_present();
-				const bool is_track_peak_present = replay_gain_info.is_track_peak_present();
+				console::printf("Formatting playback statistics takes %s us per track with one script for all fields, or %s us with one script per field.",
+					to_string(fusedSeconds * 1000000.0, 3).c_str(), to_string(separateSeconds * 1000000.0, 3).c_str());
+			}
 
-				if(is_album_gain_present || is_album_peak_present || is_track_gain_present || is_track_peak_present)
-				{
-					rapidjson::Value replayGainContainerValue;
-					replayGainContainerValue.SetObject();
-
-					if(replay_gain_info.is_album_gain_present())
-					{
-						rapidjson::Value replayGainValue(replay_gain_info.m_album_gain);
-						replayGainContainerValue.AddMember("album_gain", replayGainValue, allocator);
-					}
-
-					if(replay_gain_info.is_album_peak_present())
-					{
-						rapidjson::Value replayGainValue(replay_gain_info.m_album_peak);
-						replayGainContainerValue.AddMember("album_peak", replayGainValue, allocator);
-					}
-
-					if(replay_gain_info.is_track_gain_present())
-					{
-						rapidjson::Value replayGainValue(replay_gain_info.m_track_gain);
-						replayGainContainerValue.AddMember("track_gain", replayGainValue, allocator);
-					}
-
-					if(replay_gain_info.is_track_peak_present())
-					{
-						rapidjson::Value replayGainValue(replay_gain_info.m_track_peak);
-						replayGainContainerValue.AddMember("track_peak", replayGainValue, allocator);
-					}
-
-					trackValue.AddMember("replaygain", replayGainContainerValue, allocator);
-				}
+			// Reading from the database is what's timed, whether into the snapshot or straight into the output.
+			std::unique_ptr<jsonexport::metered_source> meteredSource(metrics ? new jsonexport::metered_source(metadbSource, *metrics) : nullptr);
+			jsonexport::track_source& librarySource = meteredSource ? static_cast<jsonexport::track_source&>(*meteredSource) : metadbSource;
 
-				// 'info', which is technical details about the file.
-				if(fileInfo->info_get_count() > 0)
-				{
-					rapidjson::Value infoValue;
-					infoValue.SetObject();
+			// Copying the tracks first lets the database be unlocked before serializing and writing them, which take far longer.
+			std::unique_ptr<jsonexport::track_snapshot> snapshot;
 
-					for(t_size i = 0; i < fileInfo->info_get_count(); ++i)
-					{
-						rapidjson::Value individualInfoValue(fileInfo->info_enum_value(i), allocator);
-						infoValue.AddMember(fileInfo->info_enum_name(i), allocator, individualInfoValue, allocator);
-					}
+			if(advconfig_snapshot_tracks.get())
+			{
+				const size_t tracksPerBatch = static_cast<size_t>(advconfig_lock_batch_tracks.get());
+				const double secondsPerBatch = static_cast<double>(advconfig_lock_batch_milliseconds.get()) / 1000.0;
 
-					trackValue.AddMember("info", infoValue, allocator);
-				}
+				const jsonexport::stage_timer snapshotTimer(metrics.get(), jsonexport::stage_build, librarySource.get_track_count());
+				snapshot.reset(new jsonexport::track_snapshot(librarySource, options.thread_count, databaseLock, tracksPerBatch, secondsPerBatch, status, options.memory_ceiling));
+				databaseLock.release();
 
-				// 'meta', which are metadata about the track, normally called its 'tags'.
-				// Note that unlike 'info', all meta fields can be multi-valued, so we save them out as arrays.
-				// todo: add option to save single-valued fields as values directly rather than one-element arrays.
-				if(fileInfo->meta_get_count() > 0)
+				if(metrics)
 				{
-					rapidjson::Value metaValue;
-					metaValue.SetObject();
-
-					for(t_size i = 0; i < fileInfo->meta_get_count(); ++i)
-					{
-						rapidjson::Value individualMetaValue;
-						individualMetaValue.SetArray();
-						individualMetaValue.Reserve(fileInfo->meta_enum_value_count(i), allocator);
-
-						for(t_size j = 0; j < fileInfo->meta_enum_value_count(i); ++j)
-						{
-							individualMetaValue.PushBack(fileInfo->meta_enum_value(i, j), allocator);
-						}
-
-						metaValue.AddMember(fileInfo->meta_enum_name(i), allocator, individualMetaValue, allocator);
-					}
-
-					trackValue.AddMember("meta", metaValue, allocator);
+					metrics->add_allocations(snapshot->get_allocation_count(), snapshot->get_allocated_bytes(), snapshot->get_block_count(), snapshot->get_size());
 				}
 
-				// Playback statistics. I don't know if there's an API for the component, or if that's even possible,
-				// so we do the expensive and inextensible thing and query for its fields using titleformatting.
-				// Scripts have already been compiled; we just need to format the track with them and add their values
-				// if present.
-
-				const pfc::string8 first_played_string		= title_format(track, *fileInfo, first_played_script);
-				const pfc::string8 last_played_string		= title_format(track, *fileInfo, last_played_script);
-				const pfc::string8 play_count_string		= title_format(track, *fileInfo, play_count_script);
-				const pfc::string8 added_string				= title_format(track, *fileInfo, added_script);
-				const pfc::string8 rating_string			= title_format(track, *fileInfo, rating_script);
-
-				const pfc::string8 lastfm_playcount_string	= title_format(track, *fileInfo, lastfm_playcount_script);
-				const pfc::string8 lastfm_loved_string		= title_format(track, *fileInfo, lastfm_loved_script);
-
-				if( !first_played_string.is_empty()		||
-					!last_played_string.is_empty()		||
-					!play_count_string.is_empty()		||
-					!added_string.is_empty()			||
-					!rating_string.is_empty()			||
-					!lastfm_playcount_string.is_empty()	||
-					!lastfm_loved_string.is_empty()
-				)
-				{
-					rapidjson::Value playback_stats_value;
-					playback_stats_value.SetObject();
-
-					add_string_value_to_json_object_if_not_empty("first_played"	, first_played_string		, playback_stats_value, allocator);
-					add_string_value_to_json_object_if_not_empty("last_played"	, last_played_string		, playback_stats_value, allocator);
-					add_string_value_to_json_object_if_not_empty("play_count"	, play_count_string			, playback_stats_value, allocator);
-					add_string_value_to_json_object_if_not_empty("added"		, added_string				, playback_stats_value, allocator);
-					add_string_value_to_json_object_if_not_empty("rating"		, rating_string				, playback_stats_value, allocator);
-
-					add_string_value_to_json_object_if_not_empty("lastfm_playcount"	, lastfm_playcount_string	, playback_stats_value, allocator);
-					add_string_value_to_json_object_if_not_empty("lastfm_loved"		, lastfm_loved_string		, playback_stats_value, allocator);
+				console::printf("Copied track info into %s MB of memory; unlocked the database.", to_string(snapshot->get_size() / (1024 * 1024)).c_str());
+			}
 
-					trackValue.AddMember("playback_stats", playback_stats_value, allocator);
-				}
+			jsonexport::track_source& source = snapshot ? static_cast<jsonexport::track_source&>(*snapshot) : librarySource;
 
-				// Finally, add the whole track object to the document.
-				document.PushBack(trackValue, allocator);
+			if(exportingChanges)
+			{
+				jsonexport::export_changes_as_json_file(m_filePath.get_ptr(), source, removedTracks, m_fromGeneration, m_generation, options, status);
+			}
+			else
+			{
+				jsonexport::export_library_as_json_file(m_filePath.get_ptr(), source, options, status);
 			}
 
-			console::print("JSON built up in memory; saving to output file.");
+			databaseLock.release();
 
-			static const size_t fileWriteBufferSize = 2048;
-			char fileWriteBuffer[fileWriteBufferSize];
-			rapidjson::FileWriteStream fileStream(file.get(), fileWriteBuffer, fileWriteBufferSize);
-			// todo: add UI option for pretty print.
-			//rapidjson::Writer<rapidjson::FileWriteStream> writer(fileStream);
-			rapidjson::PrettyWriter<rapidjson::FileWriteStream> writer(fileStream);
+			const jsonexport::hold_time_histogram& holdTimes = databaseLock.getHoldTimes();
+			const double heldSeconds = holdTimes.get_total_seconds();
+			const double exportSeconds = exportTimer.query();
 
-			console::print("File stream open. Writing JSON.");
+			console::printf("Held the database lock for %s s of the %s s export (%s%%): %s.",
+				to_string(heldSeconds, 3).c_str(), to_string(exportSeconds, 3).c_str(), to_string(exportSeconds > 0.0 ? 100.0 * heldSeconds / exportSeconds : 100.0, 3).c_str(),
+				holdTimes.describe().c_str());
 
-			document.Accept(writer);
+			if(metrics)
+			{
+				console::print(metrics->summarize().c_str());
+				jsonexport::export_metrics_as_json_file(jsonexport::stats_file_path(m_filePath.get_ptr()), *metrics, status);
+			}
 
-			console::print("File written successfully.");
+			console::printf("Exported generation %s.", to_string(m_generation).c_str());
+			m_exportedGeneration = m_generation;
 		}
 		catch(const exception_aborted&)
 		{
 		}
+		catch(const jsonexport::export_error& e)
+		{
+			m_failureMessage = e.what();
+			console::print(m_failureMessage);
+		}
 		catch(const std::exception& e)
 		{
 			m_failureMessage = "Exception whilst exporting library: ";
@@ -321,6 +348,11 @@ public:
 
 	void on_done(HWND, bool p_was_aborted)
 	{
+		if(m_exportedGeneration != 0)
+		{
+			setLastExportedGeneration(m_exportedGeneration);
+		}
+
 		if(!p_was_aborted)
 		{
 			if(!m_failureMessage.is_empty())
@@ -331,9 +363,48 @@ public:
 	}
 
 private:
+	// Gets the tracks changed since the last export, for exporting rather than the whole library.
+	void getChanges(pfc::list_t<metadb_handle_ptr>& updatedTracks, std::vector<jsonexport::track_change>& removedTracks)
+	{
+		const jsonexport::change_journal& journal = getChangeJournal();
+
+		if(m_fromGeneration == 0 || !journal.is_recorded_since(m_fromGeneration))
+		{
+			throw jsonexport::export_error("Changes since the last export are unknown, as foobar2000 has been restarted since "
+				"or there hasn't been an export yet; export the whole library first.");
+		}
+
+		std::vector<jsonexport::track_change> changes;
+		journal.get_changes_since(m_fromGeneration, changes);
+
+		static_api_ptr_t<metadb> db;
+
+		for(size_t i = 0; i < changes.size(); ++i)
+		{
+			if(changes[i].removed)
+			{
+				removedTracks.push_back(changes[i]);
+			}
+			else
+			{
+				metadb_handle_ptr track;
+				db->handle_create(track, make_playable_location(changes[i].path.c_str(), changes[i].subsong_index));
+				updatedTracks.add_item(track);
+			}
+		}
+
+		console::printf("Exporting changes since generation %s: %s tracks updated, %s removed.",
+			to_string(m_fromGeneration).c_str(), to_string(updatedTracks.get_count()).c_str(), to_string(removedTracks.size()).c_str());
+	}
+
 	pfc::string8 m_filePath;
 	pfc::string8 m_failureMessage;
 	pfc::list_t<metadb_handle_ptr> m_library;
+	const double m_enumerationSeconds;
+	const std::vector<jsonexport::formatted_field> m_fields;
+	const t_uint64 m_fromGeneration;
+	const t_uint64 m_generation;
+	t_uint64 m_exportedGeneration;
 };
 
 
@@ -357,28 +428,64 @@ private:
 	BOOL OnInitDialog(CWindow, LPARAM)
 	{
 		uSetDlgItemText(*this, IDC_FILE_PATH_TEXT, config_export_path);
+		uSetDlgItemText(*this, IDC_EXTRA_FIELDS_TEXT, config_extra_fields);
 		ShowWindowCentered(*this, GetParent()); // Function declared in SDK helpers.
 		return TRUE;
 	}
 
 	void OnOk(UINT, int, CWindow)
 	{
-		exportLibrary();
-
-		DestroyWindow();
+		// Stay open if the fields can't be parsed, so they can be fixed.
+		if(exportLibrary())
+		{
+			DestroyWindow();
+		}
 	}
 
 	void OnChooseFile(UINT, int, CWindow)
 	{
-		WTL::CFileDialog fileSaveDialogue(FALSE, L"json");//, currentValue, flags, filter, parent);
+		// The output is compressed, or binary, if its extension says so, so offer those extensions as file types.
+		static const wchar_t filter[] =
+			L"JSON files (*.json)\0*.json\0"
+			L"Gzip-compressed JSON files (*.json.gz)\0*.json.gz\0"
+			L"MessagePack files (*.msgpack)\0*.msgpack\0"
+			L"CBOR files (*.cbor)\0*.cbor\0"
+			L"All files (*.*)\0*.*\0";
+		static const DWORD gzip_filter_index = 2;
+		static const DWORD msgpack_filter_index = 3;
+		static const DWORD cbor_filter_index = 4;
+
+		WTL::CFileDialog fileSaveDialogue(FALSE, L"json", nullptr, OFN_HIDEREADONLY | OFN_OVERWRITEPROMPT, filter, *this);
 
 		if(fileSaveDialogue.DoModal() == IDOK)
 		{
-			SetDlgItemText(IDC_FILE_PATH_TEXT, fileSaveDialogue.m_szFileName);
+			pfc::string8 filePath = pfc::stringcvt::string_utf8_from_wide(fileSaveDialogue.m_szFileName);
+
+			// The default extension is added regardless of the file type chosen.
+			if(fileSaveDialogue.m_ofn.nFilterIndex == gzip_filter_index && jsonexport::compression_for_file_path(filePath.get_ptr()) != jsonexport::compression_gzip)
+			{
+				filePath += ".gz";
+			}
+
+			const DWORD filterIndex = fileSaveDialogue.m_ofn.nFilterIndex;
+			const char* const binaryExtension = filterIndex == msgpack_filter_index ? ".msgpack" : filterIndex == cbor_filter_index ? ".cbor" : nullptr;
+
+			if(binaryExtension && jsonexport::format_for_file_path(filePath.get_ptr()) == jsonexport::format_json)
+			{
+				// Swap the default extension for the binary format's, rather than adding to it.
+				if(filePath.length() >= 5 && pfc::stricmp_ascii(filePath.get_ptr() + filePath.length() - 5, ".json") == 0)
+				{
+					filePath.truncate(filePath.length() - 5);
+				}
+
+				filePath += binaryExtension;
+			}
+
+			uSetDlgItemText(*this, IDC_FILE_PATH_TEXT, filePath);
 		}
 	}
 
-	void exportLibrary()
+	bool exportLibrary()
 	{
 		console::print("Starting library export.");
 
@@ -388,13 +495,38 @@ private:
 
 		console::printf("Chosen path: %s", filePath.get_ptr());
 
+		pfc::string8 extraFields;
+		uGetDlgItemText(*this, IDC_EXTRA_FIELDS_TEXT, extraFields);
+		config_extra_fields = extraFields;
+
+		std::vector<jsonexport::formatted_field> fields = jsonexport::default_formatted_fields();
+
+		try
+		{
+			const std::vector<jsonexport::formatted_field> parsedFields = jsonexport::parse_formatted_fields(extraFields.get_ptr());
+			fields.insert(fields.end(), parsedFields.begin(), parsedFields.end());
+		}
+		catch(std::exception const& e)
+		{
+			popup_message::g_complain("Could not parse the extra fields", e);
+			return false;
+		}
+
 		pfc::list_t<metadb_handle_ptr> library;
 		static_api_ptr_t<library_manager> lm;
+
+		pfc::hires_timer enumerationTimer;
+		enumerationTimer.start();
 		lm->get_all_items(library);
+		const double enumerationSeconds = enumerationTimer.query();
+
+		// Changes from now on go in the next generation. Library callbacks are made on this thread too, so no change
+		// can be made between listing the library and ending the generation, to be counted as exported without having been.
+		const t_uint64 generation = getChangeJournal().end_generation();
 
 		try
 		{
-			service_ptr_t<threaded_process_callback> cb = new service_impl_t<library_export_process>(filePath, library);
+			service_ptr_t<threaded_process_callback> cb = new service_impl_t<library_export_process>(filePath, library, generation, enumerationSeconds, fields);
 			static_api_ptr_t<threaded_process>()->run_modeless(
 			    cb,
 			    threaded_process::flag_show_progress | threaded_process::flag_show_abort,
@@ -406,6 +538,8 @@ private:
 		{
 			popup_message::g_complain("Could not start JSON library export process", e);
 		}
+
+		return true;
 	}
 
 	void OnCancel(UINT, int, CWindow)
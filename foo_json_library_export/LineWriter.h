@@ -0,0 +1,85 @@
+#pragma once
+
+#include "RapidJsonWrapper.h"
+
+namespace jsonexport {
+
+//------------------------------------------------------------------------------
+
+/// rapidjson writer which writes the elements of a top-level array as lines of compact JSON, without the array around them:
+/// newline-delimited JSON. Everything that writes the library as an array of tracks can write it as lines with this instead.
+/// Only the top-level array's elements may be written at the top level.
+template<typename OutputStream>
+class line_writer : public rapidjson::Writer<OutputStream>
+{
+	typedef rapidjson::Writer<OutputStream> base;
+
+public:
+	explicit line_writer(OutputStream& os)
+		: base(os)
+		, m_in_lines(false)
+	{
+	}
+
+	line_writer& StartArray()
+	{
+		if(base::level_stack_.Empty() && !m_in_lines)
+		{
+			m_in_lines = true;
+			return *this;
+		}
+
+		base::StartArray();
+		return *this;
+	}
+
+	line_writer& EndArray(rapidjson::SizeType elementCount = 0)
+	{
+		if(base::level_stack_.Empty())
+		{
+			RAPIDJSON_ASSERT(m_in_lines);
+			m_in_lines = false;
+			return *this;
+		}
+
+		base::EndArray(elementCount);
+		return *this;
+	}
+
+	line_writer& EndObject(rapidjson::SizeType /*memberCount*/ = 0)
+	{
+		// Unlike the base class, doesn't flush the stream at the end of each top-level value, as there's one per line.
+		RAPIDJSON_ASSERT(base::level_stack_.GetSize() >= sizeof(typename base::Level));
+		RAPIDJSON_ASSERT(!base::level_stack_.template Top<typename base::Level>()->inArray);
+		base::level_stack_.template Pop<typename base::Level>(1);
+		base::WriteEndObject();
+		end_line_if_top_level();
+		return *this;
+	}
+
+	line_writer& RawValue(const typename base::Ch* json, size_t length, rapidjson::Type type)
+	{
+		base::RawValue(json, length, type);
+		end_line_if_top_level();
+		return *this;
+	}
+
+private:
+	// Non-copyable.
+	line_writer(const line_writer&);
+	line_writer& operator=(const line_writer&);
+
+	void end_line_if_top_level()
+	{
+		if(base::level_stack_.Empty())
+		{
+			base::os_.Put('\n');
+		}
+	}
+
+	bool m_in_lines;	///< Whether the top-level array's been started, so its elements are being written as lines.
+};
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
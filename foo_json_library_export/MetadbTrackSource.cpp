@@ -0,0 +1,366 @@
+#include "MetadbTrackSource.h"
+
+#include "ScratchString.h"
+#include "ScriptCache.h"
+
+#include <algorithm>
+
+namespace libraryexport {
+
+namespace
+{
+
+// The ASCII unit separator; it's very unlikely to be in tags, and if it is, the fields are formatted one at a time instead.
+static const char fieldSeparator = '\x1F';
+
+// Whether a script can be fused with others: whether its quotes, field references, brackets and parentheses all close,
+// so that nothing in it can carry on past its end and swallow the separator after it, or the scripts after that.
+// Comments, i.e. lines starting with //, are skipped. Parentheses are checked even where they'd be plain text; that only
+// means the odd script is formatted on its own when it needn't be.
+bool isSelfContained(const char* script)
+{
+	std::vector<char> closers;
+	bool inQuote = false;
+	bool inField = false;
+	bool atLineStart = true;
+
+	for(const char* c = script; *c; ++c)
+	{
+		if(atLineStart && !inQuote && c[0] == '/' && c[1] == '/')
+		{
+			while(c[1] && c[1] != '\n')
+			{
+				++c;
+			}
+
+			continue;
+		}
+
+		atLineStart = *c == '\n';
+
+		if(*c == '\'')
+		{
+			inQuote = !inQuote;
+		}
+		else if(inQuote)
+		{
+			continue;
+		}
+		else if(*c == '%')
+		{
+			inField = !inField;
+		}
+		else if(inField)
+		{
+			continue;
+		}
+		else if(*c == '(' || *c == '[')
+		{
+			closers.push_back(*c == '(' ? ')' : ']');
+		}
+		else if(*c == ')' || *c == ']')
+		{
+			if(closers.empty() || closers.back() != *c)
+			{
+				return false;
+			}
+
+			closers.pop_back();
+		}
+	}
+
+	return !inQuote && !inField && closers.empty();
+}
+
+class MetadbTrackReader : public jsonexport::track_reader
+{
+public:
+	MetadbTrackReader(const pfc::list_t<metadb_handle_ptr>& library, const std::vector<titleformat_object::ptr>& scripts, const titleformat_object::ptr& fusedScript, const std::vector<bool>& fused)
+		: m_library(library)
+		, m_scripts(scripts)
+		, m_fusedScript(fusedScript)
+		, m_fused(fused)
+		, m_track()
+		, m_fileInfo(nullptr)
+		, m_formatted()
+		, m_separateFormatted()
+	{
+	}
+
+	virtual bool read(size_t index) override
+	{
+		m_track = m_library.get_item_ref(index);
+		m_fileInfo = nullptr;
+
+		const bool success = m_track->get_info_locked(m_fileInfo);
+		return success && m_fileInfo;
+	}
+
+	virtual const char* get_path() const override
+	{
+		return m_track->get_path();
+	}
+
+	virtual unsigned get_subsong_index() const override
+	{
+		return m_track->get_subsong_index();
+	}
+
+	virtual double get_length() const override
+	{
+		return m_fileInfo->get_length();
+	}
+
+	virtual jsonexport::replaygain get_replaygain() const override
+	{
+		const replaygain_info replay_gain_info = m_fileInfo->get_replaygain();
+
+		jsonexport::replaygain replay_gain;
+		replay_gain.album_gain = replay_gain_info.m_album_gain;
+		replay_gain.album_peak = replay_gain_info.m_album_peak;
+		replay_gain.track_gain = replay_gain_info.m_track_gain;
+		replay_gain.track_peak = replay_gain_info.m_track_peak;
+		replay_gain.is_album_gain_present = replay_gain_info.is_album_gain_present();
+		replay_gain.is_album_peak_present = replay_gain_info.is_album_peak_present();
+		replay_gain.is_track_gain_present = replay_gain_info.is_track_gain_present();
+		replay_gain.is_track_peak_present = replay_gain_info.is_track_peak_present();
+		return replay_gain;
+	}
+
+	virtual size_t info_get_count() const override
+	{
+		return m_fileInfo->info_get_count();
+	}
+
+	virtual const char* info_enum_name(size_t index) const override
+	{
+		return m_fileInfo->info_enum_name(index);
+	}
+
+	virtual const char* info_enum_value(size_t index) const override
+	{
+		return m_fileInfo->info_enum_value(index);
+	}
+
+	virtual size_t meta_get_count() const override
+	{
+		return m_fileInfo->meta_get_count();
+	}
+
+	virtual const char* meta_enum_name(size_t index) const override
+	{
+		return m_fileInfo->meta_enum_name(index);
+	}
+
+	virtual size_t meta_enum_value_count(size_t index) const override
+	{
+		return m_fileInfo->meta_enum_value_count(index);
+	}
+
+	virtual const char* meta_enum_value(size_t index, size_t value_index) const override
+	{
+		return m_fileInfo->meta_enum_value(index, value_index);
+	}
+
+	virtual void format_fields(std::vector<jsonexport::field_value>& values) const override
+	{
+		values.resize(m_scripts.size());
+
+		if(values.empty())
+		{
+			return;
+		}
+
+		// Fields whose scripts couldn't be fused are formatted one at a time.
+		m_separateFormatted.resize(m_scripts.size());
+
+		for(size_t i = 0; i < values.size(); ++i)
+		{
+			if(!m_fused[i])
+			{
+				formatField(i, values[i]);
+			}
+		}
+
+		if(!m_fusedScript.is_valid())
+		{
+			return;
+		}
+
+		m_track->format_title_from_external_info_nonlocking(*m_fileInfo, nullptr, m_formatted, m_fusedScript, nullptr);
+
+		// Split the values out in place; the separators can't be relied on if there are too many of them.
+		const char* value = m_formatted.get_ptr();
+		const char* const end = value + m_formatted.get_length();
+		const size_t lastFused = std::find(m_fused.rbegin(), m_fused.rend(), true).base() - m_fused.begin() - 1;
+
+		for(size_t i = 0; i < values.size(); ++i)
+		{
+			if(!m_fused[i])
+			{
+				continue;
+			}
+
+			const char* const separator = std::find(value, end, fieldSeparator);
+
+			if((separator == end) != (i == lastFused))
+			{
+				formatSeparately(values);
+				return;
+			}
+
+			values[i].data = value;
+			values[i].length = separator - value;
+			value = separator + 1;
+		}
+	}
+
+	// Formats each field with its own script, for when a value contains the separator.
+	void formatSeparately(std::vector<jsonexport::field_value>& values) const
+	{
+		m_separateFormatted.resize(m_scripts.size());
+
+		for(size_t i = 0; i < m_scripts.size(); ++i)
+		{
+			formatField(i, values[i]);
+		}
+	}
+
+private:
+	void formatField(size_t index, jsonexport::field_value& value) const
+	{
+		m_track->format_title_from_external_info_nonlocking(*m_fileInfo, nullptr, m_separateFormatted[index], m_scripts[index], nullptr);
+		value.data = m_separateFormatted[index].get_ptr();
+		value.length = m_separateFormatted[index].get_length();
+	}
+
+	const pfc::list_t<metadb_handle_ptr>& m_library;
+	const std::vector<titleformat_object::ptr>& m_scripts;
+	const titleformat_object::ptr& m_fusedScript;
+	const std::vector<bool>& m_fused;
+
+	metadb_handle_ptr m_track;
+	const file_info* m_fileInfo;
+	mutable ScratchString m_formatted;						// Reused for every track, so formatting needn't allocate.
+	mutable std::vector<pfc::string8> m_separateFormatted;	// For fields that weren't fused, and the rare track with a separator in a value.
+};
+
+} // anonymous namespace
+
+//------------------------------------------------------------------------------
+
+MetadbTrackSource::MetadbTrackSource(const pfc::list_t<metadb_handle_ptr>& library, const std::vector<jsonexport::formatted_field>& fields)
+	: m_library(library)
+	, m_fields(fields)
+	, m_scripts()
+	, m_fusedScript()
+	, m_fused()
+{
+	// Compile titleformatting scripts ahead of time, or reuse those compiled by earlier exports.
+	m_scripts.resize(m_fields.size());
+	m_fused.resize(m_fields.size());
+	pfc::string8 fusedScript;
+	bool anyFused = false;
+
+	for(size_t i = 0; i < m_fields.size(); ++i)
+	{
+		m_scripts[i] = getCompiledScript(m_fields[i].script.c_str());
+		m_fused[i] = isSelfContained(m_fields[i].script.c_str());
+
+		if(!m_fused[i])
+		{
+			continue;
+		}
+
+		if(anyFused)
+		{
+			fusedScript.add_char(fieldSeparator);
+		}
+
+		anyFused = true;
+
+		// The line break ends any comment on the script's last line, and is otherwise ignored.
+		fusedScript += m_fields[i].script.c_str();
+		fusedScript += "\n";
+	}
+
+	if(anyFused)
+	{
+		m_fusedScript = getCompiledScript(fusedScript);
+	}
+}
+
+//------------------------------------------------------------------------------
+
+size_t MetadbTrackSource::get_track_count() const
+{
+	return m_library.get_count();
+}
+
+//------------------------------------------------------------------------------
+
+const std::vector<jsonexport::formatted_field>& MetadbTrackSource::get_formatted_fields() const
+{
+	return m_fields;
+}
+
+//------------------------------------------------------------------------------
+
+std::unique_ptr<jsonexport::track_reader> MetadbTrackSource::create_reader()
+{
+	return std::unique_ptr<jsonexport::track_reader>(new MetadbTrackReader(m_library, m_scripts, m_fusedScript, m_fused));
+}
+
+//------------------------------------------------------------------------------
+
+const char* MetadbTrackSource::get_track_path(size_t index) const
+{
+	// Handles' locations don't need the database lock, unlike their info.
+	return m_library.get_item_ref(index)->get_path();
+}
+
+//------------------------------------------------------------------------------
+
+unsigned MetadbTrackSource::get_track_subsong_index(size_t index) const
+{
+	return m_library.get_item_ref(index)->get_subsong_index();
+}
+
+//------------------------------------------------------------------------------
+
+void MetadbTrackSource::benchmarkFormatting(size_t trackCount, double& fusedSecondsPerTrack, double& separateSecondsPerTrack) const
+{
+	MetadbTrackReader reader(m_library, m_scripts, m_fusedScript, m_fused);
+	std::vector<jsonexport::field_value> values;
+	size_t readCount = 0;
+	pfc::hires_timer timer;
+
+	fusedSecondsPerTrack = 0.0;
+	separateSecondsPerTrack = 0.0;
+
+	for(size_t i = 0; i < trackCount && i < m_library.get_count(); ++i)
+	{
+		if(!reader.read(i))
+		{
+			continue;
+		}
+
+		timer.start();
+		reader.format_fields(values);
+		fusedSecondsPerTrack += timer.query_reset();
+		reader.formatSeparately(values);
+		separateSecondsPerTrack += timer.query();
+
+		++readCount;
+	}
+
+	if(readCount > 0)
+	{
+		fusedSecondsPerTrack /= readCount;
+		separateSecondsPerTrack /= readCount;
+	}
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace libraryexport
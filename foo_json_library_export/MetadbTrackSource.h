@@ -0,0 +1,42 @@
+#pragma once
+
+#include "FoobarSDKWrapper.h"
+#include "LibraryExport.h"
+
+namespace libraryexport {
+
+// Adapts a list of metadb handles to the export engine's track_source interface.
+// The database must be locked whilst readers are in use, as they read track info with get_info_locked().
+class MetadbTrackSource : public jsonexport::track_source
+{
+public:
+	MetadbTrackSource(const pfc::list_t<metadb_handle_ptr>& library, const std::vector<jsonexport::formatted_field>& fields);
+
+	virtual size_t get_track_count() const override;
+	virtual const std::vector<jsonexport::formatted_field>& get_formatted_fields() const override;
+	virtual std::unique_ptr<jsonexport::track_reader> create_reader() override;
+	virtual const char* get_track_path(size_t index) const override;
+	virtual unsigned get_track_subsong_index(size_t index) const override;
+
+	// Times formatting the fields of up to trackCount tracks with the fused script and with each field's own, for comparison.
+	// The database must be locked.
+	void benchmarkFormatting(size_t trackCount, double& fusedSecondsPerTrack, double& separateSecondsPerTrack) const;
+
+private:
+	// Non-copyable.
+	MetadbTrackSource(const MetadbTrackSource&);
+	MetadbTrackSource& operator=(const MetadbTrackSource&);
+
+	const pfc::list_t<metadb_handle_ptr>& m_library;
+	const std::vector<jsonexport::formatted_field> m_fields;
+	std::vector<titleformat_object::ptr> m_scripts;
+
+	// All of the fields' scripts in one, with their values separated by fieldSeparator,
+	// so that the titleformatting machinery is set up once per track rather than once per field.
+	// Only scripts whose quotes and brackets all close are fused, so one can't run on into the next; the rest are
+	// formatted on their own. Null if none could be fused.
+	titleformat_object::ptr m_fusedScript;
+	std::vector<bool> m_fused;	// Whether each field's script is in the fused script.
+};
+
+} // namespace libraryexport
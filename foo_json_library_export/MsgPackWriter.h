@@ -0,0 +1,336 @@
+#pragma once
+
+#include "RapidJsonWrapper.h"
+
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace jsonexport {
+
+//------------------------------------------------------------------------------
+
+/// rapidjson handler which writes MessagePack rather than JSON, so that anything written through a rapidjson writer,
+/// such as Document::Accept() or the streaming export, can be written as MessagePack unchanged.
+/// MessagePack prefixes maps and arrays with their size, which isn't known until they're ended, so each is assembled in memory
+/// until then; nothing reaches the stream until the top-level value is complete, so that's held in memory in its entirety.
+/// As a sequence writer, the top-level array isn't written; each of its elements is written to the stream as soon as it's
+/// complete, one after another, as a stream of MessagePack values.
+template<typename OutputStream, bool is_sequence = false>
+class msgpack_writer
+{
+public:
+	typedef char Ch;
+
+	explicit msgpack_writer(OutputStream& os)
+		: m_os(os)
+		, m_buffer()
+		, m_levels()
+		, m_in_sequence(false)
+	{
+	}
+
+	msgpack_writer& Null()
+	{
+		begin_value();
+		put(0xC0);
+		return end_value();
+	}
+
+	msgpack_writer& Bool(bool b)
+	{
+		begin_value();
+		put(b ? 0xC3 : 0xC2);
+		return end_value();
+	}
+
+	msgpack_writer& Int(int i)
+	{
+		return Int64(i);
+	}
+
+	msgpack_writer& Uint(unsigned u)
+	{
+		return Uint64(u);
+	}
+
+	msgpack_writer& Int64(int64_t i)
+	{
+		if(i >= 0)
+		{
+			return Uint64(static_cast<uint64_t>(i));
+		}
+
+		begin_value();
+
+		if(i >= -32)
+		{
+			put(static_cast<unsigned char>(i));
+		}
+		else if(i >= INT8_MIN)
+		{
+			put(0xD0);
+			put(static_cast<unsigned char>(i));
+		}
+		else if(i >= INT16_MIN)
+		{
+			put(0xD1);
+			put_big_endian(static_cast<uint16_t>(i), 2);
+		}
+		else if(i >= INT32_MIN)
+		{
+			put(0xD2);
+			put_big_endian(static_cast<uint32_t>(i), 4);
+		}
+		else
+		{
+			put(0xD3);
+			put_big_endian(static_cast<uint64_t>(i), 8);
+		}
+
+		return end_value();
+	}
+
+	msgpack_writer& Uint64(uint64_t u)
+	{
+		begin_value();
+
+		if(u < 0x80)
+		{
+			put(static_cast<unsigned char>(u));
+		}
+		else if(u <= UINT8_MAX)
+		{
+			put(0xCC);
+			put(static_cast<unsigned char>(u));
+		}
+		else if(u <= UINT16_MAX)
+		{
+			put(0xCD);
+			put_big_endian(u, 2);
+		}
+		else if(u <= UINT32_MAX)
+		{
+			put(0xCE);
+			put_big_endian(u, 4);
+		}
+		else
+		{
+			put(0xCF);
+			put_big_endian(u, 8);
+		}
+
+		return end_value();
+	}
+
+	msgpack_writer& Double(double d)
+	{
+		begin_value();
+
+		// Values which survive the trip to single precision, like replaygain's, are written in half the space.
+		if(std::fabs(d) <= FLT_MAX && static_cast<double>(static_cast<float>(d)) == d)
+		{
+			const float f = static_cast<float>(d);
+			uint32_t bits = 0;
+			memcpy(&bits, &f, sizeof(bits));
+
+			put(0xCA);
+			put_big_endian(bits, 4);
+		}
+		else
+		{
+			uint64_t bits = 0;
+			memcpy(&bits, &d, sizeof(bits));
+
+			put(0xCB);
+			put_big_endian(bits, 8);
+		}
+
+		return end_value();
+	}
+
+	msgpack_writer& String(const Ch* str, rapidjson::SizeType length, bool copy = false)
+	{
+		(void)copy;
+
+		begin_value();
+
+		if(length < 32)
+		{
+			put(static_cast<unsigned char>(0xA0 | length));
+		}
+		else if(length <= UINT8_MAX)
+		{
+			put(0xD9);
+			put(static_cast<unsigned char>(length));
+		}
+		else if(length <= UINT16_MAX)
+		{
+			put(0xDA);
+			put_big_endian(length, 2);
+		}
+		else
+		{
+			put(0xDB);
+			put_big_endian(length, 4);
+		}
+
+		m_buffer.insert(m_buffer.end(), str, str + length);
+		return end_value();
+	}
+
+	msgpack_writer& String(const Ch* str)
+	{
+		return String(str, static_cast<rapidjson::SizeType>(strlen(str)));
+	}
+
+	msgpack_writer& StartObject()
+	{
+		begin_value();
+		m_levels.push_back(level(m_buffer.size(), true));
+		return *this;
+	}
+
+	msgpack_writer& EndObject(rapidjson::SizeType memberCount = 0)
+	{
+		(void)memberCount;
+
+		RAPIDJSON_ASSERT(!m_levels.empty() && m_levels.back().is_object && m_levels.back().count % 2 == 0);
+		end_container(0x80, 0xDE, 0xDF, m_levels.back().count / 2);
+		return end_value();
+	}
+
+	msgpack_writer& StartArray()
+	{
+		if(is_sequence && m_levels.empty() && !m_in_sequence)
+		{
+			m_in_sequence = true;
+			return *this;
+		}
+
+		begin_value();
+		m_levels.push_back(level(m_buffer.size(), false));
+		return *this;
+	}
+
+	msgpack_writer& EndArray(rapidjson::SizeType elementCount = 0)
+	{
+		(void)elementCount;
+
+		if(is_sequence && m_levels.empty())
+		{
+			RAPIDJSON_ASSERT(m_in_sequence);
+			m_in_sequence = false;
+			return *this;
+		}
+
+		RAPIDJSON_ASSERT(!m_levels.empty() && !m_levels.back().is_object);
+		end_container(0x90, 0xDC, 0xDD, m_levels.back().count);
+		return end_value();
+	}
+
+	/// Writes a value already encoded as MessagePack, e.g. by another msgpack_writer.
+	msgpack_writer& RawValue(const Ch* data, size_t length, rapidjson::Type type)
+	{
+		(void)type;
+
+		begin_value();
+		m_buffer.insert(m_buffer.end(), data, data + length);
+		return end_value();
+	}
+
+private:
+	// Non-copyable.
+	msgpack_writer(const msgpack_writer&);
+	msgpack_writer& operator=(const msgpack_writer&);
+
+	/// A map or array which hasn't been ended yet.
+	struct level
+	{
+		level(size_t begin, bool is_object)
+			: begin(begin)
+			, count(0)
+			, is_object(is_object)
+		{
+		}
+
+		size_t begin;		///< Where its contents begin in the buffer; its header is inserted there once its size is known.
+		size_t count;		///< Values written in it; for a map, keys and values.
+		bool is_object;
+	};
+
+	void put(unsigned char c)
+	{
+		m_buffer.push_back(c);
+	}
+
+	void put_big_endian(uint64_t value, size_t size)
+	{
+		for(size_t i = size; i > 0; --i)
+		{
+			put(static_cast<unsigned char>(value >> ((i - 1) * 8)));
+		}
+	}
+
+	void begin_value()
+	{
+		if(!m_levels.empty())
+		{
+			++m_levels.back().count;
+		}
+	}
+
+	msgpack_writer& end_value()
+	{
+		// Once the top-level value, or an element of the sequence, is complete, it's written out.
+		if(m_levels.empty())
+		{
+			rapidjson::PutBuffer(m_os, reinterpret_cast<const Ch*>(m_buffer.data()), m_buffer.size());
+			m_buffer.clear();
+
+			if(!m_in_sequence)
+			{
+				m_os.Flush();
+			}
+		}
+
+		return *this;
+	}
+
+	void end_container(unsigned char fix_type, unsigned char type16, unsigned char type32, size_t size)
+	{
+		const size_t begin = m_levels.back().begin;
+		m_levels.pop_back();
+
+		unsigned char header[5];
+		size_t header_size = 0;
+
+		if(size < 16)
+		{
+			header[header_size++] = static_cast<unsigned char>(fix_type | size);
+		}
+		else
+		{
+			const size_t size_bytes = size <= UINT16_MAX ? 2 : 4;
+			header[header_size++] = size <= UINT16_MAX ? type16 : type32;
+
+			for(size_t i = size_bytes; i > 0; --i)
+			{
+				header[header_size++] = static_cast<unsigned char>(size >> ((i - 1) * 8));
+			}
+		}
+
+		m_buffer.insert(m_buffer.begin() + begin, header, header + header_size);
+	}
+
+	OutputStream& m_os;
+	std::vector<unsigned char> m_buffer;	///< The top-level value so far, or the current element of the sequence.
+	std::vector<level> m_levels;
+	bool m_in_sequence;						///< Whether the top-level array of a sequence writer has been started.
+};
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
@@ -0,0 +1,557 @@
+#include "OutputSink.h"
+
+#include "Deflate.h"
+#include "LibraryExport.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace jsonexport {
+
+namespace
+{
+
+typedef std::chrono::steady_clock stage_clock;
+
+double seconds_since(const stage_clock::time_point& start)
+{
+	return std::chrono::duration<double>(stage_clock::now() - start).count();
+}
+
+FILE* fopen_or_exception(const char* fileName, const char* mode)
+{
+	if(!fileName || !mode)
+	{
+		throw std::invalid_argument("Invalid argument passed to fopen");
+	}
+
+#pragma warning (push)
+#pragma warning (disable: 4996)
+	return fopen(fileName, mode);
+#pragma warning (pop)
+}
+
+// Size of the part of the file mapped at once when using mapped_file_sink.
+// Small enough to always find room for in a 32-bit address space, large enough that remapping is rare.
+static const size_t mapped_window_size = 64 * 1024 * 1024;
+
+// The least space mapped_file_sink hands out in a buffer; it maps the next window rather than handing out less.
+static const size_t mapped_min_capacity = 64 * 1024;
+
+// Offsets of mapped windows must be multiples of this.
+size_t mapping_granularity()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwAllocationGranularity;
+#else
+	return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+} // anonymous namespace
+
+//------------------------------------------------------------------------------
+
+background_file_sink::background_file_sink(const std::string& file_path, size_t buffer_size, size_t buffer_count, bool binary)
+	: m_file(fopen_or_exception(file_path.c_str(), binary ? "wb" : "w"))
+	, m_buffers()
+	, m_free_buffers()
+	, m_pending_writes()
+	, m_current_buffer(0)
+	, m_mutex()
+	, m_buffer_freed()
+	, m_buffer_committed()
+	, m_stopping(false)
+	, m_write_failed(false)
+	, m_producer_wait_seconds(0.0)
+	, m_write_seconds(0.0)
+	, m_written_size(0)
+	, m_thread()
+{
+	if(!m_file)
+	{
+		throw export_error("Failed to open file for writing; aborting");
+	}
+
+	// Buffers are already large, so there's no point stdio copying them into its own.
+	setvbuf(m_file, nullptr, _IONBF, 0);
+
+	// One buffer is being filled while the others are written, so there need to be at least two.
+	buffer_count = buffer_count < 2 ? 2 : buffer_count;
+	buffer_size = buffer_size < 1024 ? 1024 : buffer_size;
+
+	m_buffers.resize(buffer_count);
+
+	for(size_t i = 0; i < buffer_count; ++i)
+	{
+		m_buffers[i].resize(buffer_size);
+		m_free_buffers.push_back(i);
+	}
+
+	m_thread = std::thread([this](){ write_pending_buffers(); });
+}
+
+//------------------------------------------------------------------------------
+
+background_file_sink::~background_file_sink()
+{
+	stop();
+
+	if(m_file)
+	{
+		fclose(m_file);
+	}
+}
+
+//------------------------------------------------------------------------------
+
+char* background_file_sink::acquire_buffer(size_t& capacity)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	if(m_free_buffers.empty())
+	{
+		const stage_clock::time_point wait_start = stage_clock::now();
+		m_buffer_freed.wait(lock, [this](){ return !m_free_buffers.empty() || m_write_failed; });
+		m_producer_wait_seconds += seconds_since(wait_start);
+	}
+
+	if(m_write_failed)
+	{
+		throw export_error("Failed to write to output file; aborting");
+	}
+
+	m_current_buffer = m_free_buffers.back();
+	m_free_buffers.pop_back();
+
+	capacity = m_buffers[m_current_buffer].size();
+	return m_buffers[m_current_buffer].data();
+}
+
+//------------------------------------------------------------------------------
+
+void background_file_sink::commit_buffer(size_t size)
+{
+	pending_write write;
+	write.buffer_index = m_current_buffer;
+	write.size = size;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_pending_writes.push_back(write);
+	}
+
+	m_buffer_committed.notify_one();
+}
+
+//------------------------------------------------------------------------------
+
+void background_file_sink::finish()
+{
+	stop();
+
+	if(m_write_failed)
+	{
+		throw export_error("Failed to write to output file; aborting");
+	}
+
+	FILE* const file = m_file;
+	m_file = nullptr;
+
+	if(fclose(file) != 0)
+	{
+		throw export_error("Failed to write to output file; aborting");
+	}
+}
+
+//------------------------------------------------------------------------------
+
+double background_file_sink::get_producer_wait_seconds() const
+{
+	return m_producer_wait_seconds;
+}
+
+//------------------------------------------------------------------------------
+
+double background_file_sink::get_write_seconds() const
+{
+	return m_write_seconds;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t background_file_sink::get_written_size() const
+{
+	return m_written_size;
+}
+
+//------------------------------------------------------------------------------
+
+void background_file_sink::write_pending_buffers()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while(true)
+	{
+		m_buffer_committed.wait(lock, [this](){ return !m_pending_writes.empty() || m_stopping; });
+
+		if(m_pending_writes.empty())
+		{
+			// Stopping, and everything committed has been written.
+			return;
+		}
+
+		const pending_write write = m_pending_writes.front();
+		m_pending_writes.pop_front();
+
+		// Don't hold the lock while writing, so the exporting thread can keep committing buffers.
+		if(!m_write_failed)
+		{
+			lock.unlock();
+
+			const stage_clock::time_point write_start = stage_clock::now();
+			const bool success = fwrite(m_buffers[write.buffer_index].data(), 1, write.size, m_file) == write.size;
+			m_write_seconds += seconds_since(write_start);
+			m_written_size += success ? write.size : 0;
+
+			lock.lock();
+
+			m_write_failed = m_write_failed || !success;
+		}
+
+		m_free_buffers.push_back(write.buffer_index);
+		m_buffer_freed.notify_one();
+	}
+}
+
+//------------------------------------------------------------------------------
+
+void background_file_sink::stop()
+{
+	if(!m_thread.joinable())
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+
+	m_buffer_committed.notify_one();
+	m_thread.join();
+}
+
+//------------------------------------------------------------------------------
+
+mapped_file_sink::mapped_file_sink(const std::string& file_path, uint64_t estimated_size)
+#ifdef _WIN32
+	: m_file(INVALID_HANDLE_VALUE)
+	, m_mapping(nullptr)
+#else
+	: m_file(-1)
+#endif
+	, m_preallocated_size(0)
+	, m_file_size(0)
+	, m_written(0)
+	, m_grow_count(0)
+	, m_window(nullptr)
+	, m_window_offset(0)
+	, m_window_size(0)
+{
+#ifdef _WIN32
+	// Paths from foobar2000 are UTF-8.
+	const int length = MultiByteToWideChar(CP_UTF8, 0, file_path.c_str(), -1, nullptr, 0);
+	std::vector<wchar_t> wide_path(length > 0 ? length : 1);
+	MultiByteToWideChar(CP_UTF8, 0, file_path.c_str(), -1, wide_path.data(), length);
+
+	m_file = CreateFileW(wide_path.data(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+	if(m_file == INVALID_HANDLE_VALUE)
+	{
+		throw export_error("Failed to open file for writing; aborting");
+	}
+#else
+	m_file = open(file_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+
+	if(m_file < 0)
+	{
+		throw export_error("Failed to open file for writing; aborting");
+	}
+#endif
+
+	try
+	{
+		// Allocating the whole file up front lets the file system lay it out contiguously.
+		resize_file(std::max<uint64_t>(estimated_size, mapped_min_capacity));
+		m_preallocated_size = m_file_size;
+	}
+	catch(...)
+	{
+		close_file();
+		throw;
+	}
+}
+
+//------------------------------------------------------------------------------
+
+mapped_file_sink::~mapped_file_sink()
+{
+	unmap_window();
+	close_file();
+}
+
+//------------------------------------------------------------------------------
+
+char* mapped_file_sink::acquire_buffer(size_t& capacity)
+{
+	const uint64_t window_end = m_window_offset + m_window_size;
+
+	if(!m_window || window_end - m_written < mapped_min_capacity)
+	{
+		unmap_window();
+
+		if(m_file_size - m_written < mapped_min_capacity)
+		{
+			// The estimate was too small; grow by half again, so a bad estimate only costs a few remaps.
+			resize_file(std::max<uint64_t>(m_file_size + m_file_size / 2, m_written + mapped_window_size));
+			++m_grow_count;
+		}
+
+		map_window(m_written);
+	}
+
+	capacity = static_cast<size_t>(m_window_offset + m_window_size - m_written);
+	return m_window + (m_written - m_window_offset);
+}
+
+//------------------------------------------------------------------------------
+
+void mapped_file_sink::commit_buffer(size_t size)
+{
+	m_written += size;
+}
+
+//------------------------------------------------------------------------------
+
+void mapped_file_sink::finish()
+{
+	unmap_window();
+
+	// Cut off whatever was preallocated but not used.
+	resize_file(m_written);
+
+	close_file();
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t mapped_file_sink::get_preallocated_size() const
+{
+	return m_preallocated_size;
+}
+
+//------------------------------------------------------------------------------
+
+size_t mapped_file_sink::get_grow_count() const
+{
+	return m_grow_count;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t mapped_file_sink::get_written_size() const
+{
+	return m_written;
+}
+
+//------------------------------------------------------------------------------
+
+void mapped_file_sink::resize_file(uint64_t size)
+{
+#ifdef _WIN32
+	// A mapping can't outlive a change in the file's size; map_window() will create a new one.
+	if(m_mapping)
+	{
+		CloseHandle(m_mapping);
+		m_mapping = nullptr;
+	}
+
+	LARGE_INTEGER distance;
+	distance.QuadPart = static_cast<LONGLONG>(size);
+
+	if(!SetFilePointerEx(m_file, distance, nullptr, FILE_BEGIN) || !SetEndOfFile(m_file))
+	{
+		throw export_error("Failed to resize output file; aborting");
+	}
+#else
+	bool resized = false;
+
+#ifdef __linux__
+	// Unlike ftruncate(), this actually allocates the space, rather than leaving a hole.
+	if(size > m_file_size)
+	{
+		resized = posix_fallocate(m_file, 0, static_cast<off_t>(size)) == 0;
+	}
+#endif
+
+	if(!resized && ftruncate(m_file, static_cast<off_t>(size)) != 0)
+	{
+		throw export_error("Failed to resize output file; aborting");
+	}
+#endif
+
+	m_file_size = size;
+}
+
+//------------------------------------------------------------------------------
+
+void mapped_file_sink::map_window(uint64_t offset)
+{
+	const uint64_t granularity = mapping_granularity();
+	const uint64_t aligned_offset = offset - offset % granularity;
+	const size_t size = static_cast<size_t>(std::min<uint64_t>(mapped_window_size, m_file_size - aligned_offset));
+
+#ifdef _WIN32
+	if(!m_mapping)
+	{
+		m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+
+		if(!m_mapping)
+		{
+			throw export_error("Failed to map output file; aborting");
+		}
+	}
+
+	void* const window = MapViewOfFile(m_mapping, FILE_MAP_WRITE, static_cast<DWORD>(aligned_offset >> 32), static_cast<DWORD>(aligned_offset), size);
+
+	if(!window)
+	{
+		throw export_error("Failed to map output file; aborting");
+	}
+#else
+	void* const window = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_file, static_cast<off_t>(aligned_offset));
+
+	if(window == MAP_FAILED)
+	{
+		throw export_error("Failed to map output file; aborting");
+	}
+#endif
+
+	m_window = static_cast<char*>(window);
+	m_window_offset = aligned_offset;
+	m_window_size = size;
+}
+
+//------------------------------------------------------------------------------
+
+void mapped_file_sink::unmap_window()
+{
+	if(!m_window)
+	{
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(m_window);
+#else
+	munmap(m_window, m_window_size);
+#endif
+
+	m_window = nullptr;
+	m_window_offset = 0;
+	m_window_size = 0;
+}
+
+//------------------------------------------------------------------------------
+
+void mapped_file_sink::close_file()
+{
+#ifdef _WIN32
+	if(m_mapping)
+	{
+		CloseHandle(m_mapping);
+		m_mapping = nullptr;
+	}
+
+	if(m_file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_file);
+		m_file = INVALID_HANDLE_VALUE;
+	}
+#else
+	if(m_file >= 0)
+	{
+		close(m_file);
+		m_file = -1;
+	}
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+checksum_sink::checksum_sink(output_sink& destination)
+	: m_destination(destination)
+	, m_buffer(nullptr)
+	, m_size(0)
+	, m_crc(0)
+{
+}
+
+//------------------------------------------------------------------------------
+
+char* checksum_sink::acquire_buffer(size_t& capacity)
+{
+	char* const buffer = m_destination.acquire_buffer(capacity);
+	m_buffer = buffer;
+	return buffer;
+}
+
+//------------------------------------------------------------------------------
+
+void checksum_sink::commit_buffer(size_t size)
+{
+	m_crc = crc32_update(m_crc, reinterpret_cast<const unsigned char*>(m_buffer), size);
+	m_size += size;
+	m_destination.commit_buffer(size);
+}
+
+//------------------------------------------------------------------------------
+
+void checksum_sink::finish()
+{
+	m_destination.finish();
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t checksum_sink::get_size() const
+{
+	return m_size;
+}
+
+//------------------------------------------------------------------------------
+
+uint32_t checksum_sink::get_crc32() const
+{
+	return m_crc;
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
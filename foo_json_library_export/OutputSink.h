@@ -0,0 +1,173 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace jsonexport {
+
+//------------------------------------------------------------------------------
+
+/// Where the exported bytes end up. Output is handed over a buffer at a time, so that sinks can decide
+/// where the buffers live, e.g. in a pool shared with an I/O thread.
+class output_sink
+{
+public:
+	virtual ~output_sink() {}
+
+	/// Returns a buffer to write the next part of the output into, storing its size in capacity.
+	virtual char* acquire_buffer(size_t& capacity) = 0;
+
+	/// Passes on the first size bytes of the buffer returned by the last acquire_buffer(), which mustn't be used afterwards.
+	virtual void commit_buffer(size_t size) = 0;
+
+	/// Completes the output once everything has been committed; throws export_error if any of it couldn't be written.
+	virtual void finish() = 0;
+};
+
+//------------------------------------------------------------------------------
+
+/// Writes to a file on a dedicated I/O thread, so the exporting thread can fill one buffer while earlier ones are written.
+class background_file_sink : public output_sink
+{
+public:
+	/// Opens the file for writing, in binary mode or else text mode; throws export_error if it can't be.
+	background_file_sink(const std::string& file_path, size_t buffer_size, size_t buffer_count, bool binary);
+	virtual ~background_file_sink();
+
+	virtual char* acquire_buffer(size_t& capacity) override;
+	virtual void commit_buffer(size_t size) override;
+	virtual void finish() override;
+
+	/// Total time the exporting thread spent waiting for a free buffer. If this is a large part of the export,
+	/// the export is bound by the disk rather than by serialization.
+	double get_producer_wait_seconds() const;
+
+	/// Total time the I/O thread spent writing.
+	double get_write_seconds() const;
+
+	/// Bytes written to the file so far.
+	uint64_t get_written_size() const;
+
+private:
+	// Non-copyable.
+	background_file_sink(const background_file_sink&);
+	background_file_sink& operator=(const background_file_sink&);
+
+	struct pending_write
+	{
+		size_t buffer_index;
+		size_t size;
+	};
+
+	void write_pending_buffers();
+	void stop();
+
+	FILE* m_file;
+
+	std::vector<std::vector<char>> m_buffers;
+	std::vector<size_t> m_free_buffers;
+	std::deque<pending_write> m_pending_writes;
+	size_t m_current_buffer;
+
+	std::mutex m_mutex;
+	std::condition_variable m_buffer_freed;
+	std::condition_variable m_buffer_committed;
+	bool m_stopping;
+	bool m_write_failed;
+
+	double m_producer_wait_seconds;
+	double m_write_seconds;
+	uint64_t m_written_size;
+
+	std::thread m_thread;
+};
+
+//------------------------------------------------------------------------------
+
+/// Writes to a file through a memory mapping, avoiding the copy into stdio's buffers.
+/// The file is preallocated from an estimate of the output size, grown if the estimate turns out to be too small,
+/// and truncated to the real size when finished. Only a window of the file is mapped at a time, so this works
+/// for files larger than the address space.
+class mapped_file_sink : public output_sink
+{
+public:
+	/// Creates the file; throws export_error if it can't be.
+	mapped_file_sink(const std::string& file_path, uint64_t estimated_size);
+	virtual ~mapped_file_sink();
+
+	virtual char* acquire_buffer(size_t& capacity) override;
+	virtual void commit_buffer(size_t size) override;
+	virtual void finish() override;
+
+	uint64_t get_preallocated_size() const;
+
+	/// Number of times the file had to be grown beyond the preallocated size.
+	size_t get_grow_count() const;
+
+	/// Bytes written to the file so far; once finished, its size.
+	uint64_t get_written_size() const;
+
+private:
+	// Non-copyable.
+	mapped_file_sink(const mapped_file_sink&);
+	mapped_file_sink& operator=(const mapped_file_sink&);
+
+	void resize_file(uint64_t size);
+	void map_window(uint64_t offset);
+	void unmap_window();
+	void close_file();
+
+#ifdef _WIN32
+	void* m_file;
+	void* m_mapping;
+#else
+	int m_file;
+#endif
+
+	uint64_t m_preallocated_size;
+	uint64_t m_file_size;
+	uint64_t m_written;
+	size_t m_grow_count;
+
+	char* m_window;
+	uint64_t m_window_offset;
+	size_t m_window_size;
+};
+
+//------------------------------------------------------------------------------
+
+/// Passes everything on to another sink, keeping the size and CRC-32 of what's passed through,
+/// e.g. to record in a manifest what each file should contain.
+class checksum_sink : public output_sink
+{
+public:
+	explicit checksum_sink(output_sink& destination);
+
+	virtual char* acquire_buffer(size_t& capacity) override;
+	virtual void commit_buffer(size_t size) override;
+	virtual void finish() override;
+
+	uint64_t get_size() const;
+	uint32_t get_crc32() const;
+
+private:
+	// Non-copyable.
+	checksum_sink(const checksum_sink&);
+	checksum_sink& operator=(const checksum_sink&);
+
+	output_sink& m_destination;
+	const char* m_buffer;	///< The buffer last acquired from the destination.
+	uint64_t m_size;
+	uint32_t m_crc;
+};
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
@@ -0,0 +1,157 @@
+#include "PathTable.h"
+
+#include "Deflate.h"
+#include "LibraryExport.h"
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_set>
+
+namespace jsonexport {
+
+//------------------------------------------------------------------------------
+
+size_t path_table::directory_key_hash::operator()(const directory_key& key) const
+{
+	// FNV-1a.
+	uint64_t hash = 14695981039346656037ULL;
+
+	for(size_t i = 0; i < key.length; ++i)
+	{
+		hash ^= static_cast<unsigned char>(key.data[i]);
+		hash *= 1099511628211ULL;
+	}
+
+	return static_cast<size_t>(hash);
+}
+
+//------------------------------------------------------------------------------
+
+bool path_table::directory_key_equal::operator()(const directory_key& a, const directory_key& b) const
+{
+	return a.length == b.length && memcmp(a.data, b.data, a.length) == 0;
+}
+
+//------------------------------------------------------------------------------
+
+path_table::path_table(const track_source& source)
+	: m_directories()
+	, m_indices()
+	, m_directory_size(0)
+	, m_file_name_size(0)
+	, m_path_size(0)
+	, m_checksum(0)
+{
+	// Tracks' paths stay valid as long as the source, so the distinct directories are found without copying any of them.
+	std::unordered_set<directory_key, directory_key_hash, directory_key_equal> directories;
+
+	for(size_t i = 0; i < source.get_track_count(); ++i)
+	{
+		const char* const path = source.get_track_path(i);
+		const size_t path_length = strlen(path);
+
+		const directory_key key = { path, directory_length(path, path_length) };
+		directories.insert(key);
+		m_file_name_size += path_length - key.length;
+		m_path_size += path_length;
+	}
+
+	m_directories.reserve(directories.size());
+
+	for(std::unordered_set<directory_key, directory_key_hash, directory_key_equal>::const_iterator i = directories.begin(); i != directories.end(); ++i)
+	{
+		m_directories.push_back(std::string(i->data, i->length));
+	}
+
+	std::sort(m_directories.begin(), m_directories.end());
+
+	m_indices.reserve(m_directories.size());
+
+	for(size_t i = 0; i < m_directories.size(); ++i)
+	{
+		const std::string& directory = m_directories[i];
+		const directory_key key = { directory.data(), directory.size() };
+		m_indices[key] = i;
+
+		// Each one's terminated, so that "a" then "bc" differs from "ab" then "c".
+		m_checksum = crc32_update(m_checksum, reinterpret_cast<const unsigned char*>(directory.c_str()), directory.size() + 1);
+		m_directory_size += directory.size();
+	}
+}
+
+//------------------------------------------------------------------------------
+
+size_t path_table::get_directory_count() const
+{
+	return m_directories.size();
+}
+
+//------------------------------------------------------------------------------
+
+const std::string& path_table::get_directory(size_t index) const
+{
+	return m_directories[index];
+}
+
+//------------------------------------------------------------------------------
+
+size_t path_table::find(const char* path, const char*& file_name) const
+{
+	const directory_key key = { path, directory_length(path, strlen(path)) };
+	const std::unordered_map<directory_key, size_t, directory_key_hash, directory_key_equal>::const_iterator found = m_indices.find(key);
+
+	if(found == m_indices.end())
+	{
+		throw export_error(std::string("Track not in the table of directories: ") + path);
+	}
+
+	file_name = path + key.length;
+	return found->second;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t path_table::get_directory_size() const
+{
+	return m_directory_size;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t path_table::get_file_name_size() const
+{
+	return m_file_name_size;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t path_table::get_path_size() const
+{
+	return m_path_size;
+}
+
+//------------------------------------------------------------------------------
+
+uint32_t path_table::get_checksum() const
+{
+	return m_checksum;
+}
+
+//------------------------------------------------------------------------------
+
+size_t path_table::directory_length(const char* path, size_t path_length)
+{
+	for(size_t i = path_length; i > 0; --i)
+	{
+		if(path[i - 1] == '/' || path[i - 1] == '\\')
+		{
+			return i;
+		}
+	}
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace jsonexport {
+
+class track_source;
+
+//------------------------------------------------------------------------------
+
+/// The distinct directories of a library's tracks, so that each track's path can be written as the index of its directory
+/// and its file name, rather than repeating the directory's long prefix in every track. Paths are split after their last
+/// '/' or '\', so a directory followed by a file name is exactly the path they came from, whatever its scheme.
+/// Directories are sorted, so the table doesn't depend on the order of the tracks. Once built, may be used from any thread.
+class path_table
+{
+public:
+	/// Reads the path of every track in the source.
+	explicit path_table(const track_source& source);
+
+	size_t get_directory_count() const;
+	const std::string& get_directory(size_t index) const;
+
+	/// Returns the index of the path's directory, which must be in the table, and points file_name at the rest of the path.
+	size_t find(const char* path, const char*& file_name) const;
+
+	/// Bytes of the directories, of the tracks' file names, and of their paths in full, to show how much the table saves.
+	uint64_t get_directory_size() const;
+	uint64_t get_file_name_size() const;
+	uint64_t get_path_size() const;
+
+	/// CRC-32 of the directories in order, to tell whether two tables would give the same directories the same indices.
+	uint32_t get_checksum() const;
+
+private:
+	// Non-copyable.
+	path_table(const path_table&);
+	path_table& operator=(const path_table&);
+
+	struct directory_key
+	{
+		const char* data;
+		size_t length;
+	};
+
+	struct directory_key_hash
+	{
+		size_t operator()(const directory_key& key) const;
+	};
+
+	struct directory_key_equal
+	{
+		bool operator()(const directory_key& a, const directory_key& b) const;
+	};
+
+	/// The length of the path's directory, including the separator it ends with.
+	static size_t directory_length(const char* path, size_t path_length);
+
+	std::vector<std::string> m_directories;
+	std::unordered_map<directory_key, size_t, directory_key_hash, directory_key_equal> m_indices;	///< Keys point into m_directories.
+	uint64_t m_directory_size;
+	uint64_t m_file_name_size;
+	uint64_t m_path_size;
+	uint32_t m_checksum;
+};
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
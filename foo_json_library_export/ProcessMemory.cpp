@@ -0,0 +1,133 @@
+#include "ProcessMemory.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <malloc.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#endif
+
+namespace jsonexport {
+
+namespace
+{
+
+#if !defined(_WIN32) && defined(__linux__)
+
+// Reads a "Name:   1234 kB" line of /proc/self/status.
+uint64_t read_status_kilobytes(const char* name)
+{
+	FILE* file = fopen("/proc/self/status", "r");
+
+	if(!file)
+	{
+		return 0;
+	}
+
+	const size_t name_length = strlen(name);
+	char line[256];
+	uint64_t kilobytes = 0;
+
+	while(fgets(line, sizeof(line), file))
+	{
+		if(strncmp(line, name, name_length) == 0 && line[name_length] == ':')
+		{
+			kilobytes = strtoull(line + name_length + 1, nullptr, 10);
+			break;
+		}
+	}
+
+	fclose(file);
+	return kilobytes * 1024;
+}
+
+#endif
+
+} // anonymous namespace
+
+//------------------------------------------------------------------------------
+
+uint64_t get_resident_size()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.WorkingSetSize : 0;
+#elif defined(__linux__)
+	return read_status_kilobytes("VmRSS");
+#else
+	return 0;
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t get_peak_resident_size()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.PeakWorkingSetSize : 0;
+#elif defined(__linux__)
+	// Unlike ru_maxrss, VmHWM is reset by reset_peak_resident_size().
+	return read_status_kilobytes("VmHWM");
+#else
+	// Bytes on macOS, kilobytes elsewhere.
+	struct rusage usage;
+
+	if(getrusage(RUSAGE_SELF, &usage) != 0)
+	{
+		return 0;
+	}
+
+#ifdef __APPLE__
+	return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+	return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+bool reset_peak_resident_size()
+{
+#if !defined(_WIN32) && defined(__linux__)
+	// Writing 5 resets VmHWM to the current VmRSS (since Linux 4.0).
+	FILE* file = fopen("/proc/self/clear_refs", "w");
+
+	if(!file)
+	{
+		return false;
+	}
+
+	const bool reset = fputs("5", file) >= 0;
+	return fclose(file) == 0 && reset;
+#else
+	return false;
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+void release_unused_heap()
+{
+#ifdef _WIN32
+	_heapmin();
+#elif defined(__GLIBC__)
+	malloc_trim(0);
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
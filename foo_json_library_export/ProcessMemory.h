@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+
+namespace jsonexport {
+
+//------------------------------------------------------------------------------
+
+/// Bytes of the process's memory resident in RAM (the working set, on Windows), or 0 if the platform doesn't say.
+uint64_t get_resident_size();
+
+/// The most get_resident_size() has been since the process started or reset_peak_resident_size() was last called, or 0 if the platform doesn't say.
+uint64_t get_peak_resident_size();
+
+/// Starts measuring the peak again from the current resident size, so that the peak of one stage of a long-running
+/// process can be measured. Returns false if the platform can't, in which case the peak is since the process started.
+bool reset_peak_resident_size();
+
+/// Returns memory the heap is holding on to, but not using, to the system, so that the resident size
+/// measured afterwards reflects what's in use rather than what something freed earlier left behind.
+void release_unused_heap();
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
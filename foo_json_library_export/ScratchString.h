@@ -0,0 +1,80 @@
+#pragma once
+
+#include "FoobarSDKWrapper.h"
+
+#include <cstring>
+#include <vector>
+
+namespace libraryexport {
+
+// A string to format into over and over again, e.g. once per track.
+// pfc::string8 resizes its buffer to fit on every change, so titleformatting into one reallocates as each piece is appended;
+// this keeps its capacity, so once it's grown to fit the longest value it doesn't allocate again.
+class ScratchString : public pfc::string_base
+{
+public:
+	ScratchString()
+		: m_buffer(1, '\0')
+	{
+	}
+
+	virtual const char* get_ptr() const override
+	{
+		return m_buffer.data();
+	}
+
+	virtual void add_string(const char* p_string, t_size p_length = ~0) override
+	{
+		const t_size length = pfc::strlen_max(p_string, p_length);
+
+		// The string may be part of this one, so don't let the buffer move out from under it.
+		if(p_string >= m_buffer.data() && p_string < m_buffer.data() + m_buffer.size())
+		{
+			const std::vector<char> copy(p_string, p_string + length);
+			append(copy.data(), length);
+		}
+		else
+		{
+			append(p_string, length);
+		}
+	}
+
+	virtual void truncate(t_size len) override
+	{
+		if(len < get_length())
+		{
+			m_buffer.resize(len + 1);
+			m_buffer[len] = '\0';
+		}
+	}
+
+	virtual t_size get_length() const override
+	{
+		return m_buffer.size() - 1;
+	}
+
+	virtual char* lock_buffer(t_size p_requested_length) override
+	{
+		m_buffer.assign(p_requested_length + 1, '\0');
+		return m_buffer.data();
+	}
+
+	virtual void unlock_buffer() override
+	{
+		m_buffer.resize(strlen(m_buffer.data()) + 1);
+	}
+
+private:
+	// Non-copyable.
+	ScratchString(const ScratchString&);
+	ScratchString& operator=(const ScratchString&);
+
+	void append(const char* string, t_size length)
+	{
+		m_buffer.insert(m_buffer.end() - 1, string, string + length);
+	}
+
+	std::vector<char> m_buffer;		// The string, always followed by a null terminator.
+};
+
+} // namespace libraryexport
@@ -0,0 +1,48 @@
+#include "ScriptCache.h"
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace libraryexport {
+
+namespace
+{
+
+std::mutex compiledScriptsMutex;
+std::unordered_map<std::string, titleformat_object::ptr> compiledScripts;
+
+// The scripts are services, so must be released before foobar2000 shuts down rather than with the rest of the globals.
+class ScriptCacheInitQuit : public initquit
+{
+public:
+	virtual void on_quit() override
+	{
+		std::lock_guard<std::mutex> lock(compiledScriptsMutex);
+		compiledScripts.clear();
+	}
+};
+
+initquit_factory_t<ScriptCacheInitQuit> scriptCacheInitQuit;
+
+} // anonymous namespace
+
+//------------------------------------------------------------------------------
+
+titleformat_object::ptr getCompiledScript(const char* script)
+{
+	std::lock_guard<std::mutex> lock(compiledScriptsMutex);
+
+	titleformat_object::ptr& compiled = compiledScripts[script];
+
+	if(compiled.is_empty())
+	{
+		static_api_ptr_t<titleformat_compiler>()->compile_force(compiled, script);
+	}
+
+	return compiled;
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace libraryexport
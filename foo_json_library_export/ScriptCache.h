@@ -0,0 +1,11 @@
+#pragma once
+
+#include "FoobarSDKWrapper.h"
+
+namespace libraryexport {
+
+// Compiles a titleformatting script, or returns the copy compiled by an earlier export, so that exporting again with the same
+// fields doesn't recompile them. Scripts are kept until foobar2000 quits. May be called from any thread.
+extern titleformat_object::ptr getCompiledScript(const char* script);
+
+} // namespace libraryexport
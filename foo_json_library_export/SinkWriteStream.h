@@ -0,0 +1,118 @@
+#pragma once
+
+#include "OutputSink.h"
+#include "RapidJsonWrapper.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace jsonexport {
+
+//------------------------------------------------------------------------------
+
+/// rapidjson output stream which writes into buffers acquired from an output_sink.
+class sink_write_stream
+{
+public:
+	typedef char Ch;
+
+	explicit sink_write_stream(output_sink& sink)
+		: m_sink(sink)
+		, m_buffer(nullptr)
+		, m_current(nullptr)
+		, m_end(nullptr)
+	{
+	}
+
+	void Put(char c)
+	{
+		if(m_current == m_end)
+		{
+			next_buffer();
+		}
+
+		*m_current++ = c;
+	}
+
+	void PutN(char c, size_t n)
+	{
+		while(n > 0)
+		{
+			if(m_current == m_end)
+			{
+				next_buffer();
+			}
+
+			const size_t count = std::min(n, static_cast<size_t>(m_end - m_current));
+			memset(m_current, c, count);
+			m_current += count;
+			n -= count;
+		}
+	}
+
+	void PutBuffer(const char* buffer, size_t n)
+	{
+		while(n > 0)
+		{
+			if(m_current == m_end)
+			{
+				next_buffer();
+			}
+
+			const size_t count = std::min(n, static_cast<size_t>(m_end - m_current));
+			memcpy(m_current, buffer, count);
+			m_current += count;
+			buffer += count;
+			n -= count;
+		}
+	}
+
+	/// Commits whatever has been written so far to the sink.
+	void Flush()
+	{
+		if(m_buffer)
+		{
+			m_sink.commit_buffer(m_current - m_buffer);
+			m_buffer = m_current = m_end = nullptr;
+		}
+	}
+
+private:
+	// Non-copyable.
+	sink_write_stream(const sink_write_stream&);
+	sink_write_stream& operator=(const sink_write_stream&);
+
+	void next_buffer()
+	{
+		Flush();
+
+		size_t capacity = 0;
+		m_buffer = m_current = m_sink.acquire_buffer(capacity);
+		m_end = m_buffer + capacity;
+	}
+
+	output_sink& m_sink;
+	char* m_buffer;
+	char* m_current;
+	char* m_end;
+};
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
+
+namespace rapidjson {
+
+template<>
+inline void PutN(jsonexport::sink_write_stream& stream, char c, size_t n)
+{
+	stream.PutN(c, n);
+}
+
+template<>
+inline void PutBuffer(jsonexport::sink_write_stream& stream, const char* buffer, size_t n)
+{
+	stream.PutBuffer(buffer, n);
+}
+
+} // namespace rapidjson
@@ -0,0 +1,143 @@
+#include "StringDictionary.h"
+
+#include <algorithm>
+
+namespace jsonexport {
+
+namespace
+{
+
+// Orders value indices by how often they were added, most first, then by index, for a stable and repeatable order.
+class more_frequent
+{
+public:
+	explicit more_frequent(const std::vector<uint64_t>& counts)
+		: m_counts(counts)
+	{
+	}
+
+	bool operator()(size_t a, size_t b) const
+	{
+		return m_counts[a] != m_counts[b] ? m_counts[a] > m_counts[b] : a < b;
+	}
+
+private:
+	const std::vector<uint64_t>& m_counts;
+};
+
+} // anonymous namespace
+
+//------------------------------------------------------------------------------
+
+string_dictionary::string_dictionary(const std::vector<std::string>& properties)
+	: m_properties(properties)
+	, m_encoded_properties(properties.begin(), properties.end())
+	, m_indices()
+	, m_values()
+	, m_counts()
+	, m_order()
+	, m_places()
+	, m_lookup()
+	, m_reuse_count(0)
+	, m_value_size(0)
+{
+}
+
+//------------------------------------------------------------------------------
+
+const std::vector<std::string>& string_dictionary::get_properties() const
+{
+	return m_properties;
+}
+
+//------------------------------------------------------------------------------
+
+bool string_dictionary::is_encoded(const char* object, const char* name)
+{
+	m_lookup.assign(object);
+	m_lookup += '.';
+	m_lookup.append(name);
+	return m_encoded_properties.count(m_lookup) > 0;
+}
+
+//------------------------------------------------------------------------------
+
+size_t string_dictionary::add(const char* value, size_t length)
+{
+	m_lookup.assign(value, length);
+
+	const std::unordered_map<std::string, size_t>::const_iterator found = m_indices.find(m_lookup);
+
+	if(found != m_indices.end())
+	{
+		++m_counts[found->second];
+		++m_reuse_count;
+		return found->second;
+	}
+
+	const size_t index = m_values.size();
+	m_values.push_back(&m_indices.insert(std::make_pair(m_lookup, index)).first->first);
+	m_counts.push_back(1);
+	m_value_size += length;
+	return index;
+}
+
+//------------------------------------------------------------------------------
+
+void string_dictionary::sort_by_frequency()
+{
+	m_order.resize(m_values.size());
+
+	for(size_t i = 0; i < m_order.size(); ++i)
+	{
+		m_order[i] = i;
+	}
+
+	std::sort(m_order.begin(), m_order.end(), more_frequent(m_counts));
+
+	m_places.resize(m_order.size());
+
+	for(size_t place = 0; place < m_order.size(); ++place)
+	{
+		m_places[m_order[place]] = place;
+	}
+}
+
+//------------------------------------------------------------------------------
+
+size_t string_dictionary::get_index(size_t index_when_added) const
+{
+	return m_places.empty() ? index_when_added : m_places[index_when_added];
+}
+
+//------------------------------------------------------------------------------
+
+size_t string_dictionary::get_size() const
+{
+	return m_values.size();
+}
+
+//------------------------------------------------------------------------------
+
+const std::string& string_dictionary::get_value(size_t index) const
+{
+	return *m_values[m_order.empty() ? index : m_order[index]];
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t string_dictionary::get_reuse_count() const
+{
+	return m_reuse_count;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t string_dictionary::get_value_size() const
+{
+	return m_value_size;
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
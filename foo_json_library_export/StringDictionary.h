@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace jsonexport {
+
+//------------------------------------------------------------------------------
+
+/// A table of the distinct values of chosen properties, so that each track can refer to a value by its index in the table
+/// rather than repeating the string. Indices are handed out in the order values are first seen; once every value has been
+/// added, the table can be reordered so that the commonest values get the smallest, and so shortest, indices.
+class string_dictionary
+{
+public:
+	/// Properties are named as in the columnar layout, e.g. "meta.GENRE" or "info.codec".
+	explicit string_dictionary(const std::vector<std::string>& properties);
+
+	const std::vector<std::string>& get_properties() const;
+
+	/// Whether values of the given property of the given object, e.g. "GENRE" of "meta", go in the table.
+	bool is_encoded(const char* object, const char* name);
+
+	/// Returns the value's index in the table, adding it if it's new.
+	size_t add(const char* value, size_t length);
+
+	/// Reorders the table by how many times each value was added, most first, ties in the order they were first seen.
+	/// Afterwards get_index() maps the indices add() returned to their new places; they map to themselves until this is called.
+	void sort_by_frequency();
+
+	size_t get_index(size_t index_when_added) const;
+
+	/// The values in order, after any sorting.
+	size_t get_size() const;
+	const std::string& get_value(size_t index) const;
+
+	/// Values added which were already in the table, so are written as indices instead of strings.
+	uint64_t get_reuse_count() const;
+
+	/// Bytes of the distinct values.
+	uint64_t get_value_size() const;
+
+private:
+	// Non-copyable.
+	string_dictionary(const string_dictionary&);
+	string_dictionary& operator=(const string_dictionary&);
+
+	const std::vector<std::string> m_properties;
+	std::unordered_set<std::string> m_encoded_properties;
+
+	std::unordered_map<std::string, size_t> m_indices;
+	std::vector<const std::string*> m_values;	///< Keys of m_indices in the order they were added; their addresses never change.
+	std::vector<uint64_t> m_counts;				///< How many times each value was added, in the same order.
+	std::vector<size_t> m_order;				///< Value index of each place in the table, once sorted.
+	std::vector<size_t> m_places;				///< Place in the table of each value index, once sorted.
+
+	std::string m_lookup;	///< Reused for looking up properties and values, so that finding existing ones doesn't allocate.
+
+	uint64_t m_reuse_count;
+	uint64_t m_value_size;
+};
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
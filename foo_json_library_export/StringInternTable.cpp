@@ -0,0 +1,189 @@
+#include "StringInternTable.h"
+
+#include <cstring>
+
+namespace jsonexport {
+
+namespace
+{
+
+static const size_t block_size = 64 * 1024;
+
+// A key's values are only judged once this many have been looked up, so a few early repeats or uniques don't decide it.
+static const uint64_t key_trial_count = 256;
+
+} // anonymous namespace
+
+//------------------------------------------------------------------------------
+
+string_intern_table::key_statistics::key_statistics()
+	: lookup_count(0)
+	, reuse_count(0)
+	, is_interning(true)
+{
+}
+
+//------------------------------------------------------------------------------
+
+size_t string_intern_table::stored_string_hash::operator()(const stored_string& string) const
+{
+	// FNV-1a.
+	uint64_t hash = 14695981039346656037ULL;
+
+	for(size_t i = 0; i < string.length; ++i)
+	{
+		hash ^= static_cast<unsigned char>(string.data[i]);
+		hash *= 1099511628211ULL;
+	}
+
+	return static_cast<size_t>(hash);
+}
+
+//------------------------------------------------------------------------------
+
+bool string_intern_table::stored_string_equal::operator()(const stored_string& a, const stored_string& b) const
+{
+	return a.length == b.length && memcmp(a.data, b.data, a.length) == 0;
+}
+
+//------------------------------------------------------------------------------
+
+string_intern_table::string_intern_table()
+	: m_strings()
+	, m_keys()
+	, m_blocks()
+	, m_next(nullptr)
+	, m_remaining(0)
+	, m_reuse_count(0)
+	, m_stored_size(0)
+	, m_saved_size(0)
+{
+}
+
+//------------------------------------------------------------------------------
+
+const char* string_intern_table::intern(const char* string, size_t length)
+{
+	stored_string key;
+	key.data = string;
+	key.length = length;
+
+	const std::unordered_set<stored_string, stored_string_hash, stored_string_equal>::const_iterator found = m_strings.find(key);
+
+	if(found != m_strings.end())
+	{
+		++m_reuse_count;
+		m_saved_size += length + 1;
+		return found->data;
+	}
+
+	key.data = store(string, length);
+	m_strings.insert(key);
+	return key.data;
+}
+
+//------------------------------------------------------------------------------
+
+const char* string_intern_table::intern(const char* string)
+{
+	return intern(string, strlen(string));
+}
+
+//------------------------------------------------------------------------------
+
+const char* string_intern_table::intern_value(const char* key, const char* string, size_t length)
+{
+	key_statistics& statistics = m_keys[key];
+
+	if(!statistics.is_interning)
+	{
+		return nullptr;
+	}
+
+	const uint64_t reuse_count = m_reuse_count;
+	const char* interned = intern(string, length);
+
+	++statistics.lookup_count;
+	statistics.reuse_count += m_reuse_count - reuse_count;
+
+	// Give up on keys whose values are mostly new; the ones already stored stay valid.
+	if(statistics.lookup_count >= key_trial_count && statistics.reuse_count * 2 < statistics.lookup_count)
+	{
+		statistics.is_interning = false;
+	}
+
+	return interned;
+}
+
+//------------------------------------------------------------------------------
+
+const char* string_intern_table::intern_value(const char* key, const char* string)
+{
+	return intern_value(key, string, strlen(string));
+}
+
+//------------------------------------------------------------------------------
+
+size_t string_intern_table::get_distinct_count() const
+{
+	return m_strings.size();
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t string_intern_table::get_reuse_count() const
+{
+	return m_reuse_count;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t string_intern_table::get_stored_size() const
+{
+	return m_stored_size;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t string_intern_table::get_saved_size() const
+{
+	return m_saved_size;
+}
+
+//------------------------------------------------------------------------------
+
+const char* string_intern_table::store(const char* string, size_t length)
+{
+	const size_t size = length + 1;
+
+	if(size > m_remaining)
+	{
+		// Long strings get a block to themselves, leaving the current one to carry on filling.
+		if(size > block_size / 4)
+		{
+			m_blocks.push_back(std::unique_ptr<char[]>(new char[size]));
+			char* const copy = m_blocks.back().get();
+			memcpy(copy, string, length);
+			copy[length] = '\0';
+			m_stored_size += size;
+			return copy;
+		}
+
+		m_blocks.push_back(std::unique_ptr<char[]>(new char[block_size]));
+		m_next = m_blocks.back().get();
+		m_remaining = block_size;
+	}
+
+	char* const copy = m_next;
+	memcpy(copy, string, length);
+	copy[length] = '\0';
+
+	m_next += size;
+	m_remaining -= size;
+	m_stored_size += size;
+	return copy;
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
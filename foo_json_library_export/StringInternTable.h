@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace jsonexport {
+
+//------------------------------------------------------------------------------
+
+/// Stores each distinct string once, so that a document built from many tracks can refer to a single copy of each key
+/// and repeated value rather than copying it into every track. Not thread-safe.
+class string_intern_table
+{
+public:
+	string_intern_table();
+
+	/// Returns the stored copy of the string, storing it first if it's new.
+	/// The copy is null-terminated, and valid until the table is destroyed.
+	const char* intern(const char* string, size_t length);
+	const char* intern(const char* string);
+
+	/// As intern(), for a value of the given key, which is identified by its address, e.g. the key's interned copy. Values of keys which turn out to be mostly unique
+	/// (e.g. titles) aren't worth a table entry each, so for those this stops storing anything and returns nullptr.
+	const char* intern_value(const char* key, const char* string, size_t length);
+	const char* intern_value(const char* key, const char* string);
+
+	size_t get_distinct_count() const;
+
+	/// Strings looked up and found, which would otherwise have been copied.
+	uint64_t get_reuse_count() const;
+
+	/// Bytes of the stored strings, including their terminators.
+	uint64_t get_stored_size() const;
+
+	/// Bytes which copying each string every time it was looked up would have taken on top of the stored strings.
+	uint64_t get_saved_size() const;
+
+private:
+	// Non-copyable.
+	string_intern_table(const string_intern_table&);
+	string_intern_table& operator=(const string_intern_table&);
+
+	struct stored_string
+	{
+		const char* data;
+		size_t length;
+	};
+
+	struct stored_string_hash
+	{
+		size_t operator()(const stored_string& string) const;
+	};
+
+	struct stored_string_equal
+	{
+		bool operator()(const stored_string& a, const stored_string& b) const;
+	};
+
+	/// How often a key's values have been found already, to decide whether they're worth interning.
+	struct key_statistics
+	{
+		key_statistics();
+
+		uint64_t lookup_count;
+		uint64_t reuse_count;
+		bool is_interning;
+	};
+
+	const char* store(const char* string, size_t length);
+
+	std::unordered_set<stored_string, stored_string_hash, stored_string_equal> m_strings;
+	std::unordered_map<const char*, key_statistics> m_keys;	///< By interned key, so compared by address.
+
+	/// The strings are copied into blocks, which are never moved, so the pointers handed out stay valid.
+	std::vector<std::unique_ptr<char[]>> m_blocks;
+	char* m_next;
+	size_t m_remaining;
+
+	uint64_t m_reuse_count;
+	uint64_t m_stored_size;
+	uint64_t m_saved_size;
+};
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
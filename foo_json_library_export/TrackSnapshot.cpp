@@ -0,0 +1,547 @@
+#include "TrackSnapshot.h"
+
+#include "TrackingAllocator.h"
+#include "WorkerThreads.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <thread>
+
+namespace jsonexport {
+
+//------------------------------------------------------------------------------
+
+static const char* const snapshot_ceiling_advice = "Reading the tracks straight from the library, rather than copying them into a snapshot first, needs far less.";
+
+//------------------------------------------------------------------------------
+
+/// Reads tracks back out of the snapshot. Strings point straight into the arenas, so nothing is copied.
+class track_snapshot::reader : public track_reader
+{
+public:
+	explicit reader(const track_snapshot& snapshot)
+		: m_snapshot(snapshot)
+		, m_track(nullptr)
+	{
+	}
+
+	virtual bool read(size_t index) override
+	{
+		m_track = &m_snapshot.m_tracks[index];
+		return m_track->is_readable;
+	}
+
+	virtual const char* get_path() const override
+	{
+		return m_track->path.data;
+	}
+
+	virtual unsigned get_subsong_index() const override
+	{
+		return m_track->subsong_index;
+	}
+
+	virtual double get_length() const override
+	{
+		return m_track->length;
+	}
+
+	virtual replaygain get_replaygain() const override
+	{
+		return m_track->replay_gain;
+	}
+
+	virtual size_t info_get_count() const override
+	{
+		return m_track->info_count;
+	}
+
+	virtual const char* info_enum_name(size_t index) const override
+	{
+		return m_track->info[index].name.data;
+	}
+
+	virtual const char* info_enum_value(size_t index) const override
+	{
+		return m_track->info[index].value.data;
+	}
+
+	virtual size_t meta_get_count() const override
+	{
+		return m_track->meta_count;
+	}
+
+	virtual const char* meta_enum_name(size_t index) const override
+	{
+		return m_track->meta[index].name.data;
+	}
+
+	virtual size_t meta_enum_value_count(size_t index) const override
+	{
+		return m_track->meta[index].value_count;
+	}
+
+	virtual const char* meta_enum_value(size_t index, size_t value_index) const override
+	{
+		return m_track->meta[index].values[value_index].data;
+	}
+
+	virtual void format_fields(std::vector<field_value>& values) const override
+	{
+		values.resize(m_snapshot.m_fields.size());
+
+		for(size_t i = 0; i < values.size(); ++i)
+		{
+			values[i].data = m_track->formatted[i].data;
+			values[i].length = m_track->formatted[i].length;
+		}
+	}
+
+private:
+	// Non-copyable.
+	reader(const reader&);
+	reader& operator=(const reader&);
+
+	const track_snapshot& m_snapshot;
+	const track* m_track;
+};
+
+//------------------------------------------------------------------------------
+
+track_snapshot::arena::arena(std::atomic<uint64_t>& snapshot_size, uint64_t memory_ceiling)
+	: m_snapshot_size(snapshot_size)
+	, m_memory_ceiling(memory_ceiling)
+	, m_blocks()
+	, m_next(nullptr)
+	, m_remaining(0)
+	, m_allocation_count(0)
+	, m_allocated_bytes(0)
+{
+}
+
+//------------------------------------------------------------------------------
+
+track_snapshot::arena::~arena()
+{
+	for(size_t i = 0; i < m_blocks.size(); ++i)
+	{
+		delete[] m_blocks[i];
+	}
+}
+
+//------------------------------------------------------------------------------
+
+void* track_snapshot::arena::allocate(size_t size, size_t alignment)
+{
+	// Big enough that there are few blocks, but small enough that the last one doesn't waste much.
+	static const size_t block_size = 1024 * 1024;
+
+	const size_t padding = (alignment - reinterpret_cast<uintptr_t>(m_next) % alignment) % alignment;
+
+	++m_allocation_count;
+	m_allocated_bytes += size;
+
+	if(!m_next || padding + size > m_remaining)
+	{
+		// Anything too big for a block gets one to itself, and the current block carries on being filled.
+		if(size > block_size / 4)
+		{
+			return allocate_block(size);
+		}
+
+		// Blocks from new[] are aligned for anything.
+		m_next = allocate_block(block_size);
+		m_remaining = block_size;
+	}
+	else
+	{
+		m_next += padding;
+		m_remaining -= padding;
+	}
+
+	void* const memory = m_next;
+	m_next += size;
+	m_remaining -= size;
+	return memory;
+}
+
+//------------------------------------------------------------------------------
+
+char* track_snapshot::arena::allocate_block(size_t size)
+{
+	// Charged before it's allocated, so that going over the ceiling fails the export rather than the process.
+	const uint64_t snapshot_size = m_snapshot_size.fetch_add(size) + size;
+	check_memory_ceiling(snapshot_size, m_memory_ceiling, snapshot_ceiling_advice);
+
+	char* const block = new char[size];
+	m_blocks.push_back(block);
+	return block;
+}
+
+//------------------------------------------------------------------------------
+
+track_snapshot::string_ref track_snapshot::arena::add_string(const char* string, size_t length)
+{
+	char* const data = static_cast<char*>(allocate(length + 1, 1));
+	memcpy(data, string, length);
+	data[length] = '\0';
+
+	string_ref ref;
+	ref.data = data;
+	ref.length = length;
+	return ref;
+}
+
+//------------------------------------------------------------------------------
+
+track_snapshot::string_ref track_snapshot::arena::add_string(const char* string)
+{
+	return add_string(string, strlen(string));
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t track_snapshot::arena::get_allocation_count() const
+{
+	return m_allocation_count;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t track_snapshot::arena::get_allocated_bytes() const
+{
+	return m_allocated_bytes;
+}
+
+//------------------------------------------------------------------------------
+
+size_t track_snapshot::arena::get_block_count() const
+{
+	return m_blocks.size();
+}
+
+//------------------------------------------------------------------------------
+
+track_snapshot::track_snapshot(track_source& source, size_t thread_count, export_status& status, uint64_t memory_ceiling)
+	: m_fields(source.get_formatted_fields())
+	, m_memory_ceiling(memory_ceiling)
+	, m_tracks()
+	, m_size(0)
+	, m_arenas()
+{
+	capture(source, thread_count, nullptr, 0, 0.0, status);
+}
+
+//------------------------------------------------------------------------------
+
+track_snapshot::track_snapshot(track_source& source, size_t thread_count, source_lock& lock, size_t tracks_per_batch, double seconds_per_batch, export_status& status, uint64_t memory_ceiling)
+	: m_fields(source.get_formatted_fields())
+	, m_memory_ceiling(memory_ceiling)
+	, m_tracks()
+	, m_size(0)
+	, m_arenas()
+{
+	capture(source, thread_count, &lock, tracks_per_batch, seconds_per_batch, status);
+}
+
+//------------------------------------------------------------------------------
+
+size_t track_snapshot::get_track_count() const
+{
+	return m_tracks.size();
+}
+
+//------------------------------------------------------------------------------
+
+const std::vector<formatted_field>& track_snapshot::get_formatted_fields() const
+{
+	return m_fields;
+}
+
+//------------------------------------------------------------------------------
+
+std::unique_ptr<track_reader> track_snapshot::create_reader()
+{
+	return std::unique_ptr<track_reader>(new reader(*this));
+}
+
+//------------------------------------------------------------------------------
+
+const char* track_snapshot::get_track_path(size_t index) const
+{
+	return m_tracks[index].path.data;
+}
+
+//------------------------------------------------------------------------------
+
+unsigned track_snapshot::get_track_subsong_index(size_t index) const
+{
+	return m_tracks[index].subsong_index;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t track_snapshot::get_size() const
+{
+	return m_size;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t track_snapshot::get_allocation_count() const
+{
+	uint64_t count = 1;
+
+	for(size_t i = 0; i < m_arenas.size(); ++i)
+	{
+		count += m_arenas[i]->get_allocation_count();
+	}
+
+	return count;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t track_snapshot::get_allocated_bytes() const
+{
+	uint64_t bytes = m_tracks.size() * sizeof(track);
+
+	for(size_t i = 0; i < m_arenas.size(); ++i)
+	{
+		bytes += m_arenas[i]->get_allocated_bytes();
+	}
+
+	return bytes;
+}
+
+//------------------------------------------------------------------------------
+
+size_t track_snapshot::get_block_count() const
+{
+	size_t count = 1;
+
+	for(size_t i = 0; i < m_arenas.size(); ++i)
+	{
+		count += m_arenas[i]->get_block_count();
+	}
+
+	return count;
+}
+
+//------------------------------------------------------------------------------
+
+void track_snapshot::capture(track_source& source, size_t thread_count, source_lock* lock, size_t tracks_per_batch, double seconds_per_batch, export_status& status)
+{
+	const size_t track_count = source.get_track_count();
+
+	m_size = static_cast<uint64_t>(track_count) * sizeof(track);
+	check_memory_ceiling(m_size, m_memory_ceiling, snapshot_ceiling_advice);
+	m_tracks.resize(track_count);
+
+	// Not worth splitting small libraries up, and each thread should have a fair few tracks to capture.
+	thread_count = std::max<size_t>(1, std::min(thread_count, track_count / 1024));
+
+	std::vector<std::unique_ptr<track_reader>> readers;
+
+	for(size_t i = 0; i < thread_count; ++i)
+	{
+		readers.push_back(source.create_reader());
+	}
+
+	// Created up front, as the threads fill in their arenas concurrently.
+	for(size_t i = 0; i < thread_count; ++i)
+	{
+		m_arenas.push_back(std::unique_ptr<arena>(new arena(m_size, m_memory_ceiling)));
+	}
+
+	if(!lock || tracks_per_batch == 0)
+	{
+		tracks_per_batch = track_count;
+	}
+
+	size_t next_track = 0;
+
+	while(true)
+	{
+		const size_t batch_end = next_track + std::min(tracks_per_batch, track_count - next_track);
+		next_track = capture_batch(readers, next_track, batch_end, lock ? seconds_per_batch : 0.0, status);
+
+		if(next_track == track_count)
+		{
+			break;
+		}
+
+		// Let anyone waiting for the lock have it before carrying on.
+		lock->release();
+		std::this_thread::yield();
+		lock->acquire();
+	}
+}
+
+//------------------------------------------------------------------------------
+
+size_t track_snapshot::capture_batch(std::vector<std::unique_ptr<track_reader>>& readers, size_t first_track, size_t end_track, double seconds, export_status& status)
+{
+	// Threads take tracks a few at a time, so they finish close together and the time limit is checked often enough.
+	static const size_t tracks_per_claim = 64;
+
+	typedef std::chrono::steady_clock clock;
+	const clock::time_point deadline = clock::now() + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(seconds));
+
+	std::atomic<size_t> next_claim(first_track);
+	std::vector<std::exception_ptr> errors(readers.size());
+
+	// Captures claimed tracks into a thread's arena until the batch is done or out of time.
+	// Tracks are always captured once claimed, so the tracks captured are exactly those before the last claim.
+	auto capture_claims = [&](size_t thread_index, export_status* thread_status, const std::atomic<bool>& cancelled)
+	{
+		arena& storage = *m_arenas[thread_index];
+		track_reader& reader = *readers[thread_index];
+		std::vector<field_value> formatted;
+
+		while(!cancelled && (seconds <= 0.0 || clock::now() < deadline))
+		{
+			const size_t claim = next_claim.fetch_add(tracks_per_claim);
+
+			if(claim >= end_track)
+			{
+				break;
+			}
+
+			if(thread_status)
+			{
+				// Check if the user has chosen to abort; will throw an exception if this is the case.
+				thread_status->check_abort();
+
+				// Update the progress bar.
+				thread_status->set_progress(claim, m_tracks.size());
+			}
+
+			const size_t claim_end = std::min(claim + tracks_per_claim, end_track);
+
+			for(size_t track_index = claim; track_index < claim_end; ++track_index)
+			{
+				capture_track(storage, track_index, reader, formatted);
+			}
+		}
+	};
+
+	worker_threads workers;
+
+	// This thread captures into the first arena, checking for abort and updating the progress bar as it goes.
+	for(size_t i = 1; i < readers.size(); ++i)
+	{
+		std::exception_ptr& error = errors[i];
+		const std::atomic<bool>& cancelled = workers.cancelled();
+
+		workers.start([&capture_claims, i, &error, &cancelled]()
+		{
+			try
+			{
+				capture_claims(i, nullptr, cancelled);
+			}
+			catch(...)
+			{
+				error = std::current_exception();
+			}
+		});
+	}
+
+	capture_claims(0, &status, workers.cancelled());
+
+	workers.join();
+
+	for(size_t i = 0; i < errors.size(); ++i)
+	{
+		if(errors[i])
+		{
+			std::rethrow_exception(errors[i]);
+		}
+	}
+
+	// Always make some progress, even if the time limit is too short to capture anything.
+	const size_t captured_end = std::min(next_claim.load(), end_track);
+
+	if(captured_end == first_track && first_track < end_track)
+	{
+		std::vector<field_value> formatted;
+		capture_track(*m_arenas[0], first_track, *readers[0], formatted);
+		return first_track + 1;
+	}
+
+	return captured_end;
+}
+
+//------------------------------------------------------------------------------
+
+void track_snapshot::capture_track(arena& storage, size_t track_index, track_reader& reader, std::vector<field_value>& formatted)
+{
+	track& snapshot_track = m_tracks[track_index];
+	snapshot_track.is_readable = reader.read(track_index);
+	snapshot_track.path = storage.add_string(reader.get_path());
+	snapshot_track.subsong_index = snapshot_track.is_readable ? reader.get_subsong_index() : 0;
+	snapshot_track.length = 0.0;
+	snapshot_track.info = nullptr;
+	snapshot_track.info_count = 0;
+	snapshot_track.meta = nullptr;
+	snapshot_track.meta_count = 0;
+	snapshot_track.formatted = nullptr;
+
+	if(!snapshot_track.is_readable)
+	{
+		// Only the path is available; the export reports the failure when it gets to this track.
+		return;
+	}
+
+	snapshot_track.length = reader.get_length();
+	snapshot_track.replay_gain = reader.get_replaygain();
+
+	const size_t info_count = reader.info_get_count();
+	info_entry* const info = storage.allocate_array<info_entry>(info_count);
+
+	for(size_t i = 0; i < info_count; ++i)
+	{
+		info[i].name = storage.add_string(reader.info_enum_name(i));
+		info[i].value = storage.add_string(reader.info_enum_value(i));
+	}
+
+	snapshot_track.info = info;
+	snapshot_track.info_count = info_count;
+
+	const size_t meta_count = reader.meta_get_count();
+	meta_entry* const meta = storage.allocate_array<meta_entry>(meta_count);
+
+	for(size_t i = 0; i < meta_count; ++i)
+	{
+		const size_t value_count = reader.meta_enum_value_count(i);
+		string_ref* const values = storage.allocate_array<string_ref>(value_count);
+
+		for(size_t j = 0; j < value_count; ++j)
+		{
+			values[j] = storage.add_string(reader.meta_enum_value(i, j));
+		}
+
+		meta[i].name = storage.add_string(reader.meta_enum_name(i));
+		meta[i].values = values;
+		meta[i].value_count = value_count;
+	}
+
+	snapshot_track.meta = meta;
+	snapshot_track.meta_count = meta_count;
+
+	reader.format_fields(formatted);
+	string_ref* const formatted_values = storage.allocate_array<string_ref>(m_fields.size());
+
+	for(size_t i = 0; i < m_fields.size(); ++i)
+	{
+		formatted_values[i] = storage.add_string(formatted[i].data, formatted[i].length);
+	}
+
+	snapshot_track.formatted = formatted_values;
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
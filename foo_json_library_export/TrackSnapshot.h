@@ -0,0 +1,157 @@
+#pragma once
+
+#include "LibraryExport.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace jsonexport {
+
+//------------------------------------------------------------------------------
+
+/// Something which must be held while reading from a track source, such as the database lock,
+/// which a track_snapshot can release between batches of tracks so that whoever else needs it isn't kept waiting.
+class source_lock
+{
+public:
+	virtual ~source_lock() {}
+
+	virtual void acquire() = 0;
+	virtual void release() = 0;
+};
+
+//------------------------------------------------------------------------------
+
+/// A copy of everything the export reads from each track of another source, so that the other source can be released
+/// (e.g. the database unlocked) before the slower work of serializing and writing the tracks begins.
+/// Strings and tables are copied into a few large arenas rather than allocated one by one, so capturing is mostly memcpy.
+class track_snapshot : public track_source
+{
+public:
+	/// Reads every track in source, using thread_count threads; the source isn't used once this returns.
+	/// Throws if status says to abort. Tracks whose info can't be read are remembered as such, failing to read later instead.
+	/// Throws export_error, as the export does, if the snapshot would take more than memory_ceiling bytes; 0 means no limit.
+	track_snapshot(track_source& source, size_t thread_count, export_status& status, uint64_t memory_ceiling = 0);
+
+	/// As above, but releasing the lock (which must be held on entry, and is held again on return) between batches of tracks.
+	/// A batch ends after tracks_per_batch tracks or seconds_per_batch seconds, whichever comes first; 0 means no limit.
+	/// Each batch captures at least one track. The snapshot is no longer of a single moment, as tracks can change between batches.
+	track_snapshot(track_source& source, size_t thread_count, source_lock& lock, size_t tracks_per_batch, double seconds_per_batch, export_status& status, uint64_t memory_ceiling = 0);
+
+	virtual size_t get_track_count() const override;
+	virtual const std::vector<formatted_field>& get_formatted_fields() const override;
+	virtual std::unique_ptr<track_reader> create_reader() override;
+	virtual const char* get_track_path(size_t index) const override;
+	virtual unsigned get_track_subsong_index(size_t index) const override;
+
+	/// Bytes allocated to hold the tracks.
+	uint64_t get_size() const;
+
+	/// Strings and tables copied into the arenas, and the bytes they took; then the blocks the arenas allocated to hold them,
+	/// counting the table of tracks as one. For export_metrics::add_allocations(), with get_size() as the peak, as nothing's freed.
+	uint64_t get_allocation_count() const;
+	uint64_t get_allocated_bytes() const;
+	size_t get_block_count() const;
+
+private:
+	// Non-copyable.
+	track_snapshot(const track_snapshot&);
+	track_snapshot& operator=(const track_snapshot&);
+
+	class reader;
+
+	/// A string in an arena, where it's also null-terminated.
+	struct string_ref
+	{
+		const char* data;
+		size_t length;
+	};
+
+	struct info_entry
+	{
+		string_ref name;
+		string_ref value;
+	};
+
+	struct meta_entry
+	{
+		string_ref name;
+		const string_ref* values;
+		size_t value_count;
+	};
+
+	struct track
+	{
+		string_ref path;
+		unsigned subsong_index;
+		bool is_readable;
+		double length;
+		jsonexport::replaygain replay_gain;
+
+		const info_entry* info;
+		size_t info_count;
+		const meta_entry* meta;
+		size_t meta_count;
+		const string_ref* formatted;	///< One for each formatted field.
+	};
+
+	/// Holds the strings and tables captured by one thread. Memory is handed out from large blocks,
+	/// which are never moved or reallocated, so growing the arena doesn't copy what's already in it.
+	/// Each block is added to snapshot_size, shared by every arena, which mustn't go over memory_ceiling.
+	class arena
+	{
+	public:
+		arena(std::atomic<uint64_t>& snapshot_size, uint64_t memory_ceiling);
+		~arena();
+
+		template<typename T>
+		T* allocate_array(size_t count)
+		{
+			return static_cast<T*>(allocate(count * sizeof(T), sizeof(void*)));
+		}
+
+		string_ref add_string(const char* string, size_t length);
+		string_ref add_string(const char* string);
+
+		uint64_t get_allocation_count() const;
+		uint64_t get_allocated_bytes() const;
+		size_t get_block_count() const;
+
+	private:
+		// Non-copyable.
+		arena(const arena&);
+		arena& operator=(const arena&);
+
+		void* allocate(size_t size, size_t alignment);
+		char* allocate_block(size_t size);
+
+		std::atomic<uint64_t>& m_snapshot_size;
+		const uint64_t m_memory_ceiling;
+		std::vector<char*> m_blocks;
+		char* m_next;
+		size_t m_remaining;
+		uint64_t m_allocation_count;
+		uint64_t m_allocated_bytes;
+	};
+
+	void capture(track_source& source, size_t thread_count, source_lock* lock, size_t tracks_per_batch, double seconds_per_batch, export_status& status);
+
+	/// Captures tracks from first_track on, until end_track or until the time runs out; returns the track after the last one captured.
+	size_t capture_batch(std::vector<std::unique_ptr<track_reader>>& readers, size_t first_track, size_t end_track, double seconds, export_status& status);
+
+	void capture_track(arena& storage, size_t track_index, track_reader& reader, std::vector<field_value>& formatted);
+
+	const std::vector<formatted_field> m_fields;
+	const uint64_t m_memory_ceiling;
+	std::vector<track> m_tracks;
+	std::atomic<uint64_t> m_size;					///< What get_size() returns, added to by the arenas as they grow.
+	std::vector<std::unique_ptr<arena>> m_arenas;	///< One for each capturing thread.
+};
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
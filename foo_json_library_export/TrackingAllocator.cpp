@@ -0,0 +1,193 @@
+#include "TrackingAllocator.h"
+
+#include "LibraryExport.h"
+#include "ToString.h"
+
+#include <cstdlib>
+#include <string>
+
+namespace jsonexport {
+
+//------------------------------------------------------------------------------
+
+/// Put before each block. Two pointers' worth, which is what malloc aligns to on both 32-bit and 64-bit Windows and Linux,
+/// so the block after it is aligned as malloc would have aligned it.
+struct tracking_allocator::block_header
+{
+	tracking_allocator* owner;
+	size_t size;
+};
+
+namespace
+{
+
+std::string megabytes(uint64_t bytes)
+{
+	return to_string(bytes / (1024.0 * 1024.0), 4) + " MB";
+}
+
+} // anonymous namespace
+
+//------------------------------------------------------------------------------
+
+tracking_allocator::tracking_allocator(uint64_t ceiling)
+	: m_ceiling(ceiling)
+	, m_allocation_count(0)
+	, m_allocated_bytes(0)
+	, m_block_count(0)
+	, m_size(0)
+	, m_peak_size(0)
+{
+	static_assert(sizeof(block_header) == 2 * sizeof(void*), "Blocks wouldn't be aligned as malloc aligns them.");
+}
+
+//------------------------------------------------------------------------------
+
+void* tracking_allocator::Malloc(size_t size)
+{
+	check_ceiling(size, 0);
+
+	block_header* const block = static_cast<block_header*>(malloc(sizeof(block_header) + size));
+
+	if(!block)
+	{
+		throw export_error("Ran out of memory, having allocated " + megabytes(m_size) + " for the export; aborting");
+	}
+
+	add_block(block, size);
+	return block + 1;
+}
+
+//------------------------------------------------------------------------------
+
+void* tracking_allocator::Realloc(void* original, size_t, size_t size)
+{
+	if(!original)
+	{
+		return Malloc(size);
+	}
+
+	block_header* const original_block = static_cast<block_header*>(original) - 1;
+	const size_t original_size = original_block->size;
+	check_ceiling(size, original_size);
+
+	// If this fails, the original block is left as it was.
+	block_header* const block = static_cast<block_header*>(realloc(original_block, sizeof(block_header) + size));
+
+	if(!block)
+	{
+		throw export_error("Ran out of memory, having allocated " + megabytes(m_size) + " for the export; aborting");
+	}
+
+	--m_block_count;
+	m_size -= original_size;
+
+	add_block(block, size);
+	return block + 1;
+}
+
+//------------------------------------------------------------------------------
+
+void tracking_allocator::Free(void* pointer)
+{
+	if(!pointer)
+	{
+		return;
+	}
+
+	block_header* const block = static_cast<block_header*>(pointer) - 1;
+	block->owner->remove_block(block);
+	free(block);
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t tracking_allocator::get_allocation_count() const
+{
+	return m_allocation_count;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t tracking_allocator::get_allocated_bytes() const
+{
+	return m_allocated_bytes;
+}
+
+//------------------------------------------------------------------------------
+
+size_t tracking_allocator::get_block_count() const
+{
+	return m_block_count;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t tracking_allocator::get_size() const
+{
+	return m_size;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t tracking_allocator::get_peak_size() const
+{
+	return m_peak_size;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t tracking_allocator::get_ceiling() const
+{
+	return m_ceiling;
+}
+
+//------------------------------------------------------------------------------
+
+void tracking_allocator::check_ceiling(size_t size, size_t reallocated_size) const
+{
+	check_memory_ceiling(m_size - reallocated_size + size, m_ceiling);
+}
+
+//------------------------------------------------------------------------------
+
+void tracking_allocator::add_block(block_header* block, size_t size)
+{
+	block->owner = this;
+	block->size = size;
+
+	++m_allocation_count;
+	m_allocated_bytes += size;
+	++m_block_count;
+	m_size += size;
+	m_peak_size = m_size > m_peak_size ? m_size : m_peak_size;
+}
+
+//------------------------------------------------------------------------------
+
+void tracking_allocator::remove_block(const block_header* block)
+{
+	--m_block_count;
+	m_size -= block->size;
+}
+
+//------------------------------------------------------------------------------
+
+void check_memory_ceiling(uint64_t size, uint64_t ceiling)
+{
+	check_memory_ceiling(size, ceiling, "Streaming the export, rather than building it in memory, needs far less.");
+}
+
+//------------------------------------------------------------------------------
+
+void check_memory_ceiling(uint64_t size, uint64_t ceiling, const char* advice)
+{
+	if(ceiling > 0 && size > ceiling)
+	{
+		throw export_error("The export needs more than the " + megabytes(ceiling) + " of memory it's limited to; aborting. " + advice);
+	}
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
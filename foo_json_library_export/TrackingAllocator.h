@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace jsonexport {
+
+//------------------------------------------------------------------------------
+
+/// An allocator for rapidjson, in place of CrtAllocator, which keeps count of what it allocates and how much it has
+/// allocated at once, and which can be given a ceiling on that. Beneath a MemoryPoolAllocator it allocates the pool's chunks,
+/// so it shows how much memory a document really takes, rather than just how much was asked of the pool.
+/// Running out of memory, or hitting the ceiling, throws export_error rather than handing rapidjson a null pointer,
+/// so a document too big for a 32-bit process fails the export instead of the process.
+/// Not thread-safe. It must outlive everything allocated from it, e.g. the pool it's given to.
+class tracking_allocator
+{
+public:
+	static const bool kNeedFree = true;
+
+	/// ceiling is the most bytes to have allocated at once; 0 means no limit.
+	explicit tracking_allocator(uint64_t ceiling = 0);
+
+	void* Malloc(size_t size);
+	void* Realloc(void* original, size_t original_size, size_t size);
+
+	/// Static, as rapidjson calls it without an allocator; each block remembers which allocator it came from.
+	static void Free(void* pointer);
+
+	/// Calls to Malloc() and Realloc(), and the bytes they asked for.
+	uint64_t get_allocation_count() const;
+	uint64_t get_allocated_bytes() const;
+
+	/// Blocks allocated and not yet freed; beneath a pool, these are its chunks.
+	size_t get_block_count() const;
+
+	/// Bytes allocated and not yet freed, and the most there have been at once.
+	uint64_t get_size() const;
+	uint64_t get_peak_size() const;
+
+	uint64_t get_ceiling() const;
+
+private:
+	// Non-copyable.
+	tracking_allocator(const tracking_allocator&);
+	tracking_allocator& operator=(const tracking_allocator&);
+
+	struct block_header;
+
+	/// Checks that size more bytes can be allocated, on top of any being reallocated, without going over the ceiling.
+	void check_ceiling(size_t size, size_t reallocated_size) const;
+
+	void add_block(block_header* block, size_t size);
+	void remove_block(const block_header* block);
+
+	const uint64_t m_ceiling;
+
+	uint64_t m_allocation_count;
+	uint64_t m_allocated_bytes;
+	size_t m_block_count;
+	uint64_t m_size;
+	uint64_t m_peak_size;
+};
+
+//------------------------------------------------------------------------------
+
+/// Throws the export_error a tracking_allocator throws at its ceiling if size bytes are over ceiling; 0 means no limit.
+/// For what the export holds in memory that isn't allocated through one, e.g. the columns it gathers before writing them.
+void check_memory_ceiling(uint64_t size, uint64_t ceiling);
+
+/// As above, but ending the message with advice, e.g. on how else to export, suiting whatever size measures.
+void check_memory_ceiling(uint64_t size, uint64_t ceiling, const char* advice);
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace jsonexport {
+
+//------------------------------------------------------------------------------
+
+/// Owns a set of worker threads, and makes sure they're joined even if the export fails.
+class worker_threads
+{
+public:
+	worker_threads()
+		: m_cancelled(false)
+		, m_threads()
+	{
+	}
+
+	~worker_threads()
+	{
+		m_cancelled = true;
+		join();
+	}
+
+	template<typename Function>
+	void start(Function function)
+	{
+		m_threads.push_back(std::thread(function));
+	}
+
+	void join()
+	{
+		for(size_t i = 0; i < m_threads.size(); ++i)
+		{
+			m_threads[i].join();
+		}
+
+		m_threads.clear();
+	}
+
+	/// Set when the export is being abandoned, so workers can stop early.
+	const std::atomic<bool>& cancelled() const
+	{
+		return m_cancelled;
+	}
+
+private:
+	// Non-copyable.
+	worker_threads(const worker_threads&);
+	worker_threads& operator=(const worker_threads&);
+
+	std::atomic<bool> m_cancelled;
+	std::vector<std::thread> m_threads;
+};
+
+//------------------------------------------------------------------------------
+
+} // namespace jsonexport
@@ -6,6 +6,8 @@
 #define IDC_FILE_PATH_TEXT              1066
 #define IDC_FILE_PATH_LABEL             1067
 #define IDC_BROWSE_BUTTON               1073
+#define IDC_EXTRA_FIELDS_TEXT           1074
+#define IDC_EXTRA_FIELDS_LABEL          1075
 
 // Next default values for new objects
 // 
@@ -13,7 +15,7 @@
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NEXT_RESOURCE_VALUE        111
 #define _APS_NEXT_COMMAND_VALUE         40001
-#define _APS_NEXT_CONTROL_VALUE         1074
+#define _APS_NEXT_CONTROL_VALUE         1076
 #define _APS_NEXT_SYMED_VALUE           101
 #endif
 #endif
@@ -0,0 +1,814 @@
+// Benchmarks the export engine against synthetic libraries, without foobar2000, so that versions can be compared.
+// Each scenario exports the same library a few times; the median time is reported, along with the best and the peak memory used.
+
+#include "FragmentCache.h"
+#include "LibraryExport.h"
+#include "ProcessMemory.h"
+#include "RapidJsonWrapper.h"
+#include "SyntheticLibrary.h"
+#include "TrackSnapshot.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+typedef std::chrono::steady_clock stage_clock;
+
+double seconds_since(const stage_clock::time_point& start)
+{
+	return std::chrono::duration<double>(stage_clock::now() - start).count();
+}
+
+double megabytes(uint64_t bytes)
+{
+	return static_cast<double>(bytes) / (1024.0 * 1024.0);
+}
+
+class quiet_status : public jsonexport::export_status
+{
+public:
+	explicit quiet_status(bool verbose)
+		: m_verbose(verbose)
+	{
+	}
+
+	virtual void set_progress(size_t, size_t) override
+	{
+	}
+
+	virtual void check_abort() override
+	{
+	}
+
+	virtual void log(const char* message) override
+	{
+		if(m_verbose)
+		{
+			fprintf(stderr, "%s\n", message);
+		}
+	}
+
+private:
+	bool m_verbose;
+};
+
+// One way of exporting the library. The output file's extension picks its compression and format, as in the component.
+struct scenario
+{
+	const char* name;
+	const char* extension;
+	bool pretty_print;
+	bool stream_output;
+	bool threaded;
+	jsonexport::output_layout layout;
+	bool snapshot;		// Capture a snapshot first, as the component does to release the database lock early.
+	bool cached;		// Fill a fragment cache first, so that every track is found in it.
+	const char* compared_with;	// The JSON scenario whose size and speed this one's are reported against, if any.
+	const char* description;
+};
+
+const scenario scenarios[] = {
+	{ "stream",   ".json",    false, true,  false, jsonexport::layout_tracks,  false, false, nullptr,   "compact JSON, one thread" },
+	{ "pretty",   ".json",    true,  true,  false, jsonexport::layout_tracks,  false, false, nullptr,   "pretty-printed JSON, one thread" },
+	{ "threads",  ".json",    false, true,  true,  jsonexport::layout_tracks,  false, false, nullptr,   "compact JSON, all threads" },
+	{ "document", ".json",    false, false, false, jsonexport::layout_tracks,  false, false, nullptr,   "compact JSON built in memory first" },
+	{ "lines",    ".jsonl",   false, true,  true,  jsonexport::layout_lines,   false, false, nullptr,   "newline-delimited JSON, all threads" },
+	{ "columns",  ".json",    false, true,  false, jsonexport::layout_columns, false, false, nullptr,   "an array per property" },
+	{ "gzip",     ".json.gz", false, true,  true,  jsonexport::layout_tracks,  false, false, "threads", "gzipped compact JSON, all threads" },
+	{ "msgpack",  ".msgpack", false, true,  true,  jsonexport::layout_tracks,  false, false, "threads", "MessagePack, all threads" },
+	{ "cbor",     ".cbor",    false, true,  true,  jsonexport::layout_tracks,  false, false, "threads", "CBOR, all threads" },
+	{ "snapshot", ".json",    false, true,  true,  jsonexport::layout_tracks,  true,  false, nullptr,   "snapshot, then compact JSON, all threads" },
+	{ "cached",   ".json",    false, true,  true,  jsonexport::layout_tracks,  false, true,  nullptr,   "compact JSON from a full fragment cache" }
+};
+
+const size_t scenario_count = sizeof(scenarios) / sizeof(scenarios[0]);
+
+const scenario* find_scenario(const char* name)
+{
+	for(size_t i = 0; i < scenario_count; ++i)
+	{
+		if(strcmp(scenarios[i].name, name) == 0)
+		{
+			return &scenarios[i];
+		}
+	}
+
+	return nullptr;
+}
+
+// How long one run of a scenario spent in each stage, and what it produced.
+struct run_result
+{
+	run_result()
+		: snapshot_seconds(0.0)
+		, export_seconds(0.0)
+		, output_size(0)
+		, peak_resident_size(0)
+	{
+	}
+
+	double get_total_seconds() const
+	{
+		return snapshot_seconds + export_seconds;
+	}
+
+	double snapshot_seconds;
+	double export_seconds;
+	uint64_t output_size;
+	uint64_t peak_resident_size;
+};
+
+// The median and best of a scenario's runs; the median is what's compared between versions, being least upset by the odd slow run.
+struct scenario_result
+{
+	const scenario* benchmarked;
+	run_result median;
+	double best_seconds;
+	uint64_t peak_resident_size;
+};
+
+void print_usage()
+{
+	fprintf(stderr,
+		"Usage: json_library_export_benchmark <output directory> [options]\n"
+		"\n"
+		"Exports a synthetic library in each scenario and reports the median time, tracks/s,\n"
+		"MB/s and peak resident memory of each, then times formatting each kind of number the\n"
+		"export writes, writing the results to benchmark.json in the output directory as well\n"
+		"as to the console.\n"
+		"\n"
+		"Options:\n"
+		"  --tracks <n>          Number of tracks in the synthetic library (default 100000).\n"
+		"  --seed <n>            Seed for generating the synthetic library (default 1).\n"
+		"  --repeat <n>          Runs of each scenario (default 5).\n"
+		"  --threads <n>         Threads for the scenarios which use them; 0 uses one per\n"
+		"                        hardware thread (default 0).\n"
+		"  --scenario <name>     Run only this scenario; may be given more than once. Any\n"
+		"                        scenario it's compared with is run too.\n"
+		"  --verbose             Print what the engine logs.\n"
+		"\n"
+		"Scenarios:\n"
+	);
+
+	for(size_t i = 0; i < scenario_count; ++i)
+	{
+		fprintf(stderr, "  %-21s %s.\n", scenarios[i].name, scenarios[i].description);
+	}
+
+	fprintf(stderr,
+		"\n"
+		"The synthetic library is realistic unless these options say otherwise:\n"
+		"%s",
+		synthetic::profile_usage
+	);
+}
+
+uint64_t file_size(const std::string& file_path)
+{
+	FILE* file = fopen(file_path.c_str(), "rb");
+
+	if(!file)
+	{
+		return 0;
+	}
+
+	fseek(file, 0, SEEK_END);
+	const long long size = ftell(file);
+	fclose(file);
+	return size > 0 ? static_cast<uint64_t>(size) : 0;
+}
+
+// Reads everything the export would from every track, without serializing any of it: the least any export could take.
+double time_reading(jsonexport::track_source& source)
+{
+	const stage_clock::time_point start = stage_clock::now();
+
+	std::unique_ptr<jsonexport::track_reader> reader = source.create_reader();
+	std::vector<jsonexport::field_value> values;
+	size_t total_length = 0;
+
+	for(size_t i = 0; i < source.get_track_count(); ++i)
+	{
+		if(!reader->read(i))
+		{
+			continue;
+		}
+
+		total_length += strlen(reader->get_path());
+
+		for(size_t j = 0; j < reader->info_get_count(); ++j)
+		{
+			total_length += strlen(reader->info_enum_value(j));
+		}
+
+		for(size_t j = 0; j < reader->meta_get_count(); ++j)
+		{
+			for(size_t k = 0; k < reader->meta_enum_value_count(j); ++k)
+			{
+				total_length += strlen(reader->meta_enum_value(j, k));
+			}
+		}
+
+		reader->format_fields(values);
+
+		for(size_t j = 0; j < values.size(); ++j)
+		{
+			total_length += values[j].length;
+		}
+	}
+
+	const double seconds = seconds_since(start);
+
+	// So that the reading can't be optimized away.
+	if(total_length == 0)
+	{
+		fprintf(stderr, "The library is empty.\n");
+	}
+
+	return seconds;
+}
+
+run_result run(const scenario& benchmarked, synthetic::library& library, const std::string& file_path, unsigned thread_count, jsonexport::export_status& status)
+{
+	jsonexport::export_options options;
+	options.compression = jsonexport::compression_for_file_path(file_path);
+	options.format = jsonexport::format_for_file_path(file_path);
+	options.pretty_print = benchmarked.pretty_print;
+	options.stream_output = benchmarked.stream_output;
+	options.thread_count = benchmarked.threaded ? thread_count : 1;
+	options.layout = benchmarked.layout;
+
+	jsonexport::fragment_cache cache;
+
+	if(benchmarked.cached)
+	{
+		options.cache = &cache;
+		jsonexport::export_library_as_json_file(file_path, library, options, status);
+	}
+
+	// Measure the peak from what's resident now, rather than from whatever an earlier run left behind.
+	jsonexport::release_unused_heap();
+	jsonexport::reset_peak_resident_size();
+
+	run_result result;
+
+	if(benchmarked.snapshot)
+	{
+		stage_clock::time_point start = stage_clock::now();
+		jsonexport::track_snapshot snapshot(library, options.thread_count, status);
+		result.snapshot_seconds = seconds_since(start);
+
+		start = stage_clock::now();
+		jsonexport::export_library_as_json_file(file_path, snapshot, options, status);
+		result.export_seconds = seconds_since(start);
+	}
+	else
+	{
+		const stage_clock::time_point start = stage_clock::now();
+		jsonexport::export_library_as_json_file(file_path, library, options, status);
+		result.export_seconds = seconds_since(start);
+	}
+
+	result.peak_resident_size = jsonexport::get_peak_resident_size();
+	result.output_size = file_size(file_path);
+	return result;
+}
+
+bool compare_total_seconds(const run_result& a, const run_result& b)
+{
+	return a.get_total_seconds() < b.get_total_seconds();
+}
+
+scenario_result run_repeatedly(const scenario& benchmarked, synthetic::library& library, const std::string& output_directory, unsigned thread_count, size_t repeat_count, jsonexport::export_status& status)
+{
+	const std::string file_path = output_directory + "/" + benchmarked.name + benchmarked.extension;
+
+	std::vector<run_result> runs;
+
+	for(size_t i = 0; i < repeat_count; ++i)
+	{
+		runs.push_back(run(benchmarked, library, file_path, thread_count, status));
+	}
+
+	std::sort(runs.begin(), runs.end(), compare_total_seconds);
+
+	scenario_result result;
+	result.benchmarked = &benchmarked;
+	result.median = runs[runs.size() / 2];
+	result.best_seconds = runs.front().get_total_seconds();
+	result.peak_resident_size = 0;
+
+	for(size_t i = 0; i < runs.size(); ++i)
+	{
+		result.peak_resident_size = std::max(result.peak_resident_size, runs[i].peak_resident_size);
+	}
+
+	return result;
+}
+
+// Formatting one kind of number on its own, with the writer's conversions and with printf's, which they replaced.
+struct number_formatting_result
+{
+	const char* name;
+	size_t count;
+	double writer_seconds;
+	double printf_seconds;
+};
+
+void write_number(rapidjson::Writer<rapidjson::StringBuffer>& writer, double number)
+{
+	writer.Double(number);
+}
+
+// As the export writes floats, e.g. replaygain, so that 0.1f is written as 0.1.
+void write_number(rapidjson::Writer<rapidjson::StringBuffer>& writer, float number)
+{
+	writer.Double(rapidjson::internal::ShortestDouble(number));
+}
+
+void write_number(rapidjson::Writer<rapidjson::StringBuffer>& writer, int number)
+{
+	writer.Int(number);
+}
+
+void write_number(rapidjson::Writer<rapidjson::StringBuffer>& writer, uint64_t number)
+{
+	writer.Uint64(number);
+}
+
+// With the precision needed to parse back to the same number, which is what the writer guarantees.
+int print_number(char* buffer, double number)
+{
+	return sprintf(buffer, "%.17g", number);
+}
+
+int print_number(char* buffer, float number)
+{
+	return sprintf(buffer, "%.9g", number);
+}
+
+int print_number(char* buffer, int number)
+{
+	return sprintf(buffer, "%d", number);
+}
+
+int print_number(char* buffer, uint64_t number)
+{
+	return sprintf(buffer, "%llu", static_cast<unsigned long long>(number));
+}
+
+template<typename Number>
+number_formatting_result time_number_formatting(const char* name, const std::vector<Number>& numbers, size_t repeat_count)
+{
+	std::vector<double> writer_seconds;
+	std::vector<double> printf_seconds;
+	size_t total_length = 0;
+
+	for(size_t i = 0; i < repeat_count; ++i)
+	{
+		stage_clock::time_point start = stage_clock::now();
+		rapidjson::StringBuffer buffer;
+		rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+		writer.StartArray();
+
+		for(size_t j = 0; j < numbers.size(); ++j)
+		{
+			write_number(writer, numbers[j]);
+		}
+
+		writer.EndArray();
+		total_length += buffer.GetSize();
+		writer_seconds.push_back(seconds_since(start));
+
+		start = stage_clock::now();
+		char printed[32];
+
+		for(size_t j = 0; j < numbers.size(); ++j)
+		{
+			total_length += print_number(printed, numbers[j]);
+		}
+
+		printf_seconds.push_back(seconds_since(start));
+	}
+
+	// So that the formatting can't be optimized away.
+	if(total_length == 0)
+	{
+		fprintf(stderr, "Nothing was formatted.\n");
+	}
+
+	std::sort(writer_seconds.begin(), writer_seconds.end());
+	std::sort(printf_seconds.begin(), printf_seconds.end());
+
+	number_formatting_result result;
+	result.name = name;
+	result.count = numbers.size();
+	result.writer_seconds = writer_seconds[writer_seconds.size() / 2];
+	result.printf_seconds = printf_seconds[printf_seconds.size() / 2];
+	return result;
+}
+
+// The kinds of number an export writes, with the median time taken to format each. Generated from the seed, like the library.
+std::vector<number_formatting_result> time_number_formatting(uint64_t seed, size_t repeat_count)
+{
+	static const size_t count = 200000;
+
+	std::mt19937_64 random(seed);
+	std::vector<double> lengths;
+	std::vector<float> gains;
+	std::vector<double> doubles;
+	std::vector<int> ints;
+	std::vector<uint64_t> sizes;
+
+	for(size_t i = 0; i < count; ++i)
+	{
+		// Lengths are sample counts divided by the sample rate, so most have all 17 digits.
+		lengths.push_back(static_cast<double>(random() % (44100 * 600)) / 44100.0);
+		gains.push_back(static_cast<float>(static_cast<double>(random() % 20000) / 1000.0 - 15.0));
+
+		uint64_t bits = random();
+		bits = (bits & 0x7FF0000000000000ull) == 0x7FF0000000000000ull ? bits & 0x800FFFFFFFFFFFFFull : bits;
+		double value;
+		memcpy(&value, &bits, sizeof(value));
+		doubles.push_back(value);
+
+		// Shifted by random amounts, so that short numbers are as common as long ones.
+		const uint64_t int_bits = random();
+		ints.push_back(static_cast<int>(int_bits >> (32 + random() % 32)) * (random() % 2 == 0 ? 1 : -1));
+		const uint64_t size_bits = random();
+		sizes.push_back(size_bits >> (random() % 64));
+	}
+
+	std::vector<number_formatting_result> results;
+	results.push_back(time_number_formatting("lengths", lengths, repeat_count));
+	results.push_back(time_number_formatting("gains", gains, repeat_count));
+	results.push_back(time_number_formatting("doubles", doubles, repeat_count));
+	results.push_back(time_number_formatting("int32", ints, repeat_count));
+	results.push_back(time_number_formatting("uint64", sizes, repeat_count));
+	return results;
+}
+
+double nanoseconds_per_number(double seconds, size_t count)
+{
+	return count > 0 ? seconds * 1e9 / static_cast<double>(count) : 0.0;
+}
+
+const scenario_result* find_result(const std::vector<scenario_result>& results, const char* name)
+{
+	for(size_t i = 0; i < results.size(); ++i)
+	{
+		if(strcmp(results[i].benchmarked->name, name) == 0)
+		{
+			return &results[i];
+		}
+	}
+
+	return nullptr;
+}
+
+void write_profile(rapidjson::PrettyWriter<rapidjson::StringBuffer>& writer, const synthetic::library_profile& profile)
+{
+	writer.StartObject();
+	writer.String("min_extra_tags");
+	writer.Uint(profile.min_extra_tags);
+	writer.String("max_extra_tags");
+	writer.Uint(profile.max_extra_tags);
+	writer.String("long_value_percent");
+	writer.Uint(profile.long_value_percent);
+	writer.String("multi_value_percent");
+	writer.Uint(profile.multi_value_percent);
+	writer.String("unicode_percent");
+	writer.Uint(profile.unicode_percent);
+	writer.String("replaygain_percent");
+	writer.Uint(profile.replaygain_percent);
+	writer.EndObject();
+}
+
+// Writes everything printed to the console as JSON, for comparing versions with a script.
+bool write_results(
+	const std::string& file_path,
+	size_t track_count,
+	uint64_t seed,
+	const synthetic::library_profile& profile,
+	unsigned thread_count,
+	size_t repeat_count,
+	double generate_seconds,
+	double read_seconds,
+	uint64_t library_resident_size,
+	const std::vector<scenario_result>& results,
+	const std::vector<number_formatting_result>& number_results
+)
+{
+	rapidjson::StringBuffer buffer;
+	rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+
+	writer.StartObject();
+	writer.String("tracks");
+	writer.Uint64(track_count);
+	writer.String("seed");
+	writer.Uint64(seed);
+	writer.String("profile");
+	write_profile(writer, profile);
+	writer.String("threads");
+	writer.Uint(thread_count);
+	writer.String("repeat");
+	writer.Uint64(repeat_count);
+	writer.String("generate_seconds");
+	writer.Double(generate_seconds);
+	writer.String("read_seconds");
+	writer.Double(read_seconds);
+	writer.String("library_resident_size");
+	writer.Uint64(library_resident_size);
+
+	writer.String("scenarios");
+	writer.StartArray();
+
+	for(size_t i = 0; i < results.size(); ++i)
+	{
+		const scenario_result& result = results[i];
+		const double seconds = result.median.get_total_seconds();
+
+		writer.StartObject();
+		writer.String("name");
+		writer.String(result.benchmarked->name);
+		writer.String("seconds");
+		writer.Double(seconds);
+		writer.String("best_seconds");
+		writer.Double(result.best_seconds);
+		writer.String("snapshot_seconds");
+		writer.Double(result.median.snapshot_seconds);
+		writer.String("export_seconds");
+		writer.Double(result.median.export_seconds);
+		writer.String("tracks_per_second");
+		writer.Double(seconds > 0.0 ? static_cast<double>(track_count) / seconds : 0.0);
+		writer.String("megabytes_per_second");
+		writer.Double(seconds > 0.0 ? megabytes(result.median.output_size) / seconds : 0.0);
+		writer.String("output_size");
+		writer.Uint64(result.median.output_size);
+		writer.String("peak_resident_size");
+		writer.Uint64(result.peak_resident_size);
+
+		const scenario_result* const compared = result.benchmarked->compared_with ? find_result(results, result.benchmarked->compared_with) : nullptr;
+
+		if(compared && compared->median.output_size > 0 && seconds > 0.0)
+		{
+			writer.String("compared_with");
+			writer.String(compared->benchmarked->name);
+			writer.String("relative_size");
+			writer.Double(static_cast<double>(result.median.output_size) / static_cast<double>(compared->median.output_size));
+			writer.String("relative_speed");
+			writer.Double(compared->median.get_total_seconds() / seconds);
+		}
+
+		writer.EndObject();
+	}
+
+	writer.EndArray();
+
+	writer.String("number_formatting");
+	writer.StartArray();
+
+	for(size_t i = 0; i < number_results.size(); ++i)
+	{
+		const number_formatting_result& result = number_results[i];
+
+		writer.StartObject();
+		writer.String("name");
+		writer.String(result.name);
+		writer.String("count");
+		writer.Uint64(result.count);
+		writer.String("writer_nanoseconds");
+		writer.Double(nanoseconds_per_number(result.writer_seconds, result.count));
+		writer.String("printf_nanoseconds");
+		writer.Double(nanoseconds_per_number(result.printf_seconds, result.count));
+		writer.EndObject();
+	}
+
+	writer.EndArray();
+	writer.EndObject();
+
+	FILE* file = fopen(file_path.c_str(), "wb");
+
+	if(!file)
+	{
+		return false;
+	}
+
+	const bool written = fwrite(buffer.GetString(), 1, buffer.GetSize(), file) == buffer.GetSize();
+	return fclose(file) == 0 && written;
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv)
+{
+	if(argc < 2)
+	{
+		print_usage();
+		return EXIT_FAILURE;
+	}
+
+	const std::string output_directory = argv[1];
+	size_t track_count = 100000;
+	unsigned long long seed = 1;
+	size_t repeat_count = 5;
+	unsigned thread_count = 0;
+	bool verbose = false;
+	std::vector<const scenario*> selected;
+	synthetic::library_profile profile = synthetic::library_profile::realistic();
+
+	for(int i = 2; i < argc; ++i)
+	{
+		const bool has_value = i + 1 < argc;
+
+		if(synthetic::parse_profile_option(argc, argv, i, profile))
+		{
+			continue;
+		}
+
+		if(strcmp(argv[i], "--tracks") == 0 && has_value)
+		{
+			track_count = static_cast<size_t>(strtoull(argv[++i], nullptr, 10));
+		}
+		else if(strcmp(argv[i], "--seed") == 0 && has_value)
+		{
+			seed = strtoull(argv[++i], nullptr, 10);
+		}
+		else if(strcmp(argv[i], "--repeat") == 0 && has_value)
+		{
+			repeat_count = std::max<size_t>(1, static_cast<size_t>(strtoull(argv[++i], nullptr, 10)));
+		}
+		else if(strcmp(argv[i], "--threads") == 0 && has_value)
+		{
+			thread_count = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+		}
+		else if(strcmp(argv[i], "--scenario") == 0 && has_value)
+		{
+			const char* const name = argv[++i];
+			const scenario* const found = find_scenario(name);
+
+			if(!found)
+			{
+				fprintf(stderr, "Unknown scenario %s\n", name);
+				return EXIT_FAILURE;
+			}
+
+			selected.push_back(found);
+		}
+		else if(strcmp(argv[i], "--verbose") == 0)
+		{
+			verbose = true;
+		}
+		else
+		{
+			print_usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(thread_count == 0)
+	{
+		thread_count = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	if(selected.empty())
+	{
+		for(size_t i = 0; i < scenario_count; ++i)
+		{
+			selected.push_back(&scenarios[i]);
+		}
+	}
+
+	// Scenarios compared with another need it run too, first.
+	for(size_t i = 0; i < selected.size(); ++i)
+	{
+		const scenario* const compared = selected[i]->compared_with ? find_scenario(selected[i]->compared_with) : nullptr;
+
+		if(compared && std::find(selected.begin(), selected.end(), compared) == selected.end())
+		{
+			selected.insert(selected.begin() + i, compared);
+		}
+	}
+
+	const stage_clock::time_point start = stage_clock::now();
+	synthetic::library library(static_cast<size_t>(track_count), seed, profile);
+	const double generate_seconds = seconds_since(start);
+
+	jsonexport::release_unused_heap();
+	const uint64_t library_resident_size = jsonexport::get_resident_size();
+	const double read_seconds = time_reading(library);
+
+	printf("Generated %u tracks in %.3f s; %.1f MB resident.\n", static_cast<unsigned>(track_count), generate_seconds, megabytes(library_resident_size));
+	printf("Reading every track takes %.3f s (%.0f tracks/s).\n", read_seconds, read_seconds > 0.0 ? static_cast<double>(track_count) / read_seconds : 0.0);
+
+	if(!jsonexport::reset_peak_resident_size())
+	{
+		printf("The peak resident memory can't be reset here, so is the peak since the benchmark started.\n");
+	}
+
+	printf("Median of %u runs, using %u threads where threaded:\n\n", static_cast<unsigned>(repeat_count), thread_count);
+	printf("%-10s %9s %9s %11s %9s %10s %10s  %s\n", "scenario", "time s", "best s", "tracks/s", "MB/s", "output MB", "peak MB", "stages");
+
+	quiet_status status(verbose);
+	std::vector<scenario_result> results;
+
+	for(size_t i = 0; i < selected.size(); ++i)
+	{
+		try
+		{
+			results.push_back(run_repeatedly(*selected[i], library, output_directory, thread_count, repeat_count, status));
+		}
+		catch(const std::exception& e)
+		{
+			fprintf(stderr, "Scenario %s failed: %s\n", selected[i]->name, e.what());
+			return EXIT_FAILURE;
+		}
+
+		const scenario_result& result = results.back();
+		const double seconds = result.median.get_total_seconds();
+
+		char stages[64];
+		sprintf(stages, "export %.3f s", result.median.export_seconds);
+
+		if(result.benchmarked->snapshot)
+		{
+			sprintf(stages, "snapshot %.3f s + export %.3f s", result.median.snapshot_seconds, result.median.export_seconds);
+		}
+
+		printf("%-10s %9.3f %9.3f %11.0f %9.1f %10.2f %10.1f  %s\n",
+			result.benchmarked->name,
+			seconds,
+			result.best_seconds,
+			seconds > 0.0 ? static_cast<double>(track_count) / seconds : 0.0,
+			seconds > 0.0 ? megabytes(result.median.output_size) / seconds : 0.0,
+			megabytes(result.median.output_size),
+			megabytes(result.peak_resident_size),
+			stages
+		);
+	}
+
+	bool printed_comparison_heading = false;
+
+	for(size_t i = 0; i < results.size(); ++i)
+	{
+		const scenario_result& result = results[i];
+		const scenario_result* const compared = result.benchmarked->compared_with ? find_result(results, result.benchmarked->compared_with) : nullptr;
+		const double seconds = result.median.get_total_seconds();
+
+		if(!compared || compared->median.output_size == 0 || seconds <= 0.0)
+		{
+			continue;
+		}
+
+		if(!printed_comparison_heading)
+		{
+			printf("\nAgainst the equivalent JSON:\n\n");
+			printf("%-10s %-10s %9s %9s\n", "scenario", "against", "size", "speed");
+			printed_comparison_heading = true;
+		}
+
+		printf("%-10s %-10s %8.1f%% %8.2fx\n",
+			result.benchmarked->name,
+			compared->benchmarked->name,
+			100.0 * static_cast<double>(result.median.output_size) / static_cast<double>(compared->median.output_size),
+			compared->median.get_total_seconds() / seconds
+		);
+	}
+
+	const std::vector<number_formatting_result> number_results = time_number_formatting(seed, repeat_count);
+
+	printf("\nFormatting numbers, median ns per number:\n\n");
+	printf("%-10s %9s %9s\n", "numbers", "writer", "printf");
+
+	for(size_t i = 0; i < number_results.size(); ++i)
+	{
+		const number_formatting_result& result = number_results[i];
+
+		printf("%-10s %9.1f %9.1f\n",
+			result.name,
+			nanoseconds_per_number(result.writer_seconds, result.count),
+			nanoseconds_per_number(result.printf_seconds, result.count)
+		);
+	}
+
+	const std::string results_path = output_directory + "/benchmark.json";
+
+	if(!write_results(results_path, track_count, seed, profile, thread_count, repeat_count, generate_seconds, read_seconds, library_resident_size, results, number_results))
+	{
+		fprintf(stderr, "Couldn't write %s\n", results_path.c_str());
+		return EXIT_FAILURE;
+	}
+
+	printf("\nWrote the results to %s\n", results_path.c_str());
+	return EXIT_SUCCESS;
+}
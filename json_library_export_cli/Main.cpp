@@ -0,0 +1,526 @@
+// Command-line driver for the export engine, exporting a synthetic library without foobar2000.
+// Useful for profiling and tuning the serializer.
+
+#include "ChangeJournal.h"
+#include "ExportMetrics.h"
+#include "FragmentCache.h"
+#include "HoldTimeHistogram.h"
+#include "LibraryExport.h"
+#include "SyntheticLibrary.h"
+#include "TrackSnapshot.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+
+class console_status : public jsonexport::export_status
+{
+public:
+	virtual void set_progress(size_t, size_t) override
+	{
+	}
+
+	virtual void check_abort() override
+	{
+	}
+
+	virtual void log(const char* message) override
+	{
+		fprintf(stderr, "%s\n", message);
+	}
+};
+
+// Stands in for foobar2000's database lock, recording how long it's held as the component does,
+// and how long it's waited for if there are metrics.
+class timed_lock : public jsonexport::source_lock
+{
+public:
+	explicit timed_lock(jsonexport::export_metrics* metrics)
+		: m_mutex()
+		, m_acquired()
+		, m_hold_times()
+		, m_metrics(metrics)
+	{
+	}
+
+	virtual void acquire() override
+	{
+		const jsonexport::stage_timer timer(m_metrics, jsonexport::stage_lock_wait, 1);
+		m_mutex.lock();
+		m_acquired = std::chrono::steady_clock::now();
+	}
+
+	virtual void release() override
+	{
+		m_hold_times.record(std::chrono::duration<double>(std::chrono::steady_clock::now() - m_acquired).count());
+		m_mutex.unlock();
+	}
+
+	const jsonexport::hold_time_histogram& get_hold_times() const
+	{
+		return m_hold_times;
+	}
+
+private:
+	std::mutex m_mutex;
+	std::chrono::steady_clock::time_point m_acquired;
+	jsonexport::hold_time_histogram m_hold_times;
+	jsonexport::export_metrics* const m_metrics;
+};
+
+void print_usage()
+{
+	fprintf(stderr,
+		"Usage: json_library_export_cli <output file> [options]\n"
+		"\n"
+		"The output is compressed with gzip if the output file's name ends in .gz, and is\n"
+		"MessagePack or CBOR rather than JSON if it ends in .msgpack or .cbor (before any .gz).\n"
+		"\n"
+		"Options:\n"
+		"  --tracks <n>          Number of tracks in the synthetic library (default 10000).\n"
+		"  --seed <n>            Seed for generating the synthetic library (default 1).\n"
+		"  --compact             Don't pretty-print the output.\n"
+		"  --document            Build the whole document in memory before writing it.\n"
+		"  --memory-ceiling <MiB>\n"
+		"                        Fail the export rather than let the document (with\n"
+		"                        --document), the columns, the string table, the snapshot\n"
+		"                        or the cache take more than this in memory.\n"
+		"  --columns             Write an array per property instead of an object per track.\n"
+		"  --lines               Write each track on a line of its own (newline-delimited JSON).\n"
+		"  --dictionary <list>   Write the values of the comma-separated properties, e.g.\n"
+		"                        meta.GENRE,info.codec, as indices into a string table.\n"
+		"  --unsorted-dictionary Order the string table by first use, not by frequency.\n"
+		"  --directories         Write each directory once, in a table, and tracks' paths as\n"
+		"                        [directory index, file name].\n"
+		"  --threads <n>         Number of threads serializing tracks when streaming; 0 uses\n"
+		"                        one per hardware thread (default 1).\n"
+		"  --buffer-size <KiB>   Size of each output buffer (default 4096).\n"
+		"  --buffer-count <n>    Number of output buffers (default 4).\n"
+		"  --mmap                Write through a memory mapping of the output file.\n"
+		"  --shard-tracks <n>    Split the output into files of at most n tracks each, listed\n"
+		"                        in <output file's name>.manifest.json.\n"
+		"  --shard-size <KiB>    Split the output into files of about this much each: at\n"
+		"                        most this much of tracks, before compression, plus the\n"
+		"                        brackets, separators and indentation around them.\n"
+		"  --cache <n>           Export once to fill a fragment cache, invalidate n tracks\n"
+		"                        spread through the library, then time exporting again.\n"
+		"  --journal <n>         After exporting, record n tracks as changed, one in ten of\n"
+		"                        them removed, and export them to <output file>.journal.json.\n"
+		"  --fields <file>       Add the user-defined fields in the file, as \"key = script\"\n"
+		"                        or \"key:type = script\" lines, with made-up values.\n"
+		"  --snapshot            Copy the tracks into a snapshot with the serializing threads,\n"
+		"                        then export from that, as the component does to release the\n"
+		"                        database lock early.\n"
+		"  --lock-batch <n>      With --snapshot, release the lock every n tracks.\n"
+		"  --lock-budget <ms>    With --snapshot, release the lock every ms milliseconds.\n"
+		"  --stats               Time each stage of the export, print a summary and write it\n"
+		"                        to <output file's name>.stats.json.\n"
+		"\n"
+		"The synthetic library is plain unless these options say otherwise:\n"
+		"%s",
+		synthetic::profile_usage
+	);
+}
+
+long long file_size(const std::string& file_path)
+{
+	FILE* file = fopen(file_path.c_str(), "rb");
+
+	if(!file)
+	{
+		return 0;
+	}
+
+	fseek(file, 0, SEEK_END);
+	const long long size = ftell(file);
+	fclose(file);
+	return size;
+}
+
+// The size of the file exported to, or of all its shards.
+long long output_size(const std::string& file_path, const jsonexport::export_options& options)
+{
+	if(options.shard_track_count == 0 && options.shard_size == 0)
+	{
+		return file_size(file_path);
+	}
+
+	long long size = 0;
+
+	for(size_t i = 0; ; ++i)
+	{
+		const long long shard_size = file_size(jsonexport::shard_file_path(file_path, i));
+
+		if(shard_size == 0)
+		{
+			return size;
+		}
+
+		size += shard_size;
+	}
+}
+
+bool read_file(const std::string& file_path, std::string& text)
+{
+	FILE* file = fopen(file_path.c_str(), "rb");
+
+	if(!file)
+	{
+		return false;
+	}
+
+	char buffer[4096];
+	size_t size = 0;
+
+	while((size = fread(buffer, 1, sizeof(buffer), file)) > 0)
+	{
+		text.append(buffer, size);
+	}
+
+	fclose(file);
+	return true;
+}
+
+// Records some of the library's tracks as changed since it was exported, and exports the changes as a journal.
+void export_changes(const std::string& file_path, synthetic::library& library, size_t changed_track_count, const jsonexport::export_options& options, jsonexport::export_status& status)
+{
+	const size_t track_count = library.get_track_count();
+	changed_track_count = std::min(changed_track_count, track_count);
+
+	jsonexport::change_journal journal(1);
+	const uint64_t exported_generation = journal.end_generation();
+
+	std::unordered_map<std::string, size_t> indices_by_path;
+
+	for(size_t i = 0; i < changed_track_count; ++i)
+	{
+		const size_t index = i * track_count / changed_track_count;
+		journal.record_change(library.get_track_path(index), library.get_track_subsong_index(index), i % 10 == 9);
+		indices_by_path[library.get_track_path(index)] = index;
+	}
+
+	const uint64_t generation = journal.end_generation();
+
+	std::vector<jsonexport::track_change> changes;
+	journal.get_changes_since(exported_generation, changes);
+
+	std::vector<size_t> updated_indices;
+	std::vector<jsonexport::track_change> removed_tracks;
+
+	for(size_t i = 0; i < changes.size(); ++i)
+	{
+		if(changes[i].removed)
+		{
+			removed_tracks.push_back(changes[i]);
+		}
+		else
+		{
+			updated_indices.push_back(indices_by_path[changes[i].path]);
+		}
+	}
+
+	synthetic::library updated_tracks(library, updated_indices);
+	jsonexport::export_changes_as_json_file(file_path, updated_tracks, removed_tracks, exported_generation, generation, options, status);
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv)
+{
+	if(argc < 2)
+	{
+		print_usage();
+		return EXIT_FAILURE;
+	}
+
+	const std::string file_path = argv[1];
+	size_t track_count = 10000;
+	unsigned long long seed = 1;
+	bool use_cache = false;
+	size_t invalidated_track_count = 0;
+	size_t changed_track_count = 0;
+	bool use_snapshot = false;
+	bool write_stats = false;
+	synthetic::library_profile profile;
+	std::vector<jsonexport::formatted_field> extra_fields;
+	size_t lock_batch_tracks = 0;
+	double lock_batch_seconds = 0.0;
+	jsonexport::export_options options;
+	options.compression = jsonexport::compression_for_file_path(file_path);
+	options.format = jsonexport::format_for_file_path(file_path);
+
+	for(int i = 2; i < argc; ++i)
+	{
+		const bool has_value = i + 1 < argc;
+
+		if(synthetic::parse_profile_option(argc, argv, i, profile))
+		{
+			continue;
+		}
+
+		if(strcmp(argv[i], "--tracks") == 0 && has_value)
+		{
+			track_count = static_cast<size_t>(strtoull(argv[++i], nullptr, 10));
+		}
+		else if(strcmp(argv[i], "--seed") == 0 && has_value)
+		{
+			seed = strtoull(argv[++i], nullptr, 10);
+		}
+		else if(strcmp(argv[i], "--threads") == 0 && has_value)
+		{
+			options.thread_count = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+
+			if(options.thread_count == 0)
+			{
+				options.thread_count = std::max(1u, std::thread::hardware_concurrency());
+			}
+		}
+		else if(strcmp(argv[i], "--buffer-size") == 0 && has_value)
+		{
+			options.output_buffer_size = static_cast<size_t>(strtoull(argv[++i], nullptr, 10)) * 1024;
+		}
+		else if(strcmp(argv[i], "--buffer-count") == 0 && has_value)
+		{
+			options.output_buffer_count = static_cast<size_t>(strtoull(argv[++i], nullptr, 10));
+		}
+		else if(strcmp(argv[i], "--shard-tracks") == 0 && has_value)
+		{
+			options.shard_track_count = static_cast<size_t>(strtoull(argv[++i], nullptr, 10));
+		}
+		else if(strcmp(argv[i], "--shard-size") == 0 && has_value)
+		{
+			options.shard_size = strtoull(argv[++i], nullptr, 10) * 1024;
+		}
+		else if(strcmp(argv[i], "--mmap") == 0)
+		{
+			options.memory_map_output = true;
+		}
+		else if(strcmp(argv[i], "--cache") == 0 && has_value)
+		{
+			use_cache = true;
+			invalidated_track_count = static_cast<size_t>(strtoull(argv[++i], nullptr, 10));
+		}
+		else if(strcmp(argv[i], "--journal") == 0 && has_value)
+		{
+			changed_track_count = static_cast<size_t>(strtoull(argv[++i], nullptr, 10));
+		}
+		else if(strcmp(argv[i], "--fields") == 0 && has_value)
+		{
+			const std::string fields_path = argv[++i];
+			std::string text;
+
+			if(!read_file(fields_path, text))
+			{
+				fprintf(stderr, "Couldn't read %s\n", fields_path.c_str());
+				return EXIT_FAILURE;
+			}
+
+			try
+			{
+				extra_fields = jsonexport::parse_formatted_fields(text);
+			}
+			catch(const std::exception& e)
+			{
+				fprintf(stderr, "%s\n", e.what());
+				return EXIT_FAILURE;
+			}
+		}
+		else if(strcmp(argv[i], "--snapshot") == 0)
+		{
+			use_snapshot = true;
+		}
+		else if(strcmp(argv[i], "--lock-batch") == 0 && has_value)
+		{
+			lock_batch_tracks = static_cast<size_t>(strtoull(argv[++i], nullptr, 10));
+		}
+		else if(strcmp(argv[i], "--lock-budget") == 0 && has_value)
+		{
+			lock_batch_seconds = strtod(argv[++i], nullptr) / 1000.0;
+		}
+		else if(strcmp(argv[i], "--compact") == 0)
+		{
+			options.pretty_print = false;
+		}
+		else if(strcmp(argv[i], "--directories") == 0)
+		{
+			options.directory_table = true;
+		}
+		else if(strcmp(argv[i], "--columns") == 0)
+		{
+			options.layout = jsonexport::layout_columns;
+		}
+		else if(strcmp(argv[i], "--lines") == 0)
+		{
+			options.layout = jsonexport::layout_lines;
+		}
+		else if(strcmp(argv[i], "--dictionary") == 0 && has_value)
+		{
+			options.dictionary_properties = jsonexport::parse_property_list(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--unsorted-dictionary") == 0)
+		{
+			options.sort_dictionary_by_frequency = false;
+		}
+		else if(strcmp(argv[i], "--document") == 0)
+		{
+			options.stream_output = false;
+		}
+		else if(strcmp(argv[i], "--memory-ceiling") == 0 && has_value)
+		{
+			options.memory_ceiling = strtoull(argv[++i], nullptr, 10) * 1024 * 1024;
+		}
+		else if(strcmp(argv[i], "--stats") == 0)
+		{
+			write_stats = true;
+		}
+		else
+		{
+			print_usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	typedef std::chrono::steady_clock clock;
+
+	const clock::time_point generate_start = clock::now();
+	synthetic::library library(track_count, seed, profile, extra_fields);
+	const clock::time_point generate_end = clock::now();
+	clock::time_point export_start = generate_end;
+
+	console_status status;
+	jsonexport::fragment_cache cache;
+	std::unique_ptr<jsonexport::export_metrics> metrics;
+
+	try
+	{
+		if(use_cache)
+		{
+			options.cache = &cache;
+			jsonexport::export_library_as_json_file(file_path, library, options, status);
+
+			// As if some tracks had been edited since the last export.
+			for(size_t i = 0; i < invalidated_track_count && i < track_count; ++i)
+			{
+				const size_t index = i * track_count / std::min(invalidated_track_count, track_count);
+				cache.invalidate(library.get_track_path(index), library.get_track_subsong_index(index));
+			}
+
+			printf("Filled the cache in %.3f s\n", std::chrono::duration<double>(clock::now() - export_start).count());
+			export_start = clock::now();
+		}
+
+		// Only the export being timed is measured, not filling the cache.
+		if(write_stats)
+		{
+			metrics.reset(new jsonexport::export_metrics());
+			options.metrics = metrics.get();
+		}
+
+		std::unique_ptr<jsonexport::metered_source> metered_library(metrics ? new jsonexport::metered_source(library, *metrics) : nullptr);
+		jsonexport::track_source& source = metered_library ? static_cast<jsonexport::track_source&>(*metered_library) : library;
+
+		if(use_snapshot)
+		{
+			// Begun before the snapshot, as the component does, so tracks changed after being captured aren't cached.
+			const jsonexport::cache_export_scope cache_scope(options.cache);
+			options.cache_scope = &cache_scope;
+
+			const clock::time_point snapshot_start = clock::now();
+			timed_lock lock(metrics.get());
+			lock.acquire();
+			jsonexport::stage_timer snapshot_timer(metrics.get(), jsonexport::stage_build, track_count);
+			jsonexport::track_snapshot snapshot(source, options.thread_count, lock, lock_batch_tracks, lock_batch_seconds, status, options.memory_ceiling);
+			snapshot_timer.stop();
+			lock.release();
+
+			if(metrics)
+			{
+				metrics->add_allocations(snapshot.get_allocation_count(), snapshot.get_allocated_bytes(), snapshot.get_block_count(), snapshot.get_size());
+			}
+
+			printf("Captured a %.2f MB snapshot in %.3f s\n",
+				static_cast<double>(snapshot.get_size()) / (1024.0 * 1024.0),
+				std::chrono::duration<double>(clock::now() - snapshot_start).count()
+			);
+			printf("Lock held for %.3f s: %s\n", lock.get_hold_times().get_total_seconds(), lock.get_hold_times().describe().c_str());
+
+			jsonexport::export_library_as_json_file(file_path, snapshot, options, status);
+			options.cache_scope = nullptr;
+		}
+		else
+		{
+			jsonexport::export_library_as_json_file(file_path, source, options, status);
+		}
+	}
+	catch(const std::exception& e)
+	{
+		fprintf(stderr, "Export failed: %s\n", e.what());
+		return EXIT_FAILURE;
+	}
+
+	// The journal isn't part of the export being measured.
+	options.metrics = nullptr;
+
+	const clock::time_point export_end = clock::now();
+
+	if(metrics)
+	{
+		printf("%s\n", metrics->summarize().c_str());
+
+		try
+		{
+			jsonexport::export_metrics_as_json_file(jsonexport::stats_file_path(file_path), *metrics, status);
+		}
+		catch(const std::exception& e)
+		{
+			fprintf(stderr, "Writing the statistics failed: %s\n", e.what());
+			return EXIT_FAILURE;
+		}
+	}
+
+	const double generate_seconds = std::chrono::duration<double>(generate_end - generate_start).count();
+	const double export_seconds = std::chrono::duration<double>(export_end - export_start).count();
+	const double megabytes = static_cast<double>(output_size(file_path, options)) / (1024.0 * 1024.0);
+
+	printf("Generated %u tracks in %.3f s\n", static_cast<unsigned>(track_count), generate_seconds);
+	printf("Exported %.2f MB in %.3f s (%.0f tracks/s, %.1f MB/s)\n",
+		megabytes,
+		export_seconds,
+		static_cast<double>(track_count) / export_seconds,
+		megabytes / export_seconds
+	);
+
+	if(changed_track_count > 0)
+	{
+		const std::string journal_path = file_path + ".journal.json";
+		const clock::time_point journal_start = clock::now();
+
+		try
+		{
+			export_changes(journal_path, library, changed_track_count, options, status);
+		}
+		catch(const std::exception& e)
+		{
+			fprintf(stderr, "Export failed: %s\n", e.what());
+			return EXIT_FAILURE;
+		}
+
+		printf("Exported %.2f MB of changes in %.3f s\n",
+			static_cast<double>(file_size(journal_path)) / (1024.0 * 1024.0),
+			std::chrono::duration<double>(clock::now() - journal_start).count()
+		);
+	}
+
+	return EXIT_SUCCESS;
+}
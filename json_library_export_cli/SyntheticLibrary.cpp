@@ -0,0 +1,645 @@
+#include "SyntheticLibrary.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace synthetic {
+
+namespace
+{
+
+// xorshift64*; used instead of <random> so that the same seed gives the same library with every standard library.
+class random_generator
+{
+public:
+	explicit random_generator(uint64_t seed)
+		: m_state(seed ? seed : 0x9e3779b97f4a7c15ull)
+	{
+	}
+
+	uint64_t next()
+	{
+		m_state ^= m_state >> 12;
+		m_state ^= m_state << 25;
+		m_state ^= m_state >> 27;
+		return m_state * 2685821657736338717ull;
+	}
+
+	// Uniform-ish integer in [min, max].
+	unsigned range(unsigned min, unsigned max)
+	{
+		return min + static_cast<unsigned>(next() % (max - min + 1));
+	}
+
+	bool chance(unsigned percent)
+	{
+		return range(0, 99) < percent;
+	}
+
+	// Uniform-ish double in [min, max).
+	double real(double min, double max)
+	{
+		return min + (max - min) * (static_cast<double>(next() >> 11) / 9007199254740992.0);
+	}
+
+private:
+	uint64_t m_state;
+};
+
+std::string numbered(const char* prefix, unsigned number)
+{
+	char buffer[64];
+	sprintf(buffer, "%s %04u", prefix, number);
+	return buffer;
+}
+
+std::string number(unsigned value)
+{
+	char buffer[16];
+	sprintf(buffer, "%u", value);
+	return buffer;
+}
+
+struct vocabulary
+{
+	const char* const* words;
+	unsigned size;
+};
+
+const char* const english_words[] = {
+	"love", "night", "blue", "song", "heart", "fire", "rain", "dream", "light", "road",
+	"river", "city", "ghost", "summer", "echo", "silver", "storm", "home", "wild", "gold"
+};
+
+// Written as escaped UTF-8, so that the source means the same whatever code page the compiler assumes.
+const char* const latin_words[] = {
+	"caf\xC3\xA9",			// café
+	"\xC3\xA9t\xC3\xA9",		// été
+	"ni\xC3\xB1o",			// niño
+	"stra\xC3\x9F" "e",		// straße
+	"\xC3\xBC" "ber",		// über
+	"c\xC5\x93ur",			// cœur
+	"na\xC3\xAFve",			// naïve
+	"ma\xC3\xB1" "ana",		// mañana
+	"fj\xC3\xA4ril",		// fjäril
+	"s\xC3\xB8vn",			// søvn
+	"gar\xC3\xA7on",		// garçon
+	"\xC3\xA1rvore"			// árvore
+};
+
+const char* const cyrillic_words[] = {
+	"\xD0\xBB\xD1\x8E\xD0\xB1\xD0\xBE\xD0\xB2\xD1\x8C",		// любовь
+	"\xD0\xBD\xD0\xBE\xD1\x87\xD1\x8C",						// ночь
+	"\xD1\x81\xD0\xB8\xD0\xBD\xD0\xB8\xD0\xB9",				// синий
+	"\xD0\xBF\xD0\xB5\xD1\x81\xD0\xBD\xD1\x8F",				// песня
+	"\xD1\x81\xD0\xB5\xD1\x80\xD0\xB4\xD1\x86\xD0\xB5",		// сердце
+	"\xD0\xBE\xD0\xB3\xD0\xBE\xD0\xBD\xD1\x8C",				// огонь
+	"\xD0\xB4\xD0\xBE\xD0\xB6\xD0\xB4\xD1\x8C",				// дождь
+	"\xD0\xBC\xD0\xB5\xD1\x87\xD1\x82\xD0\xB0",				// мечта
+	"\xD1\x81\xD0\xB2\xD0\xB5\xD1\x82",						// свет
+	"\xD0\xB4\xD0\xBE\xD1\x80\xD0\xBE\xD0\xB3\xD0\xB0"		// дорога
+};
+
+const char* const japanese_words[] = {
+	"\xE5\xA4\x9C",							// 夜
+	"\xE9\x9B\xA8",							// 雨
+	"\xE5\xA4\xA2",							// 夢
+	"\xE5\x85\x89",							// 光
+	"\xE5\xBF\x83",							// 心
+	"\xE6\x9D\xB1\xE4\xBA\xAC",				// 東京
+	"\xE3\x81\x95\xE3\x81\x8F\xE3\x82\x89",	// さくら
+	"\xE3\x81\xB2\xE3\x81\x8B\xE3\x82\x8A",	// ひかり
+	"\xE3\x82\x86\xE3\x82\x81",				// ゆめ
+	"\xE6\x98\x9F\xE7\xA9\xBA"				// 星空
+};
+
+const vocabulary english = { english_words, sizeof(english_words) / sizeof(english_words[0]) };
+
+const vocabulary other_scripts[] = {
+	{ latin_words, sizeof(latin_words) / sizeof(latin_words[0]) },
+	{ cyrillic_words, sizeof(cyrillic_words) / sizeof(cyrillic_words[0]) },
+	{ japanese_words, sizeof(japanese_words) / sizeof(japanese_words[0]) }
+};
+
+const unsigned other_script_count = sizeof(other_scripts) / sizeof(other_scripts[0]);
+
+std::string words(random_generator& random, const vocabulary& source, unsigned min_words, unsigned max_words)
+{
+	std::string result;
+	const unsigned word_count = random.range(min_words, max_words);
+
+	for(unsigned i = 0; i < word_count; ++i)
+	{
+		if(i > 0)
+		{
+			result += ' ';
+		}
+
+		result += source.words[random.range(0, source.size - 1)];
+	}
+
+	// Capitalise the first letter, as titles tend to be.
+	if(!result.empty() && result[0] >= 'a' && result[0] <= 'z')
+	{
+		result[0] = static_cast<char>(result[0] - 'a' + 'A');
+	}
+
+	return result;
+}
+
+std::string words(random_generator& random, unsigned min_words, unsigned max_words)
+{
+	return words(random, english, min_words, max_words);
+}
+
+std::vector<std::string> single(const std::string& value)
+{
+	return std::vector<std::string>(1, value);
+}
+
+// Tags found in well-tagged libraries besides the basic ones, with the kind of value each has.
+enum extra_tag_kind
+{
+	tag_person,
+	tag_number,
+	tag_identifier,
+	tag_code,
+	tag_text,
+	tag_date
+};
+
+struct extra_tag
+{
+	const char* name;
+	extra_tag_kind kind;
+};
+
+const extra_tag extra_tags[] = {
+	{ "ALBUM ARTIST", tag_person },
+	{ "COMPOSER", tag_person },
+	{ "PERFORMER", tag_person },
+	{ "CONDUCTOR", tag_person },
+	{ "DISCNUMBER", tag_number },
+	{ "TOTALDISCS", tag_number },
+	{ "TOTALTRACKS", tag_number },
+	{ "BPM", tag_number },
+	{ "MUSICBRAINZ_TRACKID", tag_identifier },
+	{ "MUSICBRAINZ_ALBUMID", tag_identifier },
+	{ "MUSICBRAINZ_ARTISTID", tag_identifier },
+	{ "ISRC", tag_code },
+	{ "CATALOGNUMBER", tag_code },
+	{ "LABEL", tag_text },
+	{ "COMMENT", tag_text },
+	{ "MOOD", tag_text },
+	{ "COPYRIGHT", tag_text },
+	{ "ORIGINALDATE", tag_date },
+	{ "RELEASEDATE", tag_date },
+	{ "ENCODEDBY", tag_text }
+};
+
+const unsigned extra_tag_count = sizeof(extra_tags) / sizeof(extra_tags[0]);
+
+std::string extra_tag_value(random_generator& random, extra_tag_kind kind, unsigned artist_count)
+{
+	char buffer[64];
+
+	switch(kind)
+	{
+	case tag_person:
+		return numbered("Artist", random.range(1, artist_count));
+
+	case tag_number:
+		return number(random.range(1, 200));
+
+	case tag_identifier:
+		sprintf(buffer, "%08x-%04x-%04x-%04x-%012llx",
+			static_cast<unsigned>(random.next()),
+			static_cast<unsigned>(random.next() & 0xFFFF),
+			static_cast<unsigned>(random.next() & 0xFFFF),
+			static_cast<unsigned>(random.next() & 0xFFFF),
+			static_cast<unsigned long long>(random.next() & 0xFFFFFFFFFFFFull)
+		);
+		return buffer;
+
+	case tag_code:
+		sprintf(buffer, "%c%c%03u%02u%05u", 'A' + random.range(0, 25), 'A' + random.range(0, 25), random.range(0, 999), random.range(0, 99), random.range(0, 99999));
+		return buffer;
+
+	case tag_date:
+		sprintf(buffer, "%u-%02u-%02u", random.range(1960, 2014), random.range(1, 12), random.range(1, 28));
+		return buffer;
+
+	default:
+		return words(random, 1, 8);
+	}
+}
+
+// A few kilobytes of lyrics, one line of words after another.
+std::string lyrics(random_generator& random, const vocabulary& source)
+{
+	std::string result;
+	const unsigned line_count = random.range(20, 80);
+
+	for(unsigned i = 0; i < line_count; ++i)
+	{
+		if(i > 0)
+		{
+			result += "\r\n";
+		}
+
+		result += words(random, source, 3, 8);
+	}
+
+	return result;
+}
+
+class reader : public jsonexport::track_reader
+{
+public:
+	explicit reader(const std::vector<track>& tracks)
+		: m_tracks(tracks)
+		, m_track(nullptr)
+	{
+	}
+
+	virtual bool read(size_t index) override
+	{
+		m_track = &m_tracks[index];
+		return true;
+	}
+
+	virtual const char* get_path() const override								{ return m_track->path.c_str(); }
+	virtual unsigned get_subsong_index() const override						{ return m_track->subsong_index; }
+	virtual double get_length() const override									{ return m_track->length; }
+	virtual jsonexport::replaygain get_replaygain() const override				{ return m_track->replay_gain; }
+
+	virtual size_t info_get_count() const override								{ return m_track->info.size(); }
+	virtual const char* info_enum_name(size_t index) const override				{ return m_track->info[index].first.c_str(); }
+	virtual const char* info_enum_value(size_t index) const override			{ return m_track->info[index].second.c_str(); }
+
+	virtual size_t meta_get_count() const override								{ return m_track->meta.size(); }
+	virtual const char* meta_enum_name(size_t index) const override				{ return m_track->meta[index].first.c_str(); }
+	virtual size_t meta_enum_value_count(size_t index) const override			{ return m_track->meta[index].second.size(); }
+	virtual const char* meta_enum_value(size_t index, size_t value_index) const override	{ return m_track->meta[index].second[value_index].c_str(); }
+
+	virtual void format_fields(std::vector<jsonexport::field_value>& values) const override
+	{
+		values.resize(m_track->formatted.size());
+
+		for(size_t i = 0; i < values.size(); ++i)
+		{
+			values[i].data = m_track->formatted[i].data();
+			values[i].length = m_track->formatted[i].size();
+		}
+	}
+
+private:
+	const std::vector<track>& m_tracks;
+	const track* m_track;
+};
+
+} // anonymous namespace
+
+//------------------------------------------------------------------------------
+
+track::track()
+	: path()
+	, subsong_index(0)
+	, length(0.0)
+	, replay_gain()
+	, info()
+	, meta()
+	, formatted()
+{
+}
+
+//------------------------------------------------------------------------------
+
+library_profile::library_profile()
+	: min_extra_tags(0)
+	, max_extra_tags(0)
+	, long_value_percent(0)
+	, multi_value_percent(0)
+	, unicode_percent(0)
+	, replaygain_percent(80)
+{
+}
+
+//------------------------------------------------------------------------------
+
+library_profile library_profile::realistic()
+{
+	library_profile profile;
+	profile.min_extra_tags = 2;
+	profile.max_extra_tags = 12;
+	profile.long_value_percent = 5;
+	profile.multi_value_percent = 15;
+	profile.unicode_percent = 20;
+	profile.replaygain_percent = 70;
+	return profile;
+}
+
+//------------------------------------------------------------------------------
+
+const char* const profile_usage =
+	"  --realistic           Generate something closer to a real, well-tagged library:\n"
+	"                        2-12 extra tags per track, 5% with lyrics, 15% with\n"
+	"                        several artists and genres, 20% of artists in other\n"
+	"                        scripts and 70% with replaygain. Later options override it.\n"
+	"  --plain               Generate the plain library again: no extra tags, lyrics,\n"
+	"                        multiple values or other scripts, and 80% with replaygain.\n"
+	"  --extra-tags <n[-m]>  Give each track n (to m) tags besides the basic six, such\n"
+	"                        as COMPOSER or MUSICBRAINZ_TRACKID; at most 20.\n"
+	"  --lyrics <pct>        Give this many percent of tracks a few KiB of lyrics.\n"
+	"  --multi-value <pct>   Give this many percent of tracks several artists and genres.\n"
+	"  --unicode <pct>       Name this many percent of artists, and their albums and\n"
+	"                        tracks, in accented Latin, Cyrillic or Japanese.\n"
+	"  --replaygain <pct>    Give this many percent of tracks replaygain info.\n";
+
+//------------------------------------------------------------------------------
+
+bool parse_profile_option(int argc, char** argv, int& i, library_profile& profile)
+{
+	const bool has_value = i + 1 < argc;
+
+	if(strcmp(argv[i], "--realistic") == 0)
+	{
+		profile = library_profile::realistic();
+	}
+	else if(strcmp(argv[i], "--plain") == 0)
+	{
+		profile = library_profile();
+	}
+	else if(strcmp(argv[i], "--extra-tags") == 0 && has_value)
+	{
+		char* end = nullptr;
+		profile.min_extra_tags = std::min(static_cast<unsigned>(strtoul(argv[++i], &end, 10)), extra_tag_count);
+		profile.max_extra_tags = *end == '-' ? std::min(static_cast<unsigned>(strtoul(end + 1, nullptr, 10)), extra_tag_count) : profile.min_extra_tags;
+		profile.max_extra_tags = std::max(profile.min_extra_tags, profile.max_extra_tags);
+	}
+	else if(strcmp(argv[i], "--lyrics") == 0 && has_value)
+	{
+		profile.long_value_percent = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+	}
+	else if(strcmp(argv[i], "--multi-value") == 0 && has_value)
+	{
+		profile.multi_value_percent = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+	}
+	else if(strcmp(argv[i], "--unicode") == 0 && has_value)
+	{
+		profile.unicode_percent = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+	}
+	else if(strcmp(argv[i], "--replaygain") == 0 && has_value)
+	{
+		profile.replaygain_percent = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+	}
+	else
+	{
+		return false;
+	}
+
+	return true;
+}
+
+//------------------------------------------------------------------------------
+
+library::library(size_t track_count, uint64_t seed, const library_profile& profile, const std::vector<jsonexport::formatted_field>& extra_fields)
+	: m_fields(jsonexport::default_formatted_fields())
+	, m_tracks(track_count)
+{
+	const size_t default_field_count = m_fields.size();
+	m_fields.insert(m_fields.end(), extra_fields.begin(), extra_fields.end());
+
+	static const char* const genres[] = { "Rock", "Pop", "Jazz", "Electronic", "Classical", "Hip-Hop", "Folk", "Metal" };
+	static const unsigned genre_count = sizeof(genres) / sizeof(genres[0]);
+
+	random_generator random(seed);
+
+	// Extra fields get their own generator, so the rest of the library is the same with or without them.
+	random_generator extra_random(seed + 1);
+
+	// Likewise the profile's tags, so the plain library is the same whatever profile's tags are added to it.
+	random_generator tag_random(seed + 2);
+	unsigned tag_order[extra_tag_count];
+
+	for(unsigned i = 0; i < extra_tag_count; ++i)
+	{
+		tag_order[i] = i;
+	}
+
+	unsigned artist = 0;
+	unsigned album = 0;
+	unsigned album_track_count = 0;
+	unsigned track_number = 0;
+	std::string album_title;
+	std::string date;
+	std::string genre;
+	float album_gain = 0.0f;
+	std::string artist_name;
+	const vocabulary* artist_script = &english;
+
+	for(size_t i = 0; i < track_count; ++i)
+	{
+		// Start a new album (and sometimes a new artist) once the current one has run out of tracks.
+		if(track_number == album_track_count)
+		{
+			if(random.chance(30) || i == 0)
+			{
+				++artist;
+				artist_script = tag_random.chance(profile.unicode_percent) ? &other_scripts[tag_random.range(0, other_script_count - 1)] : &english;
+				artist_name = artist_script == &english ? numbered("Artist", artist) : numbered(words(tag_random, *artist_script, 1, 2).c_str(), artist);
+			}
+
+			++album;
+			album_track_count = random.range(6, 16);
+			track_number = 0;
+			album_title = words(random, 1, 4);
+			date = number(random.range(1960, 2014));
+			genre = genres[random.range(0, genre_count - 1)];
+			album_gain = static_cast<float>(random.real(-12.0, 2.0));
+
+			if(artist_script != &english)
+			{
+				album_title = words(tag_random, *artist_script, 1, 4);
+			}
+		}
+
+		++track_number;
+
+		track& t = m_tracks[i];
+		std::string title = words(random, 1, 6);
+
+		if(artist_script != &english)
+		{
+			title = words(tag_random, *artist_script, 1, 6);
+		}
+
+		const bool lossless = random.chance(60);
+
+		char track_number_text[16];
+		sprintf(track_number_text, "%02u", track_number);
+
+		t.path = "file://D:\\Music\\" + artist_name + "\\" + numbered("Album", album) + "\\" + track_number_text + " " + title + (lossless ? ".flac" : ".mp3");
+		t.length = random.real(60.0, 600.0);
+
+		if(random.chance(profile.replaygain_percent))
+		{
+			t.replay_gain.album_gain = album_gain;
+			t.replay_gain.album_peak = static_cast<float>(random.real(0.5, 1.0));
+			t.replay_gain.track_gain = static_cast<float>(random.real(-12.0, 2.0));
+			t.replay_gain.track_peak = static_cast<float>(random.real(0.5, 1.0));
+			t.replay_gain.is_album_gain_present = true;
+			t.replay_gain.is_album_peak_present = true;
+			t.replay_gain.is_track_gain_present = true;
+			t.replay_gain.is_track_peak_present = true;
+		}
+
+		t.info.push_back(std::make_pair(std::string("bitrate"), lossless ? number(random.range(700, 1100)) : std::string("320")));
+		t.info.push_back(std::make_pair(std::string("channels"), std::string("2")));
+		t.info.push_back(std::make_pair(std::string("codec"), std::string(lossless ? "FLAC" : "MP3")));
+		t.info.push_back(std::make_pair(std::string("encoding"), std::string(lossless ? "lossless" : "lossy")));
+		t.info.push_back(std::make_pair(std::string("samplerate"), std::string("44100")));
+
+		t.meta.push_back(std::make_pair(std::string("ARTIST"), single(artist_name)));
+		t.meta.push_back(std::make_pair(std::string("ALBUM"), single(album_title)));
+		t.meta.push_back(std::make_pair(std::string("TITLE"), single(title)));
+		t.meta.push_back(std::make_pair(std::string("DATE"), single(date)));
+		t.meta.push_back(std::make_pair(std::string("GENRE"), single(genre)));
+		t.meta.push_back(std::make_pair(std::string("TRACKNUMBER"), single(track_number_text)));
+
+		if(tag_random.chance(profile.multi_value_percent))
+		{
+			// A guest artist or two, and a second genre.
+			const unsigned guest_count = tag_random.range(1, 2);
+
+			for(unsigned j = 0; j < guest_count; ++j)
+			{
+				t.meta[0].second.push_back(numbered("Artist", tag_random.range(1, artist)));
+			}
+
+			const char* const second_genre = genres[tag_random.range(0, genre_count - 1)];
+
+			if(genre != second_genre)
+			{
+				t.meta[4].second.push_back(second_genre);
+			}
+		}
+
+		// Shuffle enough of the extra tags to pick this track's from.
+		const unsigned extra_tag_count_for_track = tag_random.range(profile.min_extra_tags, profile.max_extra_tags);
+
+		for(unsigned j = 0; j < extra_tag_count_for_track; ++j)
+		{
+			std::swap(tag_order[j], tag_order[tag_random.range(j, extra_tag_count - 1)]);
+
+			const extra_tag& tag = extra_tags[tag_order[j]];
+			t.meta.push_back(std::make_pair(std::string(tag.name), single(extra_tag_value(tag_random, tag.kind, artist))));
+		}
+
+		if(tag_random.chance(profile.long_value_percent))
+		{
+			t.meta.push_back(std::make_pair(std::string("LYRICS"), single(lyrics(tag_random, *artist_script))));
+		}
+
+		// Playback statistics only exist for tracks that have been played.
+		t.formatted.resize(m_fields.size());
+
+		if(random.chance(50))
+		{
+			t.formatted[0] = "2013-01-02 03:04:05";
+			t.formatted[1] = "2014-05-06 07:08:09";
+			t.formatted[2] = number(random.range(1, 200));
+		}
+		else
+		{
+			t.formatted[2] = "0";
+		}
+
+		t.formatted[3] = "2012-11-12 13:14:15";
+
+		for(size_t j = default_field_count; j < m_fields.size(); ++j)
+		{
+			if(extra_random.chance(20))
+			{
+				continue;
+			}
+
+			char value[32];
+
+			switch(m_fields[j].type)
+			{
+			case jsonexport::field_integer:
+				t.formatted[j] = number(extra_random.range(0, 1000));
+				break;
+
+			case jsonexport::field_float:
+				sprintf(value, "%.2f", extra_random.real(0.0, 100.0));
+				t.formatted[j] = value;
+				break;
+
+			case jsonexport::field_boolean:
+				t.formatted[j] = extra_random.chance(30) ? "1" : "0";
+				break;
+
+			default:
+				t.formatted[j] = genre;
+				break;
+			}
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+
+library::library(const library& source, const std::vector<size_t>& indices)
+	: m_fields(source.m_fields)
+	, m_tracks()
+{
+	m_tracks.reserve(indices.size());
+
+	for(size_t i = 0; i < indices.size(); ++i)
+	{
+		m_tracks.push_back(source.m_tracks[indices[i]]);
+	}
+}
+
+//------------------------------------------------------------------------------
+
+size_t library::get_track_count() const
+{
+	return m_tracks.size();
+}
+
+//------------------------------------------------------------------------------
+
+const std::vector<jsonexport::formatted_field>& library::get_formatted_fields() const
+{
+	return m_fields;
+}
+
+//------------------------------------------------------------------------------
+
+std::unique_ptr<jsonexport::track_reader> library::create_reader()
+{
+	return std::unique_ptr<jsonexport::track_reader>(new reader(m_tracks));
+}
+
+//------------------------------------------------------------------------------
+
+const char* library::get_track_path(size_t index) const
+{
+	return m_tracks[index].path.c_str();
+}
+
+//------------------------------------------------------------------------------
+
+unsigned library::get_track_subsong_index(size_t index) const
+{
+	return m_tracks[index].subsong_index;
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace synthetic
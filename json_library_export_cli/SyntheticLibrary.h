@@ -0,0 +1,81 @@
+#pragma once
+
+#include "LibraryExport.h"
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace synthetic {
+
+//------------------------------------------------------------------------------
+
+struct track
+{
+	track();
+
+	std::string path;
+	unsigned subsong_index;
+	double length;
+	jsonexport::replaygain replay_gain;
+
+	std::vector<std::pair<std::string, std::string> > info;
+	std::vector<std::pair<std::string, std::vector<std::string> > > meta;
+
+	/// One value per formatted field; empty values are omitted from the export, as with titleformatting.
+	std::vector<std::string> formatted;
+};
+
+//------------------------------------------------------------------------------
+
+/// How the tags of a synthetic library are distributed. Percentages are the chance of each track (or artist) having the feature.
+/// The defaults give the plain library the command-line driver has always exported, so its results stay comparable.
+struct library_profile
+{
+	library_profile();
+
+	/// Something closer to a real, well-tagged library: a handful of extra tags per track, some multi-value artists
+	/// and genres, a fifth of the artists named in other scripts, the odd track with lyrics, and some tracks not yet scanned for replaygain.
+	static library_profile realistic();
+
+	unsigned min_extra_tags;		///< Tags beyond artist, album, title, date, genre and track number, e.g. COMPOSER or MUSICBRAINZ_TRACKID.
+	unsigned max_extra_tags;
+	unsigned long_value_percent;	///< Tracks with a few kilobytes of LYRICS.
+	unsigned multi_value_percent;	///< Tracks with more than one ARTIST and GENRE.
+	unsigned unicode_percent;		///< Artists whose names and titles are accented Latin, Cyrillic or Japanese rather than ASCII.
+	unsigned replaygain_percent;	///< Tracks with replaygain info.
+};
+
+/// Parses a command-line option setting part of a profile, with i at the option; moves i past any value and returns
+/// true if it was one, otherwise returns false. profile_usage describes the options, for a program's usage message.
+bool parse_profile_option(int argc, char** argv, int& i, library_profile& profile);
+extern const char* const profile_usage;
+
+//------------------------------------------------------------------------------
+
+/// A library of made-up tracks, generated deterministically from a seed so that runs are comparable.
+/// Everything is generated up-front, so exporting it measures the serializer rather than the generator.
+class library : public jsonexport::track_source
+{
+public:
+	/// Any extra fields are given made-up values of their type, standing in for what their scripts would format to.
+	library(size_t track_count, uint64_t seed, const library_profile& profile = library_profile(), const std::vector<jsonexport::formatted_field>& extra_fields = std::vector<jsonexport::formatted_field>());
+
+	/// A library of some of another library's tracks.
+	library(const library& source, const std::vector<size_t>& indices);
+
+	virtual size_t get_track_count() const override;
+	virtual const std::vector<jsonexport::formatted_field>& get_formatted_fields() const override;
+	virtual std::unique_ptr<jsonexport::track_reader> create_reader() override;
+	virtual const char* get_track_path(size_t index) const override;
+	virtual unsigned get_track_subsong_index(size_t index) const override;
+
+private:
+	std::vector<jsonexport::formatted_field> m_fields;
+	std::vector<track> m_tracks;
+};
+
+//------------------------------------------------------------------------------
+
+} // namespace synthetic
@@ -0,0 +1,1016 @@
+#include "Tests.h"
+
+#include "CborWriter.h"
+#include "LibraryExport.h"
+#include "MsgPackWriter.h"
+#include "RapidJsonWrapper.h"
+#include "SyntheticLibrary.h"
+#include "ToString.h"
+
+#include <cfloat>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace tests {
+
+namespace
+{
+
+typedef rapidjson::Document::AllocatorType allocator_type;
+
+//------------------------------------------------------------------------------
+
+/// Reads MessagePack back into a DOM: just enough of it to check msgpack_writer, i.e. everything it writes, and nothing else.
+class msgpack_reader
+{
+public:
+	explicit msgpack_reader(const std::string& data)
+		: m_data(data)
+		, m_position(0)
+	{
+	}
+
+	bool at_end() const
+	{
+		return m_position == m_data.size();
+	}
+
+	/// Reads the next value; returns false if it isn't valid, or isn't something msgpack_writer would write.
+	bool read(rapidjson::Value& value, allocator_type& allocator)
+	{
+		uint64_t type = 0;
+
+		if(!read_big_endian(1, type))
+		{
+			return false;
+		}
+
+		if(type <= 0x7F)
+		{
+			value.SetUint64(type);
+			return true;
+		}
+
+		if(type >= 0xE0)
+		{
+			value.SetInt64(static_cast<int64_t>(type) - 0x100);
+			return true;
+		}
+
+		if(type >= 0x80 && type <= 0x8F)
+		{
+			return read_map(type & 0x0F, value, allocator);
+		}
+
+		if(type >= 0x90 && type <= 0x9F)
+		{
+			return read_array(type & 0x0F, value, allocator);
+		}
+
+		if(type >= 0xA0 && type <= 0xBF)
+		{
+			return read_string(type & 0x1F, value, allocator);
+		}
+
+		uint64_t argument = 0;
+
+		switch(type)
+		{
+		case 0xC0:	value.SetNull();		return true;
+		case 0xC2:	value.SetBool(false);	return true;
+		case 0xC3:	value.SetBool(true);	return true;
+
+		case 0xCA:
+			{
+				if(!read_big_endian(4, argument))
+				{
+					return false;
+				}
+
+				const uint32_t bits = static_cast<uint32_t>(argument);
+				float f;
+				memcpy(&f, &bits, sizeof(f));
+				value.SetDouble(f);
+				return true;
+			}
+
+		case 0xCB:
+			{
+				if(!read_big_endian(8, argument))
+				{
+					return false;
+				}
+
+				double d;
+				memcpy(&d, &argument, sizeof(d));
+				value.SetDouble(d);
+				return true;
+			}
+
+		case 0xCC: case 0xCD: case 0xCE: case 0xCF:
+			if(!read_big_endian(1u << (type - 0xCC), argument))
+			{
+				return false;
+			}
+
+			value.SetUint64(argument);
+			return true;
+
+		case 0xD0: case 0xD1: case 0xD2: case 0xD3:
+			{
+				const size_t size = 1u << (type - 0xD0);
+
+				if(!read_big_endian(size, argument))
+				{
+					return false;
+				}
+
+				// Sign-extended from however many bytes it was written in.
+				const unsigned shift = static_cast<unsigned>(64 - 8 * size);
+				value.SetInt64(static_cast<int64_t>(argument << shift) >> shift);
+				return true;
+			}
+
+		case 0xD9: case 0xDA: case 0xDB:
+			return read_big_endian(1u << (type - 0xD9), argument) && read_string(argument, value, allocator);
+
+		case 0xDC: case 0xDD:
+			return read_big_endian(2u << (type - 0xDC), argument) && read_array(argument, value, allocator);
+
+		case 0xDE: case 0xDF:
+			return read_big_endian(2u << (type - 0xDE), argument) && read_map(argument, value, allocator);
+
+		default:
+			return false;
+		}
+	}
+
+private:
+	bool read_big_endian(size_t size, uint64_t& value)
+	{
+		if(m_data.size() - m_position < size)
+		{
+			return false;
+		}
+
+		value = 0;
+
+		for(size_t i = 0; i < size; ++i)
+		{
+			value = (value << 8) | static_cast<unsigned char>(m_data[m_position++]);
+		}
+
+		return true;
+	}
+
+	bool read_string(uint64_t length, rapidjson::Value& value, allocator_type& allocator)
+	{
+		if(m_data.size() - m_position < length)
+		{
+			return false;
+		}
+
+		value.SetString(m_data.data() + m_position, static_cast<rapidjson::SizeType>(length), allocator);
+		m_position += static_cast<size_t>(length);
+		return true;
+	}
+
+	bool read_array(uint64_t size, rapidjson::Value& value, allocator_type& allocator)
+	{
+		value.SetArray();
+
+		for(uint64_t i = 0; i < size; ++i)
+		{
+			rapidjson::Value element;
+
+			if(!read(element, allocator))
+			{
+				return false;
+			}
+
+			value.PushBack(element, allocator);
+		}
+
+		return true;
+	}
+
+	bool read_map(uint64_t size, rapidjson::Value& value, allocator_type& allocator)
+	{
+		value.SetObject();
+
+		for(uint64_t i = 0; i < size; ++i)
+		{
+			rapidjson::Value name;
+			rapidjson::Value member;
+
+			// JSON's names are always strings.
+			if(!read(name, allocator) || !name.IsString() || !read(member, allocator))
+			{
+				return false;
+			}
+
+			value.AddMember(name, member, allocator);
+		}
+
+		return true;
+	}
+
+	const std::string& m_data;
+	size_t m_position;
+};
+
+//------------------------------------------------------------------------------
+
+/// Reads CBOR back into a DOM: just enough of it to check cbor_writer, i.e. everything it writes, and nothing else.
+class cbor_reader
+{
+public:
+	explicit cbor_reader(const std::string& data)
+		: m_data(data)
+		, m_position(0)
+	{
+	}
+
+	bool at_end() const
+	{
+		return m_position == m_data.size();
+	}
+
+	/// Reads the next value; returns false if it isn't valid, or isn't something cbor_writer would write.
+	bool read(rapidjson::Value& value, allocator_type& allocator)
+	{
+		uint64_t initial = 0;
+
+		if(!read_big_endian(1, initial))
+		{
+			return false;
+		}
+
+		const unsigned major = static_cast<unsigned>(initial >> 5);
+		const unsigned additional = static_cast<unsigned>(initial & 0x1F);
+
+		// Simple values and floats, whose additional information isn't a length.
+		if(major == 7)
+		{
+			uint64_t bits = 0;
+
+			switch(additional)
+			{
+			case 20:	value.SetBool(false);	return true;
+			case 21:	value.SetBool(true);	return true;
+			case 22:	value.SetNull();		return true;
+
+			case 26:
+				{
+					if(!read_big_endian(4, bits))
+					{
+						return false;
+					}
+
+					const uint32_t float_bits = static_cast<uint32_t>(bits);
+					float f;
+					memcpy(&f, &float_bits, sizeof(f));
+					value.SetDouble(f);
+					return true;
+				}
+
+			case 27:
+				{
+					if(!read_big_endian(8, bits))
+					{
+						return false;
+					}
+
+					double d;
+					memcpy(&d, &bits, sizeof(d));
+					value.SetDouble(d);
+					return true;
+				}
+
+			default:
+				return false;
+			}
+		}
+
+		// Maps and arrays of indefinite length, ended by a break.
+		if(additional == 31)
+		{
+			if(major == 4)
+			{
+				value.SetArray();
+
+				while(!read_break())
+				{
+					rapidjson::Value element;
+
+					if(!read(element, allocator))
+					{
+						return false;
+					}
+
+					value.PushBack(element, allocator);
+				}
+
+				return true;
+			}
+
+			if(major == 5)
+			{
+				value.SetObject();
+
+				while(!read_break())
+				{
+					rapidjson::Value name;
+					rapidjson::Value member;
+
+					if(!read(name, allocator) || !name.IsString() || !read(member, allocator))
+					{
+						return false;
+					}
+
+					value.AddMember(name, member, allocator);
+				}
+
+				return true;
+			}
+
+			return false;
+		}
+
+		uint64_t argument = additional;
+
+		if(additional >= 24 && (additional > 27 || !read_big_endian(1u << (additional - 24), argument)))
+		{
+			return false;
+		}
+
+		switch(major)
+		{
+		case 0:
+			value.SetUint64(argument);
+			return true;
+
+		case 1:
+			if(argument > static_cast<uint64_t>(INT64_MAX))
+			{
+				return false;
+			}
+
+			value.SetInt64(-1 - static_cast<int64_t>(argument));
+			return true;
+
+		case 3:
+			if(m_data.size() - m_position < argument)
+			{
+				return false;
+			}
+
+			value.SetString(m_data.data() + m_position, static_cast<rapidjson::SizeType>(argument), allocator);
+			m_position += static_cast<size_t>(argument);
+			return true;
+
+		default:
+			return false;
+		}
+	}
+
+private:
+	bool read_big_endian(size_t size, uint64_t& value)
+	{
+		if(m_data.size() - m_position < size)
+		{
+			return false;
+		}
+
+		value = 0;
+
+		for(size_t i = 0; i < size; ++i)
+		{
+			value = (value << 8) | static_cast<unsigned char>(m_data[m_position++]);
+		}
+
+		return true;
+	}
+
+	/// Moves past a break if it's next. Running out of data isn't a break, so is left for read() to fail on.
+	bool read_break()
+	{
+		if(m_position < m_data.size() && static_cast<unsigned char>(m_data[m_position]) == 0xFF)
+		{
+			++m_position;
+			return true;
+		}
+
+		return false;
+	}
+
+	const std::string& m_data;
+	size_t m_position;
+};
+
+//------------------------------------------------------------------------------
+
+bool is_integer(const rapidjson::Value& value)
+{
+	return value.IsNumber() && !value.IsDouble();
+}
+
+uint64_t get_bits(double value)
+{
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+std::string describe(const rapidjson::Value& value)
+{
+	rapidjson::StringBuffer buffer;
+	rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+	const_cast<rapidjson::Value&>(value).Accept(writer);	// Accept() doesn't change it, but isn't const in this rapidjson.
+
+	const std::string json(buffer.GetString(), buffer.GetSize());
+	return json.size() > 100 ? json.substr(0, 100) + "..." : json;
+}
+
+/// Where actual first differs from expected, or an empty string if it doesn't. Numbers are compared by value, exactly,
+/// as JSON doesn't distinguish 245 from 245.0 but the binary formats do, and so do doubles parsed from JSON text.
+std::string find_difference(const rapidjson::Value& expected, const rapidjson::Value& actual, const std::string& path)
+{
+	const std::string difference = path + ": expected " + describe(expected) + ", got " + describe(actual);
+
+	if(expected.IsNumber() && actual.IsNumber())
+	{
+		if(is_integer(expected) && is_integer(actual))
+		{
+			const bool equal = expected.IsInt64() ? actual.IsInt64() && expected.GetInt64() == actual.GetInt64()
+				: actual.IsUint64() && expected.GetUint64() == actual.GetUint64();
+
+			return equal ? std::string() : difference;
+		}
+
+		if(expected.IsDouble() && actual.IsDouble())
+		{
+			return get_bits(expected.GetDouble()) == get_bits(actual.GetDouble()) ? std::string() : difference;
+		}
+
+		return expected.GetDouble() == actual.GetDouble() ? std::string() : difference;
+	}
+
+	if(expected.GetType() != actual.GetType())
+	{
+		return difference;
+	}
+
+	if(expected.IsString())
+	{
+		const bool equal = expected.GetStringLength() == actual.GetStringLength()
+			&& memcmp(expected.GetString(), actual.GetString(), expected.GetStringLength()) == 0;
+
+		return equal ? std::string() : difference;
+	}
+
+	if(expected.IsArray())
+	{
+		if(expected.Size() != actual.Size())
+		{
+			return path + ": expected " + ::to_string(expected.Size()) + " elements, got " + ::to_string(actual.Size());
+		}
+
+		for(rapidjson::SizeType i = 0; i < expected.Size(); ++i)
+		{
+			const std::string element_difference = find_difference(expected[i], actual[i], path + "[" + ::to_string(i) + "]");
+
+			if(!element_difference.empty())
+			{
+				return element_difference;
+			}
+		}
+	}
+
+	if(expected.IsObject())
+	{
+		rapidjson::Value::ConstMemberIterator expected_member = expected.MemberBegin();
+		rapidjson::Value::ConstMemberIterator actual_member = actual.MemberBegin();
+
+		// Members are written in order, so should be read back in the same order.
+		for(; expected_member != expected.MemberEnd() && actual_member != actual.MemberEnd(); ++expected_member, ++actual_member)
+		{
+			const std::string name(expected_member->name.GetString(), expected_member->name.GetStringLength());
+			const std::string member_difference = find_difference(expected_member->name, actual_member->name, path + " name of " + name);
+
+			if(!member_difference.empty())
+			{
+				return member_difference;
+			}
+
+			const std::string value_difference = find_difference(expected_member->value, actual_member->value, path + "." + name);
+
+			if(!value_difference.empty())
+			{
+				return value_difference;
+			}
+		}
+
+		if(expected_member != expected.MemberEnd() || actual_member != actual.MemberEnd())
+		{
+			return path + ": expected " + ::to_string(expected.MemberEnd() - expected.MemberBegin()) + " members, got " + ::to_string(actual.MemberEnd() - actual.MemberBegin());
+		}
+	}
+
+	return std::string();
+}
+
+/// This rapidjson predates GenericValue::CopyFrom().
+void copy_value(const rapidjson::Value& source, rapidjson::Value& copy, allocator_type& allocator)
+{
+	if(source.IsObject())
+	{
+		copy.SetObject();
+
+		for(rapidjson::Value::ConstMemberIterator member = source.MemberBegin(); member != source.MemberEnd(); ++member)
+		{
+			rapidjson::Value name;
+			rapidjson::Value value;
+			copy_value(member->name, name, allocator);
+			copy_value(member->value, value, allocator);
+			copy.AddMember(name, value, allocator);
+		}
+	}
+	else if(source.IsArray())
+	{
+		copy.SetArray();
+
+		for(rapidjson::SizeType i = 0; i < source.Size(); ++i)
+		{
+			rapidjson::Value element;
+			copy_value(source[i], element, allocator);
+			copy.PushBack(element, allocator);
+		}
+	}
+	else if(source.IsString())
+	{
+		copy.SetString(source.GetString(), source.GetStringLength(), allocator);
+	}
+	else if(source.IsDouble())
+	{
+		copy.SetDouble(source.GetDouble());
+	}
+	else if(source.IsInt64())
+	{
+		copy.SetInt64(source.GetInt64());
+	}
+	else if(source.IsUint64())
+	{
+		copy.SetUint64(source.GetUint64());
+	}
+	else if(source.IsBool())
+	{
+		copy.SetBool(source.GetBool());
+	}
+	else
+	{
+		copy.SetNull();
+	}
+}
+
+template<typename Writer>
+std::string encode(const rapidjson::Value& value)
+{
+	rapidjson::StringBuffer buffer;
+	Writer writer(buffer);
+	const_cast<rapidjson::Value&>(value).Accept(writer);
+	return std::string(buffer.GetString(), buffer.GetSize());
+}
+
+/// Decodes data, which must be exactly one value, or a sequence of them, and checks it against expected, which is
+/// an array of the values in the sequence if it's one.
+template<typename Reader>
+void check_decodes_to(results& results, const std::string& data, const rapidjson::Value& expected, bool is_sequence, const std::string& description)
+{
+	rapidjson::Document decoded;
+	Reader reader(data);
+
+	if(is_sequence)
+	{
+		decoded.SetArray();
+
+		while(!reader.at_end())
+		{
+			rapidjson::Value element;
+
+			if(!results.check(reader.read(element, decoded.GetAllocator()), description + " couldn't be decoded"))
+			{
+				return;
+			}
+
+			decoded.PushBack(element, decoded.GetAllocator());
+		}
+	}
+	else if(!results.check(reader.read(decoded, decoded.GetAllocator()) && reader.at_end(), description + " couldn't be decoded as one value"))
+	{
+		return;
+	}
+
+	const std::string difference = find_difference(expected, decoded, description);
+	results.check(difference.empty(), difference);
+}
+
+/// Decodes data and writes it as compact JSON, which must be byte for byte the JSON that data was exported alongside:
+/// the JSON writer's numbers parse back exactly, so anything lost or changed on the way through shows, which parsing
+/// the JSON with this rapidjson, whose reader isn't exact, couldn't show. As a sequence, each value is a line.
+template<typename Reader>
+void check_encodes_as_json(results& results, const std::string& data, const std::string& json, bool is_sequence, const std::string& description)
+{
+	rapidjson::Document decoded;
+	Reader reader(data);
+	std::string encoded;
+
+	do
+	{
+		if(!results.check(reader.read(decoded, decoded.GetAllocator()), description + " couldn't be decoded"))
+		{
+			return;
+		}
+
+		encoded += encode<rapidjson::Writer<rapidjson::StringBuffer> >(decoded);
+		encoded += is_sequence ? "\n" : "";
+	}
+	while(is_sequence && !reader.at_end());
+
+	results.check(reader.at_end(), description + " has more after its value");
+
+	size_t difference = 0;
+
+	while(difference < encoded.size() && difference < json.size() && encoded[difference] == json[difference])
+	{
+		++difference;
+	}
+
+	const size_t context = difference > 40 ? difference - 40 : 0;
+	results.check(encoded == json, description + " differs from the JSON at byte " + ::to_string(difference) + ": expected ..."
+		+ json.substr(context, 80) + "..., got ..." + encoded.substr(context, 80) + "...");
+}
+
+/// Checks a value is written in as many bytes as its width should take, and decodes to itself, in both formats.
+void check_encoding(results& results, const rapidjson::Value& value, size_t msgpack_size, size_t cbor_size, const std::string& description)
+{
+	typedef jsonexport::msgpack_writer<rapidjson::StringBuffer> msgpack_writer;
+	typedef jsonexport::cbor_writer<rapidjson::StringBuffer> cbor_writer;
+
+	const std::string msgpack = encode<msgpack_writer>(value);
+	results.check(msgpack.size() == msgpack_size, "MessagePack " + description + " took " + ::to_string(msgpack.size()) + " bytes rather than " + ::to_string(msgpack_size));
+	check_decodes_to<msgpack_reader>(results, msgpack, value, false, "MessagePack " + description);
+
+	const std::string cbor = encode<cbor_writer>(value);
+	results.check(cbor.size() == cbor_size, "CBOR " + description + " took " + ::to_string(cbor.size()) + " bytes rather than " + ::to_string(cbor_size));
+	check_decodes_to<cbor_reader>(results, cbor, value, false, "CBOR " + description);
+}
+
+/// Text of the given length, with multi-byte UTF-8 and a null character, so that lengths are checked in bytes.
+std::string get_text(size_t length)
+{
+	static const char pattern[] = "Caf\xC3\xA9 \xE6\x97\xA5\xE6\x9C\xAC \\\"x\"\n";
+	std::string text(length, '\0');
+
+	for(size_t i = 0; i < length; ++i)
+	{
+		text[i] = i % 97 == 50 ? '\0' : pattern[i % (sizeof(pattern) - 1)];
+	}
+
+	return text;
+}
+
+std::string read_file(const std::string& file_path)
+{
+	std::string contents;
+	FILE* file = fopen(file_path.c_str(), "rb");
+
+	if(!file)
+	{
+		return contents;
+	}
+
+	char buffer[65536];
+	size_t read_size = 0;
+
+	while((read_size = fread(buffer, 1, sizeof(buffer), file)) > 0)
+	{
+		contents.append(buffer, read_size);
+	}
+
+	fclose(file);
+	return contents;
+}
+
+} // anonymous namespace
+
+//------------------------------------------------------------------------------
+
+void test_binary_format_widths(results& results)
+{
+	// Integers either side of each width, with how many bytes MessagePack and CBOR take for them.
+	// MessagePack's positive fixint goes to 127 and negative to -32; CBOR's inline values go to 23 and -24.
+	static const struct
+	{
+		int64_t value;
+		size_t msgpack_size;
+		size_t cbor_size;
+	}
+	signed_integers[] = {
+		{ 0, 1, 1 },
+		{ 23, 1, 1 },
+		{ 24, 1, 2 },
+		{ 127, 1, 2 },
+		{ 128, 2, 2 },
+		{ 255, 2, 2 },
+		{ 256, 3, 3 },
+		{ 65535, 3, 3 },
+		{ 65536, 5, 5 },
+		{ 4294967295ll, 5, 5 },
+		{ 4294967296ll, 9, 9 },
+		{ INT64_MAX, 9, 9 },
+		{ -1, 1, 1 },
+		{ -24, 1, 1 },
+		{ -25, 1, 2 },
+		{ -32, 1, 2 },
+		{ -33, 2, 2 },
+		{ -128, 2, 2 },
+		{ -129, 3, 2 },
+		{ -256, 3, 2 },
+		{ -257, 3, 3 },
+		{ -32768, 3, 3 },
+		{ -32769, 5, 3 },
+		{ -65536, 5, 3 },
+		{ -65537, 5, 5 },
+		{ INT32_MIN, 5, 5 },
+		{ static_cast<int64_t>(INT32_MIN) - 1, 9, 5 },
+		{ -4294967296ll, 9, 5 },
+		{ -4294967297ll, 9, 9 },
+		{ INT64_MIN, 9, 9 }
+	};
+
+	for(size_t i = 0; i < sizeof(signed_integers) / sizeof(signed_integers[0]); ++i)
+	{
+		const rapidjson::Value value(signed_integers[i].value);
+		check_encoding(results, value, signed_integers[i].msgpack_size, signed_integers[i].cbor_size, ::to_string(signed_integers[i].value));
+	}
+
+	check_encoding(results, rapidjson::Value(static_cast<uint64_t>(INT64_MAX) + 1), 9, 9, "2^63");
+	check_encoding(results, rapidjson::Value(UINT64_MAX), 9, 9, "UINT64_MAX");
+
+	// Doubles which are exactly a float are written as one.
+	static const struct
+	{
+		double value;
+		size_t size;
+	}
+	doubles[] = {
+		{ 0.0, 5 },
+		{ -0.0, 5 },
+		{ 1.5, 5 },
+		{ static_cast<double>(-6.52f), 5 },		// As replaygain is.
+		{ FLT_MAX, 5 },
+		{ FLT_MIN, 5 },
+		{ 0.1, 9 },
+		{ -6.52, 9 },
+		{ static_cast<double>(FLT_MAX) * 2, 9 },
+		{ DBL_MAX, 9 },
+		{ DBL_MIN, 9 },
+		{ 4.9406564584124654e-324, 9 },
+		{ 245.213, 9 }
+	};
+
+	for(size_t i = 0; i < sizeof(doubles) / sizeof(doubles[0]); ++i)
+	{
+		char description[32];
+		sprintf(description, "%.17g", doubles[i].value);
+		check_encoding(results, rapidjson::Value(doubles[i].value), doubles[i].size, doubles[i].size, description);
+	}
+
+	rapidjson::Document document;
+	allocator_type& allocator = document.GetAllocator();
+
+	// Strings either side of each width: MessagePack's fixstr goes to 31 bytes, CBOR's inline length to 23, then str8, str16 and str32.
+	static const struct
+	{
+		size_t length;
+		size_t msgpack_header_size;
+		size_t cbor_header_size;
+	}
+	strings[] = {
+		{ 0, 1, 1 },
+		{ 23, 1, 1 },
+		{ 24, 1, 2 },
+		{ 31, 1, 2 },
+		{ 32, 2, 2 },
+		{ 255, 2, 2 },
+		{ 256, 3, 3 },
+		{ 65535, 3, 3 },
+		{ 65536, 5, 5 },
+		{ 100000, 5, 5 }
+	};
+
+	for(size_t i = 0; i < sizeof(strings) / sizeof(strings[0]); ++i)
+	{
+		const std::string text = get_text(strings[i].length);
+		rapidjson::Value value;
+		value.SetString(text.data(), static_cast<rapidjson::SizeType>(text.size()), allocator);
+
+		check_encoding(results, value, strings[i].msgpack_header_size + text.size(), strings[i].cbor_header_size + text.size(), "string of " + ::to_string(text.size()) + " bytes");
+	}
+
+	// Arrays and maps either side of each width: MessagePack's fixarray and fixmap go to 15, then 16 and 32 bits.
+	// CBOR's are indefinite, so always take a byte before and after.
+	static const struct
+	{
+		size_t size;
+		size_t msgpack_header_size;
+	}
+	containers[] = {
+		{ 0, 1 },
+		{ 1, 1 },
+		{ 15, 1 },
+		{ 16, 3 },
+		{ 65535, 3 },
+		{ 65536, 5 },
+		{ 70000, 5 }
+	};
+
+	for(size_t i = 0; i < sizeof(containers) / sizeof(containers[0]); ++i)
+	{
+		const size_t size = containers[i].size;
+		rapidjson::Value array(rapidjson::kArrayType);
+		rapidjson::Value object(rapidjson::kObjectType);
+		size_t names_size = 0;
+
+		for(size_t j = 0; j < size; ++j)
+		{
+			rapidjson::Value element;
+			array.PushBack(element, allocator);
+
+			// Names of a few bytes each; every one fits in a fixstr and CBOR's inline length.
+			const std::string name = ::to_string(j);
+			rapidjson::Value member_name;
+			member_name.SetString(name.data(), static_cast<rapidjson::SizeType>(name.size()), allocator);
+			rapidjson::Value member_value;
+			object.AddMember(member_name, member_value, allocator);
+			names_size += 1 + name.size();
+		}
+
+		check_encoding(results, array, containers[i].msgpack_header_size + size, 2 + size, "array of " + ::to_string(size));
+		check_encoding(results, object, containers[i].msgpack_header_size + names_size + size, 2 + names_size + size, "map of " + ::to_string(size));
+	}
+
+	// Everything at once, nested, as a document would be.
+	rapidjson::Value nested(rapidjson::kObjectType);
+	rapidjson::Value inner(rapidjson::kArrayType);
+	rapidjson::Value empty_array(rapidjson::kArrayType);
+	rapidjson::Value empty_object(rapidjson::kObjectType);
+
+	rapidjson::Value true_value(true);
+	rapidjson::Value false_value(false);
+	rapidjson::Value null_value;
+
+	for(size_t i = 0; i < sizeof(signed_integers) / sizeof(signed_integers[0]); ++i)
+	{
+		rapidjson::Value element(signed_integers[i].value);
+		inner.PushBack(element, allocator);
+	}
+
+	for(size_t i = 0; i < sizeof(doubles) / sizeof(doubles[0]); ++i)
+	{
+		rapidjson::Value element(doubles[i].value);
+		inner.PushBack(element, allocator);
+	}
+
+	inner.PushBack(true_value, allocator);
+	inner.PushBack(false_value, allocator);
+	inner.PushBack(null_value, allocator);
+	inner.PushBack(empty_array, allocator);
+	inner.PushBack(empty_object, allocator);
+
+	nested.AddMember("values", inner, allocator);
+
+	const std::string long_text = get_text(300);
+	rapidjson::Value long_value;
+	long_value.SetString(long_text.data(), static_cast<rapidjson::SizeType>(long_text.size()), allocator);
+	nested.AddMember("text", long_value, allocator);
+
+	check_decodes_to<msgpack_reader>(results, encode<jsonexport::msgpack_writer<rapidjson::StringBuffer> >(nested), nested, false, "MessagePack nested values");
+	check_decodes_to<cbor_reader>(results, encode<jsonexport::cbor_writer<rapidjson::StringBuffer> >(nested), nested, false, "CBOR nested values");
+}
+
+//------------------------------------------------------------------------------
+
+void test_binary_format_sequences(results& results)
+{
+	// As the lines layout writes them: the top-level array's elements one after another, rather than in an array.
+	rapidjson::Document document;
+	allocator_type& allocator = document.GetAllocator();
+	document.SetArray();
+
+	for(int i = 0; i < 100; ++i)
+	{
+		rapidjson::Value track(rapidjson::kObjectType);
+		rapidjson::Value index(i * 1000 - 50000);
+		rapidjson::Value length(i * 2.5 + 0.1);
+		track.AddMember("index", index, allocator);
+		track.AddMember("length", length, allocator);
+
+		rapidjson::Value tags(rapidjson::kArrayType);
+
+		for(int j = 0; j < i % 20; ++j)
+		{
+			rapidjson::Value tag(j);
+			tags.PushBack(tag, allocator);
+		}
+
+		track.AddMember("tags", tags, allocator);
+		document.PushBack(track, allocator);
+	}
+
+	// A sequence of none, one, and many values.
+	const rapidjson::SizeType sizes[] = { 0, 1, document.Size() };
+
+	for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+	{
+		rapidjson::Value sequence(rapidjson::kArrayType);
+
+		for(rapidjson::SizeType j = 0; j < sizes[i]; ++j)
+		{
+			rapidjson::Value element;
+			copy_value(document[j], element, allocator);
+			sequence.PushBack(element, allocator);
+		}
+
+		const std::string description = "sequence of " + ::to_string(sizes[i]);
+		const std::string msgpack = encode<jsonexport::msgpack_writer<rapidjson::StringBuffer, true> >(sequence);
+		const std::string cbor = encode<jsonexport::cbor_writer<rapidjson::StringBuffer, true> >(sequence);
+
+		results.check(sizes[i] > 0 || msgpack.empty(), "an empty MessagePack sequence wrote " + ::to_string(msgpack.size()) + " bytes");
+		results.check(sizes[i] > 0 || cbor.empty(), "an empty CBOR sequence wrote " + ::to_string(cbor.size()) + " bytes");
+
+		check_decodes_to<msgpack_reader>(results, msgpack, sequence, true, "MessagePack " + description);
+		check_decodes_to<cbor_reader>(results, cbor, sequence, true, "CBOR " + description);
+	}
+}
+
+//------------------------------------------------------------------------------
+
+void test_binary_exports_match_json(results& results)
+{
+	// A realistic library: Unicode, long and multi-value tags, and replaygain, as floats.
+	synthetic::library library(2000, 1, synthetic::library_profile::realistic());
+	quiet_status status;
+
+	static const struct
+	{
+		jsonexport::output_layout layout;
+		const char* json_extension;
+		const char* name;
+	}
+	layouts[] = {
+		{ jsonexport::layout_tracks, ".json", "tracks" },
+		{ jsonexport::layout_lines, ".jsonl", "lines" }
+	};
+
+	for(size_t i = 0; i < sizeof(layouts) / sizeof(layouts[0]); ++i)
+	{
+		const bool is_lines = layouts[i].layout == jsonexport::layout_lines;
+		const std::string base_path = std::string("binary_exports_match_json_") + layouts[i].name;
+		const std::string json_path = base_path + layouts[i].json_extension;
+		const std::string msgpack_path = base_path + ".msgpack";
+		const std::string cbor_path = base_path + ".cbor";
+
+		jsonexport::export_options options;
+		options.layout = layouts[i].layout;
+		options.pretty_print = false;
+
+		options.format = jsonexport::format_for_file_path(json_path);
+		jsonexport::export_library_as_json_file(json_path, library, options, status);
+		options.format = jsonexport::format_for_file_path(msgpack_path);
+		jsonexport::export_library_as_json_file(msgpack_path, library, options, status);
+		options.format = jsonexport::format_for_file_path(cbor_path);
+		jsonexport::export_library_as_json_file(cbor_path, library, options, status);
+
+		const std::string json = read_file(json_path);
+		const std::string msgpack = read_file(msgpack_path);
+		const std::string cbor = read_file(cbor_path);
+		remove(json_path.c_str());
+		remove(msgpack_path.c_str());
+		remove(cbor_path.c_str());
+
+		results.check(!msgpack.empty() && msgpack.size() < json.size(), std::string("the ") + layouts[i].name + " MessagePack is " + ::to_string(msgpack.size()) + " bytes, against JSON's " + ::to_string(json.size()));
+		results.check(!cbor.empty() && cbor.size() < json.size(), std::string("the ") + layouts[i].name + " CBOR is " + ::to_string(cbor.size()) + " bytes, against JSON's " + ::to_string(json.size()));
+
+		check_encodes_as_json<msgpack_reader>(results, msgpack, json, is_lines, std::string("MessagePack ") + layouts[i].name);
+		check_encodes_as_json<cbor_reader>(results, cbor, json, is_lines, std::string("CBOR ") + layouts[i].name);
+	}
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace tests
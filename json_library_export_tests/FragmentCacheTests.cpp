@@ -0,0 +1,209 @@
+#include "Tests.h"
+
+#include "FragmentCache.h"
+#include "LibraryExport.h"
+#include "SyntheticLibrary.h"
+#include "ToString.h"
+#include "TrackSnapshot.h"
+
+#include <cstdio>
+#include <string>
+
+namespace tests {
+
+namespace
+{
+
+static const size_t track_count = 500;
+static const size_t changed_track = 10;
+
+/// As if the track were edited while the lock was released between two of a snapshot's batches, after it had been captured.
+class editing_lock : public jsonexport::source_lock
+{
+public:
+	editing_lock(jsonexport::fragment_cache& cache, const synthetic::library& library)
+		: m_cache(cache)
+		, m_library(library)
+		, m_release_count(0)
+	{
+	}
+
+	virtual void acquire() override
+	{
+	}
+
+	virtual void release() override
+	{
+		if(m_release_count++ == 0)
+		{
+			m_cache.invalidate(m_library.get_track_path(changed_track), m_library.get_track_subsong_index(changed_track));
+		}
+	}
+
+	size_t get_release_count() const
+	{
+		return m_release_count;
+	}
+
+private:
+	// Non-copyable.
+	editing_lock(const editing_lock&);
+	editing_lock& operator=(const editing_lock&);
+
+	jsonexport::fragment_cache& m_cache;
+	const synthetic::library& m_library;
+	size_t m_release_count;
+};
+
+void export_snapshot(jsonexport::track_snapshot& snapshot, jsonexport::fragment_cache& cache, const jsonexport::cache_export_scope& scope)
+{
+	static const char* const file_path = "cache_skips_changed_tracks.json";
+
+	jsonexport::export_options options;
+	options.thread_count = 2;
+	options.cache = &cache;
+	options.cache_scope = &scope;
+
+	quiet_status status;
+	jsonexport::export_library_as_json_file(file_path, snapshot, options, status);
+	remove(file_path);
+}
+
+bool is_cached(const jsonexport::fragment_cache& cache, const synthetic::library& library, size_t index)
+{
+	std::string json;
+	return cache.find(library.get_track_path(index), library.get_track_subsong_index(index), json);
+}
+
+void check_only_changed_track_missing(results& results, const jsonexport::fragment_cache& cache, const synthetic::library& library, const std::string& description)
+{
+	results.check(!is_cached(cache, library, changed_track), description + ": the changed track was cached from what was read before it changed");
+
+	size_t cached_count = 0;
+
+	for(size_t i = 0; i < track_count; ++i)
+	{
+		cached_count += i != changed_track && is_cached(cache, library, i) ? 1 : 0;
+	}
+
+	results.check(cached_count == track_count - 1, description + ": only " + ::to_string(cached_count) + " of the other " + ::to_string(track_count - 1) + " tracks were cached");
+}
+
+} // anonymous namespace
+
+//------------------------------------------------------------------------------
+
+void test_cache_skips_changed_tracks(results& results)
+{
+	synthetic::library library(track_count, 7);
+	quiet_status status;
+
+	// Changed after the whole snapshot was captured, before the export began.
+	{
+		jsonexport::fragment_cache cache;
+		const jsonexport::cache_export_scope scope(&cache);
+		jsonexport::track_snapshot snapshot(library, 2, status);
+
+		cache.invalidate(library.get_track_path(changed_track), library.get_track_subsong_index(changed_track));
+
+		export_snapshot(snapshot, cache, scope);
+		check_only_changed_track_missing(results, cache, library, "changed after the snapshot");
+	}
+
+	// Changed between the snapshot's batches, after it was captured in the first.
+	{
+		jsonexport::fragment_cache cache;
+		const jsonexport::cache_export_scope scope(&cache);
+		editing_lock lock(cache, library);
+		jsonexport::track_snapshot snapshot(library, 2, lock, 50, 0.0, status);
+
+		if(results.check(lock.get_release_count() > 0, "the snapshot didn't release the lock between batches"))
+		{
+			export_snapshot(snapshot, cache, scope);
+			check_only_changed_track_missing(results, cache, library, "changed between batches");
+		}
+	}
+
+	// Changed before the export began and then read afresh, so its new JSON is cached like any other track's.
+	{
+		jsonexport::fragment_cache cache;
+		cache.invalidate(library.get_track_path(changed_track), library.get_track_subsong_index(changed_track));
+
+		const jsonexport::cache_export_scope scope(&cache);
+		jsonexport::track_snapshot snapshot(library, 2, status);
+		export_snapshot(snapshot, cache, scope);
+
+		results.check(is_cached(cache, library, changed_track), "a track changed before the export began wasn't cached");
+	}
+
+	// Once every export's over, a later one can cache the track again.
+	{
+		jsonexport::fragment_cache cache;
+
+		{
+			const jsonexport::cache_export_scope scope(&cache);
+			jsonexport::track_snapshot snapshot(library, 2, status);
+			cache.invalidate(library.get_track_path(changed_track), library.get_track_subsong_index(changed_track));
+			export_snapshot(snapshot, cache, scope);
+		}
+
+		const jsonexport::cache_export_scope scope(&cache);
+		jsonexport::track_snapshot snapshot(library, 2, status);
+		export_snapshot(snapshot, cache, scope);
+
+		results.check(is_cached(cache, library, changed_track), "a changed track wasn't cached by the next export");
+	}
+}
+
+//------------------------------------------------------------------------------
+
+void test_ceiling_covers_snapshot_and_cache(results& results)
+{
+	static const char* const file_path = "ceiling_covers_snapshot_and_cache.json";
+	static const uint64_t ceiling = 64 * 1024;
+
+	synthetic::library library(track_count, 7);
+	quiet_status status;
+
+	bool snapshot_threw = false;
+
+	try
+	{
+		jsonexport::track_snapshot snapshot(library, 2, status, ceiling);
+	}
+	catch(const jsonexport::export_error&)
+	{
+		snapshot_threw = true;
+	}
+
+	results.check(snapshot_threw, "a snapshot bigger than the memory ceiling didn't throw");
+
+	jsonexport::track_snapshot unlimited_snapshot(library, 2, status);
+	results.check(unlimited_snapshot.get_size() > ceiling, "the snapshot is too small to test the memory ceiling with");
+
+	jsonexport::fragment_cache cache;
+	jsonexport::export_options options;
+	options.thread_count = 2;
+	options.cache = &cache;
+	options.memory_ceiling = ceiling;
+
+	bool export_threw = false;
+
+	try
+	{
+		jsonexport::export_library_as_json_file(file_path, library, options, status);
+	}
+	catch(const jsonexport::export_error&)
+	{
+		export_threw = true;
+	}
+
+	remove(file_path);
+
+	results.check(export_threw, "an export whose cache grew past the memory ceiling didn't throw");
+	results.check(cache.get_size() < ceiling + 4096, "the cache grew to " + ::to_string(cache.get_size()) + " bytes, well past the memory ceiling");
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace tests
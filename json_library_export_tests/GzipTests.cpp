@@ -0,0 +1,829 @@
+#include "Tests.h"
+
+#include "Deflate.h"
+#include "GzipSink.h"
+#include "OutputSink.h"
+#include "ToString.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace tests {
+
+namespace
+{
+
+//------------------------------------------------------------------------------
+
+/// CRC-32 a bit at a time, as gzip defines it, to check the trailer against something other than crc32_update().
+uint32_t crc32_reference(const std::vector<unsigned char>& data)
+{
+	uint32_t crc = 0xFFFFFFFF;
+
+	for(size_t i = 0; i < data.size(); ++i)
+	{
+		crc ^= data[i];
+
+		for(int bit = 0; bit < 8; ++bit)
+		{
+			crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+		}
+	}
+
+	return ~crc;
+}
+
+//------------------------------------------------------------------------------
+
+/// A canonical Huffman code, as a deflate stream describes it: how many codes there are of each length, and their symbols in code order.
+struct huffman_code
+{
+	static const int max_length = 15;
+
+	int counts[max_length + 1];
+	int symbols[288];
+};
+
+/// Reads a gzip file back, written from RFC 1951 and 1952 rather than from deflate_compressor, so that the two don't share mistakes.
+/// As strict as zlib: codes mustn't be oversubscribed, nor incomplete unless they only use one bit, and nothing may follow the trailer.
+class gzip_reader
+{
+public:
+	explicit gzip_reader(const std::vector<unsigned char>& data)
+		: m_data(data)
+		, m_position(0)
+		, m_bit_buffer(0)
+		, m_bit_count(0)
+		, m_error()
+	{
+	}
+
+	/// Decompresses the whole file into out; returns false, with the reason in get_error(), if it isn't valid.
+	bool read(std::vector<unsigned char>& out)
+	{
+		out.clear();
+
+		// Magic and deflate; the sink never sets any flags, so neither is a name, comment or extra field expected.
+		if(m_data.size() < 18 || m_data[0] != 0x1F || m_data[1] != 0x8B || m_data[2] != 0x08)
+		{
+			return fail("the gzip header is missing");
+		}
+
+		if(m_data[3] != 0)
+		{
+			return fail("the gzip header has flags set");
+		}
+
+		m_position = 10;
+		bool final_block = false;
+
+		while(!final_block)
+		{
+			uint32_t type = 0;
+
+			if(!read_bits(1, type))
+			{
+				return false;
+			}
+
+			final_block = type != 0;
+
+			if(!read_bits(2, type))
+			{
+				return false;
+			}
+
+			bool success = false;
+
+			switch(type)
+			{
+			case 0:	success = read_stored_block(out);	break;
+			case 1:	success = read_fixed_block(out);	break;
+			case 2:	success = read_dynamic_block(out);	break;
+			default:	return fail("block type 3 is reserved");
+			}
+
+			if(!success)
+			{
+				return false;
+			}
+		}
+
+		// The trailer starts at the next byte; the rest of this one is padding.
+		m_bit_buffer = 0;
+		m_bit_count = 0;
+
+		if(m_data.size() - m_position != 8)
+		{
+			return fail(::to_string(m_data.size() - m_position) + " bytes follow the deflate stream, rather than the 8 byte trailer");
+		}
+
+		if(read_uint32_le() != crc32_reference(out))
+		{
+			return fail("the trailer's CRC-32 doesn't match the data");
+		}
+
+		if(read_uint32_le() != static_cast<uint32_t>(out.size()))
+		{
+			return fail("the trailer's size doesn't match the data");
+		}
+
+		return true;
+	}
+
+	const std::string& get_error() const
+	{
+		return m_error;
+	}
+
+private:
+	// Non-copyable.
+	gzip_reader(const gzip_reader&);
+	gzip_reader& operator=(const gzip_reader&);
+
+	bool fail(const std::string& error)
+	{
+		m_error = error + " (at byte " + ::to_string(m_position) + ")";
+		return false;
+	}
+
+	bool read_bits(int count, uint32_t& value)
+	{
+		while(m_bit_count < count)
+		{
+			if(m_position == m_data.size())
+			{
+				return fail("the deflate stream ends early");
+			}
+
+			m_bit_buffer |= static_cast<uint32_t>(m_data[m_position++]) << m_bit_count;
+			m_bit_count += 8;
+		}
+
+		value = m_bit_buffer & ((1u << count) - 1);
+		m_bit_buffer >>= count;
+		m_bit_count -= count;
+		return true;
+	}
+
+	uint32_t read_uint32_le()
+	{
+		const uint32_t value = m_data[m_position] | (m_data[m_position + 1] << 8) | (m_data[m_position + 2] << 16) | (static_cast<uint32_t>(m_data[m_position + 3]) << 24);
+		m_position += 4;
+		return value;
+	}
+
+	bool read_stored_block(std::vector<unsigned char>& out)
+	{
+		// The length starts at the next byte.
+		m_bit_buffer = 0;
+		m_bit_count = 0;
+
+		if(m_data.size() - m_position < 4)
+		{
+			return fail("a stored block's length is cut off");
+		}
+
+		const size_t length = m_data[m_position] | (m_data[m_position + 1] << 8);
+		const size_t complement = m_data[m_position + 2] | (m_data[m_position + 3] << 8);
+		m_position += 4;
+
+		if(length != (~complement & 0xFFFF))
+		{
+			return fail("a stored block's length doesn't match its complement");
+		}
+
+		if(m_data.size() - m_position < length)
+		{
+			return fail("a stored block is cut off");
+		}
+
+		out.insert(out.end(), m_data.begin() + m_position, m_data.begin() + m_position + length);
+		m_position += length;
+		return true;
+	}
+
+	bool read_fixed_block(std::vector<unsigned char>& out)
+	{
+		unsigned char lengths[288 + 30];
+		std::fill(lengths, lengths + 144, 8);
+		std::fill(lengths + 144, lengths + 256, 9);
+		std::fill(lengths + 256, lengths + 280, 7);
+		std::fill(lengths + 280, lengths + 288, 8);
+		std::fill(lengths + 288, lengths + 288 + 30, 5);
+
+		huffman_code literal_code;
+		huffman_code distance_code;
+
+		// The fixed codes are incomplete by design, so aren't checked.
+		build_code(lengths, 288, literal_code);
+		build_code(lengths + 288, 30, distance_code);
+		return read_codes(literal_code, distance_code, out);
+	}
+
+	bool read_dynamic_block(std::vector<unsigned char>& out)
+	{
+		static const int code_length_order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+		uint32_t literal_count = 0;
+		uint32_t distance_count = 0;
+		uint32_t code_length_count = 0;
+
+		if(!read_bits(5, literal_count) || !read_bits(5, distance_count) || !read_bits(4, code_length_count))
+		{
+			return false;
+		}
+
+		literal_count += 257;
+		distance_count += 1;
+		code_length_count += 4;
+
+		if(literal_count > 286 || distance_count > 30)
+		{
+			return fail("a dynamic block has too many codes");
+		}
+
+		unsigned char lengths[286 + 30] = {};
+
+		for(uint32_t i = 0; i < code_length_count; ++i)
+		{
+			uint32_t length = 0;
+
+			if(!read_bits(3, length))
+			{
+				return false;
+			}
+
+			lengths[code_length_order[i]] = static_cast<unsigned char>(length);
+		}
+
+		huffman_code code_length_code;
+
+		if(build_code(lengths, 19, code_length_code) != 0)
+		{
+			return fail("a dynamic block's code length code is oversubscribed or incomplete");
+		}
+
+		std::fill(lengths, lengths + 19, 0);
+
+		for(uint32_t index = 0; index < literal_count + distance_count;)
+		{
+			int symbol = 0;
+
+			if(!read_symbol(code_length_code, symbol))
+			{
+				return false;
+			}
+
+			if(symbol < 16)
+			{
+				lengths[index++] = static_cast<unsigned char>(symbol);
+				continue;
+			}
+
+			unsigned char repeated = 0;
+			uint32_t repeat = 0;
+
+			if(symbol == 16)
+			{
+				if(index == 0)
+				{
+					return fail("a dynamic block repeats a code length before the first");
+				}
+
+				repeated = lengths[index - 1];
+
+				if(!read_bits(2, repeat))
+				{
+					return false;
+				}
+
+				repeat += 3;
+			}
+			else if(symbol == 17)
+			{
+				if(!read_bits(3, repeat))
+				{
+					return false;
+				}
+
+				repeat += 3;
+			}
+			else
+			{
+				if(!read_bits(7, repeat))
+				{
+					return false;
+				}
+
+				repeat += 11;
+			}
+
+			if(index + repeat > literal_count + distance_count)
+			{
+				return fail("a dynamic block repeats code lengths past the last");
+			}
+
+			std::fill(lengths + index, lengths + index + repeat, repeated);
+			index += repeat;
+		}
+
+		if(lengths[256] == 0)
+		{
+			return fail("a dynamic block has no end-of-block code");
+		}
+
+		huffman_code literal_code;
+		huffman_code distance_code;
+
+		if(!is_valid_code(build_code(lengths, literal_count, literal_code), literal_code))
+		{
+			return fail("a dynamic block's literal/length code is oversubscribed or incomplete");
+		}
+
+		if(!is_valid_code(build_code(lengths + literal_count, distance_count, distance_code), distance_code))
+		{
+			return fail("a dynamic block's distance code is oversubscribed or incomplete");
+		}
+
+		return read_codes(literal_code, distance_code, out);
+	}
+
+	/// Returns how many codes are left unused: negative if the lengths are oversubscribed, positive if they're incomplete.
+	static int build_code(const unsigned char* lengths, size_t count, huffman_code& code)
+	{
+		std::fill(code.counts, code.counts + huffman_code::max_length + 1, 0);
+
+		for(size_t i = 0; i < count; ++i)
+		{
+			++code.counts[lengths[i]];
+		}
+
+		if(code.counts[0] == static_cast<int>(count))
+		{
+			return 0;
+		}
+
+		int left = 1;
+
+		for(int length = 1; length <= huffman_code::max_length; ++length)
+		{
+			left = left * 2 - code.counts[length];
+
+			if(left < 0)
+			{
+				return left;
+			}
+		}
+
+		int offsets[huffman_code::max_length + 1];
+		offsets[1] = 0;
+
+		for(int length = 1; length < huffman_code::max_length; ++length)
+		{
+			offsets[length + 1] = offsets[length] + code.counts[length];
+		}
+
+		for(size_t i = 0; i < count; ++i)
+		{
+			if(lengths[i] != 0)
+			{
+				code.symbols[offsets[lengths[i]]++] = static_cast<int>(i);
+			}
+		}
+
+		return left;
+	}
+
+	/// As zlib has it, an incomplete code is only valid if it's a single one-bit code, or no code at all.
+	static bool is_valid_code(int left, const huffman_code& code)
+	{
+		if(left == 0)
+		{
+			return true;
+		}
+
+		if(left < 0)
+		{
+			return false;
+		}
+
+		for(int length = 2; length <= huffman_code::max_length; ++length)
+		{
+			if(code.counts[length] != 0)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	bool read_symbol(const huffman_code& code, int& symbol)
+	{
+		// Codes are read a bit at a time, most significant first; first is the first code of each length.
+		int value = 0;
+		int first = 0;
+		int index = 0;
+
+		for(int length = 1; length <= huffman_code::max_length; ++length)
+		{
+			uint32_t bit = 0;
+
+			if(!read_bits(1, bit))
+			{
+				return false;
+			}
+
+			value |= static_cast<int>(bit);
+			const int count = code.counts[length];
+
+			if(value - count < first)
+			{
+				symbol = code.symbols[index + (value - first)];
+				return true;
+			}
+
+			index += count;
+			first += count;
+			first <<= 1;
+			value <<= 1;
+		}
+
+		return fail("a code isn't in the block's Huffman code");
+	}
+
+	bool read_codes(const huffman_code& literal_code, const huffman_code& distance_code, std::vector<unsigned char>& out)
+	{
+		static const int length_base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+		static const int length_extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+		static const int distance_base[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+		static const int distance_extra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+		while(true)
+		{
+			int symbol = 0;
+
+			if(!read_symbol(literal_code, symbol))
+			{
+				return false;
+			}
+
+			if(symbol < 256)
+			{
+				out.push_back(static_cast<unsigned char>(symbol));
+				continue;
+			}
+
+			if(symbol == 256)
+			{
+				return true;
+			}
+
+			symbol -= 257;
+
+			if(symbol >= 29)
+			{
+				return fail("length code " + ::to_string(symbol + 257) + " is invalid");
+			}
+
+			uint32_t extra = 0;
+
+			if(!read_bits(length_extra[symbol], extra))
+			{
+				return false;
+			}
+
+			const size_t length = length_base[symbol] + extra;
+
+			if(!read_symbol(distance_code, symbol))
+			{
+				return false;
+			}
+
+			if(symbol >= 30)
+			{
+				return fail("distance code " + ::to_string(symbol) + " is invalid");
+			}
+
+			if(!read_bits(distance_extra[symbol], extra))
+			{
+				return false;
+			}
+
+			const size_t distance = distance_base[symbol] + extra;
+
+			if(distance > out.size())
+			{
+				return fail("a match refers back " + ::to_string(distance) + " bytes, before the start of the data");
+			}
+
+			// Byte by byte, as a match may overlap what it copies.
+			for(size_t i = 0; i < length; ++i)
+			{
+				out.push_back(out[out.size() - distance]);
+			}
+		}
+	}
+
+	const std::vector<unsigned char>& m_data;
+	size_t m_position;
+	uint32_t m_bit_buffer;
+	int m_bit_count;
+	std::string m_error;
+};
+
+//------------------------------------------------------------------------------
+
+/// Keeps everything written to it, through small buffers, so that the gzip header, chunks and trailer are split across them.
+class memory_sink : public jsonexport::output_sink
+{
+public:
+	memory_sink()
+		: m_buffer(1000)
+		, m_data()
+		, m_finished(false)
+	{
+	}
+
+	virtual char* acquire_buffer(size_t& capacity) override
+	{
+		capacity = m_buffer.size();
+		return m_buffer.data();
+	}
+
+	virtual void commit_buffer(size_t size) override
+	{
+		m_data.insert(m_data.end(), m_buffer.begin(), m_buffer.begin() + size);
+	}
+
+	virtual void finish() override
+	{
+		m_finished = true;
+	}
+
+	const std::vector<unsigned char>& get_data() const
+	{
+		return m_data;
+	}
+
+	bool is_finished() const
+	{
+		return m_finished;
+	}
+
+private:
+	std::vector<char> m_buffer;
+	std::vector<unsigned char> m_data;
+	bool m_finished;
+};
+
+/// Compresses data through a gzip_sink, committing at most commit_size bytes to each of its buffers, so that chunks can
+/// be made smaller than the sink's own, and so more of them are compressed at once and have to be put back in order.
+std::vector<unsigned char> compress(const std::vector<unsigned char>& data, size_t thread_count, size_t commit_size)
+{
+	memory_sink destination;
+	jsonexport::gzip_sink sink(destination, thread_count);
+
+	// An empty buffer first, as a writer flushing before it's written anything would commit, which mustn't make a chunk.
+	size_t empty_capacity = 0;
+	sink.acquire_buffer(empty_capacity);
+	sink.commit_buffer(0);
+
+	for(size_t written = 0; written < data.size();)
+	{
+		size_t capacity = 0;
+		char* const buffer = sink.acquire_buffer(capacity);
+		const size_t size = std::min(std::min(capacity, commit_size), data.size() - written);
+
+		memcpy(buffer, data.data() + written, size);
+		sink.commit_buffer(size);
+		written += size;
+	}
+
+	sink.finish();
+	return destination.is_finished() ? destination.get_data() : std::vector<unsigned char>();
+}
+
+/// Compresses data and reads it back, checking it's the same; returns the compressed size, or 0 if it failed.
+size_t check_round_trip(results& results, const std::vector<unsigned char>& data, size_t thread_count, size_t commit_size, const std::string& description)
+{
+	const std::string context = description + " (" + ::to_string(data.size()) + " bytes, " + ::to_string(thread_count) + " threads, committed "
+		+ ::to_string(commit_size) + " bytes at a time)";
+
+	const std::vector<unsigned char> compressed = compress(data, thread_count, commit_size);
+	std::vector<unsigned char> decompressed;
+	gzip_reader reader(compressed);
+
+	if(!results.check(reader.read(decompressed), context + " isn't valid gzip: " + reader.get_error()))
+	{
+		return 0;
+	}
+
+	if(!results.check(decompressed == data, context + " doesn't decompress to what was compressed"))
+	{
+		return 0;
+	}
+
+	return compressed.size();
+}
+
+std::vector<unsigned char> get_random_data(std::mt19937_64& random, size_t size)
+{
+	std::vector<unsigned char> data(size);
+
+	for(size_t i = 0; i < size; ++i)
+	{
+		data[i] = static_cast<unsigned char>(random());
+	}
+
+	return data;
+}
+
+/// Something like an export: the same keys over and over, with varied values, and runs of indentation.
+std::vector<unsigned char> get_json_like_data(std::mt19937_64& random, size_t size)
+{
+	static const char* const keys[] = { "\"artist\": ", "\"album\": ", "\"title\": ", "\"tracknumber\": ", "\"path\": \"C:\\\\Music\\\\", "\"length_seconds\": " };
+
+	std::string text;
+
+	while(text.size() < size)
+	{
+		text += "\t\t{\n";
+
+		for(size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i)
+		{
+			text += "\t\t\t";
+			text += keys[i];
+			text += "\"" + ::to_string(random() % 5000) + " value\",\n";
+		}
+
+		text += "\t\t},\n";
+	}
+
+	text.resize(size);
+	return std::vector<unsigned char>(text.begin(), text.end());
+}
+
+//------------------------------------------------------------------------------
+
+} // anonymous namespace
+
+//------------------------------------------------------------------------------
+
+void test_gzip_round_trip(results& results)
+{
+	static const size_t sizes[] = { 0, 1, 2, 3, 4, 5, 100, 257, 258, 259, 32767, 32768, 32769, 65536 + 13, 1024 * 1024 - 1, 1024 * 1024, 1024 * 1024 + 1, 5 * 1024 * 1024 };
+	static const size_t thread_counts[] = { 1, 4 };
+
+	std::mt19937_64 random(3);
+
+	for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+	{
+		const size_t size = sizes[i];
+
+		for(size_t j = 0; j < sizeof(thread_counts) / sizeof(thread_counts[0]); ++j)
+		{
+			const size_t thread_count = thread_counts[j];
+			const size_t whole_chunks = static_cast<size_t>(-1);
+
+			// Incompressible: every byte a literal, in blocks whose codes are as long as they get for literals.
+			check_round_trip(results, get_random_data(random, size), thread_count, whole_chunks, "random data");
+
+			// The longest matches, over and over, each overlapping what it copies.
+			const size_t constant_size = check_round_trip(results, std::vector<unsigned char>(size, 'a'), thread_count, whole_chunks, "constant data");
+			results.check(size < 1024 || constant_size < size / 50, "constant data compressed to " + ::to_string(constant_size) + " of " + ::to_string(size) + " bytes");
+
+			check_round_trip(results, get_json_like_data(random, size), thread_count, whole_chunks, "JSON-like data");
+		}
+	}
+
+	// Nothing at all: just the header, the final block and the trailer of an empty file.
+	const std::vector<unsigned char> empty = compress(std::vector<unsigned char>(), 1, 1);
+	static const unsigned char expected_trailer[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+
+	results.check(empty.size() >= 8 && std::equal(expected_trailer, expected_trailer + 8, empty.end() - 8),
+		"an empty file's trailer isn't a CRC-32 and size of 0");
+}
+
+//------------------------------------------------------------------------------
+
+void test_gzip_chunk_boundaries(results& results)
+{
+	std::mt19937_64 random(4);
+
+	// A stretch of random data repeated, so that everything after the first copy is matches, most of them reaching back
+	// into the previous chunk's history.
+	static const size_t period = 16 * 1024 + 7;
+	const std::vector<unsigned char> block = get_random_data(random, period);
+	std::vector<unsigned char> repeated;
+
+	while(repeated.size() < 3 * 1024 * 1024 + 11)
+	{
+		repeated.insert(repeated.end(), block.begin(), block.end());
+	}
+
+	static const size_t commit_sizes[] = { 1, 1000, period - 1, period, period + 1, 100000, static_cast<size_t>(-1) };
+
+	for(size_t i = 0; i < sizeof(commit_sizes) / sizeof(commit_sizes[0]); ++i)
+	{
+		// Committing a byte at a time makes a chunk for every byte, so only do that for a little of it.
+		const size_t commit_size = commit_sizes[i];
+		const std::vector<unsigned char> data(repeated.begin(), commit_size == 1 ? repeated.begin() + 5000 : repeated.end());
+
+		for(size_t thread_count = 1; thread_count <= 8; thread_count *= 2)
+		{
+			const size_t compressed_size = check_round_trip(results, data, thread_count, commit_size, "repeated random data");
+
+			// One copy of the random data, then the longest matches at up to 3 bytes each, and a block header or two per chunk.
+			// Without the history, each chunk would also have to hold its own copy of the random data.
+			const size_t chunk_size = std::min(commit_size, static_cast<size_t>(1024 * 1024));
+			const size_t chunk_count = (data.size() + chunk_size - 1) / chunk_size;
+			results.check(compressed_size < period + data.size() / 258 * 3 + chunk_count * 512, "repeated random data committed " + ::to_string(commit_size)
+				+ " bytes at a time compressed to " + ::to_string(compressed_size) + " bytes, as if matches didn't reach into the previous chunk");
+		}
+	}
+
+	// Chunks of every size, in lots, on more threads than cores, so that they finish out of order and have to be written in order.
+	for(size_t round = 0; round < 20; ++round)
+	{
+		const std::vector<unsigned char> data = get_json_like_data(random, 200000 + random() % 200000);
+		const size_t commit_size = 1 + random() % 5000;
+		check_round_trip(results, data, 1 + random() % 16, commit_size, "JSON-like data in round " + ::to_string(round));
+	}
+}
+
+//------------------------------------------------------------------------------
+
+void test_deflate_chunks(results& results)
+{
+	std::mt19937_64 random(5);
+
+	// The sink's CRC-32 against the bit-at-a-time one, at every alignment and length around the 8 bytes it takes at a time.
+	for(size_t size = 0; size < 40; ++size)
+	{
+		for(size_t offset = 0; offset < 8; ++offset)
+		{
+			const std::vector<unsigned char> data = get_random_data(random, offset + size);
+			const std::vector<unsigned char> tail(data.begin() + offset, data.end());
+
+			results.check(jsonexport::crc32_update(0, data.data() + offset, size) == crc32_reference(tail),
+				"crc32_update() disagrees with the reference on " + ::to_string(size) + " bytes at offset " + ::to_string(offset));
+
+			// And in two parts, as the sink updates it a chunk at a time.
+			const size_t split = size / 3;
+			const uint32_t crc = jsonexport::crc32_update(jsonexport::crc32_update(0, data.data() + offset, split), data.data() + offset + split, size - split);
+			results.check(crc == crc32_reference(tail), "crc32_update() in two parts disagrees with the reference on " + ::to_string(size) + " bytes");
+		}
+	}
+
+	// Raw chunks, with every amount of history, concatenated as the sink does and wrapped in a gzip header and trailer by hand.
+	static const size_t dictionary_sizes[] = { 0, 1, 4, 1000, jsonexport::deflate_compressor::window_size - 1,
+		jsonexport::deflate_compressor::window_size, jsonexport::deflate_compressor::window_size + 1000 };
+
+	jsonexport::deflate_compressor compressor;
+
+	for(size_t i = 0; i < sizeof(dictionary_sizes) / sizeof(dictionary_sizes[0]); ++i)
+	{
+		const size_t dictionary_size = dictionary_sizes[i];
+		const std::vector<unsigned char> data = get_json_like_data(random, dictionary_size + 50000);
+
+		static const unsigned char header[10] = { 0x1F, 0x8B, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF };
+		std::vector<unsigned char> file(header, header + sizeof(header));
+
+		// The history as a chunk of its own, then the rest as a chunk which can refer back into it.
+		compressor.compress_chunk(data.data(), 0, dictionary_size, file);
+		compressor.compress_chunk(data.data(), dictionary_size, data.size(), file);
+		jsonexport::deflate_compressor::finish_stream(file);
+
+		const uint32_t crc = crc32_reference(data);
+		const uint32_t size = static_cast<uint32_t>(data.size());
+
+		for(int shift = 0; shift < 32; shift += 8)
+		{
+			file.push_back(static_cast<unsigned char>(crc >> shift));
+		}
+
+		for(int shift = 0; shift < 32; shift += 8)
+		{
+			file.push_back(static_cast<unsigned char>(size >> shift));
+		}
+
+		std::vector<unsigned char> decompressed;
+		gzip_reader reader(file);
+
+		if(results.check(reader.read(decompressed), "chunks with " + ::to_string(dictionary_size) + " bytes of history aren't valid deflate: " + reader.get_error()))
+		{
+			results.check(decompressed == data, "chunks with " + ::to_string(dictionary_size) + " bytes of history don't decompress to what was compressed");
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace tests
@@ -0,0 +1,146 @@
+// Tests the parts of the export engine and its rapidjson fork whose bugs would quietly corrupt exports, rather than fail them.
+// Run by ctest, one test at a time, or all of them when run without arguments.
+
+#include "Tests.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+
+namespace tests {
+
+//------------------------------------------------------------------------------
+
+results::results()
+	: m_check_count(0)
+	, m_failure_count(0)
+{
+}
+
+//------------------------------------------------------------------------------
+
+bool results::check(bool passed, const std::string& description)
+{
+	static const size_t reported_failure_count = 10;
+
+	++m_check_count;
+
+	if(!passed)
+	{
+		if(m_failure_count < reported_failure_count)
+		{
+			fprintf(stderr, "  FAILED: %s\n", description.c_str());
+		}
+
+		++m_failure_count;
+	}
+
+	return passed;
+}
+
+//------------------------------------------------------------------------------
+
+size_t results::get_check_count() const
+{
+	return m_check_count;
+}
+
+//------------------------------------------------------------------------------
+
+size_t results::get_failure_count() const
+{
+	return m_failure_count;
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace tests
+
+namespace
+{
+
+struct test
+{
+	const char* name;
+	void (*run)(tests::results& results);
+};
+
+const test all_tests[] = {
+	{ "dtoa_round_trip",                   tests::test_dtoa_round_trip },
+	{ "itoa_matches_printf",               tests::test_itoa_matches_printf },
+	{ "dtoa_shortest",                     tests::test_dtoa_shortest },
+	{ "escape_scan_equivalence",           tests::test_escape_scan_equivalence },
+	{ "writer_escaping",                   tests::test_writer_escaping },
+	{ "binary_format_widths",              tests::test_binary_format_widths },
+	{ "binary_format_sequences",           tests::test_binary_format_sequences },
+	{ "binary_exports_match_json",         tests::test_binary_exports_match_json },
+	{ "gzip_round_trip",                   tests::test_gzip_round_trip },
+	{ "gzip_chunk_boundaries",             tests::test_gzip_chunk_boundaries },
+	{ "deflate_chunks",                    tests::test_deflate_chunks },
+	{ "cache_skips_changed_tracks",        tests::test_cache_skips_changed_tracks },
+	{ "ceiling_covers_snapshot_and_cache", tests::test_ceiling_covers_snapshot_and_cache }
+};
+
+const size_t test_count = sizeof(all_tests) / sizeof(all_tests[0]);
+
+bool run(const test& selected)
+{
+	tests::results results;
+	printf("%s\n", selected.name);
+
+	try
+	{
+		selected.run(results);
+	}
+	catch(const std::exception& e)
+	{
+		results.check(false, std::string("threw ") + e.what());
+	}
+
+	printf("  %u of %u checks failed\n", static_cast<unsigned>(results.get_failure_count()), static_cast<unsigned>(results.get_check_count()));
+	return results.get_failure_count() == 0 && results.get_check_count() > 0;
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv)
+{
+	bool passed = true;
+
+	if(argc < 2)
+	{
+		for(size_t i = 0; i < test_count; ++i)
+		{
+			passed = run(all_tests[i]) && passed;
+		}
+
+		return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	for(int i = 1; i < argc; ++i)
+	{
+		size_t index = 0;
+
+		while(index < test_count && strcmp(all_tests[index].name, argv[i]) != 0)
+		{
+			++index;
+		}
+
+		if(index == test_count)
+		{
+			fprintf(stderr, "Unknown test %s; the tests are:\n", argv[i]);
+
+			for(size_t j = 0; j < test_count; ++j)
+			{
+				fprintf(stderr, "  %s\n", all_tests[j].name);
+			}
+
+			return EXIT_FAILURE;
+		}
+
+		passed = run(all_tests[index]) && passed;
+	}
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,410 @@
+#include "Tests.h"
+
+#include "RapidJsonWrapper.h"
+#include "ToString.h"
+
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace tests {
+
+namespace
+{
+
+uint64_t get_bits(double value)
+{
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+double from_bits(uint64_t bits)
+{
+	double value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+std::string dtoa(double value)
+{
+	char buffer[25];
+	const char* const end = rapidjson::internal::dtoa(value, buffer);
+	return std::string(buffer, static_cast<size_t>(end - buffer));
+}
+
+/// Bits as well as the value, so "-0" and "0" differ.
+std::string describe(double value)
+{
+	char description[64];
+	sprintf(description, "%.17g (0x%016llx)", value, static_cast<unsigned long long>(get_bits(value)));
+	return description;
+}
+
+/// The digits of a number, without its sign, decimal point, exponent or the zeros either side, e.g. 3 for "-0.00123e5".
+size_t count_significant_digits(const std::string& number)
+{
+	const size_t exponent = number.find_first_of("eE");
+	std::string digits;
+
+	for(size_t i = 0; i < number.size() && i < exponent; ++i)
+	{
+		if(number[i] >= '0' && number[i] <= '9')
+		{
+			digits += number[i];
+		}
+	}
+
+	const size_t first = digits.find_first_not_of('0');
+
+	if(first == std::string::npos)
+	{
+		return 1;
+	}
+
+	return digits.find_last_not_of('0') + 1 - first;
+}
+
+/// The fewest significant digits printf needs for value to parse back exactly.
+size_t count_shortest_printf_digits(double value)
+{
+	for(int precision = 1; precision < 17; ++precision)
+	{
+		char buffer[32];
+		sprintf(buffer, "%.*e", precision - 1, value);
+
+		if(strtod(buffer, nullptr) == value)
+		{
+			return precision;
+		}
+	}
+
+	return 17;
+}
+
+/// Doubles on which conversions tend to go wrong: zeros, subnormals, the ends of the range, and the powers of two and ten
+/// with their neighbours either side, both positive and negative.
+std::vector<double> get_edge_doubles()
+{
+	std::vector<double> doubles;
+	doubles.push_back(0.0);
+	doubles.push_back(from_bits(1));						// The smallest subnormal.
+	doubles.push_back(from_bits(0x000FFFFFFFFFFFFFull));	// The largest subnormal.
+	doubles.push_back(from_bits(0x0008000000000000ull));
+	doubles.push_back(DBL_MIN);
+	doubles.push_back(DBL_MAX);
+	doubles.push_back(DBL_EPSILON);
+	doubles.push_back(1.0 / 3.0);
+	doubles.push_back(0.1);
+	doubles.push_back(0.3);
+	doubles.push_back(9007199254740992.0);				// 2^53, past which not every integer is representable.
+	doubles.push_back(9007199254740994.0);
+	doubles.push_back(18446744073709551616.0);			// 2^64.
+
+	for(int exponent = -1074; exponent <= 1023; ++exponent)
+	{
+		doubles.push_back(ldexp(1.0, exponent));
+	}
+
+	for(int exponent = -323; exponent <= 308; ++exponent)
+	{
+		char power[16];
+		sprintf(power, "1e%d", exponent);
+		doubles.push_back(strtod(power, nullptr));
+	}
+
+	const size_t exact_count = doubles.size();
+
+	for(size_t i = 0; i < exact_count; ++i)
+	{
+		const uint64_t bits = get_bits(doubles[i]);
+
+		if(bits > 0)
+		{
+			doubles.push_back(from_bits(bits - 1));
+		}
+
+		if(doubles[i] < DBL_MAX)
+		{
+			doubles.push_back(from_bits(bits + 1));
+		}
+	}
+
+	const size_t positive_count = doubles.size();
+
+	for(size_t i = 0; i < positive_count; ++i)
+	{
+		doubles.push_back(-doubles[i]);
+	}
+
+	return doubles;
+}
+
+/// Any finite double, with every exponent equally likely, and a share of subnormals.
+double get_random_double(std::mt19937_64& random)
+{
+	for(;;)
+	{
+		uint64_t bits = random();
+
+		if(bits % 16 == 0)
+		{
+			bits &= 0x800FFFFFFFFFFFFFull;
+		}
+
+		const double value = from_bits(bits);
+
+		if(value - value == 0.0)
+		{
+			return value;
+		}
+	}
+}
+
+template<typename Integer>
+void add_boundaries(std::vector<Integer>& integers, Integer value)
+{
+	integers.push_back(value - 1);
+	integers.push_back(value);
+	integers.push_back(value + 1);
+}
+
+/// Every width a number's digits could be written in: the powers of two and ten and their neighbours, the ends of
+/// the type's range, and the small numbers either side of zero. Negatives only for signed types, with their extra value.
+template<typename Integer>
+std::vector<Integer> get_edge_integers(Integer min, Integer max)
+{
+	std::vector<Integer> integers;
+	const bool is_signed = min < 0;
+
+	for(Integer i = 0; i <= 1000; ++i)
+	{
+		integers.push_back(i);
+
+		if(is_signed)
+		{
+			integers.push_back(0 - i);
+		}
+	}
+
+	const int bit_count = is_signed ? 8 * sizeof(Integer) - 1 : 8 * sizeof(Integer);
+
+	for(int bit = 1; bit < bit_count; ++bit)
+	{
+		const Integer power = static_cast<Integer>(1) << bit;
+		add_boundaries(integers, power);
+
+		if(is_signed)
+		{
+			add_boundaries(integers, static_cast<Integer>(0 - power));
+		}
+	}
+
+	for(Integer power = 10; power <= max / 10; power *= 10)
+	{
+		add_boundaries(integers, power);
+		add_boundaries(integers, static_cast<Integer>(power * 10));
+
+		if(is_signed)
+		{
+			add_boundaries(integers, static_cast<Integer>(0 - power));
+			add_boundaries(integers, static_cast<Integer>(0 - power * 10));
+		}
+	}
+
+	integers.push_back(max);
+	integers.push_back(max - 1);
+	integers.push_back(min);
+	integers.push_back(min + 1);
+	return integers;
+}
+
+template<typename Integer>
+void add_random_integers(std::vector<Integer>& integers, std::mt19937_64& random, size_t count)
+{
+	for(size_t i = 0; i < count; ++i)
+	{
+		// Shifted by a random amount, so that short numbers are as common as long ones.
+		const uint64_t bits = random();
+		integers.push_back(static_cast<Integer>(bits >> (random() % 64)));
+	}
+}
+
+template<typename Integer, typename Printed>
+void check_itoa(results& results, const std::vector<Integer>& integers, char* (*itoa)(Integer, char*), const char* format, const char* type_name)
+{
+	for(size_t i = 0; i < integers.size(); ++i)
+	{
+		char expected[32];
+		sprintf(expected, format, static_cast<Printed>(integers[i]));
+
+		char buffer[32];
+		const char* const end = itoa(integers[i], buffer);
+		const std::string actual(buffer, static_cast<size_t>(end - buffer));
+
+		results.check(actual == expected, std::string(type_name) + " " + expected + " was written as " + actual);
+	}
+}
+
+} // anonymous namespace
+
+//------------------------------------------------------------------------------
+
+void test_dtoa_round_trip(results& results)
+{
+	std::vector<double> doubles = get_edge_doubles();
+	std::mt19937_64 random(1);
+
+	for(size_t i = 0; i < 1000000; ++i)
+	{
+		doubles.push_back(get_random_double(random));
+	}
+
+	for(size_t i = 0; i < doubles.size(); ++i)
+	{
+		const std::string written = dtoa(doubles[i]);
+		char* end = nullptr;
+		const double parsed = strtod(written.c_str(), &end);
+
+		results.check(end == written.c_str() + written.size() && get_bits(parsed) == get_bits(doubles[i]),
+			describe(doubles[i]) + " was written as " + written + ", which parses as " + describe(parsed));
+	}
+
+	// JSON has no infinity or NaN; the writer writes null for them rather than something nothing could parse.
+	rapidjson::StringBuffer buffer;
+	rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+	writer.StartArray();
+	writer.Double(HUGE_VAL);
+	writer.Double(-HUGE_VAL);
+	writer.Double(from_bits(0x7FF8000000000000ull));
+	writer.Double(-0.0);
+	writer.Double(DBL_MAX);
+	writer.EndArray();
+
+	const std::string json = buffer.GetString();
+	results.check(json == "[null,null,null,-0,1.7976931348623157e308]", "the writer wrote infinities, NaN, -0 and DBL_MAX as " + json);
+}
+
+//------------------------------------------------------------------------------
+
+void test_itoa_matches_printf(results& results)
+{
+	std::mt19937_64 random(1);
+
+	std::vector<int32_t> int32s = get_edge_integers<int32_t>(INT32_MIN, INT32_MAX);
+	add_random_integers(int32s, random, 100000);
+	check_itoa<int32_t, long long>(results, int32s, rapidjson::internal::i32toa, "%lld", "int32");
+
+	std::vector<uint32_t> uint32s = get_edge_integers<uint32_t>(0, UINT32_MAX);
+	add_random_integers(uint32s, random, 100000);
+	check_itoa<uint32_t, unsigned long long>(results, uint32s, rapidjson::internal::u32toa, "%llu", "uint32");
+
+	std::vector<int64_t> int64s = get_edge_integers<int64_t>(INT64_MIN, INT64_MAX);
+	add_random_integers(int64s, random, 100000);
+	check_itoa<int64_t, long long>(results, int64s, rapidjson::internal::i64toa, "%lld", "int64");
+
+	std::vector<uint64_t> uint64s = get_edge_integers<uint64_t>(0, UINT64_MAX);
+	add_random_integers(uint64s, random, 100000);
+	check_itoa<uint64_t, unsigned long long>(results, uint64s, rapidjson::internal::u64toa, "%llu", "uint64");
+}
+
+//------------------------------------------------------------------------------
+
+void test_dtoa_shortest(results& results)
+{
+	// How each is laid out, as well as how many digits it has.
+	static const struct
+	{
+		double value;
+		const char* expected;
+	}
+	expected_numbers[] = {
+		{ 0.0, "0" },
+		{ -0.0, "-0" },
+		{ 1.0, "1" },
+		{ -1.0, "-1" },
+		{ 0.1, "0.1" },
+		{ 0.3, "0.3" },
+		{ 1.0 / 3.0, "0.3333333333333333" },
+		{ 245.0, "245" },
+		{ 1.5, "1.5" },
+		{ -12.375, "-12.375" },
+		{ 0.000001, "0.000001" },
+		{ 0.0000001, "1e-7" },
+		{ 0.00000123, "0.00000123" },
+		{ 1.23e-7, "1.23e-7" },
+		{ 1e20, "100000000000000000000" },
+		{ 1e21, "1e21" },
+		{ 1.5e21, "1.5e21" },
+		{ 9007199254740992.0, "9007199254740992" },
+		{ 4.9406564584124654e-324, "5e-324" },
+		{ 2.2250738585072014e-308, "2.2250738585072014e-308" },
+		{ 1.7976931348623157e308, "1.7976931348623157e308" },
+		{ -1.7976931348623157e308, "-1.7976931348623157e308" }
+	};
+
+	for(size_t i = 0; i < sizeof(expected_numbers) / sizeof(expected_numbers[0]); ++i)
+	{
+		const std::string written = dtoa(expected_numbers[i].value);
+		results.check(written == expected_numbers[i].expected, describe(expected_numbers[i].value) + " was written as " + written + " rather than " + expected_numbers[i].expected);
+	}
+
+	// Floats, e.g. replaygain, are widened to the double nearest their own shortest representation before they're written.
+	static const struct
+	{
+		float value;
+		const char* expected;
+	}
+	expected_floats[] = {
+		{ 0.1f, "0.1" },
+		{ 1.1f, "1.1" },
+		{ -6.52f, "-6.52" },
+		{ 0.988525f, "0.988525" },
+		{ 16777216.0f, "16777216" },
+		{ 1e-10f, "1e-10" }
+	};
+
+	for(size_t i = 0; i < sizeof(expected_floats) / sizeof(expected_floats[0]); ++i)
+	{
+		const std::string written = dtoa(rapidjson::internal::ShortestDouble(expected_floats[i].value));
+		results.check(written == expected_floats[i].expected, describe(expected_floats[i].value) + " as a float was written as " + written + " rather than " + expected_floats[i].expected);
+	}
+
+	// Grisu2 finds the shortest digits for all but about one double in a thousand. For the rest it gives the nearest
+	// digits it can prove round-trip, e.g. 9.999999999999999e22 for 1e23: still exact, just not as short as printf's.
+	std::vector<double> doubles = get_edge_doubles();
+	std::mt19937_64 random(2);
+
+	for(size_t i = 0; i < 100000; ++i)
+	{
+		doubles.push_back(get_random_double(random));
+	}
+
+	size_t longer_count = 0;
+
+	for(size_t i = 0; i < doubles.size(); ++i)
+	{
+		const std::string written = dtoa(doubles[i]);
+		const size_t digit_count = count_significant_digits(written);
+		const size_t shortest_digit_count = count_shortest_printf_digits(doubles[i]);
+
+		char shortest[32];
+		sprintf(shortest, "%.*e", static_cast<int>(shortest_digit_count) - 1, doubles[i]);
+
+		results.check(digit_count <= 17, describe(doubles[i]) + " was written as " + written + ", longer than " + shortest);
+		longer_count += digit_count > shortest_digit_count ? 1 : 0;
+	}
+
+	results.check(longer_count * 500 <= doubles.size(), ::to_string(longer_count) + " of " + ::to_string(doubles.size()) + " doubles were written with more digits than they need");
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace tests
@@ -0,0 +1,292 @@
+#include "Tests.h"
+
+#include "RapidJsonWrapper.h"
+#include "ToString.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(RAPIDJSON_WRITER_SSE2) && defined(_MSC_VER)
+#include <intrin.h>		// __cpuid(), _xgetbv()
+#endif
+
+namespace tests {
+
+namespace
+{
+
+#ifdef RAPIDJSON_WRITER_SSE2
+/// Whether ScanUnescapedAVX2() can be run here, whatever the tests were compiled for.
+bool cpu_supports_avx2()
+{
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+
+	if(info[0] < 7)
+	{
+		return false;
+	}
+
+	// The OS must save the AVX registers on context switches, as well as the CPU having them.
+	__cpuid(info, 1);
+	const bool os_saves_avx = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+
+	__cpuidex(info, 7, 0);
+	return os_saves_avx && (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+#endif
+
+/// Bytes weighted towards the ones the scans have to tell apart: the escaped ones, those either side of the control
+/// characters, and those with the top bit set, which a signed comparison would take for control characters.
+char get_random_byte(std::mt19937_64& random)
+{
+	static const char interesting[] = { '"', '\\', '\0', '\x01', '\x08', '\x1F', ' ', '!', '#', '[', ']', '\x7F', '\x80', '\x9F', '\xC3', '\xE3', '\xFF' };
+
+	const uint64_t choice = random() % 4;
+
+	if(choice == 0)
+	{
+		return interesting[random() % sizeof(interesting)];
+	}
+
+	// Plain text mostly, so that runs are long enough to need a few blocks before anything's found.
+	if(choice == 1)
+	{
+		return static_cast<char>(random() % 256);
+	}
+
+	return static_cast<char>('a' + random() % 26);
+}
+
+/// Lengths either side of every block size the scans use, and of a few blocks, and some longer ones.
+std::vector<size_t> get_lengths()
+{
+	std::vector<size_t> lengths;
+
+	for(size_t length = 0; length <= 130; ++length)
+	{
+		lengths.push_back(length);
+	}
+
+	lengths.push_back(255);
+	lengths.push_back(256);
+	lengths.push_back(257);
+	lengths.push_back(1000);
+	lengths.push_back(4096);
+	return lengths;
+}
+
+/// A string of the given length, usually with nothing to escape before a random position, so that every position in
+/// and across blocks is where the first escaped byte is found.
+std::string get_random_string(std::mt19937_64& random, size_t length)
+{
+	std::string string(length, 'a');
+
+	for(size_t i = 0; i < length; ++i)
+	{
+		string[i] = get_random_byte(random);
+	}
+
+	if(length > 0 && random() % 2 == 0)
+	{
+		const size_t first_escaped = random() % (length + 1);
+		const char* const escape = rapidjson::internal::GetEscapeTable();
+
+		for(size_t i = 0; i < first_escaped; ++i)
+		{
+			while(escape[static_cast<unsigned char>(string[i])])
+			{
+				string[i] = get_random_byte(random);
+			}
+		}
+	}
+
+	return string;
+}
+
+std::string describe(const std::string& string)
+{
+	std::string description = "\"";
+
+	for(size_t i = 0; i < string.size() && i < 80; ++i)
+	{
+		const unsigned char c = static_cast<unsigned char>(string[i]);
+
+		if(c >= 0x20 && c < 0x7F && c != '"' && c != '\\')
+		{
+			description += static_cast<char>(c);
+		}
+		else
+		{
+			char escaped[8];
+			sprintf(escaped, "\\x%02X", c);
+			description += escaped;
+		}
+	}
+
+	return description + (string.size() > 80 ? "\"..." : "\"") + " (" + ::to_string(string.size()) + " bytes)";
+}
+
+/// How JSON says to escape a string, written independently of the writer to check it against.
+std::string escape_as_reference(const std::string& string)
+{
+	std::string escaped = "\"";
+
+	for(size_t i = 0; i < string.size(); ++i)
+	{
+		const unsigned char c = static_cast<unsigned char>(string[i]);
+
+		switch(c)
+		{
+		case '"':	escaped += "\\\"";	break;
+		case '\\':	escaped += "\\\\";	break;
+		case '\b':	escaped += "\\b";	break;
+		case '\f':	escaped += "\\f";	break;
+		case '\n':	escaped += "\\n";	break;
+		case '\r':	escaped += "\\r";	break;
+		case '\t':	escaped += "\\t";	break;
+		default:
+			if(c < 0x20)
+			{
+				char unicode[8];
+				sprintf(unicode, "\\u%04X", c);
+				escaped += unicode;
+			}
+			else
+			{
+				escaped += static_cast<char>(c);
+			}
+		}
+	}
+
+	return escaped + "\"";
+}
+
+} // anonymous namespace
+
+//------------------------------------------------------------------------------
+
+void test_escape_scan_equivalence(results& results)
+{
+	using rapidjson::internal::ScanUnescapedScalar;
+	const std::vector<size_t> lengths = get_lengths();
+	std::mt19937_64 random(1);
+
+#ifdef RAPIDJSON_WRITER_SSE2
+	const bool avx2 = cpu_supports_avx2();
+
+	if(!avx2)
+	{
+		printf("  This CPU doesn't support AVX2, so only the SSE2 scan is checked.\n");
+	}
+#else
+	printf("  SSE2 isn't available here, so only the scan used is checked.\n");
+#endif
+
+	for(size_t round = 0; round < 200; ++round)
+	{
+		for(size_t i = 0; i < lengths.size(); ++i)
+		{
+			const std::string string = get_random_string(random, lengths[i]);
+
+			// Copied to a block of exactly its size, at every alignment a block could start at, so that reading
+			// outside the string trips the address sanitizer, and so that loads straddle cache lines.
+			const size_t offset = random() % 32;
+			std::vector<char> buffer(offset + string.size());
+			std::copy(string.begin(), string.end(), buffer.begin() + offset);
+
+			const char* const begin = buffer.data() + offset;
+			const char* const end = begin + string.size();
+			const size_t expected = ScanUnescapedScalar(begin, end) - begin;
+
+			results.check(rapidjson::internal::ScanUnescaped(begin, end) - begin == static_cast<ptrdiff_t>(expected),
+				"ScanUnescaped() and the byte-by-byte scan disagree on " + describe(string));
+
+#ifdef RAPIDJSON_WRITER_SSE2
+			results.check(rapidjson::internal::ScanUnescapedSSE2(begin, end) - begin == static_cast<ptrdiff_t>(expected),
+				"the SSE2 and byte-by-byte scans disagree on " + describe(string));
+
+			if(avx2)
+			{
+				results.check(rapidjson::internal::ScanUnescapedAVX2(begin, end) - begin == static_cast<ptrdiff_t>(expected),
+					"the AVX2 and byte-by-byte scans disagree on " + describe(string));
+			}
+#endif
+		}
+	}
+
+	// Every byte on its own, at every position in a block and a half of either block size.
+	for(unsigned byte = 0; byte < 256; ++byte)
+	{
+		for(size_t position = 0; position < 48; ++position)
+		{
+			std::vector<char> buffer(48, 'a');
+			buffer[position] = static_cast<char>(byte);
+
+			const char* const begin = buffer.data();
+			const char* const end = begin + buffer.size();
+			const char* const expected = ScanUnescapedScalar(begin, end);
+			const std::string description = "byte " + ::to_string(byte) + " at " + ::to_string(position);
+
+			results.check(rapidjson::internal::ScanUnescaped(begin, end) == expected, "ScanUnescaped() and the byte-by-byte scan disagree on " + description);
+
+#ifdef RAPIDJSON_WRITER_SSE2
+			results.check(rapidjson::internal::ScanUnescapedSSE2(begin, end) == expected, "the SSE2 and byte-by-byte scans disagree on " + description);
+
+			if(avx2)
+			{
+				results.check(rapidjson::internal::ScanUnescapedAVX2(begin, end) == expected, "the AVX2 and byte-by-byte scans disagree on " + description);
+			}
+#endif
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+
+void test_writer_escaping(results& results)
+{
+	const std::vector<size_t> lengths = get_lengths();
+	std::mt19937_64 random(2);
+
+	for(size_t round = 0; round < 50; ++round)
+	{
+		for(size_t i = 0; i < lengths.size(); ++i)
+		{
+			const std::string string = get_random_string(random, lengths[i]);
+
+			rapidjson::StringBuffer buffer;
+			rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+			writer.StartArray();
+			writer.String(string.data(), static_cast<rapidjson::SizeType>(string.size()));
+			writer.EndArray();
+
+			const std::string written(buffer.GetString(), buffer.GetSize());
+			const std::string expected = "[" + escape_as_reference(string) + "]";
+
+			if(!results.check(written == expected, describe(string) + " was written as " + describe(written)))
+			{
+				continue;
+			}
+
+			// And it reads back the same, including any null characters.
+			rapidjson::Document document;
+			document.Parse<0>(written.c_str());
+
+			results.check(!document.HasParseError() && document.IsArray() && document.Size() == 1 && document[0u].IsString()
+				&& std::string(document[0u].GetString(), document[0u].GetStringLength()) == string,
+				describe(string) + " didn't read back the same from " + describe(written));
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace tests
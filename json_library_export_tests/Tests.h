@@ -0,0 +1,82 @@
+#pragma once
+
+#include "LibraryExport.h"
+
+#include <cstddef>
+#include <string>
+
+namespace tests {
+
+//------------------------------------------------------------------------------
+
+/// Counts a test's checks and reports the first few that fail; a test that fails one check usually fails thousands alike.
+class results
+{
+public:
+	results();
+
+	/// Returns passed, so that a test can stop early when later checks depend on this one.
+	bool check(bool passed, const std::string& description);
+
+	size_t get_check_count() const;
+	size_t get_failure_count() const;
+
+private:
+	size_t m_check_count;
+	size_t m_failure_count;
+};
+
+/// For exports run by tests, which only care about the output.
+class quiet_status : public jsonexport::export_status
+{
+public:
+	virtual void set_progress(size_t, size_t) override
+	{
+	}
+
+	virtual void check_abort() override
+	{
+	}
+
+	virtual void log(const char*) override
+	{
+	}
+};
+
+//------------------------------------------------------------------------------
+
+/// Numbers as the writers format them: doubles, which must parse back exactly and are almost always as short as
+/// printf's shortest round-trip, and integers, which must match printf across every width boundary.
+void test_dtoa_round_trip(results& results);
+void test_itoa_matches_printf(results& results);
+void test_dtoa_shortest(results& results);
+
+/// Escaping strings: the SSE2 and AVX2 scans for bytes to escape must find the same byte as the scalar scan, and
+/// the writer must escape strings as JSON says, so that they read back the same.
+void test_escape_scan_equivalence(results& results);
+void test_writer_escaping(results& results);
+
+/// MessagePack and CBOR, decoded by minimal readers and compared with the JSON they stand in for: every width of
+/// integer, string and container either side of its threshold, floats and doubles, sequences as the lines layout
+/// writes them, and whole exports of a synthetic library in both layouts.
+void test_binary_format_widths(results& results);
+void test_binary_format_sequences(results& results);
+void test_binary_exports_match_json(results& results);
+
+/// gzip, read back by an inflater written from the RFCs rather than from the compressor: empty, incompressible, constant
+/// and JSON-like data, chunks of every size finishing out of order on several threads, matches reaching back into the
+/// previous chunk, and the CRC-32 and size in the trailer.
+void test_gzip_round_trip(results& results);
+void test_gzip_chunk_boundaries(results& results);
+void test_deflate_chunks(results& results);
+
+/// The fragment cache mustn't keep the JSON of a track which changed after it was read from the library but before it was
+/// serialized, e.g. between being copied into a snapshot and the export, or between the snapshot's batches.
+void test_cache_skips_changed_tracks(results& results);
+
+/// The memory ceiling covers a track_snapshot's arenas and the fragment cache, not just what the export builds.
+void test_ceiling_covers_snapshot_and_cache(results& results);
+
+//------------------------------------------------------------------------------
+
+} // namespace tests
@@ -41,6 +41,23 @@ public:
 		}
 	}
 
+	void PutBuffer(const char* buffer, size_t n) {
+		size_t avail = bufferEnd_ - current_;
+		while (n > avail) {
+			memcpy(current_, buffer, avail);
+			current_ += avail;
+			Flush();
+			buffer += avail;
+			n -= avail;
+			avail = bufferEnd_ - current_;
+		}
+
+		if (n > 0) {
+			memcpy(current_, buffer, n);
+			current_ += n;
+		}
+	}
+
 	void Flush() {
 		if (current_ != buffer_) {
 			fwrite(buffer_, 1, current_ - buffer_, fp_);
@@ -68,6 +85,12 @@ inline void PutN(FileWriteStream& stream, char c, size_t n) {
 	stream.PutN(c, n);
 }
 
+//! Implement specialized version of PutBuffer() with memcpy() for better performance.
+template<>
+inline void PutBuffer(FileWriteStream& stream, const char* buffer, size_t n) {
+	stream.PutBuffer(buffer, n);
+}
+
 } // namespace rapidjson
 
 #endif // RAPIDJSON_FILESTREAM_H_
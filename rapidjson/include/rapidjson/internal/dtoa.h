@@ -0,0 +1,199 @@
+#ifndef RAPIDJSON_DTOA_
+#define RAPIDJSON_DTOA_
+
+#include "diyfp.h"
+#include "itoa.h"
+#include "pow10.h"
+
+namespace rapidjson {
+namespace internal {
+
+inline void GrisuRound(char* buffer, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w) {
+	while (rest < wp_w && delta - rest >= ten_kappa &&
+		(rest + ten_kappa < wp_w || // closer
+		 wp_w - rest > rest + ten_kappa - wp_w)) {
+		buffer[len - 1]--;
+		rest += ten_kappa;
+	}
+}
+
+inline int CountDecimalDigit32(unsigned n) {
+	if (n < 10) return 1;
+	if (n < 100) return 2;
+	if (n < 1000) return 3;
+	if (n < 10000) return 4;
+	if (n < 100000) return 5;
+	if (n < 1000000) return 6;
+	if (n < 10000000) return 7;
+	if (n < 100000000) return 8;
+	// Will not reach 10 digits in DigitGen().
+	return 9;
+}
+
+inline void DigitGen(const DiyFp& W, const DiyFp& Mp, uint64_t delta, char* buffer, int* len, int* K) {
+	static const unsigned kPow10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+	const DiyFp one(static_cast<uint64_t>(1) << -Mp.e, Mp.e);
+	const DiyFp wp_w = Mp - W;
+	unsigned p1 = static_cast<unsigned>(Mp.f >> -one.e);
+	uint64_t p2 = Mp.f & (one.f - 1);
+	int kappa = CountDecimalDigit32(p1); // kappa in [0, 9]
+	*len = 0;
+
+	while (kappa > 0) {
+		const unsigned d = p1 / kPow10[kappa - 1];
+		p1 %= kPow10[kappa - 1];
+		if (d || *len)
+			buffer[(*len)++] = static_cast<char>('0' + d);
+		kappa--;
+		const uint64_t tmp = (static_cast<uint64_t>(p1) << -one.e) + p2;
+		if (tmp <= delta) {
+			*K += kappa;
+			GrisuRound(buffer, *len, delta, tmp, static_cast<uint64_t>(kPow10[kappa]) << -one.e, wp_w.f);
+			return;
+		}
+	}
+
+	// kappa = 0
+	for (;;) {
+		p2 *= 10;
+		delta *= 10;
+		const char d = static_cast<char>(p2 >> -one.e);
+		if (d || *len)
+			buffer[(*len)++] = static_cast<char>('0' + d);
+		p2 &= one.f - 1;
+		kappa--;
+		if (p2 < delta) {
+			*K += kappa;
+			const int index = -kappa;
+			GrisuRound(buffer, *len, delta, p2, one.f, wp_w.f * (index < 9 ? kPow10[index] : 0));
+			return;
+		}
+	}
+}
+
+//! Generates the shortest digits which round-trip to v, so that v == digits * 10^K.
+/*! \param lowerBoundaryIsCloser True if v is a power of two, so the representable value below it is only half as far away.
+*/
+inline void Grisu2(const DiyFp& v, bool lowerBoundaryIsCloser, char* buffer, int* length, int* K) {
+	DiyFp w_m, w_p;
+	v.NormalizedBoundaries(lowerBoundaryIsCloser, &w_m, &w_p);
+
+	const DiyFp c_mk = GetCachedPower(w_p.e, K);
+	const DiyFp W = v.Normalize() * c_mk;
+	DiyFp Wp = w_p * c_mk;
+	DiyFp Wm = w_m * c_mk;
+	Wm.f++;
+	Wp.f--;
+	DigitGen(W, Wp, Wp.f - Wm.f, buffer, length, K);
+}
+
+inline char* WriteExponent(int K, char* buffer) {
+	if (K < 0) {
+		*buffer++ = '-';
+		K = -K;
+	}
+	return u32toa(static_cast<unsigned>(K), buffer);
+}
+
+//! Lays out the digits from Grisu2() as a JSON number, using exponent notation only for very large or small values.
+inline char* Prettify(char* buffer, int length, int k) {
+	const int kk = length + k; // 10^(kk-1) <= v < 10^kk
+
+	if (0 <= k && kk <= 21) {
+		// 1234e7 -> 12340000000
+		for (int i = length; i < kk; i++)
+			buffer[i] = '0';
+		return &buffer[kk];
+	}
+	else if (0 < kk && kk <= 21) {
+		// 1234e-2 -> 12.34
+		memmove(&buffer[kk + 1], &buffer[kk], length - kk);
+		buffer[kk] = '.';
+		return &buffer[length + 1];
+	}
+	else if (-6 < kk && kk <= 0) {
+		// 1234e-6 -> 0.001234
+		const int offset = 2 - kk;
+		memmove(&buffer[offset], &buffer[0], length);
+		buffer[0] = '0';
+		buffer[1] = '.';
+		for (int i = 2; i < offset; i++)
+			buffer[i] = '0';
+		return &buffer[length + offset];
+	}
+	else if (length == 1) {
+		// 1e30
+		buffer[1] = 'e';
+		return WriteExponent(kk - 1, &buffer[2]);
+	}
+	else {
+		// 1234e30 -> 1.234e33
+		memmove(&buffer[2], &buffer[1], length - 1);
+		buffer[1] = '.';
+		buffer[length + 1] = 'e';
+		return WriteExponent(kk - 1, &buffer[length + 2]);
+	}
+}
+
+//! Converts a finite double to the shortest decimal string which parses back to the same value.
+/*! Unlike printf(), this doesn't depend on the locale.
+	Integral values are written without a fractional part, e.g. "245" rather than "245.0".
+	\param buffer Must have room for at least 25 characters. No null terminator is written.
+	\return Pointer past the last character written.
+*/
+inline char* dtoa(double value, char* buffer) {
+	if (value == 0) {
+		if (1.0 / value < 0)
+			*buffer++ = '-';
+		*buffer++ = '0';
+		return buffer;
+	}
+
+	if (value < 0) {
+		*buffer++ = '-';
+		value = -value;
+	}
+
+	bool lowerBoundaryIsCloser;
+	const DiyFp v = DoubleToDiyFp(value, &lowerBoundaryIsCloser);
+
+	int length, K;
+	Grisu2(v, lowerBoundaryIsCloser, buffer, &length, &K);
+	return Prettify(buffer, length, K);
+}
+
+//! Returns the double nearest to the shortest decimal representation of a finite float.
+/*! Widening a float to double keeps its binary value exactly, which has many more digits than the float was
+	ever precise to (e.g. 0.1f becomes 0.100000001490116...). Passing the result of this to dtoa() instead gives
+	the digits the float would have been written with.
+*/
+inline double ShortestDouble(float value) {
+	if (value == 0)
+		return value;
+
+	const bool negative = value < 0;
+
+	bool lowerBoundaryIsCloser;
+	const DiyFp v = FloatToDiyFp(negative ? -value : value, &lowerBoundaryIsCloser);
+
+	char buffer[16];
+	int length, K;
+	Grisu2(v, lowerBoundaryIsCloser, buffer, &length, &K);
+
+	// A float has at most 9 significant digits, so the digits fit exactly in a double.
+	// When the power of ten is also exact, a single multiply or divide gives the correctly rounded result.
+	if (K < -22 || K > 22)
+		return value;
+
+	double digits = 0;
+	for (int i = 0; i < length; i++)
+		digits = digits * 10 + (buffer[i] - '0');
+
+	const double result = K < 0 ? digits / Pow10(-K) : digits * Pow10(K);
+	return negative ? -result : result;
+}
+
+} // namespace internal
+} // namespace rapidjson
+
+#endif // RAPIDJSON_DTOA_
@@ -0,0 +1,156 @@
+#ifndef RAPIDJSON_ITOA_
+#define RAPIDJSON_ITOA_
+
+namespace rapidjson {
+namespace internal {
+
+//! Lookup table of the decimal digits of 00 to 99, two characters per number.
+inline const char* GetDigitsLut() {
+	static const char cDigitsLut[200] = {
+		'0','0','0','1','0','2','0','3','0','4','0','5','0','6','0','7','0','8','0','9',
+		'1','0','1','1','1','2','1','3','1','4','1','5','1','6','1','7','1','8','1','9',
+		'2','0','2','1','2','2','2','3','2','4','2','5','2','6','2','7','2','8','2','9',
+		'3','0','3','1','3','2','3','3','3','4','3','5','3','6','3','7','3','8','3','9',
+		'4','0','4','1','4','2','4','3','4','4','4','5','4','6','4','7','4','8','4','9',
+		'5','0','5','1','5','2','5','3','5','4','5','5','5','6','5','7','5','8','5','9',
+		'6','0','6','1','6','2','6','3','6','4','6','5','6','6','6','7','6','8','6','9',
+		'7','0','7','1','7','2','7','3','7','4','7','5','7','6','7','7','7','8','7','9',
+		'8','0','8','1','8','2','8','3','8','4','8','5','8','6','8','7','8','8','8','9',
+		'9','0','9','1','9','2','9','3','9','4','9','5','9','6','9','7','9','8','9','9',
+	};
+	return cDigitsLut;
+}
+
+//! Writes exactly 8 digits of value (which must be < 100000000), including leading zeros.
+inline char* Write8Digits(unsigned value, char* buffer) {
+	const char* cDigitsLut = GetDigitsLut();
+	const unsigned b = value / 10000;
+	const unsigned c = value % 10000;
+	const unsigned d1 = (b / 100) << 1;
+	const unsigned d2 = (b % 100) << 1;
+	const unsigned d3 = (c / 100) << 1;
+	const unsigned d4 = (c % 100) << 1;
+
+	*buffer++ = cDigitsLut[d1];
+	*buffer++ = cDigitsLut[d1 + 1];
+	*buffer++ = cDigitsLut[d2];
+	*buffer++ = cDigitsLut[d2 + 1];
+	*buffer++ = cDigitsLut[d3];
+	*buffer++ = cDigitsLut[d3 + 1];
+	*buffer++ = cDigitsLut[d4];
+	*buffer++ = cDigitsLut[d4 + 1];
+	return buffer;
+}
+
+//! Converts an unsigned 32-bit integer to decimal, two digits at a time.
+/*! \param buffer Must have room for at least 10 characters. No null terminator is written.
+	\return Pointer past the last character written.
+*/
+inline char* u32toa(unsigned value, char* buffer) {
+	const char* cDigitsLut = GetDigitsLut();
+
+	if (value < 10000) {
+		const unsigned d1 = (value / 100) << 1;
+		const unsigned d2 = (value % 100) << 1;
+
+		if (value >= 1000)
+			*buffer++ = cDigitsLut[d1];
+		if (value >= 100)
+			*buffer++ = cDigitsLut[d1 + 1];
+		if (value >= 10)
+			*buffer++ = cDigitsLut[d2];
+		*buffer++ = cDigitsLut[d2 + 1];
+	}
+	else if (value < 100000000) {
+		// value = bbbbcccc
+		const unsigned b = value / 10000;
+		const unsigned c = value % 10000;
+		const unsigned d1 = (b / 100) << 1;
+		const unsigned d2 = (b % 100) << 1;
+		const unsigned d3 = (c / 100) << 1;
+		const unsigned d4 = (c % 100) << 1;
+
+		if (value >= 10000000)
+			*buffer++ = cDigitsLut[d1];
+		if (value >= 1000000)
+			*buffer++ = cDigitsLut[d1 + 1];
+		if (value >= 100000)
+			*buffer++ = cDigitsLut[d2];
+		*buffer++ = cDigitsLut[d2 + 1];
+
+		*buffer++ = cDigitsLut[d3];
+		*buffer++ = cDigitsLut[d3 + 1];
+		*buffer++ = cDigitsLut[d4];
+		*buffer++ = cDigitsLut[d4 + 1];
+	}
+	else {
+		// value = aabbbbcccc
+		const unsigned a = value / 100000000; // 1 to 42
+		value %= 100000000;
+
+		if (a >= 10) {
+			const unsigned i = a << 1;
+			*buffer++ = cDigitsLut[i];
+			*buffer++ = cDigitsLut[i + 1];
+		}
+		else
+			*buffer++ = static_cast<char>('0' + a);
+
+		buffer = Write8Digits(value, buffer);
+	}
+	return buffer;
+}
+
+//! Converts a signed 32-bit integer to decimal, two digits at a time.
+/*! \param buffer Must have room for at least 11 characters. No null terminator is written.
+	\return Pointer past the last character written.
+*/
+inline char* i32toa(int value, char* buffer) {
+	unsigned u = static_cast<unsigned>(value);
+	if (value < 0) {
+		*buffer++ = '-';
+		u = ~u + 1;
+	}
+	return u32toa(u, buffer);
+}
+
+//! Converts an unsigned 64-bit integer to decimal, two digits at a time.
+/*! \param buffer Must have room for at least 20 characters. No null terminator is written.
+	\return Pointer past the last character written.
+*/
+inline char* u64toa(uint64_t value, char* buffer) {
+	const uint64_t kTen8 = 100000000;
+	const uint64_t kTen16 = kTen8 * kTen8;
+
+	if (value < kTen8)
+		return u32toa(static_cast<unsigned>(value), buffer);
+
+	if (value < kTen16) {
+		buffer = u32toa(static_cast<unsigned>(value / kTen8), buffer);
+		return Write8Digits(static_cast<unsigned>(value % kTen8), buffer);
+	}
+
+	// value = aaaabbbbbbbbcccccccc
+	const uint64_t rest = value % kTen16;
+	buffer = u32toa(static_cast<unsigned>(value / kTen16), buffer); // 1 to 1844
+	buffer = Write8Digits(static_cast<unsigned>(rest / kTen8), buffer);
+	return Write8Digits(static_cast<unsigned>(rest % kTen8), buffer);
+}
+
+//! Converts a signed 64-bit integer to decimal, two digits at a time.
+/*! \param buffer Must have room for at least 20 characters. No null terminator is written.
+	\return Pointer past the last character written.
+*/
+inline char* i64toa(int64_t value, char* buffer) {
+	uint64_t u = static_cast<uint64_t>(value);
+	if (value < 0) {
+		*buffer++ = '-';
+		u = ~u + 1;
+	}
+	return u64toa(u, buffer);
+}
+
+} // namespace internal
+} // namespace rapidjson
+
+#endif // RAPIDJSON_ITOA_
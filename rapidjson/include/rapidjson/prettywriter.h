@@ -103,6 +103,15 @@ public:
 	//! Simpler but slower overload.
 	PrettyWriter& String(const Ch* str) { return String(str, internal::StrLen(str)); }
 
+	//! Write a raw JSON value.
+	/*! \see Writer::RawValue()
+	*/
+	PrettyWriter& RawValue(const Ch* json, size_t length, Type type) {
+		PrettyPrefix(type);
+		Base::WriteRawValue(json, length);
+		return *this;
+	}
+
 protected:
 	void PrettyPrefix(Type type) {
 		if (Base::level_stack_.GetSize() != 0) { // this value is not at root
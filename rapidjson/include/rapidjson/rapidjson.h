@@ -23,6 +23,9 @@ typedef unsigned __int64 uint64_t;
 #endif
 #endif // RAPIDJSON_NO_INT64TYPEDEF
 
+//! Constructs a 64-bit unsigned integer constant from two 32-bit halves, as not all compilers support the ULL suffix.
+#define RAPIDJSON_UINT64_C2(high32, low32) ((static_cast<uint64_t>(high32) << 32) | static_cast<uint64_t>(low32))
+
 ///////////////////////////////////////////////////////////////////////////////
 // RAPIDJSON_ENDIAN
 #define RAPIDJSON_LITTLEENDIAN	0	//!< Little endian machine
@@ -172,6 +175,15 @@ inline void PutN(Stream& stream, Ch c, size_t n) {
 		stream.Put(c);
 }
 
+//! Put a buffer of characters to a stream.
+/*! Streams which can copy blocks of memory should specialize this for better performance.
+*/
+template<typename Stream, typename Ch>
+inline void PutBuffer(Stream& stream, const Ch* buffer, size_t n) {
+	for (size_t i = 0; i < n; i++)
+		stream.Put(buffer[i]);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // StringStream
 
@@ -45,6 +45,12 @@ inline void PutN(GenericStringBuffer<UTF8<> >& stream, char c, size_t n) {
 	memset(stream.stack_.Push<char>(n), c, n * sizeof(c));
 }
 
+//! Implement specialized version of PutBuffer() with memcpy() for better performance.
+template<>
+inline void PutBuffer(GenericStringBuffer<UTF8<> >& stream, const char* buffer, size_t n) {
+	memcpy(stream.stack_.Push<char>(n), buffer, n * sizeof(*buffer));
+}
+
 } // namespace rapidjson
 
 #endif // RAPIDJSON_STRINGBUFFER_H_
@@ -4,11 +4,144 @@
 #include "rapidjson.h"
 #include "internal/stack.h"
 #include "internal/strfunc.h"
-#include <cstdio>	// snprintf() or _sprintf_s()
+#include "internal/dtoa.h"
+#include "internal/itoa.h"
 #include <new>		// placement new
 
+// SIMD string scanning. SSE2 is always available on x64, and on x86 when compiling for it.
+// The AVX2 scan is compiled wherever SSE2 is, so that it can be tested against the others, but only used when compiling for AVX2.
+#if defined(RAPIDJSON_AVX2) || defined(__AVX2__) || defined(RAPIDJSON_SSE2) || defined(RAPIDJSON_SSE42) || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#define RAPIDJSON_WRITER_SSE2
+#if defined(RAPIDJSON_AVX2) || defined(__AVX2__)
+#define RAPIDJSON_WRITER_AVX2
+#endif
+#endif
+
+// GCC and Clang only compile AVX2 intrinsics in functions targeting it; MSVC compiles them anywhere.
+#if defined(RAPIDJSON_WRITER_SSE2) && defined(__GNUC__) && !defined(__AVX2__)
+#define RAPIDJSON_WRITER_AVX2_TARGET __attribute__((target("avx2")))
+#else
+#define RAPIDJSON_WRITER_AVX2_TARGET
+#endif
+
+#if defined(RAPIDJSON_WRITER_SSE2) && defined(_MSC_VER)
+#include <intrin.h>	// _BitScanForward()
+#endif
+
 namespace rapidjson {
 
+namespace internal {
+
+template<bool Value>
+struct BoolType {};
+
+//! Whether strings can be copied to the output as they are, other than escaping.
+template<typename SourceEncoding, typename TargetEncoding>
+struct IsCopyableString { static const bool Value = false; };
+
+template<typename Encoding>
+struct IsCopyableString<Encoding, Encoding> { static const bool Value = sizeof(typename Encoding::Ch) == 1; };
+
+//! For each byte, the character to follow the backslash it's escaped with, or 0 if it doesn't need escaping.
+inline const char* GetEscapeTable() {
+	static const char escape[256] = {
+#define Z16 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
+		//0    1    2    3    4    5    6    7    8    9    A    B    C    D    E    F
+		'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u', // 00
+		'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', // 10
+		  0,   0, '"',   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0, // 20
+		Z16, Z16,																		// 30~4F
+		  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,'\\',   0,   0,   0, // 50
+		Z16, Z16, Z16, Z16, Z16, Z16, Z16, Z16, Z16, Z16								// 60~FF
+#undef Z16
+	};
+	return escape;
+}
+
+#ifdef RAPIDJSON_WRITER_SSE2
+inline unsigned CountTrailingZeros(unsigned mask) {
+	RAPIDJSON_ASSERT(mask != 0);
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return static_cast<unsigned>(index);
+#else
+	return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+#endif
+
+//! Finds the first byte in [p, end) which needs escaping in a JSON string: '"', '\\' or a control character, one byte at a time.
+/*! \return Pointer to the byte, or end if there isn't one.
+*/
+inline const char* ScanUnescapedScalar(const char* p, const char* end) {
+	const char* escape = GetEscapeTable();
+	while (p != end && !escape[static_cast<unsigned char>(*p)])
+		++p;
+	return p;
+}
+
+#ifdef RAPIDJSON_WRITER_SSE2
+//! As ScanUnescapedScalar(), 16 bytes at a time, finishing any shorter remainder one byte at a time. Never reads outside [p, end).
+inline const char* ScanUnescapedSSE2(const char* p, const char* end) {
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i lastControl = _mm_set1_epi8(0x1F);
+
+	while (end - p >= 16) {
+		const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		// max(s, 0x1F) == 0x1F exactly when s <= 0x1F, comparing unsigned.
+		const __m128i control = _mm_cmpeq_epi8(_mm_max_epu8(s, lastControl), lastControl);
+		const __m128i x = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(s, quote), _mm_cmpeq_epi8(s, backslash)), control);
+		const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(x));
+		if (mask != 0)
+			return p + CountTrailingZeros(mask);
+		p += 16;
+	}
+
+	return ScanUnescapedScalar(p, end);
+}
+
+//! As ScanUnescapedScalar(), 32 bytes at a time, finishing any shorter remainder with SSE2. Never reads outside [p, end).
+/*! Only call this where the CPU supports AVX2.
+*/
+RAPIDJSON_WRITER_AVX2_TARGET inline const char* ScanUnescapedAVX2(const char* p, const char* end) {
+	const __m256i quote = _mm256_set1_epi8('"');
+	const __m256i backslash = _mm256_set1_epi8('\\');
+	const __m256i lastControl = _mm256_set1_epi8(0x1F);
+
+	while (end - p >= 32) {
+		const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+		const __m256i control = _mm256_cmpeq_epi8(_mm256_max_epu8(s, lastControl), lastControl);
+		const __m256i x = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(s, quote), _mm256_cmpeq_epi8(s, backslash)), control);
+		const unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(x));
+		if (mask != 0)
+			return p + CountTrailingZeros(mask);
+		p += 32;
+	}
+
+	return ScanUnescapedSSE2(p, end);
+}
+#endif
+
+//! Finds the first byte in [p, end) which needs escaping in a JSON string: '"', '\\' or a control character.
+/*! Strings rarely need escaping at all, so this scans 32 (AVX2) or 16 (SSE2) bytes at a time where available.
+	Never reads outside [p, end).
+	\return Pointer to the byte, or end if there isn't one.
+*/
+inline const char* ScanUnescaped(const char* p, const char* end) {
+#if defined(RAPIDJSON_WRITER_AVX2)
+	return ScanUnescapedAVX2(p, end);
+#elif defined(RAPIDJSON_WRITER_SSE2)
+	return ScanUnescapedSSE2(p, end);
+#else
+	return ScanUnescapedScalar(p, end);
+#endif
+}
+
+} // namespace internal
+
 //! JSON writer
 /*! Writer implements the concept Handler.
 	It generates JSON text by events to an output os.
@@ -86,6 +219,19 @@ public:
 	//! Simpler but slower overload.
 	Writer& String(const Ch* str) { return String(str, internal::StrLen(str)); }
 
+	//! Write a raw JSON value.
+	/*! The value is written as-is, without any validation or escaping.
+		This is useful for splicing in values which have already been serialized.
+		\param json A complete JSON value, as written by a writer of the same type at the same nesting level.
+		\param length Length of json in characters.
+		\param type Type of the value, which is only used for checking its position.
+	*/
+	Writer& RawValue(const Ch* json, size_t length, Type type) {
+		Prefix(type);
+		WriteRawValue(json, length);
+		return *this;
+	}
+
 protected:
 	//! Information for each nested level
 	struct Level {
@@ -110,95 +256,96 @@ protected:
 	}
 
 	void WriteInt(int i) {
-		if (i < 0) {
-			os_.Put('-');
-			i = -i;
-		}
-		WriteUint((unsigned)i);
+		char buffer[11];
+		const char* end = internal::i32toa(i, buffer);
+		PutBuffer(os_, buffer, static_cast<size_t>(end - buffer));
 	}
 
 	void WriteUint(unsigned u) {
 		char buffer[10];
-		char *p = buffer;
-		do {
-			*p++ = (u % 10) + '0';
-			u /= 10;
-		} while (u > 0);
-
-		do {
-			--p;
-			os_.Put(*p);
-		} while (p != buffer);
+		const char* end = internal::u32toa(u, buffer);
+		PutBuffer(os_, buffer, static_cast<size_t>(end - buffer));
 	}
 
 	void WriteInt64(int64_t i64) {
-		if (i64 < 0) {
-			os_.Put('-');
-			i64 = -i64;
-		}
-		WriteUint64((uint64_t)i64);
+		char buffer[21];
+		const char* end = internal::i64toa(i64, buffer);
+		PutBuffer(os_, buffer, static_cast<size_t>(end - buffer));
 	}
 
 	void WriteUint64(uint64_t u64) {
 		char buffer[20];
-		char *p = buffer;
-		do {
-			*p++ = char(u64 % 10) + '0';
-			u64 /= 10;
-		} while (u64 > 0);
-
-		do {
-			--p;
-			os_.Put(*p);
-		} while (p != buffer);
+		const char* end = internal::u64toa(u64, buffer);
+		PutBuffer(os_, buffer, static_cast<size_t>(end - buffer));
 	}
 
-	//! \todo Optimization with custom double-to-string converter.
+	//! Writes the shortest representation which parses back to the same value.
+	/*! JSON can't represent infinity or NaN, so they're written as null.
+	*/
 	void WriteDouble(double d) {
-		char buffer[100];
-#if _MSC_VER
-		int ret = sprintf_s(buffer, sizeof(buffer), "%g", d);
-#else
-		int ret = snprintf(buffer, sizeof(buffer), "%g", d);
-#endif
-		RAPIDJSON_ASSERT(ret >= 1);
-		for (int i = 0; i < ret; i++)
-			os_.Put(buffer[i]);
+		if (d != d || d - d != d - d) {
+			WriteNull();
+			return;
+		}
+
+		char buffer[25];
+		const char* end = internal::dtoa(d, buffer);
+		PutBuffer(os_, buffer, static_cast<size_t>(end - buffer));
 	}
 
 	void WriteString(const Ch* str, SizeType length)  {
-		static const char hexDigits[16] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
-		static const char escape[256] = {
-#define Z16 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
-			//0    1    2    3    4    5    6    7    8    9    A    B    C    D    E    F
-			'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u', // 00
-			'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', // 10
-			  0,   0, '"',   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0, // 20
-			Z16, Z16,																		// 30~4F
-			  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,'\\',   0,   0,   0, // 50
-			Z16, Z16, Z16, Z16, Z16, Z16, Z16, Z16, Z16, Z16								// 60~FF
-#undef Z16
-		};
-
 		os_.Put('\"');
+		WriteStringContents(str, length, internal::BoolType<internal::IsCopyableString<SourceEncoding, TargetEncoding>::Value>());
+		os_.Put('\"');
+	}
+
+	//! Copies runs of characters which don't need escaping to the stream in one go.
+	void WriteStringContents(const Ch* str, SizeType length, internal::BoolType<true>)  {
+		const char* p = reinterpret_cast<const char*>(str);
+		const char* const end = p + length;
+
+		for (;;) {
+			const char* runEnd = internal::ScanUnescaped(p, end);
+			PutBuffer(os_, p, static_cast<size_t>(runEnd - p));
+			if (runEnd == end)
+				break;
+			WriteEscapedChar(static_cast<unsigned char>(*runEnd));
+			p = runEnd + 1;
+		}
+	}
+
+	//! Transcodes one character at a time, for when the source and target encodings differ.
+	void WriteStringContents(const Ch* str, SizeType length, internal::BoolType<false>)  {
+		const char* escape = internal::GetEscapeTable();
+
 		GenericStringStream<SourceEncoding> is(str);
 		while (is.Tell() < length) {
 			const Ch c = is.Peek();
 			if ((sizeof(Ch) == 1 || (unsigned)c < 256) && escape[(unsigned char)c])  {
 				is.Take();
-				os_.Put('\\');
-				os_.Put(escape[(unsigned char)c]);
-				if (escape[(unsigned char)c] == 'u') {
-					os_.Put('0');
-					os_.Put('0');
-					os_.Put(hexDigits[(unsigned char)c >> 4]);
-					os_.Put(hexDigits[(unsigned char)c & 0xF]);
-				}
+				WriteEscapedChar((unsigned char)c);
 			}
 			else
 				Transcoder<SourceEncoding, TargetEncoding>::Transcode(is, os_);
 		}
-		os_.Put('\"');
+	}
+
+	void WriteEscapedChar(unsigned char c)  {
+		static const char hexDigits[16] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
+		const char* escape = internal::GetEscapeTable();
+
+		os_.Put('\\');
+		os_.Put(escape[c]);
+		if (escape[c] == 'u') {
+			os_.Put('0');
+			os_.Put('0');
+			os_.Put(hexDigits[c >> 4]);
+			os_.Put(hexDigits[c & 0xF]);
+		}
+	}
+
+	void WriteRawValue(const Ch* json, size_t length) {
+		PutBuffer(os_, json, length);
 	}
 
 	void WriteStartObject()	{ os_.Put('{'); }